@@ -0,0 +1,123 @@
+//A reconnect storm: every client of a deploy connecting at once, round after round, against one server on loopback
+//reports how many connections per second get their INFO, how many connects fail or take a SYN retransmit (over a
+//second), and how long it takes until the threads of the closed connections are gone again, and the process's
+//memory and thread count after all rounds next to before the first one
+//  --port=4360 --connections=1000 (per round) --connectors=8 (threads connecting) --rounds=5
+//  --backlog=4096 (the listen backlog of the server, 5 is what it used to be)
+#include "bench_common.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    //a field of /proc/self/status, like "VmRSS" (in kB) or "Threads"
+    long long procStatus(const std::string& field){
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while(std::getline(status, line)){
+            if(line.compare(0, field.size() + 1, field + ":") == 0){
+                return std::stoll(line.substr(field.size() + 1));
+            }
+        }
+        return -1;
+    }
+
+    //connects and waits for the INFO, the point where the server has taken the connection
+    int connectAndWaitForInfo(int port){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || !readUntil(fd, "\r\n")){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    int port = args.get("port", 4360);
+    int connections = args.get("connections", 1000);
+    int connectors = args.get("connectors", 8);
+    int rounds = args.get("rounds", 5);
+    int backlog = args.get("backlog", 4096);
+
+    LoopbackServer node(port, 0, "", [backlog](NatsServer& server) { server.m_listen_backlog = backlog; });
+    long long rss_before = procStatus("VmRSS");
+    long long threads_before = procStatus("Threads");
+    for(int round=0;round<rounds;round++){
+        std::vector<std::vector<int>> fds(connectors);
+        std::atomic<int> failed{0};
+        std::atomic<int> slow{0};
+        auto start = chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int c=0;c<connectors;c++){
+            threads.emplace_back([&, c]() {
+                for(int i=c;i<connections;i+=connectors){
+                    auto connect_start = chrono::steady_clock::now();
+                    int fd = connectAndWaitForInfo(port);
+                    if(fd < 0){
+                        failed.fetch_add(1);
+                        continue;
+                    }
+                    //a connection dropped from a full backlog is only retried after the SYN timeout
+                    if(secondsSince(connect_start) >= 1.0){
+                        slow.fetch_add(1);
+                    }
+                    fds[c].push_back(fd);
+                }
+            });
+        }
+        for(std::thread& thread: threads){
+            thread.join();
+        }
+        double seconds = secondsSince(start);
+        std::size_t threads_at_peak = node.m_server.getClientThreadCount();
+        for(auto& list: fds){
+            for(int fd: list){
+                close(fd);
+            }
+        }
+        //the accept loop joins finished client threads on every pass
+        auto reclaim_start = chrono::steady_clock::now();
+        while(node.m_server.getClientThreadCount() > 0 && secondsSince(reclaim_start) < 10){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        report({
+            {"bench", "accept_storm"},
+            {"round", round},
+            {"backlog", backlog},
+            {"connections", connections},
+            {"connectors", connectors},
+            {"failed", failed.load()},
+            {"over_1s", slow.load()},
+            {"seconds", seconds},
+            {"connections_per_sec", (connections - failed.load()) / seconds},
+            {"client_threads_at_peak", threads_at_peak},
+            {"client_threads_left", node.m_server.getClientThreadCount()},
+            {"reclaim_ms", secondsSince(reclaim_start) * 1e3},
+        });
+    }
+    report({
+        {"bench", "accept_storm_totals"},
+        {"rounds", rounds},
+        {"rss_kb_before", rss_before},
+        {"rss_kb_after", procStatus("VmRSS")},
+        {"threads_before", threads_before},
+        {"threads_after", procStatus("Threads")},
+    });
+    return 0;
+}
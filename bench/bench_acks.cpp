@@ -0,0 +1,131 @@
+//At-least-once delivery: what the pending index costs per message and how many acked messages per second a consumer
+//gets through over loopback for a few max_pending windows
+//  --messages=200000 --payload=128 (bytes) --window=4096 (pending seqs in the index benchmark) --port=4336
+//the stream is written to a temporary directory under /tmp that is removed afterwards
+#include "bench_common.hpp"
+#include "../include/nats/pending_set.hpp"
+#include "../include/nats/stream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    //every seq is added once and acked once with window seqs in flight, acks either in order or shuffled within the window
+    double pendingNanos(long long messages, size_t window, bool shuffled){
+        NatsPendingSet pending(window);
+        std::vector<uint64_t> in_flight;
+        in_flight.reserve(window);
+        std::mt19937 gen(42);
+        uint64_t next_seq = 1;
+        long long acked = 0;
+        auto start = chrono::steady_clock::now();
+        while(acked < messages){
+            while(in_flight.size() < window && pending.add(next_seq, 0)){
+                in_flight.push_back(next_seq++);
+            }
+            if(shuffled){
+                std::shuffle(in_flight.begin(), in_flight.end(), gen);
+            }
+            //half of what is in flight is acked per round, the window keeps moving
+            size_t ack_count = std::max<size_t>(1, in_flight.size() / 2);
+            for(size_t i=0;i<ack_count;i++){
+                pending.remove(in_flight[i]);
+            }
+            in_flight.erase(in_flight.begin(), in_flight.begin() + ack_count);
+            if(shuffled){
+                std::sort(in_flight.begin(), in_flight.end());
+            }
+            acked += ack_count;
+        }
+        return secondsSince(start) * 1e9 / acked;
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    long long messages = args.get("messages", 200000);
+    int payload_size = args.get("payload", 128);
+    size_t window = args.get("window", 4096);
+    int port = args.get("port", 4336);
+    char directory_template[] = "/tmp/nats_bench_acks_XXXXXX";
+    if(mkdtemp(directory_template) == nullptr){
+        perror("mkdtemp failed");
+        return 1;
+    }
+    std::string directory = directory_template;
+    std::string payload(std::max(payload_size, 1), 'x');
+
+    //the shuffle is part of the measured time, so only the in order number is the index alone
+    report({
+        {"bench", "pending_set"},
+        {"messages", messages},
+        {"window", window},
+        {"ns_per_add_and_ack_in_order", pendingNanos(messages, window, false)},
+        {"ns_per_add_and_ack_shuffled", pendingNanos(std::min(messages, 20000LL), window, true)},
+    });
+
+    //the consumer replays the stream with acks, the client acks every MSG as soon as it read it, in one write per read
+    LoopbackServer loopback(port);
+    NatsStreamConfig config;
+    config.m_name = "acks";
+    config.m_subject = "acks.>";
+    config.m_directory = directory;
+    loopback.m_server.addStream(config);
+    for(long long i=0;i<messages;i++){
+        loopback.m_server.publish("acks.0", payload);
+    }
+    int sid = 1;
+    for(long long max_pending: {256LL, 4096LL, 65536LL}){
+        int fd = connectClient(port);
+        if(fd < 0){
+            return 1;
+        }
+        //consumer ids are handed out in order starting at 1, so the client knows its ack subjects without parsing them
+        uint64_t consumer_id = sid;
+        std::string sub = "SUB acks.> " + std::to_string(sid) + " stream=acks ack_wait=30000 max_pending=" + std::to_string(max_pending) + "\r\n";
+        auto start = chrono::steady_clock::now();
+        sendAll(fd, sub.data(), sub.size());
+        std::vector<char> buffer(256 * 1024);
+        std::string acks;
+        long long received = 0;
+        long long acked = 0;
+        char previous = 0;
+        //every PUB is answered with +OK, so MSGs are counted by their payloads, the only lines starting with x
+        while(acked < messages){
+            ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+            if(n <= 0) break;
+            for(ssize_t i=0;i<n;i++){
+                if(previous == '\n' && buffer[i] == 'x') received++;
+                previous = buffer[i];
+            }
+            acks.clear();
+            for(;acked < received;acked++){
+                acks += "PUB $ACK." + std::to_string(consumer_id) + "." + std::to_string(acked + 1) + " 0\r\n\r\n";
+            }
+            if(!acks.empty() && !sendAll(fd, acks.data(), acks.size())) break;
+        }
+        flushClient(fd);
+        double seconds = secondsSince(start);
+        close(fd);
+        report({
+            {"bench", "acked_delivery"},
+            {"messages", messages},
+            {"payload", payload_size},
+            {"max_pending", max_pending},
+            {"complete", acked == messages},
+            {"acked_msgs_per_sec", acked / seconds},
+        });
+        sid++;
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
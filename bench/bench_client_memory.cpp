@@ -0,0 +1,95 @@
+//Benchmark for the memory a connection costs the server, for idle connections and for connections in the middle
+//of a split PUB (the only time a client holds parse buffers), reported from the heap allocator and from RSS
+//the per connection thread stack is reserved separately by the thread library and is reported for reference only
+#include "../include/nats/server.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/parser.hpp"
+#include <nlohmann/json.hpp>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace nats;
+using namespace std;
+
+namespace {
+    constexpr int CLIENTS = 10000;
+
+    long long heapInUse(){
+        struct mallinfo2 info = mallinfo2();
+        return static_cast<long long>(info.uordblks + info.hblkhd);
+    }
+
+    long long residentBytes(){
+        long long pages = 0, resident = 0;
+        std::ifstream statm("/proc/self/statm");
+        statm >> pages >> resident;
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    long long defaultThreadStackBytes(){
+        pthread_attr_t attr;
+        size_t stack_size = 0;
+        pthread_attr_init(&attr);
+        pthread_attr_getstacksize(&attr, &stack_size);
+        pthread_attr_destroy(&attr);
+        return static_cast<long long>(stack_size);
+    }
+
+    void report(const std::string& name, long long heap_bytes, long long rss_bytes){
+        nlohmann::json result = {
+            {"bench", name},
+            {"clients", CLIENTS},
+            {"heap_bytes_per_client", static_cast<double>(heap_bytes) / CLIENTS},
+            {"rss_bytes_per_client", static_cast<double>(rss_bytes) / CLIENTS},
+        };
+        cout << result.dump() << "\n";
+    }
+}
+
+int main(){
+    NatsServer server;
+    std::vector<std::unique_ptr<NatsClient>> clients;
+    clients.reserve(CLIENTS);
+
+    long long heap_before = heapInUse();
+    long long rss_before = residentBytes();
+    for(int i=0;i<CLIENTS;i++){
+        //no socket behind the clients, nothing is sent in this benchmark anyway
+        clients.push_back(std::make_unique<NatsClient>(-1, &server));
+        clients.back()->m_waiting_for_initial_connect = false;
+    }
+    long long heap_idle = heapInUse();
+    long long rss_idle = residentBytes();
+    report("idle_connection", heap_idle - heap_before, rss_idle - rss_before);
+
+    //every client gets the first half of a PUB, so each of them holds a partial payload until the rest arrives
+    std::string first_half = "PUB foo.bar 2000\r\n" + std::string(1000, 'x');
+    for(auto& client: clients){
+        std::string input = first_half;
+        NatsParser::parse(client.get(), input.data(), input.size());
+    }
+    long long heap_split = heapInUse();
+    long long rss_split = residentBytes();
+    report("connection_with_split_pub", heap_split - heap_before, rss_split - rss_before);
+
+    std::string second_half = std::string(1000, 'x') + "\r\n";
+    for(auto& client: clients){
+        std::string input = second_half;
+        NatsParser::parse(client.get(), input.data(), input.size());
+    }
+    //the buffers are back in the pool (or freed), a connection is idle again
+    report("connection_after_pub", heapInUse() - heap_before, residentBytes() - rss_before);
+
+    nlohmann::json stack = {
+        {"bench", "thread_stack_reserved"},
+        {"bytes_per_client", defaultThreadStackBytes()},
+    };
+    cout << stack.dump() << "\n";
+    return 0;
+}
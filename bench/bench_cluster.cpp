@@ -0,0 +1,250 @@
+//Three NatsServers on loopback routed to each other: throughput when every node's publisher feeds a subscriber on the
+//next node, and the round trip of a message through two routes next to the same round trip within one server
+//  --port=4340 (client ports port..port+2, cluster ports port+10..port+12) --messages=100000 (per publisher)
+//  --payload=128 (bytes) --roundtrips=5000
+#include "bench_common.hpp"
+#include "../include/nats/route.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    constexpr int NODES = 3;
+    constexpr int SEND_CHUNK = 64*1024;
+    constexpr int IDLE_TIMEOUT_SECONDS = 5;
+
+    //subjects are "bench.<n>" and payloads all 'x', so every 'M' starts a MSG
+    long long countMessages(const char* data, size_t len){
+        long long count = 0;
+        const char* end = data + len;
+        while((data = static_cast<const char*>(memchr(data, 'M', end - data))) != nullptr){
+            count++;
+            data++;
+        }
+        return count;
+    }
+
+    uint64_t remoteSubjects(NatsServer& server){
+        std::shared_lock<std::shared_mutex> lock(server.m_routes_mutex);
+        uint64_t subjects = 0;
+        for(auto& pair: server.m_routes){
+            subjects += pair.second->getRemoteSubjectCount();
+        }
+        return subjects;
+    }
+
+    //interest travels over the routes on their own threads, a publish before it arrived would go nowhere
+    bool waitForRemoteSubjects(NatsServer& server, uint64_t subjects){
+        for(int i=0;i<5000 && remoteSubjects(server) != subjects;i++){
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return remoteSubjects(server) == subjects;
+    }
+
+    int subscribe(int port, const std::string& subject){
+        int fd = connectClient(port);
+        if(fd < 0){
+            return -1;
+        }
+        std::string sub = "SUB " + subject + " 1\r\n";
+        sendAll(fd, sub.data(), sub.size());
+        flushClient(fd);
+        struct timeval timeout {IDLE_TIMEOUT_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return fd;
+    }
+
+    //microseconds from sending a PUB on one connection until its MSG arrived on the other, one message at a time
+    std::vector<double> roundTrips(int publisher, int subscriber, int count, const std::string& subject){
+        std::string pub = "PUB " + subject + " 1\r\nx\r\n";
+        std::string expected_msg = "MSG " + subject + " 1 1\r\nx\r\n";
+        std::vector<double> micros;
+        char buffer[4096];
+        for(int i=0;i<count;i++){
+            auto start = chrono::steady_clock::now();
+            sendAll(publisher, pub.data(), pub.size());
+            size_t received = 0;
+            while(received < expected_msg.size()){
+                ssize_t n = recv(subscriber, buffer, sizeof(buffer), 0);
+                if(n <= 0) return micros;
+                received += n;
+            }
+            micros.push_back(secondsSince(start) * 1e6);
+            //the publisher's +OK, read here so it never piles up
+            readUntil(publisher, "+OK\r\n");
+        }
+        return micros;
+    }
+
+    nlohmann::json summary(std::vector<double> micros){
+        if(micros.empty()){
+            return nullptr;
+        }
+        std::sort(micros.begin(), micros.end());
+        double total = 0;
+        for(double value: micros){
+            total += value;
+        }
+        return {
+            {"samples", micros.size()},
+            {"mean_us", total / micros.size()},
+            {"p50_us", micros[micros.size() / 2]},
+            {"p99_us", micros[micros.size() * 99 / 100]},
+            {"max_us", micros.back()},
+        };
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    int port = args.get("port", 4340);
+    long long messages = args.get("messages", 100000);
+    int payload_size = args.get("payload", 128);
+    int roundtrip_count = args.get("roundtrips", 5000);
+
+    std::vector<std::unique_ptr<LoopbackServer>> nodes;
+    for(int i=0;i<NODES;i++){
+        nodes.push_back(std::make_unique<LoopbackServer>(port + i, port + 10 + i));
+    }
+    //a full mesh, every server routes to every other one
+    for(int i=0;i<NODES;i++){
+        for(int k=i+1;k<NODES;k++){
+            if(!nodes[i]->m_server.connectRoute("127.0.0.1", port + 10 + k)){
+                fprintf(stderr, "could not route node %d to node %d\n", i, k);
+                return 1;
+            }
+        }
+    }
+
+    //node i publishes bench.<i>, which only node i+1 subscribes to
+    {
+        std::vector<int> subscriber_fds;
+        for(int i=0;i<NODES;i++){
+            int fd = subscribe(port + (i + 1) % NODES, "bench." + std::to_string(i));
+            if(fd < 0){
+                fprintf(stderr, "could not connect subscriber\n");
+                return 1;
+            }
+            subscriber_fds.push_back(fd);
+        }
+        //interest goes to every route, so each node hears of the subjects of both others
+        for(int i=0;i<NODES;i++){
+            if(!waitForRemoteSubjects(nodes[i]->m_server, NODES - 1)){
+                fprintf(stderr, "interest never reached node %d\n", i);
+                return 1;
+            }
+        }
+        std::vector<int> publisher_fds;
+        for(int i=0;i<NODES;i++){
+            int fd = connectClient(port + i);
+            if(fd < 0){
+                fprintf(stderr, "could not connect publisher\n");
+                return 1;
+            }
+            publisher_fds.push_back(fd);
+        }
+
+        std::atomic<long long> delivered{0};
+        auto start = chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int fd: subscriber_fds){
+            threads.emplace_back([fd, messages, &delivered]() {
+                char buffer[SEND_CHUNK];
+                long long received = 0;
+                while(received < messages){
+                    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                    if(n <= 0) break;
+                    received += countMessages(buffer, n);
+                }
+                delivered.fetch_add(received);
+            });
+        }
+        for(int i=0;i<NODES;i++){
+            int fd = publisher_fds[i];
+            threads.emplace_back([fd, i, messages, payload_size]() {
+                //the +OKs for the PUBs have to be read or the server blocks on a full socket
+                std::thread drain([fd]() {
+                    char buffer[SEND_CHUNK];
+                    while(recv(fd, buffer, sizeof(buffer), 0) > 0){}
+                });
+                std::string pub = "PUB bench." + std::to_string(i) + " " + std::to_string(payload_size) + "\r\n"
+                    + std::string(payload_size, 'x') + "\r\n";
+                std::string chunk;
+                chunk.reserve(SEND_CHUNK + pub.size());
+                for(long long m=0;m<messages;m++){
+                    chunk += pub;
+                    if(chunk.size() >= SEND_CHUNK){
+                        sendAll(fd, chunk.data(), chunk.size());
+                        chunk.clear();
+                    }
+                }
+                sendAll(fd, chunk.data(), chunk.size());
+                shutdown(fd, SHUT_WR);
+                drain.join();
+                close(fd);
+            });
+        }
+        for(std::thread& thread: threads){
+            thread.join();
+        }
+        double seconds = secondsSince(start);
+        for(int fd: subscriber_fds){
+            close(fd);
+        }
+        uint64_t routed = 0;
+        for(auto& node: nodes){
+            std::shared_lock<std::shared_mutex> lock(node->m_server.m_routes_mutex);
+            for(auto& pair: node->m_server.m_routes){
+                routed += pair.second->getOutMsgs();
+            }
+        }
+        report({
+            {"bench", "cluster_throughput"},
+            {"nodes", NODES},
+            {"messages", messages * NODES},
+            {"payload", payload_size},
+            {"delivered", delivered.load()},
+            {"routed", routed},
+            {"seconds", seconds},
+            {"msgs_per_sec", delivered.load() / seconds},
+            {"mb_per_sec", delivered.load() * payload_size / seconds / 1e6},
+        });
+    }
+
+    //one message at a time from node 0, to a subscriber on node 0 and to one on node 2
+    {
+        //the throughput subscribers are gone once their RS- went out
+        waitForRemoteSubjects(nodes[0]->m_server, 0);
+        int publisher = connectClient(port);
+        int local = subscribe(port, "bench.local");
+        int remote = subscribe(port + 2, "bench.remote");
+        if(publisher < 0 || local < 0 || remote < 0 || !waitForRemoteSubjects(nodes[0]->m_server, 1)){
+            fprintf(stderr, "could not set up the round trips\n");
+            return 1;
+        }
+        nlohmann::json local_summary = summary(roundTrips(publisher, local, roundtrip_count, "bench.local"));
+        nlohmann::json remote_summary = summary(roundTrips(publisher, remote, roundtrip_count, "bench.remote"));
+        close(publisher);
+        close(local);
+        close(remote);
+        report({
+            {"bench", "cluster_latency"},
+            {"roundtrips", roundtrip_count},
+            {"same_server", local_summary},
+            {"across_route", remote_summary},
+        });
+    }
+    return 0;
+}
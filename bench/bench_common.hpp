@@ -0,0 +1,167 @@
+#ifndef NATS_BENCH_COMMON_H
+#define NATS_BENCH_COMMON_H
+
+//helpers shared by the benchmarks that drive a real NatsServer over loopback sockets
+
+#include "../include/nats/server.hpp"
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace nats::bench{
+
+    //"--name=value" arguments, anything else is ignored
+    class BenchArgs{
+        std::unordered_map<std::string, std::string> m_values;
+        public:
+        BenchArgs(int argc, char** argv){
+            for(int i=1;i<argc;i++){
+                std::string_view arg(argv[i]);
+                if(arg.substr(0, 2) != "--") continue;
+                size_t eq = arg.find('=');
+                if(eq == std::string_view::npos) continue;
+                m_values[std::string(arg.substr(2, eq - 2))] = std::string(arg.substr(eq + 1));
+            }
+        }
+        long long get(const std::string& name, long long default_value) const{
+            auto it = m_values.find(name);
+            return it == m_values.end() ? default_value : std::stoll(it->second);
+        }
+        double getDouble(const std::string& name, double default_value) const{
+            auto it = m_values.find(name);
+            return it == m_values.end() ? default_value : std::stod(it->second);
+        }
+    };
+
+    inline double secondsSince(std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //a NatsServer on its own thread for the lifetime of the object, with its logging sent to /dev/null
+    class LoopbackServer{
+        std::streambuf* m_cout_buffer;
+        std::ofstream m_null_stream;
+        std::thread m_server_thread;
+        public:
+        NatsServer m_server;
+        //a cluster_port lets other servers route to this one, a unix_socket_path lets clients connect through it as well,
+        //configure can change anything else before the server starts
+        explicit LoopbackServer(int port, int cluster_port = 0, std::string unix_socket_path = "",
+            const std::function<void(NatsServer&)>& configure = nullptr): m_null_stream("/dev/null"){
+            m_cout_buffer = std::cout.rdbuf();
+            std::cout.rdbuf(m_null_stream.rdbuf());
+            m_server.m_port = port;
+            m_server.m_monitor_port = 0;
+            m_server.m_cluster_port = cluster_port;
+            m_server.m_unix_socket_path = unix_socket_path;
+            if(configure){
+                configure(m_server);
+            }
+            m_server_thread = std::thread([this]() { m_server.startServer(); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        //every client connection has to be closed before, the server waits for its client threads
+        ~LoopbackServer(){
+            m_server.stopServer();
+            //accept doesn't always wake up when the listening socket is closed from another thread
+            int wake_fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(m_server.m_port);
+            addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+            connect(wake_fd, (struct sockaddr*)&addr, sizeof(addr));
+            close(wake_fd);
+            m_server_thread.join();
+            std::cout.rdbuf(m_cout_buffer);
+        }
+    };
+
+    //reads until the data received so far ends with terminator, returns false if the connection ends first
+    inline bool readUntil(int fd, std::string_view terminator){
+        std::string received;
+        char buffer[4096];
+        while(received.size() < terminator.size() || received.compare(received.size() - terminator.size(), terminator.size(), terminator) != 0){
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if(n <= 0) return false;
+            received.append(buffer, n);
+        }
+        return true;
+    }
+
+    inline bool sendAll(int fd, const char* data, size_t len){
+        while(len > 0){
+            ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+            if(n <= 0) return false;
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    //the CONNECT / PING / PONG handshake on a connected socket, returns the socket or -1
+    inline int handshake(int fd){
+        std::string connect_cmd = "CONNECT {\"verbose\":false}\r\n";
+        if(!readUntil(fd, "\r\n") || !sendAll(fd, connect_cmd.data(), connect_cmd.size()) || !readUntil(fd, "PING\r\n")
+            || !sendAll(fd, "PONG\r\n", 6)){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    //connects and does the handshake, returns the socket or -1
+    inline int connectClient(int port){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+            close(fd);
+            return -1;
+        }
+        int no_delay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        return handshake(fd);
+    }
+
+    //connects to a unix socket listener, without the handshake so the caller can send its own CONNECT
+    inline int connectUnixSocket(const std::string& path){
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    //sends a PING and waits for its PONG, everything sent before is applied by the server once it arrives
+    inline bool flushClient(int fd){
+        return sendAll(fd, "PING\r\n", 6) && readUntil(fd, "PONG\r\n");
+    }
+
+    //written to stdout directly since std::cout is redirected while a LoopbackServer is running
+    inline void report(const nlohmann::json& result){
+        std::string line = result.dump() + "\n";
+        fwrite(line.data(), 1, line.size(), stdout);
+        fflush(stdout);
+    }
+}
+
+#endif
@@ -0,0 +1,91 @@
+//In-process publish throughput through the embedding API, NatsServer::publish to local handlers without any socket
+//next to the same messages sent by a publisher connection over loopback for comparison
+//  --port=4334 --messages=1000000 --payload=128 (bytes) --subscribers=1 (local handlers, every one gets every message)
+//  --wildcard=0|1 (subscribe to "bench.*" instead of "bench.0")
+#include "bench_common.hpp"
+#include "../include/nats/alloc_counter.hpp"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    int port = args.get("port", 4334);
+    long long messages = args.get("messages", 1000000);
+    int payload_size = args.get("payload", 128);
+    int subscribers = args.get("subscribers", 1);
+    bool wildcard = args.get("wildcard", 0) != 0;
+
+    LoopbackServer loopback(port);
+    NatsServer& server = loopback.m_server;
+    std::atomic<long long> received{0};
+    std::atomic<long long> received_bytes{0};
+    for(int i=0;i<subscribers;i++){
+        server.subscribe(wildcard ? "bench.*" : "bench.0", [&received, &received_bytes](std::string_view, std::string_view payload) {
+            received.fetch_add(1, std::memory_order_relaxed);
+            received_bytes.fetch_add(payload.size(), std::memory_order_relaxed);
+        });
+    }
+    std::string payload(payload_size, 'x');
+
+    //in-process, the handlers run on this thread so everything is delivered when the loop ends
+    server.publish("bench.0", payload);
+    received = 0;
+    received_bytes = 0;
+    unsigned long long allocations = NatsAllocCounter::threadAllocations();
+    auto start = chrono::steady_clock::now();
+    for(long long i=0;i<messages;i++){
+        server.publish("bench.0", payload);
+    }
+    double seconds = secondsSince(start);
+    report({
+        {"bench", "embedded_publish"},
+        {"messages", messages},
+        {"payload", payload_size},
+        {"subscribers", subscribers},
+        {"wildcard", wildcard},
+        {"msgs_per_sec", messages / seconds},
+        {"delivered_per_sec", received.load() / seconds},
+        {"ns_per_publish", seconds * 1e9 / messages},
+        {"allocs_per_publish", static_cast<double>(NatsAllocCounter::threadAllocations() - allocations) / messages},
+        {"delivered", received.load()},
+    });
+
+    //the same messages from a socket publisher, delivered to the same local handlers
+    int fd = connectClient(port);
+    if(fd < 0){
+        return 1;
+    }
+    std::string pub = "PUB bench.0 " + std::to_string(payload_size) + "\r\n" + payload + "\r\n";
+    std::string batch;
+    for(int i=0;i<64;i++) batch += pub;
+    long long before = received.load();
+    long long sent = 0;
+    start = chrono::steady_clock::now();
+    for(;sent + 64 <= messages;sent += 64){
+        sendAll(fd, batch.data(), batch.size());
+        //+OKs aren't read while sending, drain them now and then so the server never blocks on them
+        if((sent / 64) % 64 == 0) flushClient(fd);
+    }
+    //the client thread delivers every PUB before it answers the PING, so everything has arrived here
+    flushClient(fd);
+    seconds = secondsSince(start);
+    report({
+        {"bench", "socket_publish"},
+        {"messages", sent},
+        {"payload", payload_size},
+        {"subscribers", subscribers},
+        {"wildcard", wildcard},
+        {"msgs_per_sec", sent / seconds},
+        {"delivered_per_sec", (received.load() - before) / seconds},
+        {"ns_per_publish", seconds * 1e9 / sent},
+    });
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,170 @@
+//What a peer has to hold and how much it is sent when interest is summarized, for several fanout limits (0 announces
+//every subject), and how many messages the summary lets through that nobody subscribed to
+//the peer subscribes the exact entries and the folded prefixes in a sublist and checks a folded prefix's filter, like a
+//route does
+//the interest is inboxes with random ids, device subjects under a few regions and some fixed subjects, the publishes
+//go to half subscribed and half unsubscribed subjects of the same shapes
+//  --inboxes=100000 --devices=50000 --publishes=100000 --churn=0.1 (share of inboxes unsubscribed and subscribed again)
+#include "bench_common.hpp"
+#include "../include/nats/interest_summary.hpp"
+#include "../include/nats/sublist.hpp"
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    constexpr int REGIONS = 16;
+    const std::size_t FANOUTS[] = {0, 64, 256, 1024};
+
+    //what a route makes of a snapshot, exact entries get positive sub ids and folded prefixes negative ones
+    struct Peer {
+        NatsSublist m_sublist;
+        std::unordered_map<int, std::unique_ptr<NatsSummaryFilter>> m_filters;
+        std::size_t m_filter_bytes = 0;
+        std::size_t m_entries = 0;
+        explicit Peer(const std::string& snapshot){
+            std::vector<std::pair<int, std::vector<std::string>>> entries;
+            std::size_t pos = 0;
+            while(pos < snapshot.size()){
+                std::size_t end = snapshot.find("\r\n", pos);
+                std::string line = snapshot.substr(pos, end - pos);
+                pos = end + 2;
+                std::string args = line.substr(4);
+                std::string entry = args.substr(0, args.find(' '));
+                std::vector<std::string> subject_list;
+                NatsClient::convertSubjectToList(entry, false, subject_list);
+                if(line.rfind("RF+ ", 0) == 0){
+                    uint32_t bits = std::stoul(args.substr(entry.size() + 1));
+                    int sub_id = -static_cast<int>(m_filters.size()) - 1;
+                    m_filters.emplace(sub_id, std::make_unique<NatsSummaryFilter>(bits, std::string_view(snapshot).substr(pos, bits / 8)));
+                    m_filter_bytes += bits / 8;
+                    pos += bits / 8 + 2;
+                    entries.emplace_back(sub_id, std::move(subject_list));
+                } else {
+                    entries.emplace_back(static_cast<int>(entries.size()) + 1, std::move(subject_list));
+                }
+            }
+            m_entries = entries.size();
+            m_sublist.addSubscriptions(-1, entries);
+        }
+        bool forwards(const std::string& subject, std::vector<NatsSubscription>& matches){
+            thread_local std::vector<std::string> subject_list;
+            NatsClient::convertSubjectToList(subject, true, subject_list);
+            m_sublist.getSubscriptionsForTopic(subject_list, matches);
+            for(const NatsSubscription& match: matches){
+                if(match.m_sub_id > 0 || m_filters[match.m_sub_id]->mayContain(subject)){
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    int inboxes = args.get("inboxes", 100000);
+    int devices = args.get("devices", 50000);
+    int publishes = args.get("publishes", 100000);
+    double churn = args.getDouble("churn", 0.1);
+
+    std::mt19937_64 random(42);
+    auto inboxSubject = [](uint64_t id) { return "_INBOX." + std::to_string(id); };
+    auto deviceSubject = [](uint64_t id) { return "devices.region" + std::to_string(id % REGIONS) + ".d" + std::to_string(id) + ".status"; };
+    //devices 0 up to --devices are subscribed, the ones after them in the same regions aren't
+    std::vector<std::string> subjects = {"orders.new", "orders.cancel", "payments.>", "audit.*.login"};
+    std::vector<uint64_t> inbox_ids;
+    for(int i=0;i<inboxes;i++){
+        inbox_ids.push_back(random());
+        subjects.push_back(inboxSubject(inbox_ids.back()));
+    }
+    for(int i=0;i<devices;i++){
+        subjects.push_back(deviceSubject(i));
+    }
+    std::vector<std::pair<std::string, bool>> messages; //subject, whether anyone here wants it
+    for(int i=0;i<publishes;i++){
+        bool wanted = i % 2 == 0;
+        switch(i % 6 / 2){
+            case 0: messages.emplace_back(wanted ? inboxSubject(inbox_ids[random() % inbox_ids.size()]) : inboxSubject(random()), wanted); break;
+            case 1: messages.emplace_back(deviceSubject(random() % devices + (wanted ? 0 : devices)), wanted); break;
+            default: messages.emplace_back(wanted ? "orders.new" : "orders.refund", wanted); break;
+        }
+    }
+
+    for(std::size_t fanout: FANOUTS){
+        NatsInterestSummary summary(fanout);
+        std::vector<NatsRouteInterestChange> changes;
+        for(const std::string& subject: subjects){
+            changes.push_back({subject, true});
+        }
+        std::string out;
+        auto start = chrono::steady_clock::now();
+        summary.apply(changes, out);
+        double add_ns = secondsSince(start) * 1e9 / subjects.size();
+        std::string snapshot = summary.getSnapshot();
+
+        //inboxes come and go all the time, every change of local interest against what reaches the peers, sent in
+        //batches of 100 like a busy server's notifications would
+        std::size_t churned = static_cast<std::size_t>(churn * inbox_ids.size());
+        std::size_t churn_bytes = 0;
+        start = chrono::steady_clock::now();
+        for(bool has_interest: {false, true}){
+            for(std::size_t i=0;i<churned;i+=100){
+                changes.clear();
+                for(std::size_t k=i;k<churned && k<i+100;k++){
+                    changes.push_back({inboxSubject(inbox_ids[k]), has_interest});
+                }
+                out.clear();
+                summary.apply(changes, out);
+                churn_bytes += out.size();
+            }
+        }
+        double churn_ns = churned > 0 ? secondsSince(start) * 1e9 / (2 * churned) : 0;
+        std::size_t exact_churn_bytes = 0;
+        for(std::size_t i=0;i<churned;i++){
+            exact_churn_bytes += 2 * (4 + inboxSubject(inbox_ids[i]).size() + 2); //"RS- <subject>\r\n" and "RS+ ..."
+        }
+
+        Peer peer(snapshot);
+        long long forwarded_unwanted = 0;
+        long long unwanted = 0;
+        long long missed = 0;
+        std::vector<NatsSubscription> matches;
+        start = chrono::steady_clock::now();
+        for(auto& message: messages){
+            bool forwarded = peer.forwards(message.first, matches);
+            if(message.second){
+                missed += !forwarded;
+            } else {
+                unwanted++;
+                forwarded_unwanted += forwarded;
+            }
+        }
+        double match_ns = secondsSince(start) * 1e9 / messages.size();
+        report({
+            {"bench", "interest_summary"},
+            {"max_fanout", fanout},
+            {"subjects", summary.getSubjectCount()},
+            {"peer_entries", peer.m_entries},
+            {"peer_filter_bytes", peer.m_filter_bytes},
+            {"folded_prefixes", summary.getFoldedCount()},
+            {"snapshot_bytes", snapshot.size()},
+            {"ns_per_add", add_ns},
+            {"churn_changes", 2 * churned},
+            {"churn_bytes", churn_bytes},
+            {"churn_bytes_exact", exact_churn_bytes},
+            {"ns_per_churn_change", churn_ns},
+            {"peer_ns_per_match", match_ns},
+            {"false_positive_rate", unwanted > 0 ? static_cast<double>(forwarded_unwanted) / unwanted : 0.0},
+            {"missed", missed},
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+//What tracking last values adds to a publish, tracked or not, and how fast a wildcard subscriber gets the current value
+//of every subject over loopback
+//  --messages=200000 --subjects=10000 --payload=64 (bytes) --port=4337
+#include "bench_common.hpp"
+#include "../include/nats/last_value_cache.hpp"
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    //ns per publish of the embedding API, rotating over the subjects
+    double publishNanos(NatsServer& server, long long messages, const std::vector<std::string>& subjects, const std::string& payload){
+        for(const std::string& subject: subjects){
+            server.publish(subject, payload);
+        }
+        auto start = chrono::steady_clock::now();
+        for(long long i=0;i<messages;i++){
+            server.publish(subjects[i % subjects.size()], payload);
+        }
+        return secondsSince(start) * 1e9 / messages;
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    long long messages = args.get("messages", 200000);
+    int subject_count = args.get("subjects", 10000);
+    int payload_size = args.get("payload", 64);
+    int port = args.get("port", 4337);
+    std::string payload(payload_size, 'x');
+    std::vector<std::string> subjects;
+    for(int i=0;i<subject_count;i++){
+        subjects.push_back("status.device" + std::to_string(i));
+    }
+
+    //without tracking, tracking another subject and tracking every subject published to
+    {
+        NatsServer server;
+        double baseline = publishNanos(server, messages, subjects, payload);
+        server.trackLastValues("other.*");
+        double untracked = publishNanos(server, messages, subjects, payload);
+        server.trackLastValues("status.*");
+        double tracked = publishNanos(server, messages, subjects, payload);
+        report({
+            {"bench", "last_value_publish_overhead"},
+            {"messages", messages},
+            {"subjects", subject_count},
+            {"payload", payload_size},
+            {"ns_per_publish_without_tracking", baseline},
+            {"ns_per_publish_untracked_subject", untracked},
+            {"ns_per_publish_tracked", tracked},
+            {"ns_added_by_tracking", tracked - baseline},
+            {"stored_bytes", server.m_last_values.getByteCount()},
+        });
+    }
+
+    //a dashboard subscribing to status.* gets every current value in one write
+    {
+        LoopbackServer loopback(port);
+        loopback.m_server.trackLastValues("status.*");
+        for(const std::string& subject: subjects){
+            loopback.m_server.publish(subject, payload);
+        }
+        size_t expected = 5;
+        for(const std::string& subject: subjects){
+            expected += 4 + subject.size() + 3 + std::to_string(payload_size).size() + 2 + payload_size + 2;
+        }
+        int fd = connectClient(port);
+        if(fd < 0){
+            return 1;
+        }
+        std::string sub = "SUB status.* 1\r\n";
+        auto start = chrono::steady_clock::now();
+        sendAll(fd, sub.data(), sub.size());
+        std::vector<char> data(256 * 1024);
+        size_t received = 0;
+        while(received < expected){
+            ssize_t n = recv(fd, data.data(), data.size(), 0);
+            if(n <= 0) break;
+            received += n;
+        }
+        double seconds = secondsSince(start);
+        close(fd);
+        report({
+            {"bench", "last_value_snapshot"},
+            {"subjects", subject_count},
+            {"payload", payload_size},
+            {"complete", received == expected},
+            {"snapshot_ms", seconds * 1e3},
+            {"subjects_per_sec", subject_count / seconds},
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+//Latency benchmark, messages are published at a fixed rate through a NatsServer on loopback to one subscriber
+//every message carries the time it was supposed to be sent and the time it was actually sent
+//latency measured from the intended time is corrected for coordinated omission: when the server stalls the publisher,
+//the messages that should have gone out during the stall still count the whole wait, instead of quietly not existing
+//  --port=4334 --rate=10000 (msgs/sec) --messages=100000 --warmup=1000 (not recorded) --payload=64 (bytes, at least 41)
+#include "bench_common.hpp"
+#include "../include/nats/latency.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    constexpr int TIMESTAMP_DIGITS = 20;
+    constexpr int MIN_PAYLOAD = 2 * TIMESTAMP_DIGITS + 1;
+    constexpr int IDLE_TIMEOUT_SECONDS = 5;
+    const double PERCENTILES[] = {50, 75, 90, 95, 99, 99.9, 99.99, 99.999, 100};
+
+    uint64_t nowNs(){
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    nlohmann::json distribution(const NatsLatencyHistogram& histogram){
+        nlohmann::json percentiles = nlohmann::json::object();
+        for(double percentile: PERCENTILES){
+            char name[32];
+            snprintf(name, sizeof(name), "p%g", percentile);
+            percentiles[name] = histogram.valueAtPercentile(percentile);
+        }
+        NatsLatencySummary summary = histogram.summary();
+        return {
+            {"count", summary.m_count},
+            {"mean_ns", summary.m_mean_ns},
+            {"percentiles_ns", percentiles},
+        };
+    }
+
+    //reads MSG frames and records both latencies of every message past the warmup
+    //returns the number of messages received
+    long long receive(int fd, long long messages, long long warmup, NatsLatencyHistogram& corrected, NatsLatencyHistogram& uncorrected){
+        std::string pending;
+        char buffer[64*1024];
+        long long received = 0;
+        while(received < messages){
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if(n <= 0) break;
+            uint64_t now = nowNs();
+            pending.append(buffer, n);
+            size_t pos = 0;
+            while(true){
+                size_t header_end = pending.find("\r\n", pos);
+                if(header_end == std::string::npos) break;
+                //"MSG <subject> <sid> <size>", the size is the last field
+                size_t size_start = pending.rfind(' ', header_end) + 1;
+                size_t payload_size = std::strtoull(pending.c_str() + size_start, nullptr, 10);
+                size_t payload_start = header_end + 2;
+                if(pending.size() < payload_start + payload_size + 2) break;
+                if(received >= warmup){
+                    uint64_t intended = std::strtoull(pending.c_str() + payload_start, nullptr, 10);
+                    uint64_t sent = std::strtoull(pending.c_str() + payload_start + TIMESTAMP_DIGITS + 1, nullptr, 10);
+                    corrected.record(now - intended);
+                    uncorrected.record(now - sent);
+                }
+                received++;
+                pos = payload_start + payload_size + 2;
+            }
+            pending.erase(0, pos);
+        }
+        return received;
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    int port = args.get("port", 4334);
+    long long rate = args.get("rate", 10000);
+    long long messages = args.get("messages", 100000);
+    long long warmup = args.get("warmup", 1000);
+    int payload_size = std::max<int>(args.get("payload", 64), MIN_PAYLOAD);
+
+    NatsLatencyHistogram corrected;
+    NatsLatencyHistogram uncorrected;
+    long long received = 0;
+    double seconds = 0;
+    {
+        LoopbackServer server(port);
+        int sub_fd = connectClient(port);
+        int pub_fd = connectClient(port);
+        if(sub_fd < 0 || pub_fd < 0){
+            fprintf(stderr, "could not connect\n");
+            return 1;
+        }
+        std::string sub = "SUB latency 1\r\n";
+        sendAll(sub_fd, sub.data(), sub.size());
+        flushClient(sub_fd);
+        struct timeval timeout {IDLE_TIMEOUT_SECONDS, 0};
+        setsockopt(sub_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::thread subscriber([&]() {
+            received = receive(sub_fd, messages + warmup, warmup, corrected, uncorrected);
+        });
+        std::thread drain([pub_fd]() {
+            char buffer[64*1024];
+            while(recv(pub_fd, buffer, sizeof(buffer), 0) > 0){}
+        });
+
+        std::string header = "PUB latency " + std::to_string(payload_size) + "\r\n";
+        std::string frame = header + std::string(payload_size, 'x') + "\r\n";
+        char* payload = frame.data() + header.size();
+        uint64_t interval = 1000000000ULL / rate;
+        uint64_t start = nowNs();
+        for(long long m=0;m<messages+warmup;m++){
+            uint64_t intended = start + m * interval;
+            //the schedule doesn't move when we fall behind, late messages go out right away and carry their intended time
+            uint64_t now = nowNs();
+            while(now < intended){
+                if(intended - now > 100000){
+                    std::this_thread::sleep_for(chrono::nanoseconds(intended - now - 50000));
+                }
+                now = nowNs();
+            }
+            char timestamps[MIN_PAYLOAD + 1];
+            snprintf(timestamps, sizeof(timestamps), "%020llu %020llu", static_cast<unsigned long long>(intended), static_cast<unsigned long long>(nowNs()));
+            memcpy(payload, timestamps, MIN_PAYLOAD);
+            sendAll(pub_fd, frame.data(), frame.size());
+        }
+        subscriber.join();
+        seconds = (nowNs() - start) / 1e9;
+        shutdown(pub_fd, SHUT_WR);
+        drain.join();
+        close(pub_fd);
+        close(sub_fd);
+    }
+
+    report({
+        {"bench", "latency"},
+        {"target_rate", rate},
+        {"achieved_rate", (messages + warmup) / seconds},
+        {"payload_bytes", payload_size},
+        {"messages", messages},
+        {"received", received - std::min(received, warmup)},
+        {"corrected", distribution(corrected)},
+        {"uncorrected", distribution(uncorrected)},
+    });
+    return 0;
+}
@@ -0,0 +1,106 @@
+//Microbenchmark for NatsParser::parse across operation mixes and read sizes (where frames get split)
+//the client only records what was parsed, like the mocks in tests/include/nats/test_mocks.hpp but without gmock
+//in the way, so the numbers are the parser (and the argument handling in processPubArgs) alone
+//  --ops=200000 (operations per run) --repeat=5 (median of)
+#include "bench_common.hpp"
+#include "../include/nats/alloc_counter.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/parser.hpp"
+#include "../include/nats/server.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    //counts operations instead of acting on them, nothing reaches the server or a socket
+    class CountingClient : public NatsClient {
+        public:
+        long long m_ops;
+        CountingClient(NatsServer* server): NatsClient(-1, server), m_ops(0){
+            m_waiting_for_initial_connect = false;
+        }
+        void processConnect() override { m_ops++; }
+        void processPing() override { m_ops++; }
+        void processPong() override { m_ops++; }
+        void processPub(std::string_view&) override { m_ops++; }
+        void processSub(std::string_view&) override { m_ops++; }
+        void processUnsub(std::string_view&) override { m_ops++; }
+        void processWatch(std::string_view&) override { m_ops++; }
+        void processUnwatch(std::string_view&) override { m_ops++; }
+        void flushPendingSubscriptions() override {}
+        void closeConnection(std::string) override {}
+        void sendErrorMessage(std::string) override {}
+    };
+
+    std::string makeOps(const std::string& mix, long long ops){
+        std::string input;
+        std::string payload(128, 'x');
+        for(long long i=0;i<ops;i++){
+            if(mix == "pub"){
+                input += "PUB orders.eu.created 128\r\n" + payload + "\r\n";
+            } else if(mix == "sub_unsub"){
+                input += (i % 2 == 0) ? "SUB orders.*.created " + std::to_string(i) + "\r\n" : "UNSUB " + std::to_string(i - 1) + "\r\n";
+            } else if(mix == "ping"){
+                input += "PING\r\n";
+            } else {
+                //roughly what a busy connection sends, mostly PUBs with the odd SUB and PING
+                switch(i % 10){
+                    case 0: input += "SUB orders.*.created " + std::to_string(i) + "\r\n"; break;
+                    case 5: input += "PING\r\n"; break;
+                    default: input += "PUB orders.eu.created 128\r\n" + payload + "\r\n"; break;
+                }
+            }
+        }
+        return input;
+    }
+
+    struct Measurement {
+        double m_ns_per_op;
+        double m_allocs_per_op;
+    };
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    long long ops = args.get("ops", 200000);
+    int repeat = args.get("repeat", 5);
+    NatsServer server;
+
+    for(std::string mix: {"pub", "sub_unsub", "ping", "mixed"}){
+        std::string input = makeOps(mix, ops);
+        //1023 is what a client thread reads at once, the small sizes split almost every frame
+        for(int read_size: {1, 7, 64, 1023, 65536}){
+            std::vector<Measurement> runs;
+            for(int r=0;r<repeat;r++){
+                CountingClient client(&server);
+                unsigned long long allocations = NatsAllocCounter::threadAllocations();
+                auto start = chrono::steady_clock::now();
+                for(size_t offset=0;offset<input.size();offset+=read_size){
+                    int len = static_cast<int>(std::min<size_t>(read_size, input.size() - offset));
+                    NatsParser::parse(&client, input.data() + offset, len);
+                }
+                double ns = chrono::duration<double, std::nano>(chrono::steady_clock::now() - start).count();
+                if(client.m_ops != ops){
+                    fprintf(stderr, "parsed %lld of %lld operations for %s/%d\n", client.m_ops, ops, mix.c_str(), read_size);
+                    return 1;
+                }
+                runs.push_back({ns / ops, static_cast<double>(NatsAllocCounter::threadAllocations() - allocations) / ops});
+            }
+            std::sort(runs.begin(), runs.end(), [](const Measurement& a, const Measurement& b) { return a.m_ns_per_op < b.m_ns_per_op; });
+            report({
+                {"bench", "parser_" + mix},
+                {"read_size", read_size},
+                {"ops", ops},
+                {"ns_per_op", runs[runs.size() / 2].m_ns_per_op},
+                {"allocs_per_op", runs[runs.size() / 2].m_allocs_per_op},
+            });
+        }
+    }
+    return 0;
+}
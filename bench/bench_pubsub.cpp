@@ -0,0 +1,163 @@
+//End to end throughput benchmark, a NatsServer on loopback driven by publisher and subscriber connections
+//every subscriber receives every message, either through a wildcard subscription or a literal subscription per subject
+//  --port=4333 --publishers=1 --subscribers=1 --messages=100000 (per publisher) --payload=128 (bytes)
+//  --subjects=1 (distinct subjects published to) --wildcard=0 (fraction of subscribers using "bench.*")
+#include "bench_common.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    constexpr int SEND_CHUNK = 64*1024;
+    constexpr int IDLE_TIMEOUT_SECONDS = 5; //a subscriber gives up after this long without any message
+
+    //counts MSG lines, payloads are all 'x' and subjects "bench.<n>" so every 'M' starts a MSG
+    long long countMessages(const char* data, size_t len){
+        long long count = 0;
+        const char* end = data + len;
+        while((data = static_cast<const char*>(memchr(data, 'M', end - data))) != nullptr){
+            count++;
+            data++;
+        }
+        return count;
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    int port = args.get("port", 4333);
+    int publishers = args.get("publishers", 1);
+    int subscribers = args.get("subscribers", 1);
+    long long messages = args.get("messages", 100000);
+    int payload_size = args.get("payload", 128);
+    int subjects = args.get("subjects", 1);
+    double wildcard = args.getDouble("wildcard", 0.0);
+    int wildcard_subscribers = static_cast<int>(wildcard * subscribers + 0.5);
+
+    long long expected_per_subscriber = messages * publishers;
+    std::atomic<long long> delivered{0};
+    double publish_seconds = 0;
+    double total_seconds = 0;
+    {
+        LoopbackServer server(port);
+
+        std::vector<int> subscriber_fds;
+        for(int i=0;i<subscribers;i++){
+            int fd = connectClient(port);
+            if(fd < 0){
+                fprintf(stderr, "could not connect subscriber\n");
+                return 1;
+            }
+            std::string subs;
+            if(i < wildcard_subscribers){
+                subs = "SUB bench.* 1\r\n";
+            } else {
+                for(int k=0;k<subjects;k++){
+                    subs += "SUB bench." + std::to_string(k) + " " + std::to_string(k+1) + "\r\n";
+                }
+            }
+            sendAll(fd, subs.data(), subs.size());
+            flushClient(fd);
+            struct timeval timeout {IDLE_TIMEOUT_SECONDS, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            subscriber_fds.push_back(fd);
+        }
+
+        std::vector<int> publisher_fds;
+        for(int i=0;i<publishers;i++){
+            int fd = connectClient(port);
+            if(fd < 0){
+                fprintf(stderr, "could not connect publisher\n");
+                return 1;
+            }
+            publisher_fds.push_back(fd);
+        }
+
+        auto start = chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int fd: subscriber_fds){
+            threads.emplace_back([fd, expected_per_subscriber, &delivered]() {
+                char buffer[SEND_CHUNK];
+                long long received = 0;
+                while(received < expected_per_subscriber){
+                    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                    if(n <= 0) break;
+                    received += countMessages(buffer, n);
+                }
+                delivered.fetch_add(received);
+            });
+        }
+
+        std::atomic<int> publishers_done{0};
+        std::vector<std::thread> publisher_threads;
+        for(int p=0;p<publishers;p++){
+            int fd = publisher_fds[p];
+            publisher_threads.emplace_back([fd, messages, payload_size, subjects, p]() {
+                //the +OKs for the PUBs have to be read or the server blocks on a full socket
+                std::thread drain([fd]() {
+                    char buffer[SEND_CHUNK];
+                    while(recv(fd, buffer, sizeof(buffer), 0) > 0){}
+                });
+                std::string payload(payload_size, 'x');
+                std::string chunk;
+                chunk.reserve(SEND_CHUNK + payload_size + 64);
+                for(long long m=0;m<messages;m++){
+                    chunk += "PUB bench." + std::to_string((m + p) % subjects) + " " + std::to_string(payload_size) + "\r\n";
+                    chunk += payload;
+                    chunk += "\r\n";
+                    if(chunk.size() >= SEND_CHUNK){
+                        sendAll(fd, chunk.data(), chunk.size());
+                        chunk.clear();
+                    }
+                }
+                sendAll(fd, chunk.data(), chunk.size());
+                shutdown(fd, SHUT_WR);
+                drain.join();
+                close(fd);
+            });
+        }
+        for(std::thread& thread: publisher_threads){
+            thread.join();
+        }
+        publish_seconds = secondsSince(start);
+        for(std::thread& thread: threads){
+            thread.join();
+        }
+        total_seconds = secondsSince(start);
+        for(int fd: subscriber_fds){
+            close(fd);
+        }
+    }
+
+    long long published = messages * publishers;
+    double mb = 1024.0 * 1024.0;
+    report({
+        {"bench", "pubsub"},
+        {"publishers", publishers},
+        {"subscribers", subscribers},
+        {"payload_bytes", payload_size},
+        {"subjects", subjects},
+        {"wildcard_subscribers", wildcard_subscribers},
+        {"published", published},
+        {"delivered", delivered.load()},
+        {"expected_deliveries", published * subscribers},
+        {"publish_seconds", publish_seconds},
+        {"seconds", total_seconds},
+        {"pub_msgs_per_sec", published / total_seconds},
+        {"pub_mb_per_sec", published * payload_size / mb / total_seconds},
+        {"delivered_msgs_per_sec", delivered.load() / total_seconds},
+        {"delivered_mb_per_sec", delivered.load() * payload_size / mb / total_seconds},
+        {"fan_out", published == 0 ? 0.0 : static_cast<double>(delivered.load()) / published},
+    });
+    return 0;
+}
@@ -0,0 +1,107 @@
+//What an in-memory replay buffer adds to a publish and how fast a late subscriber catches up from it over loopback
+//  --messages=200000 --payload=128 (bytes) --capacity=16777216 (bytes) --port=4336
+#include "bench_common.hpp"
+#include "../include/nats/replay_buffer.hpp"
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    //ns per publish of the embedding API, which goes through the same publishMessage as a PUB
+    double publishNanos(NatsServer& server, long long messages, const std::string& payload){
+        server.publish("bench.0", payload);
+        auto start = chrono::steady_clock::now();
+        for(long long i=0;i<messages;i++){
+            server.publish("bench.0", payload);
+        }
+        return secondsSince(start) * 1e9 / messages;
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    long long messages = args.get("messages", 200000);
+    int payload_size = args.get("payload", 128);
+    long long capacity = args.get("capacity", 16 * 1024 * 1024);
+    int port = args.get("port", 4336);
+    std::string payload(payload_size, 'x');
+
+    //the same publishes without a buffer, with a buffer on another subject and with one keeping every message
+    {
+        NatsServer server;
+        double baseline = publishNanos(server, messages, payload);
+        NatsReplayBufferConfig other;
+        other.m_name = "other";
+        other.m_subject = "other.>";
+        other.m_capacity = capacity;
+        server.addReplayBuffer(other);
+        double non_matching = publishNanos(server, messages, payload);
+        NatsReplayBufferConfig matching = other;
+        matching.m_name = "matching";
+        matching.m_subject = "bench.*";
+        server.addReplayBuffer(matching);
+        double stored = publishNanos(server, messages, payload);
+        std::shared_ptr<NatsReplayBuffer> buffer = server.getReplayBuffer("matching");
+        report({
+            {"bench", "replay_publish_overhead"},
+            {"messages", messages},
+            {"payload", payload_size},
+            {"capacity", capacity},
+            {"ns_per_publish_without_buffer", baseline},
+            {"ns_per_publish_non_matching_buffer", non_matching},
+            {"ns_per_publish_buffered", stored},
+            {"ns_added_by_buffer", stored - baseline},
+            {"buffered_messages", buffer->getMessageCount()},
+            {"evicted", buffer->getEvictedCount()},
+        });
+    }
+
+    //a subscriber joining late gets everything still in the buffer, time until the last replayed MSG arrived
+    {
+        LoopbackServer loopback(port);
+        NatsReplayBufferConfig recent;
+        recent.m_name = "recent";
+        recent.m_subject = "replay.>";
+        recent.m_capacity = capacity;
+        loopback.m_server.addReplayBuffer(recent);
+        for(long long i=0;i<messages;i++){
+            loopback.m_server.publish("replay.0", payload);
+        }
+        std::shared_ptr<NatsReplayBuffer> buffer = loopback.m_server.getReplayBuffer("recent");
+        uint64_t buffered = buffer->getMessageCount();
+        size_t frame_size = 4 + 8 + 3 + std::to_string(payload_size).size() + 2 + payload_size + 2;
+        size_t expected = 5 + buffered * frame_size;
+        int fd = connectClient(port);
+        if(fd < 0){
+            return 1;
+        }
+        std::string sub = "SUB replay.> 1 replay=recent\r\n";
+        auto start = chrono::steady_clock::now();
+        sendAll(fd, sub.data(), sub.size());
+        std::vector<char> data(256 * 1024);
+        size_t received = 0;
+        while(received < expected){
+            ssize_t n = recv(fd, data.data(), data.size(), 0);
+            if(n <= 0) break;
+            received += n;
+        }
+        double seconds = secondsSince(start);
+        close(fd);
+        report({
+            {"bench", "replay_catch_up"},
+            {"published", messages},
+            {"replayed", buffered},
+            {"payload", payload_size},
+            {"capacity", capacity},
+            {"complete", received == expected},
+            {"catch_up_ms", seconds * 1e3},
+            {"msgs_per_sec", buffered / seconds},
+            {"mb_per_sec", received / seconds / (1024 * 1024)},
+        });
+    }
+    return 0;
+}
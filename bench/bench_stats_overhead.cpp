@@ -0,0 +1,110 @@
+//Benchmark for the cost of the monitoring counters, the striped counters used by the server and the single writer
+//per client counters against a single shared atomic and against not counting at all, from several threads at once
+//and of the hot subject sketch, next to the cost of a whole PUB for comparison, with and without the latency histograms
+#include "../include/nats/stats.hpp"
+#include "../include/nats/latency.hpp"
+#include "../include/nats/heavy_hitters.hpp"
+#include "../include/nats/server.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/parser.hpp"
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nats;
+using namespace std;
+
+namespace {
+    constexpr int OPS_PER_THREAD = 10000000;
+    constexpr int PUBS = 1000000;
+
+    //runs op OPS_PER_THREAD times on each thread and returns the nanoseconds per op (wall time / ops of one thread)
+    template<typename Op>
+    double runThreads(int thread_count, Op op){
+        std::vector<std::thread> threads;
+        auto start = chrono::steady_clock::now();
+        for(int t=0;t<thread_count;t++){
+            threads.emplace_back([&op]() {
+                for(int i=0;i<OPS_PER_THREAD;i++){
+                    op(i);
+                }
+            });
+        }
+        for(std::thread& thread: threads){
+            thread.join();
+        }
+        return chrono::duration<double, std::nano>(chrono::steady_clock::now() - start).count() / OPS_PER_THREAD;
+    }
+
+    void report(const std::string& name, int threads, double ns_per_op){
+        nlohmann::json result = {
+            {"bench", name},
+            {"threads", threads},
+            {"ns_per_op", ns_per_op},
+        };
+        cout << result.dump() << "\n";
+    }
+}
+
+int main(){
+    for(int threads: {1, 2, 4, 8}){
+        std::atomic<uint64_t> sink{0};
+        report("no_counter", threads, runThreads(threads, [&sink](int i) {
+            //keeps the loop from being optimized away without touching shared memory on every iteration
+            if(i == OPS_PER_THREAD - 1) sink.fetch_add(1, std::memory_order_relaxed);
+        }));
+
+        std::atomic<uint64_t> shared{0};
+        report("shared_atomic", threads, runThreads(threads, [&shared](int) {
+            shared.fetch_add(1, std::memory_order_relaxed);
+        }));
+
+        NatsStripedCounter striped;
+        report("striped_counter", threads, runThreads(threads, [&striped](int) {
+            striped.add(1);
+        }));
+
+        //like the in_* counters of a client, every thread owns its counter
+        std::vector<NatsCounterStripe> owned(threads);
+        std::atomic<int> next_owner{0};
+        report("single_writer_counter", threads, runThreads(threads, [&owned, &next_owner](int) {
+            thread_local std::atomic<uint64_t>* counter = nullptr;
+            if(counter == nullptr) counter = &owned[next_owner.fetch_add(1)].m_value;
+            NatsClientStats::addSingleWriter(*counter, 1);
+        }));
+
+        //the hot subject sketch every PUB feeds, a few hot subjects and a long tail like real traffic
+        NatsHeavyHitters hot_subjects;
+        std::vector<std::string> subjects;
+        for(int i=0;i<1024;i++){
+            subjects.push_back(i % 4 == 0 ? "hot." + std::to_string(i % 16) : "tail." + std::to_string(i));
+        }
+        report("hot_subjects_record", threads, runThreads(threads, [&hot_subjects, &subjects](int i) {
+            hot_subjects.record(subjects[i & 1023], 128);
+        }));
+    }
+
+    //a whole PUB without subscribers (parse, counters, interest filter) so the counter cost above has something to compare to
+    //and the same again with the latency histograms recording
+    NatsServer server;
+    for(bool latency_enabled: {false, true}){
+        NatsLatencyStats::shared().setEnabled(latency_enabled);
+        NatsClient client(-1, &server);
+        client.m_waiting_for_initial_connect = false;
+        std::string pub = "PUB foo.bar 5\r\nhello\r\n";
+        std::string input;
+        for(int i=0;i<40;i++) input += pub;
+        auto start = chrono::steady_clock::now();
+        for(int i=0;i<PUBS/40;i++){
+            NatsParser::parse(&client, input.data(), input.size());
+        }
+        double ns = chrono::duration<double, std::nano>(chrono::steady_clock::now() - start).count();
+        report(latency_enabled ? "pub_no_subscribers_latency_on" : "pub_no_subscribers", 1, ns / PUBS);
+    }
+    NatsLatencyStats::shared().setEnabled(false);
+    return 0;
+}
@@ -0,0 +1,228 @@
+//Stream append throughput per fsync policy, what a stream adds to a publish, what retention running behind the appends
+//costs them and how fast a consumer replays a stream while a publisher keeps appending to it
+//  --messages=200000 --payload=128 (bytes) --segment=67108864 (bytes) --threads=1 (appending threads) --port=4335
+//the streams are written to a temporary directory under /tmp that is removed afterwards
+#include "bench_common.hpp"
+#include "../include/nats/stream.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    const char* policyName(NatsFsyncPolicy policy){
+        switch(policy){
+            case NatsFsyncPolicy::NONE: return "none";
+            case NatsFsyncPolicy::INTERVAL: return "interval";
+            default: return "always";
+        }
+    }
+
+    //ns per publish of the embedding API, which goes through the same publishMessage as a PUB
+    double publishNanos(NatsServer& server, long long messages, const std::string& payload){
+        server.publish("bench.0", payload);
+        auto start = chrono::steady_clock::now();
+        for(long long i=0;i<messages;i++){
+            server.publish("bench.0", payload);
+        }
+        return secondsSince(start) * 1e9 / messages;
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    long long messages = args.get("messages", 200000);
+    int payload_size = args.get("payload", 128);
+    long long segment_size = args.get("segment", 64 * 1024 * 1024);
+    int threads = args.get("threads", 1);
+    int port = args.get("port", 4335);
+    char directory_template[] = "/tmp/nats_bench_stream_XXXXXX";
+    if(mkdtemp(directory_template) == nullptr){
+        perror("mkdtemp failed");
+        return 1;
+    }
+    std::string directory = directory_template;
+    std::string payload(payload_size, 'x');
+
+    for(NatsFsyncPolicy policy: {NatsFsyncPolicy::NONE, NatsFsyncPolicy::INTERVAL, NatsFsyncPolicy::ALWAYS}){
+        NatsStreamConfig config;
+        config.m_name = std::string("append_") + policyName(policy);
+        config.m_subject = "bench.>";
+        config.m_directory = directory;
+        config.m_segment_size = segment_size;
+        config.m_fsync_policy = policy;
+        //every append waits for the disk with ALWAYS, fewer of them keep the run short
+        long long count = policy == NatsFsyncPolicy::ALWAYS ? std::max(1LL, messages / 100) : messages;
+        double seconds;
+        size_t segments;
+        {
+            NatsStream stream(config);
+            if(!stream.open()){
+                return 1;
+            }
+            std::vector<std::thread> appenders;
+            auto start = chrono::steady_clock::now();
+            for(int t=0;t<threads;t++){
+                appenders.emplace_back([&stream, &payload, count, threads]() {
+                    for(long long i=0;i<count / threads;i++){
+                        stream.append("bench.0", payload);
+                    }
+                });
+            }
+            for(std::thread& appender: appenders){
+                appender.join();
+            }
+            seconds = secondsSince(start);
+            segments = stream.getSegmentCount();
+        }
+        long long appended = count / threads * threads;
+        report({
+            {"bench", "stream_append"},
+            {"fsync", policyName(policy)},
+            {"threads", threads},
+            {"messages", appended},
+            {"payload", payload_size},
+            {"segments", segments},
+            {"msgs_per_sec", appended / seconds},
+            {"mb_per_sec", appended * static_cast<double>(payload_size) / seconds / (1024 * 1024)},
+            {"ns_per_append", seconds * 1e9 / appended},
+        });
+    }
+
+    //the same publishes without a stream, with a stream on another subject and with one storing every message
+    NatsServer server;
+    double baseline = publishNanos(server, messages, payload);
+    NatsStreamConfig other;
+    other.m_name = "other";
+    other.m_subject = "other.>";
+    other.m_directory = directory;
+    server.addStream(other);
+    double non_matching = publishNanos(server, messages, payload);
+    NatsStreamConfig matching = other;
+    matching.m_name = "matching";
+    matching.m_subject = "bench.*";
+    matching.m_segment_size = segment_size;
+    server.addStream(matching);
+    double stored = publishNanos(server, messages, payload);
+    report({
+        {"bench", "stream_publish_overhead"},
+        {"messages", messages},
+        {"payload", payload_size},
+        {"ns_per_publish_without_stream", baseline},
+        {"ns_per_publish_non_matching_stream", non_matching},
+        {"ns_per_publish_stored", stored},
+        {"ns_added_by_store", stored - baseline},
+    });
+
+    //appends while the retention thread deletes and compacts segments behind them, against the same appends without limits
+    //the subjects rotate over a few keys so compaction has most of every full segment to drop
+    for(bool limited: {false, true}){
+        NatsStreamConfig retained;
+        retained.m_name = limited ? "retained" : "unlimited";
+        retained.m_subject = "bench.>";
+        retained.m_directory = directory;
+        retained.m_segment_size = 1024 * 1024;
+        retained.m_fsync_policy = NatsFsyncPolicy::NONE;
+        if(limited){
+            retained.m_max_messages = messages / 4;
+            retained.m_keep_last_per_subject = 1;
+            retained.m_retention_interval_ms = 10;
+        }
+        NatsStream stream(retained);
+        if(!stream.open()){
+            return 1;
+        }
+        std::vector<std::string> keys;
+        for(int i=0;i<16;i++){
+            keys.push_back("bench.key" + std::to_string(i));
+        }
+        auto start = chrono::steady_clock::now();
+        for(long long i=0;i<messages;i++){
+            stream.append(keys[i % keys.size()], payload);
+        }
+        double seconds = secondsSince(start);
+        //at the lowest priority the thread mostly runs once the appends stop, on a single core at least
+        auto catch_up = chrono::steady_clock::now();
+        while(limited && stream.getMessageCount() > static_cast<uint64_t>(messages / 4) && secondsSince(catch_up) < 5){
+            std::this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        double catch_up_ms = limited ? secondsSince(catch_up) * 1e3 : 0;
+        report({
+            {"bench", "stream_retention"},
+            {"catch_up_ms", catch_up_ms},
+            {"limited", limited},
+            {"messages", messages},
+            {"payload", payload_size},
+            {"ns_per_append", seconds * 1e9 / messages},
+            {"stored_messages", stream.getMessageCount()},
+            {"segments", stream.getSegmentCount()},
+            {"deleted_segments", stream.getDeletedSegmentCount()},
+            {"compacted_messages", stream.getCompactedMessageCount()},
+        });
+    }
+
+    //a consumer replaying the whole stream over loopback, with a publisher appending to the same stream meanwhile
+    {
+        LoopbackServer loopback(port);
+        NatsStreamConfig replay;
+        replay.m_name = "replay";
+        replay.m_subject = "replay.>";
+        replay.m_directory = directory;
+        replay.m_segment_size = segment_size;
+        loopback.m_server.addStream(replay);
+        for(long long i=0;i<messages;i++){
+            loopback.m_server.publish("replay.0", payload);
+        }
+        long long live_messages = messages / 10;
+        auto frameSize = [payload_size](const std::string& subject){
+            return 4 + subject.size() + 3 + std::to_string(payload_size).size() + 2 + payload_size + 2;
+        };
+        size_t expected = 5 + messages * frameSize("replay.0") + live_messages * frameSize("replay.live");
+        int fd = connectClient(port);
+        if(fd < 0){
+            return 1;
+        }
+        std::string sub = "SUB replay.> 1 stream=replay start_seq=1\r\n";
+        auto start = chrono::steady_clock::now();
+        sendAll(fd, sub.data(), sub.size());
+        double live_ns = 0;
+        std::thread publisher([&loopback, &payload, &live_ns, live_messages]() {
+            auto live_start = chrono::steady_clock::now();
+            for(long long i=0;i<live_messages;i++){
+                loopback.m_server.publish("replay.live", payload);
+            }
+            live_ns = secondsSince(live_start) * 1e9 / live_messages;
+        });
+        std::vector<char> buffer(256 * 1024);
+        size_t received = 0;
+        while(received < expected){
+            ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+            if(n <= 0) break;
+            received += n;
+        }
+        double seconds = secondsSince(start);
+        publisher.join();
+        close(fd);
+        report({
+            {"bench", "stream_replay"},
+            {"stored_messages", messages},
+            {"live_messages", live_messages},
+            {"payload", payload_size},
+            {"complete", received == expected},
+            {"msgs_per_sec", (messages + live_messages) / seconds},
+            {"mb_per_sec", received / seconds / (1024 * 1024)},
+            {"ns_per_publish_during_replay", live_ns},
+        });
+    }
+
+    std::filesystem::remove_all(directory);
+    return 0;
+}
@@ -0,0 +1,149 @@
+//Microbenchmark for NatsSublist and the sharded NatsShardedSublist the server uses, insert, match and remove across subscription counts, wildcard densities and subject depths
+//subjects are generated from a fixed seed so every run works on the same data
+//  --max-subs=100000 (counts go 1k, 10k, ... up to this, 1M and 10M are opt in as they take minutes and GBs) --matches=200000 --repeat=3 (median of)
+#include "bench_common.hpp"
+#include "../include/nats/alloc_counter.hpp"
+#include "../include/nats/sublist.hpp"
+#include "../include/nats/sharded_sublist.hpp"
+#include "../include/nats/subscription.hpp"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    constexpr int TOKENS_PER_LEVEL = 32; //distinct tokens on every level below the first
+
+    //subjects like "t<a>.t<b>.t<c>", a share of them with one token replaced by a wildcard
+    std::vector<std::vector<std::string>> makeSubjects(long long count, int depth, double wildcard_density, mt19937_64& gen){
+        std::vector<std::vector<std::string>> subjects;
+        subjects.reserve(count);
+        uniform_int_distribution<int> token(0, TOKENS_PER_LEVEL - 1);
+        uniform_real_distribution<double> chance(0.0, 1.0);
+        uniform_int_distribution<int> level(1, depth - 1);
+        for(long long i=0;i<count;i++){
+            std::vector<std::string> subject;
+            subject.reserve(depth);
+            //the first token spreads widely like service names do, the rest are from small sets
+            subject.push_back("s" + std::to_string(i % 1024));
+            for(int d=1;d<depth;d++){
+                subject.push_back("t" + std::to_string(token(gen)));
+            }
+            //the last token keeps the subject unique
+            subject.back() += "_" + std::to_string(i);
+            if(chance(gen) < wildcard_density){
+                int wildcard_level = level(gen);
+                if(wildcard_level == depth - 1 && chance(gen) < 0.5){
+                    subject.back() = ">";
+                } else {
+                    subject[wildcard_level] = "*";
+                }
+            }
+            subjects.push_back(std::move(subject));
+        }
+        return subjects;
+    }
+
+    //literal subjects to publish to, half of them hit an existing literal subscription
+    std::vector<std::vector<std::string>> makeTopics(const std::vector<std::vector<std::string>>& subjects, long long count, mt19937_64& gen){
+        std::vector<std::vector<std::string>> topics;
+        topics.reserve(count);
+        uniform_int_distribution<size_t> pick(0, subjects.size() - 1);
+        for(long long i=0;i<count;i++){
+            std::vector<std::string> topic = subjects[pick(gen)];
+            for(std::string& token: topic){
+                if(token == "*" || token == ">") token = "t0";
+            }
+            if(i % 2 == 1) topic.back() += "_miss";
+            topics.push_back(std::move(topic));
+        }
+        return topics;
+    }
+
+    struct Measurement {
+        double m_ns_per_op;
+        double m_allocs_per_op;
+    };
+
+    template<typename Op>
+    Measurement measure(long long ops, Op op){
+        unsigned long long allocations = NatsAllocCounter::threadAllocations();
+        auto start = chrono::steady_clock::now();
+        op();
+        double ns = chrono::duration<double, std::nano>(chrono::steady_clock::now() - start).count();
+        return {ns / ops, static_cast<double>(NatsAllocCounter::threadAllocations() - allocations) / ops};
+    }
+
+    void reportOp(const std::string& op, long long subscriptions, int depth, double wildcard_density, Measurement m){
+        report({
+            {"bench", "sublist_" + op},
+            {"subscriptions", subscriptions},
+            {"depth", depth},
+            {"wildcard_density", wildcard_density},
+            {"ns_per_op", m.m_ns_per_op},
+            {"allocs_per_op", m.m_allocs_per_op},
+        });
+    }
+
+    template<typename Sublist>
+    void runOps(const std::string& prefix, long long count, int depth, double wildcard_density, std::vector<std::vector<std::string>>& subjects,
+        std::vector<std::vector<std::string>>& topics, long long matches, int repeat){
+        Sublist sublist;
+        reportOp(prefix + "insert", count, depth, wildcard_density, measure(count, [&]() {
+            for(long long i=0;i<count;i++){
+                sublist.addSubscription({static_cast<int>(i), i % 1000}, subjects[i]);
+            }
+        }));
+
+        //median of a few runs, the match path is the one data structure changes are usually about
+        //matches go into one reused buffer, the way the server publishes
+        std::vector<Measurement> runs;
+        std::vector<NatsSubscription> matched;
+        for(int r=0;r<repeat;r++){
+            runs.push_back(measure(matches, [&]() {
+                size_t found = 0;
+                for(std::vector<std::string>& topic: topics){
+                    sublist.getSubscriptionsForTopic(topic, matched);
+                    found += matched.size();
+                }
+                if(found == SIZE_MAX) report({{"found", found}});
+            }));
+        }
+        std::sort(runs.begin(), runs.end(), [](const Measurement& a, const Measurement& b) { return a.m_ns_per_op < b.m_ns_per_op; });
+        reportOp(prefix + "match", count, depth, wildcard_density, runs[runs.size() / 2]);
+
+        reportOp(prefix + "remove", count, depth, wildcard_density, measure(count, [&]() {
+            for(long long i=0;i<count;i++){
+                NatsSubscription subscription {static_cast<int>(i), i % 1000};
+                sublist.removeSubscription(subscription, subjects[i]);
+            }
+        }));
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    long long max_subs = args.get("max-subs", 100000);
+    long long matches = args.get("matches", 200000);
+    int repeat = args.get("repeat", 3);
+
+    for(long long count = 1000; count <= max_subs; count *= 10){
+        for(int depth: {3, 6}){
+            for(double wildcard_density: {0.0, 0.1, 0.5}){
+                mt19937_64 gen(42);
+                std::vector<std::vector<std::string>> subjects = makeSubjects(count, depth, wildcard_density, gen);
+                std::vector<std::vector<std::string>> topics = makeTopics(subjects, matches, gen);
+
+                //the plain trie and the sharded store the server uses, on the same subjects
+                runOps<NatsSublist>("", count, depth, wildcard_density, subjects, topics, matches, repeat);
+                runOps<NatsShardedSublist>("sharded_", count, depth, wildcard_density, subjects, topics, matches, repeat);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+//Benchmark for restoring a large number of subscriptions for one client (like after a service restart)
+//compares one sublist lock per subscription against the batched insertion path, both directly on the sublist
+//and through the parser where a read that carries many SUB lines is flushed to the sublist at once
+#include "../include/nats/sublist.hpp"
+#include "../include/nats/server.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/parser.hpp"
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace nats;
+using namespace std;
+
+namespace {
+    constexpr int READ_SIZE = 1023; //same amount a client thread reads from its socket at once
+
+    std::vector<std::string> makeSubject(int i){
+        //a few services, instances and kinds of events, so there is a realistic amount of shared prefixes
+        return {"svc" + std::to_string(i % 16), "instance" + std::to_string(i % 256), "events", std::to_string(i)};
+    }
+
+    double secondsSince(chrono::steady_clock::time_point start){
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    void report(const std::string& name, int subscriptions, double seconds){
+        nlohmann::json result = {
+            {"bench", name},
+            {"subscriptions", subscriptions},
+            {"seconds", seconds},
+            {"subs_per_sec", subscriptions / seconds},
+        };
+        cout << result.dump() << "\n";
+    }
+
+    //runs the parser over the SUB lines either as full reads or one operation per read
+    double parseSubscriptions(int subscriptions, bool one_op_per_read){
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        //drain the +OKs so the client never blocks on a full socket
+        std::thread drain([fd = fds[1]]() {
+            char buffer[65536];
+            while(recv(fd, buffer, sizeof(buffer), 0) > 0){}
+        });
+
+        NatsServer server;
+        double seconds;
+        {
+            NatsClient client(fds[0], &server);
+            client.m_waiting_for_initial_connect = false;
+            client.m_waiting_for_initial_pong = false;
+
+            std::string input;
+            std::vector<size_t> line_ends;
+            for(int i=0;i<subscriptions;i++){
+                std::vector<std::string> subject = makeSubject(i);
+                input += "SUB " + subject[0] + "." + subject[1] + "." + subject[2] + "." + subject[3] + " " + std::to_string(i) + "\r\n";
+                line_ends.push_back(input.size());
+            }
+
+            auto start = chrono::steady_clock::now();
+            if(one_op_per_read){
+                size_t begin = 0;
+                for(size_t end: line_ends){
+                    NatsParser::parse(&client, input.data() + begin, end - begin);
+                    begin = end;
+                }
+            } else {
+                for(size_t offset=0; offset<input.size(); offset+=READ_SIZE){
+                    int len = std::min<size_t>(READ_SIZE, input.size() - offset);
+                    NatsParser::parse(&client, input.data() + offset, len);
+                }
+            }
+            seconds = secondsSince(start);
+        }
+        shutdown(fds[0], SHUT_RDWR);
+        close(fds[0]);
+        drain.join();
+        close(fds[1]);
+        return seconds;
+    }
+}
+
+int main(int argc, char* argv[]){
+    int subscriptions = argc > 1 ? std::stoi(argv[1]) : 100000;
+    const long long client_id = 1;
+
+    std::vector<std::pair<int, std::vector<std::string>>> batch;
+    for(int i=0;i<subscriptions;i++){
+        batch.emplace_back(i, makeSubject(i));
+    }
+
+    {
+        NatsSublist sublist;
+        auto start = chrono::steady_clock::now();
+        for(auto& pair: batch){
+            sublist.addSubscription({pair.first, client_id}, pair.second);
+        }
+        report("sublist_add_individual", subscriptions, secondsSince(start));
+
+        start = chrono::steady_clock::now();
+        for(auto& pair: batch){
+            NatsSubscription subscription{pair.first, client_id};
+            sublist.removeSubscription(subscription, pair.second);
+        }
+        report("sublist_remove_individual", subscriptions, secondsSince(start));
+    }
+
+    {
+        NatsSublist sublist;
+        auto copy = batch;
+        auto start = chrono::steady_clock::now();
+        sublist.addSubscriptions(client_id, copy);
+        report("sublist_add_batched", subscriptions, secondsSince(start));
+
+        start = chrono::steady_clock::now();
+        sublist.removeClient(client_id);
+        report("sublist_remove_client", subscriptions, secondsSince(start));
+    }
+
+    report("parser_sub_one_per_read", subscriptions, parseSubscriptions(subscriptions, true));
+    report("parser_sub_batched_reads", subscriptions, parseSubscriptions(subscriptions, false));
+    return 0;
+}
@@ -0,0 +1,169 @@
+//The same client over loopback TCP, the unix socket and the shared memory rings negotiated in CONNECT: the round trip
+//of a message from a PUB to its MSG one at a time, and the throughput of one connection publishing to itself
+//  --port=4350 (the unix socket is /tmp/nats-bench-<pid>.sock) --messages=200000 --payload=128 (bytes) --roundtrips=20000
+#include "bench_common.hpp"
+#include "../include/nats/shm_transport.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace nats;
+using namespace nats::bench;
+using namespace std;
+
+namespace {
+    constexpr int SEND_CHUNK = 64*1024;
+
+    //a client connection, the socket alone or the socket with the rings the server handed over
+    struct BenchConnection {
+        int m_fd = -1;
+        std::unique_ptr<NatsShmTransport> m_shm;
+        bool send(const char* data, size_t size){
+            if(m_shm){
+                struct iovec iov {const_cast<char*>(data), size};
+                return m_shm->toServer().write(&iov, 1);
+            }
+            return sendAll(m_fd, data, size);
+        }
+        ssize_t receive(char* buffer, size_t size){
+            if(m_shm){
+                return m_shm->toClient().read(buffer, size, m_fd);
+            }
+            return recv(m_fd, buffer, size, 0);
+        }
+        bool receiveBytes(size_t count){
+            char buffer[SEND_CHUNK];
+            while(count > 0){
+                ssize_t n = receive(buffer, std::min(count, sizeof(buffer)));
+                if(n <= 0) return false;
+                count -= n;
+            }
+            return true;
+        }
+        ~BenchConnection(){
+            m_shm.reset();
+            if(m_fd >= 0) close(m_fd);
+        }
+    };
+
+    std::unique_ptr<BenchConnection> connectShm(const std::string& path){
+        auto connection = std::make_unique<BenchConnection>();
+        connection->m_fd = connectUnixSocket(path);
+        std::string connect_cmd = "CONNECT {\"verbose\":false,\"shm\":true}\r\n";
+        if(connection->m_fd < 0 || !readUntil(connection->m_fd, "\r\n") || !sendAll(connection->m_fd, connect_cmd.data(), connect_cmd.size())){
+            return nullptr;
+        }
+        std::string line;
+        connection->m_shm = NatsShmTransport::receive(connection->m_fd, line);
+        //the rest of the handshake already goes through the rings
+        if(!connection->m_shm || !connection->receiveBytes(6) || !connection->send("PONG\r\n", 6)){
+            return nullptr;
+        }
+        return connection;
+    }
+
+    //subscribes to its own subject, every PUB then comes back as "+OK\r\n" and its MSG
+    bool subscribe(BenchConnection& connection, const std::string& subject){
+        std::string sub = "SUB " + subject + " 1\r\nPING\r\n";
+        return connection.send(sub.data(), sub.size()) && connection.receiveBytes(5 + 6);
+    }
+
+    nlohmann::json latency(BenchConnection& connection, const std::string& subject, int count){
+        std::string pub = "PUB " + subject + " 1\r\nx\r\n";
+        size_t reply_size = 5 + ("MSG " + subject + " 1 1\r\nx\r\n").size();
+        std::vector<double> micros;
+        micros.reserve(count);
+        for(int i=0;i<count;i++){
+            auto start = chrono::steady_clock::now();
+            if(!connection.send(pub.data(), pub.size()) || !connection.receiveBytes(reply_size)){
+                break;
+            }
+            micros.push_back(secondsSince(start) * 1e6);
+        }
+        if(micros.empty()){
+            return nullptr;
+        }
+        std::sort(micros.begin(), micros.end());
+        double total = 0;
+        for(double value: micros){
+            total += value;
+        }
+        return {
+            {"samples", micros.size()},
+            {"mean_us", total / micros.size()},
+            {"p50_us", micros[micros.size() / 2]},
+            {"p99_us", micros[micros.size() * 99 / 100]},
+            {"max_us", micros.back()},
+        };
+    }
+
+    nlohmann::json throughput(BenchConnection& connection, const std::string& subject, long long messages, int payload_size){
+        std::string pub = "PUB " + subject + " " + std::to_string(payload_size) + "\r\n" + std::string(payload_size, 'x') + "\r\n";
+        size_t reply_size = 5 + ("MSG " + subject + " 1 " + std::to_string(payload_size) + "\r\n").size() + payload_size + 2;
+        bool received_all = false;
+        auto start = chrono::steady_clock::now();
+        std::thread reader([&connection, &received_all, messages, reply_size]() {
+            received_all = connection.receiveBytes(messages * reply_size);
+        });
+        std::string chunk;
+        chunk.reserve(SEND_CHUNK + pub.size());
+        for(long long m=0;m<messages;m++){
+            chunk += pub;
+            if(chunk.size() >= SEND_CHUNK){
+                connection.send(chunk.data(), chunk.size());
+                chunk.clear();
+            }
+        }
+        connection.send(chunk.data(), chunk.size());
+        reader.join();
+        double seconds = secondsSince(start);
+        return {
+            {"messages", messages},
+            {"complete", received_all},
+            {"seconds", seconds},
+            {"msgs_per_sec", messages / seconds},
+            {"mb_per_sec", messages * payload_size / seconds / 1e6},
+        };
+    }
+}
+
+int main(int argc, char** argv){
+    BenchArgs args(argc, argv);
+    int port = args.get("port", 4350);
+    std::string path = "/tmp/nats-bench-" + std::to_string(getpid()) + ".sock";
+    long long messages = args.get("messages", 200000);
+    int payload_size = args.get("payload", 128);
+    int roundtrip_count = args.get("roundtrips", 20000);
+
+    LoopbackServer node(port, 0, path);
+    const char* transports[] = {"tcp", "unix", "shm"};
+    for(const char* transport: transports){
+        std::unique_ptr<BenchConnection> connection;
+        if(std::string(transport) == "shm"){
+            connection = connectShm(path);
+        } else {
+            connection = std::make_unique<BenchConnection>();
+            connection->m_fd = std::string(transport) == "tcp" ? connectClient(port) : handshake(connectUnixSocket(path));
+        }
+        std::string subject = std::string("bench.") + transport;
+        if(!connection || connection->m_fd < 0 || !subscribe(*connection, subject)){
+            fprintf(stderr, "could not connect over %s\n", transport);
+            return 1;
+        }
+        nlohmann::json latency_summary = latency(*connection, subject, roundtrip_count);
+        nlohmann::json throughput_summary = throughput(*connection, subject, messages, payload_size);
+        report({
+            {"bench", "transport"},
+            {"transport", transport},
+            {"payload", payload_size},
+            {"latency", latency_summary},
+            {"throughput", throughput_summary},
+        });
+    }
+    return 0;
+}
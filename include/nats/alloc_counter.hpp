@@ -0,0 +1,16 @@
+#ifndef NATS_ALLOC_COUNTER_H
+#define NATS_ALLOC_COUNTER_H
+
+namespace nats{
+    //Counts heap allocations made by the calling thread
+    //the counting operator new is only compiled in with -DNATS_COUNT_ALLOCATIONS (tests and benchmarks),
+    //the server binary keeps the default allocator and enabled() is false
+    class NatsAllocCounter{
+        public:
+        static bool enabled();
+        //allocations made by this thread so far, take the difference of two calls around the code being checked
+        static unsigned long long threadAllocations();
+    };
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef NATS_BUFFER_POOL_H
+#define NATS_BUFFER_POOL_H
+
+#include <mutex>
+#include <vector>
+
+namespace nats{
+    //A process wide pool of parse buffers in a few size classes
+    //clients only need buffers while a frame is split across reads, so instead of every client owning the
+    //worst case size they borrow one here when a split happens and give it back once the frame is complete
+    class NatsBufferPool{
+    public:
+        static constexpr int SIZE_CLASS_COUNT = 3;
+        static constexpr int SIZE_CLASSES[SIZE_CLASS_COUNT] = {128, 1024, 1024*5};
+        static constexpr int MAX_BUFFER_SIZE = SIZE_CLASSES[SIZE_CLASS_COUNT-1];
+        static constexpr int MAX_FREE_BUFFERS = 1024; //per size class, anything above that is given back to the allocator
+
+        static NatsBufferPool& shared();
+        //returns a buffer of at least min_size bytes (at most MAX_BUFFER_SIZE) and sets capacity to its real size
+        char* acquire(int min_size, int& capacity);
+        void release(char* buffer, int capacity);
+        ~NatsBufferPool();
+    private:
+        struct SizeClass {
+            std::mutex m_mutex;
+            std::vector<char*> m_free;
+        };
+        SizeClass m_classes[SIZE_CLASS_COUNT];
+        static int sizeClassIndex(int size);
+    };
+}
+
+#endif
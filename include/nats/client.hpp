@@ -3,13 +3,21 @@
 
 #include "parser_state.hpp"
 #include "subscription.hpp"
+#include "buffer_pool.hpp"
+#include "stats.hpp"
+#include "stream_consumer.hpp"
+#include "shm_transport.hpp"
 #include <string>
 #include <string_view>
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include <utility>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace nats{
 
@@ -18,29 +26,77 @@ namespace nats{
     class NatsClient {
         NatsServer* m_server;
         static constexpr int INTERNAL_BUFFER_SIZE = 1024*5;
+        static_assert(INTERNAL_BUFFER_SIZE <= NatsBufferPool::MAX_BUFFER_SIZE, "a full size argument or message has to fit a pooled buffer");
+        static constexpr int PAYLOAD_SUB_INLINE_SIZE = 64; //most subjects fit, longer ones borrow a buffer from the pool
         int m_client_fd;
         std::thread m_timeout_thread;
         std::atomic<bool> m_timeout_thread_running;
-        std::unordered_map<int, std::string> m_subscriptions; //mapping between sub_id and subject topic
-        void addSubscriptionMetadata(int sub_id, std::string subject);
-        std::vector<std::pair<std::vector<std::string>,NatsSubscription>> getUnsubParams(bool filter_sub_id=false, int sub_id=-1);
-        std::vector<std::string> convertSubjectToList(std::string_view& subject, bool is_publish);
+        std::unordered_set<int> m_subscriptions; //sub_ids of this client, the sublist keeps the subjects for them
+        std::unordered_set<std::string> m_interest_watches; //subjects this client wants INTEREST updates for
+        //SUB/UNSUB operations parsed but not yet applied to the sublist, they are applied together (and acknowledged with one send)
+        //at the end of the read or before anything else is sent to the client, only one of the two is non-empty at a time
+        std::vector<std::pair<int, std::vector<std::string>>> m_pending_subs;
+        std::vector<int> m_pending_unsubs;
+        int m_pending_oks;
+        //capacities of the buffers borrowed from the shared buffer pool, 0 while nothing is borrowed
+        int m_arg_capacity;
+        int m_msg_capacity;
+        int m_payload_sub_capacity;
+        char m_payload_sub_inline[PAYLOAD_SUB_INLINE_SIZE];
+        //SUBs with a stream= option, by sub_id, they deliver from the stream instead of the sublist
+        std::unordered_map<int, std::unique_ptr<NatsStreamConsumer>> m_consumers;
+        std::vector<std::unique_ptr<NatsStreamConsumer>> m_stopped_consumers; //unsubscribed, joined once their thread is done
+        //set by a CONNECT {"shm":true} the server granted, from then on everything goes through its rings and the socket
+        //only tells when the client is gone
+        std::unique_ptr<NatsShmTransport> m_shm;
+        bool startSharedMemory();
+        void stopConsumers();
+        void sendBytes(const char* data, size_t size);
+        void startConsumer(int sub_id, std::vector<std::string> subject_list, std::string_view options);
+        void startReplay(int sub_id, std::vector<std::string>& subject_list, std::string_view options);
+        void growParseBuffer(char*& buffer, int& capacity, int used, int needed);
+        void releaseParseBuffers();
+        void addSubscriptionMetadata(int sub_id);
     public:
+        //splits a subject into its tokens, throws InvalidPublishSubjectException/InvalidSubscribeSubjectException if it isn't valid
+        static std::vector<std::string> convertSubjectToList(std::string_view& subject, bool is_publish);
+        static void convertSubjectToList(std::string_view subject, bool is_publish, std::vector<std::string>& subject_list);
+        //positive and never handed out twice in a process, 0 is the server's own subscriptions and routes are negative
+        static long long nextClientId();
         NatsClient(int client_fd, NatsServer* server);
         virtual ~NatsClient();
         bool m_waiting_for_initial_connect;
         bool m_waiting_for_initial_pong;
+        bool m_shm_requested; //the last CONNECT asked for the shared memory transport
         long long m_client_id;
+        std::string m_client_ip;
+        NatsClientStats m_stats;
+        //delivered/dropped per sub_id, in slots that keep their address until the client is gone, the sublist entries point at
+        //them so publishers count without a lock or a lookup, an UNSUB hands its slot to the next SUB
+        std::mutex m_subscription_stats_mutex; //guards which slot belongs to which sub_id, not the counters in them
+        std::unordered_map<int, NatsSubscriptionStats*> m_subscription_stats;
+        std::deque<NatsSubscriptionStats> m_subscription_stats_slots;
+        std::vector<NatsSubscriptionStats*> m_free_subscription_stats;
+        std::vector<NatsSubscriptionStats*> m_released_subscription_stats; //unsubscribed, free once the UNSUBs are flushed, only the client's own thread touches it
+        //the slot of sub_id, nullptr if there is no such subscription
+        NatsSubscriptionStats* getSubscriptionStats(int sub_id);
+        //held for every write to the socket, so a MSG written by a publisher or a stream consumer is never split by another write
+        std::mutex m_write_mutex;
         int m_as;
         int m_drop;
         int m_arg_len;
         int m_msg_len;
         NatsParserState m_state;
-        char m_msg_buffer[INTERNAL_BUFFER_SIZE];
-        char m_arg_buffer[INTERNAL_BUFFER_SIZE];
+        //m_msg_buffer and m_arg_buffer only point to memory while an operation is split across reads
+        char* m_msg_buffer;
+        char* m_arg_buffer;
         int m_payload_size;
-        char m_payload_sub[INTERNAL_BUFFER_SIZE];
+        char* m_payload_sub;
         virtual void resetParsingVars();
+        void saveSplitArg(const char* data, int len);
+        void saveSplitMsg(const char* data, int len);
+        void appendArgByte(char b);
+        void appendMsgByte(char b);
 
         virtual bool maxArgSizeReached();
         virtual bool maxMessageSizeReached();
@@ -48,7 +104,21 @@ namespace nats{
         virtual void closeConnection();
         virtual void closeConnection(std::string msg);
         virtual void sendMessage(std::string msg);
+        //writes a MSG for the subscription without building it in a separate buffer first
+        virtual void deliverMessage(std::string_view subject, const NatsSubscription& subscription, std::string_view payload);
         virtual void sendErrorMessage(std::string msg);
+        //writes all of data unless the socket fails, m_write_mutex has to be held
+        void sendAllLocked(const char* data, size_t size);
+        //the same for several pieces, false if the connection failed before all of them were written
+        bool sendAllLocked(struct iovec* iov, int count);
+        //one writev, or a ring write once the client uses shared memory, m_write_mutex has to be held
+        ssize_t writeLocked(const struct iovec* iov, int count);
+        //the next bytes from the client, from the socket or the shared memory ring, 0 once it is gone
+        ssize_t readInput(char* buffer, size_t size);
+        bool usesSharedMemory() const;
+        virtual void flushPendingSubscriptions();
+        //the stream consumer of a SUB with a stream= option, nullptr for any other sub_id
+        NatsStreamConsumer* getConsumer(int sub_id);
         virtual void processConnect();
         virtual void processPing();
         virtual void processPong();
@@ -56,6 +126,8 @@ namespace nats{
         virtual void processPub(std::string_view& payload);
         virtual void processSub(std::string_view& sub_args);
         virtual void processUnsub(std::string_view& unsub_args);
+        virtual void processWatch(std::string_view& watch_args);
+        virtual void processUnwatch(std::string_view& unwatch_args);
         virtual void startPongTimeoutThread();
         virtual void stopTimeoutThread();
     };
@@ -84,6 +84,24 @@ namespace nats
             explicit NoSuchSubscriptionIdException()
                 : NatsNonFatalParserException("Subscription ID doesn't exist!") {}
     };
+
+    class NoSuchInterestWatchException: public NatsNonFatalParserException {
+        public:
+            explicit NoSuchInterestWatchException()
+                : NatsNonFatalParserException("Subject isn't being watched!") {}
+    };
+
+    class NoSuchStreamException: public NatsNonFatalParserException {
+        public:
+            explicit NoSuchStreamException()
+                : NatsNonFatalParserException("Stream doesn't exist!") {}
+    };
+
+    class NoSuchReplayBufferException: public NatsNonFatalParserException {
+        public:
+            explicit NoSuchReplayBufferException()
+                : NatsNonFatalParserException("Replay buffer doesn't exist!") {}
+    };
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef NATS_HEAVY_HITTERS_H
+#define NATS_HEAVY_HITTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nats{
+    //one subject in a top list, both counts are count-min estimates so they err on the high side
+    struct NatsSubjectCount {
+        std::string m_subject;
+        uint64_t m_msgs;
+        uint64_t m_bytes;
+    };
+
+    //Finds the subjects with the most messages and bytes without keeping a counter per subject
+    //every message bumps a count-min sketch, subjects whose estimate beats the smallest tracked one replace it
+    //in a small candidate table (space-saving), so the lock is only taken when the top list changes
+    //the sketch is bumped with a relaxed load and store instead of a fetch_add, publishers racing on the same cell
+    //can lose an increment, which is fine for spotting hot subjects and keeps recording to a few ns per message
+    class NatsHeavyHitters{
+        public:
+        static constexpr int DEPTH = 4;
+        static constexpr std::size_t WIDTH = 4096; //counters per row, a power of two
+        static constexpr int CAPACITY = 32; //subjects tracked per metric, the most a top list can return
+        NatsHeavyHitters();
+        void record(std::string_view subject, uint64_t bytes);
+        std::vector<NatsSubjectCount> topByMsgs(int count);
+        std::vector<NatsSubjectCount> topByBytes(int count);
+        void reset();
+
+        private:
+        //tracked subjects of one metric, the hashes can be scanned without the lock to see if a subject is already in
+        struct Candidates {
+            std::mutex m_mutex;
+            std::atomic<uint64_t> m_hashes[CAPACITY];
+            std::string m_subjects[CAPACITY];
+            std::atomic<int> m_size{0};
+            std::atomic<uint64_t> m_min_estimate{0}; //estimate of the weakest candidate when the table was last changed
+        };
+        //both counts of a cell share a cache line, one message touches DEPTH lines
+        struct Cell {
+            std::atomic<uint64_t> m_msgs;
+            std::atomic<uint64_t> m_bytes;
+        };
+        std::unique_ptr<Cell[]> m_cells;
+        Candidates m_by_msgs;
+        Candidates m_by_bytes;
+        static std::size_t counterIndex(int row, uint64_t hash);
+        uint64_t estimate(uint64_t hash, bool by_msgs) const;
+        void offer(Candidates& candidates, bool by_msgs, uint64_t hash, std::string_view subject, uint64_t estimate);
+        std::vector<NatsSubjectCount> top(Candidates& candidates, bool by_msgs, int count);
+    };
+}
+
+#endif
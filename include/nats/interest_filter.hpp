@@ -0,0 +1,42 @@
+#ifndef NATS_INTEREST_FILTER_H
+#define NATS_INTEREST_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace nats{
+    //which counters a subscription subject maps to, computed once so it can be stored next to the subscription
+    struct NatsInterestKey {
+        bool m_root_wildcard; //subject starts with a wildcard, so it is counted separately instead of hashed
+        uint64_t m_hash;
+    };
+
+    //A counting bloom filter summarising which subjects have at least one subscription
+    //literal subscriptions are keyed by their full subject, wildcard subscriptions by their first token
+    //and subscriptions starting with a wildcard just bump a counter that makes every lookup a "maybe"
+    //writers are expected to be serialized by the owner (the sublist mutex), readers need no lock at all
+    class NatsInterestFilter{
+        static constexpr int HASH_COUNT = 3;
+        static constexpr uint16_t COUNTER_MAX = UINT16_MAX;
+        std::size_t m_mask;
+        std::unique_ptr<std::atomic<uint16_t>[]> m_counters;
+        std::atomic<long long> m_root_wildcards;
+        void updateCounters(uint64_t hash, bool increment);
+        bool testCounters(uint64_t hash) const;
+        public:
+        explicit NatsInterestFilter(std::size_t counter_count = 1<<16);
+        static NatsInterestKey interestKey(const std::vector<std::string>& subject_list);
+        void addInterest(const NatsInterestKey& key);
+        void removeInterest(const NatsInterestKey& key);
+        void addInterest(const std::vector<std::string>& subject_list);
+        void removeInterest(const std::vector<std::string>& subject_list);
+        //false means there is definitely no subscription for the subject, true means there might be one
+        bool mayHaveInterest(const std::vector<std::string>& subject_list) const;
+    };
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef NATS_INTEREST_SUMMARY_H
+#define NATS_INTEREST_SUMMARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "interest_watch.hpp"
+
+namespace nats{
+
+    //A bloom filter of the literal subjects below a folded prefix, what a route checks a message against before it
+    //forwards it to the peer, hashed like NatsInterestFilter so every server sets the same bits for a subject
+    class NatsSummaryFilter{
+        std::vector<uint64_t> m_words;
+        uint32_t m_bits;
+        public:
+        static constexpr int HASH_COUNT = 3;
+        static constexpr uint32_t MIN_BITS = 1024;
+        static constexpr uint32_t MAX_BITS = 1u << 22; //512KB, past that the filter fills up instead of growing
+        static constexpr uint32_t BITS_PER_SUBJECT = 16; //about 0.5% false positives with 3 hashes
+        static void bitsFor(std::string_view subject, uint32_t bits, uint32_t (&indexes)[HASH_COUNT]);
+        //a power of two between MIN_BITS and MAX_BITS
+        static bool isValidSize(uint64_t bits);
+        static uint32_t sizeFor(std::size_t subjects);
+        explicit NatsSummaryFilter(uint32_t bits);
+        //bitmap holds bits/8 bytes, bit i is bit i%8 of byte i/8
+        NatsSummaryFilter(uint32_t bits, std::string_view bitmap);
+        uint32_t getBits() const;
+        void set(uint32_t bit);
+        void clear(uint32_t bit);
+        bool mayContain(std::string_view subject) const;
+    };
+
+    //What a server tells its routes it is interested in, a digest of the local interest the sublist reports instead of
+    //every subject one by one
+    //the subjects are kept in a trie of their tokens, and a prefix with more than m_max_fanout different next tokens
+    //(inboxes, device ids, order ids) is folded: every literal subject below it goes into one filter the peer matches
+    //"<prefix>.>" against, so the peer holds a bounded bitmap instead of a sublist entry per subject and only forwards
+    //the few messages the filter can't tell apart from wanted ones, which the sublist lookup here then drops
+    //wildcard subjects are always announced as they are, a filter can only hold literal subjects
+    //a folded prefix is unfolded again once it is down to half of m_max_fanout next tokens, so a count hovering around
+    //the limit doesn't flap, and new entries always go out before the ones they replace so the peer never misses
+    //interest in between
+    //the peers are told
+    //  RS+ <subject>\r\n / RS- <subject>\r\n       an exact entry
+    //  RF+ <prefix>.> <bits>\r\n<bitmap>\r\n        a folded prefix with its whole filter, replacing an older one
+    //  RF- <prefix>.>\r\n                          a folded prefix that is gone
+    //  RFS <prefix>.> <bit>...\r\n / RFC ...\r\n   bits of a filter that were set / cleared since the last changes
+    //not thread safe, the server calls it under m_route_interest_mutex
+    class NatsInterestSummary{
+        //the counting version of the filter the peer holds, only on folded prefixes no other folded prefix covers
+        struct Filter{
+            std::string m_entry;
+            std::vector<uint8_t> m_counts; //saturated counts are never decremented again, like NatsInterestFilter
+            std::size_t m_subjects = 0;
+            std::vector<uint32_t> m_touched; //bits changed since the last changes went out
+        };
+        struct Node{
+            std::unordered_map<std::string, std::unique_ptr<Node>> m_children;
+            std::size_t m_subjects = 0; //subjects at or below this node
+            std::size_t m_live_children = 0; //children with at least one subject below them
+            bool m_terminal = false; //the node's own subject is one
+            bool m_folded = false;
+            std::unique_ptr<Filter> m_filter;
+        };
+        Node m_root;
+        std::size_t m_max_fanout;
+        std::unordered_map<std::string, int> m_announced; //exact entries
+        std::unordered_map<std::string, Node*> m_filters; //folded prefixes the peers hold a filter for, by entry
+        std::size_t m_folded_count;
+        static std::string foldedEntry(const std::string& prefix);
+        static bool isLiteral(const std::vector<std::string>& tokens);
+        void announce(const std::string& subject, std::string& out);
+        void withdraw(const std::string& subject, std::string& out);
+        //the literal subjects below node that would be exact entries if node wasn't folded, and the folded nodes below
+        //it no other folded node below it covers
+        void collectBelow(Node* node, std::string& prefix, std::vector<std::string>& literals,
+            std::vector<std::pair<Node*, std::string>>& folded);
+        void collectLiterals(Node* node, std::string& prefix, std::vector<std::string>& literals);
+        void createFilter(Node* node, std::string prefix, std::string& out);
+        void removeFilter(Node* node, std::string& out);
+        void addToFilter(Node* node, const std::string& prefix, const std::string& subject, std::string& out);
+        void removeFromFilter(Node* node, const std::string& subject);
+        void fold(Node* node, std::string prefix, bool covered, std::string& out);
+        void unfold(Node* node, std::string prefix, bool covered, std::string& out);
+        void add(const std::string& subject, std::string& out);
+        void remove(const std::string& subject, std::string& out);
+        void appendTouchedBits(std::string& out);
+        static void appendFilter(const Filter& filter, std::string& out);
+        public:
+        static constexpr std::size_t DEFAULT_MAX_FANOUT = 256;
+        explicit NatsInterestSummary(std::size_t max_fanout = DEFAULT_MAX_FANOUT);
+        NatsInterestSummary(const NatsInterestSummary&) = delete;
+        NatsInterestSummary& operator=(const NatsInterestSummary&) = delete;
+        //0 never folds and announces every subject, only takes effect for subjects added afterwards
+        void setMaxFanout(std::size_t max_fanout);
+        //applies changes of local interest and appends what the peers have to be told, adding a subject that is
+        //already there or removing one that isn't does nothing
+        void apply(const std::vector<NatsRouteInterestChange>& changes, std::string& out);
+        //everything the peers currently hold, what a new route gets
+        std::string getSnapshot() const;
+        std::vector<std::string> getExactEntries() const;
+        std::vector<std::string> getFilterEntries() const;
+        std::size_t getSubjectCount() const;
+        std::size_t getAnnouncedCount() const;
+        std::size_t getFilterBytes() const;
+        std::size_t getFoldedCount() const;
+        std::size_t getMaxFanout() const;
+    };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef NATS_INTEREST_WATCH_H
+#define NATS_INTEREST_WATCH_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unordered_set>
+
+namespace nats{
+    //a literal subject that some clients want INTEREST updates for
+    struct NatsInterestWatch {
+        std::vector<std::string> m_subject_list;
+        std::unordered_set<long long> m_client_ids;
+        long long m_match_count; //number of subscriptions currently matching the subject
+    };
+
+    //The watches by subject, with their subjects also in a trie of tokens
+    //a subscription subject walks the trie the way a published subject walks the sublist, so a SUB or UNSUB only looks at
+    //the watches it can match and not at every watch
+    class NatsInterestWatchIndex{
+        struct Node {
+            std::unordered_map<std::string, std::unique_ptr<Node>> m_next;
+            std::pair<const std::string, NatsInterestWatch>* m_watch = nullptr; //the watch of the subject ending here
+        };
+        std::unordered_map<std::string, NatsInterestWatch> m_watches; //keyed by the watched subject, entries never move
+        Node m_head;
+        template<typename Visitor> static void forEachBelow(Node* node, Visitor& visit);
+        template<typename Visitor> static void forEachMatch(Node* node, const std::vector<std::string>& pattern, std::size_t depth, Visitor& visit);
+        public:
+        //nullptr if nobody watches subject
+        NatsInterestWatch* find(const std::string& subject);
+        //adds the watch for subject, which nobody watched before
+        NatsInterestWatch& insert(const std::string& subject, NatsInterestWatch watch);
+        void erase(const std::string& subject);
+        bool empty() const;
+        std::size_t size() const;
+        //calls visit(const std::string& subject, NatsInterestWatch&) for every watched subject pattern matches
+        template<typename Visitor> void forEachMatch(const std::vector<std::string>& pattern, Visitor&& visit);
+    };
+
+    template<typename Visitor>
+    void NatsInterestWatchIndex::forEachBelow(Node* node, Visitor& visit){
+        for(auto& pair: node->m_next){
+            Node* child = pair.second.get();
+            if(child->m_watch != nullptr){
+                visit(child->m_watch->first, child->m_watch->second);
+            }
+            forEachBelow(child, visit);
+        }
+    }
+
+    template<typename Visitor>
+    void NatsInterestWatchIndex::forEachMatch(Node* node, const std::vector<std::string>& pattern, std::size_t depth, Visitor& visit){
+        if(depth == pattern.size()){
+            if(node->m_watch != nullptr){
+                visit(node->m_watch->first, node->m_watch->second);
+            }
+            return;
+        }
+        const std::string& token = pattern[depth];
+        if(token == ">"){
+            //">" needs at least one token to cover, so the watch ending here isn't one of them
+            forEachBelow(node, visit);
+        } else if(token == "*"){
+            for(auto& pair: node->m_next){
+                forEachMatch(pair.second.get(), pattern, depth + 1, visit);
+            }
+        } else {
+            auto it = node->m_next.find(token);
+            if(it != node->m_next.end()){
+                forEachMatch(it->second.get(), pattern, depth + 1, visit);
+            }
+        }
+    }
+
+    template<typename Visitor>
+    void NatsInterestWatchIndex::forEachMatch(const std::vector<std::string>& pattern, Visitor&& visit){
+        if(!m_watches.empty()){
+            forEachMatch(&m_head, pattern, 0, visit);
+        }
+    }
+
+    //whether a watched subject gained or lost all of its matching subscriptions and who needs to know
+    struct NatsInterestChange {
+        std::string m_subject;
+        bool m_has_interest;
+        std::vector<long long> m_client_ids;
+    };
+
+    //a subscription subject this server's own clients started or stopped subscribing to, what routes tell their peers
+    struct NatsRouteInterestChange {
+        std::string m_subject;
+        bool m_has_interest;
+    };
+
+    //a subscription a shard gained or lost, what the sharded sublist keeps its watch counts up to date with
+    struct NatsSubscriptionChange {
+        std::vector<std::string> m_subject_list;
+        bool m_added;
+    };
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef NATS_LAST_VALUE_CACHE_H
+#define NATS_LAST_VALUE_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace nats{
+
+    //The latest message of every literal subject matching one of the tracked filters, so a new subscriber gets the
+    //current state right away instead of waiting for the next update
+    //entries are spread over shards by a hash of the subject, publishes to different subjects rarely share a lock,
+    //and an update overwrites the stored payload in place, so it only allocates when the payload grows
+    class NatsLastValueCache{
+        struct Shard{
+            std::mutex m_mutex;
+            std::unordered_map<std::string, std::string> m_values; //subject -> payload
+        };
+        //filters are only ever added, each add publishes a new list and publishes read m_filters without any lock
+        std::mutex m_filters_mutex;
+        std::vector<std::unique_ptr<const std::vector<std::vector<std::string>>>> m_filter_lists;
+        std::atomic<const std::vector<std::vector<std::string>>*> m_filters;
+        std::vector<Shard> m_shards;
+        //the stored subjects again as a trie of tokens, so a wildcard only visits (and locks the shards of) the subjects it
+        //matches, subjects are never removed so the entries a node points at stay put
+        struct SubjectNode{
+            std::unordered_map<std::string, std::unique_ptr<SubjectNode>> m_next;
+            const std::pair<const std::string, std::string>* m_value = nullptr; //the entry of the subject ending here
+            std::size_t m_shard = 0;
+        };
+        //guards the trie, taken before a shard lock, a new subject is added under it and a wildcard lockFor holds it
+        //until unlockFor, so no matching subject can show up in a shard it didn't lock
+        std::mutex m_subject_trie_mutex;
+        SubjectNode m_subject_trie;
+        std::atomic<uint64_t> m_subjects;
+        std::atomic<uint64_t> m_bytes;
+        std::atomic<uint64_t> m_updates;
+        std::size_t shardIndex(std::string_view subject) const;
+        Shard& shardFor(std::string_view subject);
+        //calls visit(const SubjectNode&) for every stored subject pattern matches, needs m_subject_trie_mutex
+        template<typename Visitor> static void forEachStored(const SubjectNode& node, const std::vector<std::string>& pattern,
+            std::size_t depth, Visitor& visit);
+        template<typename Visitor> static void forEachBelow(const SubjectNode& node, Visitor& visit);
+        //the shards holding a subject pattern matches, in shard order without duplicates
+        void matchingShards(const std::vector<std::string>& pattern, std::vector<std::size_t>& shards);
+        static bool isLiteral(const std::vector<std::string>& subject_list);
+        static std::string joinSubject(const std::vector<std::string>& subject_list);
+        public:
+        static constexpr int SHARD_COUNT = 64;
+        NatsLastValueCache();
+        NatsLastValueCache(const NatsLastValueCache&) = delete;
+        NatsLastValueCache& operator=(const NatsLastValueCache&) = delete;
+        //keeps the last value of every subject matching subject from now on, false if it isn't a valid subject
+        bool track(const std::string& subject);
+        std::vector<std::string> getTrackedSubjects();
+        //an atomic load while nothing is tracked, a filter compare per tracked subject otherwise
+        bool tracks(const std::vector<std::string>& subject_list) const;
+        //whether a subscription to subject_list can match a tracked subject at all
+        bool mayHold(const std::vector<std::string>& subject_list) const;
+        //replaces the value of subject if it is tracked, and returns with the lock of its shard held (an empty lock if it
+        //isn't tracked), publishMessage keeps it until it found its subscribers
+        std::unique_lock<std::mutex> store(const std::string& subject, const std::vector<std::string>& subject_list,
+            std::string_view payload);
+        //the shard of a literal subject, the shards of the stored subjects a wildcard matches, in shard order, a subscription holds them from adding
+        //itself to the sublist until it copied the values, so an update is either in the snapshot or delivered live
+        void lockFor(const std::vector<std::string>& subject_list);
+        void unlockFor(const std::vector<std::string>& subject_list);
+        //appends a MSG frame for every stored subject matching subject_list, needs lockFor(subject_list)
+        //returns how many there were and adds their payload bytes to payload_bytes
+        uint64_t appendFrames(const std::vector<std::string>& subject_list, int sub_id, std::string& frames, uint64_t& payload_bytes);
+        uint64_t getSubjectCount() const;
+        uint64_t getByteCount() const; //payload bytes
+        uint64_t getUpdateCount() const;
+    };
+}
+
+#endif
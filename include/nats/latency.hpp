@@ -0,0 +1,103 @@
+#ifndef NATS_LATENCY_H
+#define NATS_LATENCY_H
+
+#include "stats.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace nats{
+
+    //percentiles and counts of one histogram at the time it was read
+    struct NatsLatencySummary {
+        uint64_t m_count;
+        uint64_t m_mean_ns;
+        uint64_t m_p50_ns;
+        uint64_t m_p90_ns;
+        uint64_t m_p99_ns;
+        uint64_t m_p999_ns;
+        uint64_t m_max_ns;
+    };
+
+    //An HDR style log-linear histogram of nanosecond durations
+    //every power of two range is split into SUB_BUCKET_COUNT linear buckets, so any recorded value is within 12.5% of
+    //what is reported for it, from 1ns up to the whole uint64_t range in 496 buckets
+    //recording goes to the stripe of the calling thread (same stripes as NatsStripedCounter), reading merges the stripes
+    class NatsLatencyHistogram{
+        public:
+        static constexpr int SUB_BUCKET_BITS = 3;
+        static constexpr int SUB_BUCKET_COUNT = 1<<SUB_BUCKET_BITS;
+        static constexpr int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+        static constexpr int STRIPE_COUNT = 8;
+        private:
+        struct alignas(64) Stripe {
+            std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+            std::atomic<uint64_t> m_sum;
+        };
+        std::unique_ptr<Stripe[]> m_stripes;
+        public:
+        NatsLatencyHistogram();
+        static int bucketIndex(uint64_t value){
+            if(value < SUB_BUCKET_COUNT) return static_cast<int>(value);
+            int exponent = 63 - __builtin_clzll(value);
+            int shift = exponent - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKET_COUNT + static_cast<int>((value >> shift) & (SUB_BUCKET_COUNT - 1));
+        }
+        //highest value that falls into the bucket
+        static uint64_t bucketUpperBound(int index);
+        void record(uint64_t value_ns){
+            Stripe& stripe = m_stripes[NatsStripedCounter::stripeIndex() % STRIPE_COUNT];
+            stripe.m_buckets[bucketIndex(value_ns)].fetch_add(1, std::memory_order_relaxed);
+            stripe.m_sum.fetch_add(value_ns, std::memory_order_relaxed);
+        }
+        NatsLatencySummary summary() const;
+        //upper bound of the bucket holding the value at the given percentile (0-100), 0 if nothing was recorded
+        uint64_t valueAtPercentile(double percentile) const;
+        void reset();
+    };
+
+    //Latency of the publish hot path, split into the stages
+    //  parse   - one NatsParser::parse call, so one read worth of operations including everything they trigger
+    //  match   - NatsSublist::getSubscriptionsForTopic
+    //  publish - NatsServer::publishMessage, matching plus delivery to every subscriber
+    //recording is off by default and can be switched on and off at runtime, while off nothing reads the clock
+    class NatsLatencyStats{
+        std::atomic<bool> m_enabled;
+        public:
+        NatsLatencyHistogram m_parse;
+        NatsLatencyHistogram m_match;
+        NatsLatencyHistogram m_publish;
+        NatsLatencyStats();
+        static NatsLatencyStats& shared();
+        bool isEnabled() const{
+            return m_enabled.load(std::memory_order_relaxed);
+        }
+        void setEnabled(bool enabled);
+        void reset();
+    };
+
+    //records the time from its construction to its destruction into the histogram, if recording is enabled
+    class NatsLatencyTimer{
+        NatsLatencyHistogram* m_histogram;
+        std::chrono::steady_clock::time_point m_start;
+        public:
+        explicit NatsLatencyTimer(NatsLatencyHistogram& histogram): m_histogram(nullptr){
+            if(NatsLatencyStats::shared().isEnabled()){
+                m_histogram = &histogram;
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+        ~NatsLatencyTimer(){
+            if(m_histogram != nullptr){
+                m_histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+            }
+        }
+        NatsLatencyTimer(const NatsLatencyTimer&) = delete;
+        NatsLatencyTimer& operator=(const NatsLatencyTimer&) = delete;
+    };
+}
+
+#endif
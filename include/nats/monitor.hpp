@@ -0,0 +1,47 @@
+#ifndef NATS_MONITOR_H
+#define NATS_MONITOR_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace nats{
+
+    class NatsServer; // forward declaration because the server owns the monitor
+
+    //A tiny HTTP endpoint on a separate port serving the server's counters as JSON
+    //  /varz  - server wide message, byte and connection counters
+    //  /connz - the same counters per connection, ?subs=1 adds delivered/dropped per subscription
+    //  /subsz - subscription store counters
+    //  /subjectz - estimated top subjects by messages and by bytes, ?top=N (default 10) and ?reset=1 clears them
+    //  /streamz - every stream with its subject, message and byte counts, sequence range and segments, every replay buffer
+    //    and the last value cache
+    //  /routez - the routes to other servers of the cluster with their peer's server id, subject count and message counters
+    //  /latz  - latency percentiles of the publish path stages, ?enable=1|0 switches recording and ?reset=1 clears them
+    //requests are served one at a time on the monitor's own thread, nothing here runs on a client thread
+    class NatsMonitor{
+        NatsServer* m_server;
+        int m_monitor_fd;
+        std::thread m_monitor_thread;
+        std::atomic<bool> m_running;
+        void acceptLoop();
+        void handleConnection(int connection_fd);
+        public:
+        explicit NatsMonitor(NatsServer* server);
+        ~NatsMonitor();
+        //host is an IPv4 address, the connections list client addresses and /latz can be switched, so keep it local
+        bool start(const std::string& host, int port);
+        void stop();
+        //fills body with the JSON for the path, returns false if there is no such endpoint
+        bool handleRequest(const std::string& path, const std::string& query, std::string& body);
+        std::string varz();
+        std::string connz(const std::string& query);
+        std::string subsz();
+        std::string subjectz(const std::string& query);
+        std::string streamz();
+        std::string routez();
+        std::string latz(const std::string& query);
+    };
+}
+
+#endif
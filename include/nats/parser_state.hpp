@@ -45,7 +45,23 @@ namespace nats{
         OP_UNSU,
         OP_UNSUB,
         OP_UNSUB_SPC,
-        UNSUB_ARG
+        UNSUB_ARG,
+        // WATCH
+        OP_W,
+        OP_WA,
+        OP_WAT,
+        OP_WATC,
+        OP_WATCH,
+        OP_WATCH_SPC,
+        WATCH_ARG,
+        // UNWATCH
+        OP_UNW,
+        OP_UNWA,
+        OP_UNWAT,
+        OP_UNWATC,
+        OP_UNWATCH,
+        OP_UNWATCH_SPC,
+        UNWATCH_ARG
     };
 }
 
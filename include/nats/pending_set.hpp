@@ -0,0 +1,41 @@
+#ifndef NATS_PENDING_SET_H
+#define NATS_PENDING_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace nats{
+
+    //Sequence numbers delivered but not acknowledged yet, as a sliding window of bits
+    //a ring of 64 bit words starting at the oldest pending seq, so adding and acking is a bit operation on
+    //preallocated memory and never allocates, however many messages are in flight
+    //redelivery deadlines are kept per word, a word's deadline is the ack wait after the last delivery into it,
+    //so a message is never redelivered before its own ack wait passed (but can wait up to one batch longer)
+    class NatsPendingSet{
+        std::vector<uint64_t> m_words;
+        std::vector<int64_t> m_deadlines; //per word, 0 while the word has nothing pending
+        uint64_t m_base; //seq of the first bit of the word at m_head, always a multiple of 64
+        std::size_t m_head;
+        std::size_t m_count;
+        std::size_t m_max_pending;
+        std::size_t wordIndex(uint64_t seq) const;
+        public:
+        explicit NatsPendingSet(std::size_t max_pending);
+        //whether seq fits the window and fewer than max_pending are pending, otherwise it has to wait for acks
+        bool canAdd(uint64_t seq) const;
+        //marks seq as pending until deadline, false if it doesn't fit the window or max_pending are pending already
+        bool add(uint64_t seq, int64_t deadline);
+        //acks seq, false if it wasn't pending (acked before, or never delivered)
+        bool remove(uint64_t seq);
+        bool contains(uint64_t seq) const;
+        //appends every pending seq whose word deadline passed at now to due, in order, and gives those words next_deadline
+        void collectDue(int64_t now, int64_t next_deadline, std::vector<uint64_t>& due);
+        //the earliest deadline of any pending seq, 0 if nothing is pending
+        int64_t earliestDeadline() const;
+        std::size_t size() const;
+        std::size_t capacity() const;
+    };
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef NATS_REPLAY_BUFFER_H
+#define NATS_REPLAY_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nats{
+
+    struct NatsReplayBufferConfig {
+        std::string m_name;
+        std::string m_subject; //subject filter, wildcards allowed, every published message matching it is kept
+        uint64_t m_capacity = 1024 * 1024; //bytes, the oldest messages make room for new ones once it is full
+    };
+
+    //layout of every message in the ring, followed by the subject and the payload and padded to 8 bytes
+    struct NatsReplayRecordHeader {
+        uint32_t m_record_size;
+        uint32_t m_payload_size;
+        int64_t m_timestamp_ns; //steady clock, the buffer doesn't outlive the process
+        uint16_t m_subject_size;
+        uint16_t m_reserved16;
+        uint32_t m_reserved;
+    };
+
+    //The most recent messages published to subjects matching a filter, in memory only, for subscribers that join late
+    //and want to catch up on the last seconds without a stream on disk
+    //all of the memory is allocated when the buffer is created, messages are copied into a ring and the oldest ones
+    //are overwritten, so storing a message never allocates
+    class NatsReplayBuffer{
+        NatsReplayBufferConfig m_config;
+        std::vector<std::string> m_subject_list;
+        std::unique_ptr<char[]> m_data;
+        //the records are [m_head, m_tail) or, once wrapped, [m_head, m_end) followed by [0, m_tail)
+        uint64_t m_head;
+        uint64_t m_tail;
+        uint64_t m_end;
+        uint64_t m_count;
+        std::mutex m_mutex;
+        std::atomic<uint64_t> m_appended;
+        std::atomic<uint64_t> m_evicted;
+        std::atomic<uint64_t> m_oversized; //bigger than the whole buffer, never stored
+        std::atomic<uint64_t> m_stored_count; //m_count and the bytes in use, for monitoring without the lock
+        std::atomic<uint64_t> m_stored_bytes;
+        const NatsReplayRecordHeader* recordAt(uint64_t offset) const;
+        void evictOldest();
+        public:
+        explicit NatsReplayBuffer(NatsReplayBufferConfig config);
+        NatsReplayBuffer(const NatsReplayBuffer&) = delete;
+        NatsReplayBuffer& operator=(const NatsReplayBuffer&) = delete;
+        //checks the subject and allocates the ring, false (with the reason on stderr) if the buffer can't be used
+        bool open();
+        const NatsReplayBufferConfig& getConfig() const;
+        bool matches(const std::vector<std::string>& subject_list) const;
+        //publishMessage holds the lock from storing a message until it found its subscribers, and a replaying SUB holds
+        //it from adding its subscription until it copied the buffer, so every message is either replayed or delivered live
+        void lock();
+        void unlock();
+        //both need the lock
+        void append(std::string_view subject, std::string_view payload);
+        //appends a MSG frame for every stored message matching subject_list and stored at or after since_ns (steady clock)
+        //to frames, oldest first, returns how many there were and adds their payload bytes to payload_bytes
+        uint64_t appendFrames(const std::vector<std::string>& subject_list, int64_t since_ns, int sub_id, std::string& frames,
+            uint64_t& payload_bytes);
+        uint64_t getCapacity() const;
+        uint64_t getMessageCount() const;
+        uint64_t getByteCount() const;
+        uint64_t getAppendedCount() const;
+        uint64_t getEvictedCount() const;
+        uint64_t getOversizedCount() const;
+        static int64_t nowNanos(); //steady clock, what the records are stamped with
+    };
+}
+
+#endif
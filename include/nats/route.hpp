@@ -0,0 +1,90 @@
+#ifndef NATS_ROUTE_H
+#define NATS_ROUTE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "interest_summary.hpp"
+
+namespace nats{
+    class NatsServer;
+
+    //One connection to another server of the cluster, over which both sides speak
+    //  ROUTE <server id>\r\n              sent first by both sides
+    //  RS+ <subject>\r\n / RS- <subject>\r\n  a subject the sender's own clients started / stopped subscribing to
+    //  RMSG <subject> <size>\r\n<payload>\r\n  a message published on the sender that matches one of those subjects
+    //  RF+/RF-/RFS/RFC                     a folded prefix and the filter of its subjects, see NatsInterestSummary
+    //the peer's subjects are subscribed in the local sublist under this route's (negative) client id, so a publish finds
+    //the route like any other subscriber and a message is only forwarded to peers that want it
+    //a folded prefix is subscribed with a negative sub id, and a message it matches is only forwarded if the filter
+    //of the prefix may hold its subject
+    //messages that came in over a route are only delivered to local subscribers, every server routes to every other one
+    class NatsRoute{
+        NatsServer* m_server;
+        int m_fd;
+        long long m_route_id;
+        bool m_solicited; //we connected to the peer, rather than the peer to us
+        std::atomic<long long> m_remote_server_id; //0 until the peer's ROUTE line arrived
+        std::mutex m_write_mutex; //held for every write, so RMSGs of different publishers never interleave
+        std::thread m_thread;
+        //the peer's subjects and the sub ids they are subscribed with, only touched by the reading thread
+        std::unordered_map<std::string, int> m_remote_interest;
+        std::vector<std::pair<int, std::vector<std::string>>> m_pending_subs; //RS+ of one read, added to the sublist together
+        int m_next_sub_id;
+        std::unordered_map<std::string, int> m_remote_filter_ids; //folded prefix -> its (negative) sub id, reading thread only
+        std::shared_mutex m_filters_mutex; //publishes check the filters under the shared lock
+        std::unordered_map<int, std::unique_ptr<NatsSummaryFilter>> m_filters;
+        int m_next_filter_sub_id;
+        std::atomic<uint64_t> m_remote_filter_bytes;
+        std::atomic<uint64_t> m_remote_subjects;
+        std::atomic<uint64_t> m_in_msgs;
+        std::atomic<uint64_t> m_in_bytes;
+        std::atomic<uint64_t> m_in_unwanted; //messages that matched a folded prefix but no subscriber here
+        std::atomic<uint64_t> m_out_msgs;
+        std::atomic<uint64_t> m_out_bytes;
+        void readLoop();
+        //handles everything complete in data, returns how many bytes were used, or -1 if the peer broke the protocol
+        long long processData(const char* data, std::size_t size);
+        bool processLine(std::string_view line);
+        bool processFilter(std::string_view entry, uint64_t bits, std::string_view bitmap);
+        bool removeFilter(std::string_view entry);
+        bool updateFilterBits(std::string_view args, bool set);
+        void flushPendingSubs();
+        void sendAll(const char* data, std::size_t size);
+        public:
+        NatsRoute(NatsServer* server, int fd, long long route_id, bool solicited);
+        ~NatsRoute();
+        NatsRoute(const NatsRoute&) = delete;
+        NatsRoute& operator=(const NatsRoute&) = delete;
+        //starts reading on the route's own thread, the server calls removeRoute once the connection is gone
+        void start();
+        //shuts the socket down, the reading thread returns and the destructor joins it
+        void shutdown();
+        void sendRoute(long long server_id);
+        //RS+/RS-/RF lines from NatsInterestSummary, in one write
+        void sendInterestChanges(const std::string& changes);
+        //false if sub_id is a folded prefix whose filter rules the subject out
+        bool wants(int sub_id, std::string_view subject);
+        void forward(std::string_view subject, std::string_view payload);
+        long long getRouteId() const;
+        long long getRemoteServerId() const;
+        bool isSolicited() const;
+        uint64_t getRemoteSubjectCount() const;
+        uint64_t getRemoteFilterBytes() const;
+        uint64_t getInMsgs() const;
+        uint64_t getInBytes() const;
+        uint64_t getInUnwanted() const;
+        uint64_t getOutMsgs() const;
+        uint64_t getOutBytes() const;
+    };
+}
+
+#endif
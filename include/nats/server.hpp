@@ -2,23 +2,100 @@
 #define NATS_SERVER_H
 
 #include "client.hpp"
-#include "sublist.hpp"
+#include "sharded_sublist.hpp"
+#include "stats.hpp"
+#include "monitor.hpp"
+#include "stream.hpp"
+#include "replay_buffer.hpp"
+#include "last_value_cache.hpp"
+#include "route.hpp"
+#include "interest_summary.hpp"
+#include "timer.hpp"
+#include <atomic>
+#include <functional>
+#include <chrono>
 #include <unordered_map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <utility>
+#include <string_view>
 
 namespace nats {
 
+    //callback of an in-process subscription, the views are only valid during the call
+    using NatsMessageHandler = std::function<void(std::string_view subject, std::string_view payload)>;
+
     class NatsServer {
     public:
         long long int m_server_id;
         int m_server_fd;
+        int m_port; //client port, 4222 unless changed before startServer
         std::atomic<bool> m_running;
         std::unordered_map<long long, std::unique_ptr<NatsClient>> m_clients;
         std::mutex m_clients_mutex; //mutex to make sure multiple threads dont change m_clients at the same time
-        std::unique_ptr<NatsSublist> m_sublist;
+        std::unique_ptr<NatsShardedSublist> m_sublist;
+        std::mutex m_interest_notify_mutex; //keeps INTEREST updates in the order the sublist produced them
+        NatsServerStats m_stats;
+        int m_monitor_port; //port of the HTTP monitoring endpoint, 0 disables it
+        //address the monitoring endpoint binds to, only this host can reach it unless set to something wider like 0.0.0.0
+        std::string m_monitor_host;
+        std::unique_ptr<NatsMonitor> m_monitor;
+        std::chrono::steady_clock::time_point m_start_time;
+        //subscriptions made through subscribe() are kept in the sublist under this client id, socket clients never get 0
+        static constexpr long long LOCAL_CLIENT_ID = 0;
+        std::mutex m_local_mutex; //guards m_local_handlers
+        std::unordered_map<int, std::shared_ptr<NatsMessageHandler>> m_local_handlers; //by sub id
+        std::atomic<int> m_next_local_sub_id;
+        //streams are only ever added, each add publishes a new list and publishes read m_streams without any lock
+        //the lists are never freed while the server lives, a publish may still be reading an older one
+        std::mutex m_streams_mutex; //serializes adding streams
+        std::vector<std::unique_ptr<const std::vector<std::shared_ptr<NatsStream>>>> m_stream_lists;
+        std::atomic<const std::vector<std::shared_ptr<NatsStream>>*> m_streams;
+        //replay buffers are kept the same way, only publishes matching one of them take its lock
+        std::mutex m_replay_buffers_mutex;
+        std::vector<std::unique_ptr<const std::vector<std::shared_ptr<NatsReplayBuffer>>>> m_replay_buffer_lists;
+        std::atomic<const std::vector<std::shared_ptr<NatsReplayBuffer>>*> m_replay_buffers;
+        //latest message per subject for the subjects trackLastValues was called with, empty (and skipped) by default
+        NatsLastValueCache m_last_values;
+        //stream consumers with acks by consumer id, acks are publishes to $ACK.<consumer id>.<seq> and find them here
+        std::shared_mutex m_ack_consumers_mutex;
+        std::unordered_map<uint64_t, NatsStreamConsumer*> m_ack_consumers;
+        std::atomic<uint64_t> m_next_consumer_id;
+        NatsTimer m_ack_timer; //ack deadlines of every consumer, after the registry its callback looks in
+        //cluster, routes to other servers by their (negative) client id in the sublist, see NatsRoute
+        int m_cluster_port; //port other servers connect their routes to, 0 (the default) doesn't listen for routes
+        int m_cluster_fd;
+        std::thread m_cluster_thread;
+        std::shared_mutex m_routes_mutex; //publishes forward under the shared lock
+        std::unordered_map<long long, std::unique_ptr<NatsRoute>> m_routes;
+        std::vector<std::unique_ptr<NatsRoute>> m_closed_routes; //their threads are done or about to be, joined later
+        std::atomic<long long> m_next_route_id;
+        std::mutex m_route_interest_mutex; //keeps RS+/RS- in the order the sublist produced them, like m_interest_notify_mutex
+        //what the routes are told about local interest, filled from the sublist when the first route comes up
+        NatsInterestSummary m_interest_summary;
+        bool m_interest_summary_seeded;
+        //a subject prefix with more different next tokens than this is announced to routes as one "<prefix>.>",
+        //0 announces every subject, read when the first route comes up
+        std::size_t m_route_summary_fanout;
+        //clients on the same host can connect to this unix socket as well, empty (the default) doesn't listen on one
+        std::string m_unix_socket_path;
+        int m_unix_fd;
+        std::thread m_unix_thread;
+        std::atomic<bool> m_unix_running;
+        //bytes of each ring of a shared memory transport a client asks for with CONNECT {"shm":true}, 0 refuses it
+        std::size_t m_shm_ring_size;
+        //connections the kernel queues for the client and unix listeners until they are accepted, capped by somaxconn
+        int m_listen_backlog;
+        //a thread per client connection, a finished one is joined by the next pass of the accept loop
+        //the mutex also guards the listener fds (m_server_fd, m_unix_fd, m_cluster_fd) a stop and the accept loops race on
+        std::mutex m_client_threads_mutex;
+        std::unordered_map<uint64_t, std::thread> m_client_threads;
+        std::vector<uint64_t> m_finished_client_threads;
+        uint64_t m_next_client_thread;
 
         NatsServer();
         ~NatsServer();
@@ -28,10 +105,92 @@ namespace nats {
         void addClient(std::unique_ptr<NatsClient> client);
         void removeClient(long long client_id);
         NatsClient* getClient(long long client_id);
+        //reads and parses a client connection until it is gone, on the connection's own thread
+        void serveClient(int client_fd, std::string client_ip);
+        //accepts connections on a non-blocking listener in batches until running is false or the listener is closed
+        void acceptClients(int listen_fd, const std::atomic<bool>& running, bool tcp);
+        void startClientThread(int client_fd, std::string client_ip);
+        //joins the threads of clients that are gone
+        void reapClientThreads();
+        //waits for every client thread, the clients have to be closed first
+        void joinClientThreads();
+        std::size_t getClientThreadCount();
+        //listens on m_unix_socket_path on a thread of its own, startServer calls it when the path is set
+        bool startUnixListener();
+        //closes the listener and waits for the clients that connected through it
+        void stopUnixListener();
 
         virtual void addSubscription(int sub_id, std::vector<std::string>& subject_list, long long client_id);
-        virtual void removeSubscriptions(std::vector<std::pair<std::vector<std::string>,NatsSubscription>> unsub_params);
-        virtual void publishMessage(std::string& subject, std::vector<std::string>& subject_list, std::string msg);
+        virtual void addSubscriptions(long long client_id, std::vector<std::pair<int, std::vector<std::string>>>& subscriptions);
+        virtual void removeSubscriptions(long long client_id, std::vector<int> sub_ids);
+        virtual void removeClientSubscriptions(long long client_id);
+        virtual void publishMessage(std::string& subject, std::vector<std::string>& subject_list, std::string_view msg);
+        //true if the message went to at least one subscriber of this server
+        bool processPublish(std::string& subject, std::vector<std::string>& subject_list, std::string_view msg, bool from_route);
+        //false if the route is gone or the subscription is a folded prefix whose filter rules the subject out
+        bool forwardToRoute(long long route_id, int sub_id, std::string_view subject, std::string_view msg);
+        //sends the queued RS+/RS- to every route, m_route_interest_mutex has to be held
+        void sendRouteInterestChanges();
+        virtual void addInterestWatch(std::string& subject, std::vector<std::string>& subject_list, long long client_id);
+        virtual void removeInterestWatches(std::vector<std::string> subjects, long long client_id);
+        void notifyInterestChanges();
+        void deliverLocal(std::string_view subject, int sub_id, std::string_view msg);
+        void storeInStreams(std::string_view subject, const std::vector<std::string>& subject_list, std::string_view msg);
+        //a message a peer forwarded, delivered to this server's subscribers only and not stored anywhere
+        //false if none of them wanted it, which happens when the peer only knows a folded summary of the interest here
+        bool publishFromRoute(std::string& subject, std::vector<std::string>& subject_list, std::string_view msg);
+
+        //listens for routes on m_cluster_port on a thread of its own, startServer calls it when the port is set
+        bool startClusterListener();
+        //connects a route to the cluster port of another server, false if it can't be reached
+        bool connectRoute(const std::string& host, int port);
+        //takes over a connected socket as a route, sends it this server's interest and starts reading from it
+        NatsRoute* addRoute(int fd, bool solicited);
+        void removeRoute(long long route_id);
+        //called once the peer's server id is known, false if the route has to go (a second route to the same server
+        //keeps the one the lower server id connected, so both ends agree)
+        bool identifyRoute(NatsRoute* route);
+        std::size_t getRouteCount();
+        //closes the listener and every route and waits for their threads
+        void stopCluster();
+
+        //opens (or recovers) a stream, from then on every published message matching its subject is appended to it
+        //false if the name is taken or the stream can't be opened
+        bool addStream(NatsStreamConfig config);
+        std::shared_ptr<NatsStream> getStream(const std::string& name);
+        const std::vector<std::shared_ptr<NatsStream>>& getStreams();
+
+        //allocates the buffer, from then on every published message matching its subject is kept in it
+        //false if the name is taken or the buffer can't be created
+        bool addReplayBuffer(NatsReplayBufferConfig config);
+        std::shared_ptr<NatsReplayBuffer> getReplayBuffer(const std::string& name);
+        const std::vector<std::shared_ptr<NatsReplayBuffer>>& getReplayBuffers();
+        //subscribes and writes the buffered messages matching subject_list (stored at or after since_ns) to the client
+        //before any live one, with no message missed or sent twice in between
+        void subscribeWithReplay(NatsClient* client, int sub_id, std::vector<std::string>& subject_list, NatsReplayBuffer& buffer,
+            int64_t since_ns);
+
+        //keeps the last message of every subject matching subject, a SUB matching any of them gets their current values
+        //before any live message, false if subject isn't valid
+        bool trackLastValues(const std::string& subject);
+        //subscribes and writes the last value of every tracked subject matching subject_list to the client before any
+        //live message, with no update missed or sent twice in between
+        void subscribeWithLastValues(NatsClient* client, int sub_id, std::vector<std::string>& subject_list);
+
+        uint64_t registerAckConsumer(NatsStreamConsumer* consumer);
+        //once this returns neither an ack nor the timer reaches the consumer anymore
+        void unregisterAckConsumer(uint64_t consumer_id);
+        //true if subject_list is an ack subject, which is then handled here and not delivered or stored anywhere
+        bool handleAck(const std::vector<std::string>& subject_list);
+        void onAckTimer(uint64_t consumer_id);
+
+        //embedding API for code running in the same process, no socket, parser or MSG framing involved
+        //publish reaches socket and local subscribers alike, local handlers run on the publishing thread before publish returns
+        //both throw the same subject exceptions a PUB/SUB with that subject would get
+        void publish(std::string_view subject, std::string_view payload);
+        int subscribe(std::string_view subject, NatsMessageHandler handler);
+        //a publish that already matched the subscription can still call the handler once after this returns
+        void unsubscribe(int sub_id);
     };
 }
 
@@ -0,0 +1,76 @@
+#ifndef NATS_SHARDED_SUBLIST_H
+#define NATS_SHARDED_SUBLIST_H
+
+#include "sublist.hpp"
+#include "subscription.hpp"
+#include "interest_watch.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace nats{
+    //The server's subscription store, NatsSublists partitioned by a hash of the first subject token
+    //subjects with different first tokens are matched and changed under different locks and on different cache lines
+    //subscriptions starting with a wildcard can match any first token, they live in one extra shard that is
+    //consulted for every subject (and skipped while it is empty)
+    //interest watches are kept here rather than in the shards, a watched subject can be matched from two shards
+    class NatsShardedSublist{
+        std::vector<std::unique_ptr<NatsSublist>> m_shards;
+        std::unique_ptr<NatsSublist> m_root_wildcards;
+        std::mutex m_watch_mutex; //guards the watches and the queued changes, changes are queued in the order they happened
+        NatsInterestWatchIndex m_interest_watches;
+        std::atomic<int> m_watch_count; //lets subscription changes skip m_watch_mutex while nobody watches
+        std::vector<NatsInterestChange> m_interest_changes;
+        std::atomic<bool> m_has_interest_changes;
+        std::atomic<bool> m_track_route_interest; //lets servers without routes skip looking at every shard
+        //index m_shards.size() stands for m_root_wildcards
+        std::size_t shardIndex(const std::vector<std::string>& subject_list) const;
+        NatsSublist& shardAt(std::size_t index);
+        NatsSublist& shardFor(const std::vector<std::string>& subject_list);
+        //the shards queue their subscription changes while there are watches, these are called with m_watch_mutex held
+        void takeSubscriptionChanges(std::vector<NatsSubscriptionChange>& changes);
+        //adjusts the counts of the watches each change matches and queues 0 <-> 1 transitions
+        void applySubscriptionChanges(std::vector<NatsSubscriptionChange>& changes);
+        void updateInterestWatches();
+        public:
+        static constexpr int SHARD_COUNT = 16;
+        explicit NatsShardedSublist(int shard_count = SHARD_COUNT);
+        int getShardCount() const;
+        void addSubscription(NatsSubscription subscription, std::vector<std::string>& subject_list);
+        void removeSubscription(NatsSubscription& subscription, std::vector<std::string>& subject_list);
+        //the batch is split by shard and every shard gets its part under a single lock
+        void addSubscriptions(long long client_id, std::vector<std::pair<int, std::vector<std::string>>>& subscriptions,
+            const std::vector<NatsSubscriptionStats*>& stats = {});
+        void removeSubscriptions(long long client_id, const std::vector<int>& sub_ids);
+        void removeClient(long long client_id);
+        std::vector<NatsSubscription> getSubscriptionsForTopic(std::vector<std::string>& subject_list);
+        void getSubscriptionsForTopic(std::vector<std::string>& subject_list, std::vector<NatsSubscription>& subscriptions, NatsMatchMode mode = NatsMatchMode::ALL_SUBSCRIPTIONS);
+        template<typename Visitor> void forEachSubscriptionForTopic(std::vector<std::string>& subject_list, Visitor&& visit);
+        bool hasPossibleInterest(std::vector<std::string>& subject_list);
+        void addInterestWatch(std::string& subject, std::vector<std::string>& subject_list, long long client_id);
+        void removeInterestWatch(std::string& subject, long long client_id);
+        std::vector<NatsInterestChange> takeInterestChanges();
+        bool hasInterestChanges();
+        //route interest is tracked by the shards, a subject always lives in the same shard so its changes stay in order
+        void setRouteInterestTracking(bool enabled);
+        std::vector<NatsRouteInterestChange> takeRouteInterestChanges();
+        bool hasRouteInterestChanges();
+        std::vector<std::string> collectLocalInterest();
+        long long getSubscriptionCount();
+        std::size_t getInterestWatchCount();
+    };
+
+    template<typename Visitor>
+    void NatsShardedSublist::forEachSubscriptionForTopic(std::vector<std::string>& subject_list, Visitor&& visit){
+        shardFor(subject_list).forEachSubscriptionForTopic(subject_list, visit);
+        if(m_root_wildcards->getSubscriptionCount() > 0){
+            m_root_wildcards->forEachSubscriptionForTopic(subject_list, visit);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef NATS_SHM_TRANSPORT_H
+#define NATS_SHM_TRANSPORT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+
+namespace nats{
+
+    //the shared part of a ring, at the start of its memory, the writer only writes m_head and the reader m_tail
+    struct NatsShmRingHeader{
+        alignas(64) std::atomic<uint64_t> m_head; //bytes ever written
+        alignas(64) std::atomic<uint64_t> m_tail; //bytes ever read
+        //futex words, bumped by the other side whenever it finds this side waiting
+        alignas(64) std::atomic<uint32_t> m_data_seq;
+        std::atomic<uint32_t> m_reader_waiting;
+        alignas(64) std::atomic<uint32_t> m_space_seq;
+        std::atomic<uint32_t> m_writer_waiting;
+        std::atomic<uint32_t> m_closed;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring counters are shared with another process");
+
+    //A single producer single consumer byte ring in memory shared with another process, the bytes are plain protocol
+    //so what comes out of it goes to the parser like anything read from a socket
+    //neither side makes a system call while the ring has data (or space), a side that has to wait sleeps on a futex in
+    //the shared memory and the other side only wakes it when it finds it waiting
+    class NatsShmRing{
+        NatsShmRingHeader* m_header;
+        char* m_data;
+        std::size_t m_capacity;
+        public:
+        static constexpr int WAIT_MS = 100; //how long a wait sleeps before it looks for a closed ring or a hung up socket
+        static constexpr int SPIN_COUNT = 256; //looks at an empty ring before a reader goes to sleep
+        //header is followed by capacity (a power of two) bytes
+        NatsShmRing(NatsShmRingHeader* header, std::size_t capacity);
+        //writes all of it, waiting while the ring is full, false if the ring was closed first
+        bool write(const struct iovec* iov, int count);
+        //reads what is there (at most size bytes), waiting for at least one byte, 0 once the ring is closed or
+        //hangup_fd (the connection the ring was set up over, -1 for none) is gone
+        std::size_t read(char* buffer, std::size_t size, int hangup_fd);
+        //wakes both sides, a write or read after this fails
+        void close();
+        bool isClosed() const;
+        std::size_t getCapacity() const;
+    };
+
+    //Two rings, client to server and server to client, in one memfd the server creates for a client on the same host
+    //the fd travels to the client with the "+SHM <ring size>\r\n" reply to its CONNECT, which only a unix socket can
+    //carry, from then on the connection only tells either side when the other one is gone
+    class NatsShmTransport{
+        int m_fd;
+        void* m_memory;
+        std::size_t m_size;
+        std::unique_ptr<NatsShmRing> m_to_server;
+        std::unique_ptr<NatsShmRing> m_to_client;
+        NatsShmTransport(int fd, void* memory, std::size_t size, std::size_t ring_size);
+        public:
+        static constexpr std::size_t MIN_RING_SIZE = 4096;
+        static bool isValidRingSize(std::size_t ring_size);
+        //a new zeroed memfd with both rings, nullptr if ring_size isn't a power of two of at least MIN_RING_SIZE or
+        //the memory can't be had
+        static std::unique_ptr<NatsShmTransport> create(std::size_t ring_size);
+        //maps a memfd the other side created, takes over fd, nullptr if its size doesn't fit ring_size
+        static std::unique_ptr<NatsShmTransport> attach(int fd, std::size_t ring_size);
+        //sends data over a unix socket with fd attached, false if the socket can't carry it
+        static bool sendWithFd(int socket_fd, std::string_view data, int fd);
+        //the client side of the reply to CONNECT {"shm":true}: reads the line it came with and attaches the transport if
+        //it is "+SHM <ring size>", nullptr with line set to whatever else the server replied (a plain +OK on a tcp
+        //connection or with shared memory turned off)
+        static std::unique_ptr<NatsShmTransport> receive(int socket_fd, std::string& line);
+        ~NatsShmTransport();
+        NatsShmTransport(const NatsShmTransport&) = delete;
+        NatsShmTransport& operator=(const NatsShmTransport&) = delete;
+        int getFd() const;
+        NatsShmRing& toServer();
+        NatsShmRing& toClient();
+        void close();
+    };
+}
+
+#endif
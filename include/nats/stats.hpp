@@ -0,0 +1,72 @@
+#ifndef NATS_STATS_H
+#define NATS_STATS_H
+
+#include "heavy_hitters.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace nats{
+    //one stripe per cache line, so threads bumping the same counter don't keep stealing the line from each other
+    struct alignas(64) NatsCounterStripe {
+        std::atomic<uint64_t> m_value{0};
+    };
+
+    //A counter split into stripes, every thread adds to its own stripe and a read sums all of them
+    //adding is a single relaxed fetch_add on a line that (mostly) no other thread touches, so it can stay on in production
+    class NatsStripedCounter{
+        static constexpr int STRIPE_COUNT = 16;
+        NatsCounterStripe m_stripes[STRIPE_COUNT];
+        static int nextStripe();
+        public:
+        //stripe of the calling thread, threads get stripes round robin the first time they count anything
+        static int stripeIndex(){
+            thread_local int stripe = nextStripe();
+            return stripe;
+        }
+        void add(uint64_t value){
+            m_stripes[stripeIndex()].m_value.fetch_add(value, std::memory_order_relaxed);
+        }
+        uint64_t load() const;
+    };
+
+    //server wide counters, aggregated on demand by the monitoring endpoint
+    struct NatsServerStats {
+        //PUBs of clients that are gone, the live clients' own counters are added to these on read
+        std::atomic<uint64_t> m_closed_in_msgs{0};
+        std::atomic<uint64_t> m_closed_in_bytes{0};
+        NatsStripedCounter m_local_in_msgs; //messages published in-process through NatsServer::publish
+        NatsStripedCounter m_local_in_bytes;
+        NatsStripedCounter m_out_msgs; //MSGs delivered to subscribers
+        NatsStripedCounter m_out_bytes;
+        NatsStripedCounter m_no_interest; //PUBs the interest filter answered without touching the sublist
+        NatsStripedCounter m_slow_consumers; //deliveries that couldn't be written to the client socket completely
+        std::atomic<uint64_t> m_total_connections{0};
+        NatsHeavyHitters m_hot_subjects; //every PUB by subject, for finding the subjects that dominate the traffic
+    };
+
+    //per subscription counters, in a slot the subscribing client keeps at the same address for as long as it lives
+    //every publisher delivering to the subscription adds to them without taking any lock
+    struct NatsSubscriptionStats {
+        std::atomic<uint64_t> m_delivered{0};
+        std::atomic<uint64_t> m_dropped{0}; //MSGs that couldn't be written completely, the subscriber is a slow consumer
+        std::atomic<uint64_t> m_redelivered{0}; //stream messages sent again because they weren't acked in time, also in m_delivered
+    };
+
+    //per client counters, in_* are only written by the client's own thread but out_* by every publisher
+    //the two groups sit on their own cache lines, or every delivery would take away the line each PUB writes to
+    struct NatsClientStats {
+        //a counter with a single writer doesn't need a locked read-modify-write, a relaxed load and store is enough
+        static void addSingleWriter(std::atomic<uint64_t>& counter, uint64_t value){
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+        alignas(64) std::atomic<uint64_t> m_in_msgs{0};
+        std::atomic<uint64_t> m_in_bytes{0};
+        std::atomic<int> m_subscriptions{0}; //changed by the client's own SUBs and UNSUBs
+        alignas(64) std::atomic<uint64_t> m_out_msgs{0};
+        std::atomic<uint64_t> m_out_bytes{0};
+        std::atomic<uint64_t> m_slow_consumers{0};
+    };
+    static_assert(sizeof(NatsClientStats) == 128, "in and out counters each fill one cache line");
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef NATS_STREAM_H
+#define NATS_STREAM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace nats{
+    //when appended messages are forced to disk
+    enum class NatsFsyncPolicy {
+        NONE,     //left to the OS, segments are only synced when the stream is closed
+        INTERVAL, //a background thread syncs whatever was appended every m_fsync_interval_ms
+        ALWAYS    //append returns once the message is on disk, concurrent appends share one msync (group commit)
+    };
+
+    struct NatsStreamConfig {
+        std::string m_name;
+        std::string m_subject; //subject filter, wildcards allowed, every published message matching it is stored
+        std::string m_directory = "streams"; //segments go into <m_directory>/<m_name>/
+        uint64_t m_segment_size = 64 * 1024 * 1024;
+        NatsFsyncPolicy m_fsync_policy = NatsFsyncPolicy::INTERVAL;
+        int m_fsync_interval_ms = 100;
+        //retention, 0 is unlimited, a segment is deleted once every message in it is past one of the limits
+        //the segment being appended to is never deleted, so up to one segment more than the limits is kept
+        int64_t m_max_age_ms = 0;
+        uint64_t m_max_bytes = 0; //payload bytes
+        uint64_t m_max_messages = 0;
+        //compaction, only the newest m_keep_last_per_subject messages of each subject are kept (0 keeps all)
+        //only full segments are rewritten, newer messages still in the active one aren't counted, so it never drops too many
+        uint32_t m_keep_last_per_subject = 0;
+        int m_retention_interval_ms = 1000; //how often the background thread applies the limits, 0 leaves it to applyRetention()
+    };
+
+    //layout of every record in a segment, followed by the subject and the payload and padded to 8 bytes
+    struct NatsStreamRecordHeader {
+        uint32_t m_record_size; //whole record with padding, 0 marks the end of what was written
+        uint32_t m_payload_size;
+        uint64_t m_seq;
+        int64_t m_timestamp_ns; //system clock, so it means the same after a restart
+        uint16_t m_subject_size;
+        uint16_t m_flags;
+        uint32_t m_reserved;
+    };
+
+    //a message read back from a stream
+    struct NatsStoredMessage {
+        uint64_t m_seq;
+        int64_t m_timestamp_ns;
+        std::string m_subject;
+        std::string m_payload;
+    };
+
+    //One preallocated, memory mapped file of a stream, records are only ever appended
+    //a sparse index of (seq, offset) every INDEX_SPACING bytes keeps a lookup to a short scan
+    class NatsStreamSegment{
+        std::string m_path;
+        int m_fd;
+        char* m_data;
+        uint64_t m_capacity;
+        uint64_t m_write_offset;
+        uint64_t m_synced_offset; //everything before this has been msync'd
+        uint64_t m_first_seq;
+        uint64_t m_last_seq; //0 while empty
+        uint64_t m_message_count;
+        uint64_t m_payload_bytes;
+        std::vector<std::pair<uint64_t, uint64_t>> m_index; //(seq, offset), increasing
+        uint64_t m_last_indexed_offset;
+        void addToIndex(uint64_t seq, uint64_t offset);
+        public:
+        static constexpr uint64_t INDEX_SPACING = 4096;
+        NatsStreamSegment(std::string path, uint64_t first_seq, uint64_t capacity);
+        ~NatsStreamSegment();
+        NatsStreamSegment(const NatsStreamSegment&) = delete;
+        NatsStreamSegment& operator=(const NatsStreamSegment&) = delete;
+        //creates (or reopens and scans) the file, false if it can't be mapped
+        //seqs only have to go up within a segment, a compacted one has gaps
+        bool open();
+        static uint64_t recordSize(std::size_t subject_size, std::size_t payload_size);
+        //false if the record doesn't fit anymore
+        bool append(uint64_t seq, int64_t timestamp_ns, std::string_view subject, std::string_view payload);
+        //msyncs everything before the upto offset that isn't synced yet, returns false if msync failed
+        bool sync(uint64_t upto);
+        //offset of the record with this seq, or of the first one after it, -1 if there is none in this segment
+        int64_t findOffset(uint64_t seq) const;
+        //seq of the first record stored at or after timestamp_ns, 0 if there is none in this segment
+        uint64_t findSeqByTime(int64_t timestamp_ns) const;
+        const NatsStreamRecordHeader* recordAt(uint64_t offset) const;
+        //moves the file, the mapping and fd stay valid
+        bool rename(const std::string& path);
+        uint64_t getFirstSeq() const;
+        uint64_t getLastSeq() const;
+        uint64_t getWriteOffset() const;
+        uint64_t getCapacity() const;
+        uint64_t getMessageCount() const;
+        uint64_t getPayloadBytes() const;
+        int getFd() const;
+        const std::string& getPath() const;
+    };
+
+    //A named, persistent log of every message published to subjects matching its filter
+    //segments are named by their first sequence number, so reopening the directory recovers the stream
+    //appends only touch the active segment under m_mutex, full segments are handed over without a lock to the sealed
+    //list, which belongs to readers and the retention thread, so deleting and compacting never hold up a publish
+    class NatsStream{
+        //a full segment on its way from the appending thread to the sealed list
+        struct SealedSegment{
+            std::shared_ptr<NatsStreamSegment> m_segment;
+            SealedSegment* m_next;
+        };
+        NatsStreamConfig m_config;
+        std::vector<std::string> m_subject_list;
+        std::mutex m_mutex; //guards the active segment and appending
+        std::shared_ptr<NatsStreamSegment> m_active;
+        std::vector<std::shared_ptr<NatsStreamSegment>> m_unsynced; //sealed but maybe not synced yet, under m_mutex
+        //pushed by append, taken (all at once) by whoever holds m_segments_mutex, newest first
+        std::atomic<SealedSegment*> m_sealed_handoff;
+        std::mutex m_segments_mutex; //guards m_sealed, never taken by append
+        std::vector<std::shared_ptr<NatsStreamSegment>> m_sealed; //oldest first, readers keep a segment alive while they use it
+        std::atomic<uint64_t> m_first_seq;
+        std::atomic<uint64_t> m_last_seq; //published after the record is written, readers never look past it
+        std::atomic<uint64_t> m_messages;
+        std::atomic<uint64_t> m_bytes;
+        //durability, m_synced_seq only goes up, one thread syncs while the others wait for it
+        std::mutex m_sync_mutex;
+        std::condition_variable m_sync_cv;
+        uint64_t m_synced_seq;
+        bool m_syncing;
+        std::thread m_flusher_thread;
+        std::atomic<bool> m_running;
+        //consumers that caught up wait here for the next append, appends only notify while someone waits
+        std::mutex m_append_mutex;
+        std::condition_variable m_append_cv;
+        std::atomic<int> m_append_waiters;
+        //retention and compaction, on a thread of their own at the lowest priority
+        std::mutex m_retention_mutex;
+        std::condition_variable m_retention_cv;
+        std::thread m_retention_thread;
+        uint64_t m_compacted_upto; //last seq of the newest sealed segment the previous compaction looked at
+        std::atomic<uint64_t> m_deleted_segments;
+        std::atomic<uint64_t> m_compacted_messages;
+        std::string directory() const;
+        std::string segmentPath(uint64_t first_seq) const;
+        bool syncSegments();
+        void waitDurable(uint64_t seq);
+        void flusherLoop();
+        void retentionLoop();
+        //moves the handed over segments to m_sealed, m_segments_mutex has to be held
+        void takeSealedSegments();
+        bool compactSegment(const std::shared_ptr<NatsStreamSegment>& segment, const std::vector<uint64_t>& dropped);
+        public:
+        explicit NatsStream(NatsStreamConfig config);
+        ~NatsStream();
+        //opens the directory and recovers existing segments, false (with the reason on stderr) if the stream can't be used
+        bool open();
+        const NatsStreamConfig& getConfig() const;
+        bool matches(const std::vector<std::string>& subject_list) const;
+        //returns the sequence number of the stored message, 0 if it couldn't be stored
+        uint64_t append(std::string_view subject, std::string_view payload);
+        //forces everything appended so far to disk
+        void sync();
+        //copies the message with this seq (or the next one that exists) into message, false if there is none
+        bool read(uint64_t seq, NatsStoredMessage& message);
+        //the segment and offset of the message with this seq (or the next one that exists), false if there is none
+        //records up to getLastSeq() never change, so they can be read from the segment's mapping without the stream's lock
+        bool locate(uint64_t seq, std::shared_ptr<NatsStreamSegment>& segment, uint64_t& offset);
+        //seq of the first message stored at or after timestamp_ns (system clock), getLastSeq() + 1 if there is none yet
+        uint64_t findSeqByTime(int64_t timestamp_ns);
+        //returns once a message after after_seq is stored, wakeWaiters() is called or timeout passes, true in the first case
+        bool waitForMessages(uint64_t after_seq, std::chrono::milliseconds timeout);
+        void wakeWaiters();
+        uint64_t getFirstSeq() const;
+        uint64_t getLastSeq() const;
+        uint64_t getMessageCount() const;
+        uint64_t getByteCount() const;
+        std::size_t getSegmentCount();
+        //deletes the segments past the retention limits and compacts the full ones, the retention thread calls it every
+        //m_retention_interval_ms, it may only be called by one thread at a time (so not at all while that thread runs)
+        void applyRetention();
+        uint64_t getDeletedSegmentCount() const;
+        uint64_t getCompactedMessageCount() const;
+    };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef NATS_STREAM_CONSUMER_H
+#define NATS_STREAM_CONSUMER_H
+
+#include "stream.hpp"
+#include "pending_set.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+
+namespace nats{
+
+    class NatsClient; // forward declaration, the client owns its consumers
+    class NatsServer;
+    struct NatsSubscriptionStats;
+
+    //Delivers a stream to one subscription of a client, the stored messages from a start position first and then
+    //every new one as it is appended, so there is no gap or duplicate between replay and live delivery
+    //it runs on its own thread and reads the segments' mappings directly, the stream's lock is only taken to find
+    //where a batch starts, so a consumer far behind never holds up publishers appending to the stream
+    //with an ack wait every MSG carries a "$ACK.<consumer id>.<seq>" reply subject, a message not acked within the
+    //ack wait is sent again, and at most max_pending messages are unacked at a time
+    class NatsStreamConsumer{
+        NatsClient* m_client;
+        NatsServer* m_server;
+        int m_fd;
+        int m_sub_id;
+        NatsSubscriptionStats* m_sub_stats; //the client's slot for the subscription, looked up once when the consumer is made
+        std::shared_ptr<NatsStream> m_stream;
+        std::vector<std::string> m_subject_list;
+        std::atomic<uint64_t> m_next_seq;
+        std::atomic<bool> m_running;
+        std::atomic<bool> m_finished;
+        std::thread m_thread;
+        //one batch of MSG frames, subjects and payloads point into the segments, which are kept alive until it is sent
+        std::vector<struct iovec> m_iov;
+        std::vector<std::array<char, 96>> m_frame_args;
+        std::vector<std::shared_ptr<NatsStreamSegment>> m_batch_segments;
+        int m_iov_count;
+        int m_frame_count;
+        uint64_t m_batch_messages; //sent since the stats were last updated
+        uint64_t m_batch_bytes;
+        std::vector<std::string> m_subject_tokens; //of the record being matched, reused
+        //acks, m_pending is changed by this thread (deliveries) and by publishers of acks, so it has its own lock
+        int64_t m_ack_wait_ns; //0 without acks
+        uint64_t m_consumer_id;
+        std::mutex m_pending_mutex;
+        NatsPendingSet m_pending;
+        bool m_window_full; //under m_pending_mutex, set when a delivery had to wait for acks
+        uint64_t m_blocked_seq; //under m_pending_mutex, the seq that didn't fit, acks that don't make room for it don't wake the thread
+        std::vector<uint64_t> m_due; //seqs to redeliver, reused
+        bool m_timer_scheduled; //only used by this thread
+        std::atomic<bool> m_redelivery_due;
+        std::atomic<uint64_t> m_acked;
+        std::atomic<uint64_t> m_redelivered;
+        //wakes the thread while it waits for acks, a redelivery or stop
+        std::mutex m_wake_mutex;
+        std::condition_variable m_wake_cv;
+        void run();
+        bool addFrame(const std::shared_ptr<NatsStreamSegment>& segment, uint64_t offset);
+        bool flushFrames();
+        void countDelivered(uint64_t redelivered);
+        bool sendFileFrame(const NatsStreamSegment& segment, uint64_t offset);
+        int addFrameArgs(int index, uint64_t seq, uint32_t payload_size);
+        bool redeliver();
+        void wake();
+        public:
+        static constexpr int BATCH_MESSAGES = 128; //5 iovecs each, well below IOV_MAX
+        static constexpr uint64_t BATCH_BYTES = 256 * 1024;
+        static constexpr int BATCH_SCAN = BATCH_MESSAGES * 16; //records looked at per batch when few match the subject
+        static constexpr uint32_t SENDFILE_MIN_PAYLOAD = 16 * 1024; //bigger payloads go to the socket with sendfile
+        static constexpr std::size_t DEFAULT_MAX_PENDING = 64 * 1024;
+        static constexpr const char* ACK_PREFIX = "$ACK";
+        NatsStreamConsumer(NatsClient* client, NatsServer* server, int fd, int sub_id, std::shared_ptr<NatsStream> stream,
+            std::vector<std::string> subject_list, uint64_t start_seq, int ack_wait_ms = 0, std::size_t max_pending = DEFAULT_MAX_PENDING);
+        ~NatsStreamConsumer();
+        NatsStreamConsumer(const NatsStreamConsumer&) = delete;
+        NatsStreamConsumer& operator=(const NatsStreamConsumer&) = delete;
+        void start();
+        //asks the thread to stop, a frame being written is finished first
+        void stop();
+        void join();
+        //writes the stored messages from the next seq on, at most one batch, returns how many records were passed
+        //(delivered or skipped because the subject didn't match) and -1 once the connection is gone
+        int deliverBatch();
+        //called by whoever published to the ack subject, false if seq wasn't waiting for an ack
+        bool ack(uint64_t seq);
+        //called by the server's timer once the earliest ack deadline passed, the redelivery happens on the consumer's thread
+        void requestRedelivery();
+        uint64_t getNextSeq() const;
+        uint64_t getConsumerId() const;
+        std::size_t getPendingCount();
+        uint64_t getAckedCount() const;
+        uint64_t getRedeliveredCount() const;
+        bool isFinished() const;
+    };
+}
+
+#endif
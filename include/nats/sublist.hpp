@@ -3,22 +3,150 @@
 
 #include "sublist_node.hpp"
 #include "subscription.hpp"
+#include "interest_filter.hpp"
+#include "interest_watch.hpp"
+#include "latency.hpp"
+#include <atomic>
 #include <mutex>
+#include <string>
 #include <vector>
 #include <memory>
+#include <utility>
+#include <unordered_map>
 
 namespace nats{
+    //how overlapping subscriptions of one client show up in a match
+    enum class NatsMatchMode {
+        ALL_SUBSCRIPTIONS, //every matching subscription, a client gets one MSG per subscription
+        ONE_PER_CLIENT     //only the lowest sub id of each client, for consumers that forward a message once per connection
+    };
+
     //A trie-like data structure to store subscription details
     class NatsSublist{
         std::unique_ptr<NatsSublistNode> m_head;
         std::mutex m_sublist_mutex; //to make sure the sublist is not changed by multiple threads at the same time
+        NatsInterestFilter m_interest_filter; //summary of interest that can be read without taking m_sublist_mutex
+        //subjects gaining their first or losing their last local subscription, only queued once a route wants them
+        std::atomic<bool> m_track_route_interest;
+        std::vector<NatsRouteInterestChange> m_route_interest_changes;
+        std::atomic<bool> m_has_route_interest_changes;
+        //every subscription added or removed, only queued while the sharded sublist above has interest watches
+        std::atomic<bool> m_track_subscription_changes;
+        std::vector<NatsSubscriptionChange> m_subscription_changes;
+        std::atomic<bool> m_has_subscription_changes;
+        std::atomic<long long> m_subscription_count; //kept next to the trie so monitoring can read it without the lock
+        //back-references from each client's subscriptions to the nodes holding them, so a client can be removed without its subjects
+        //a multimap because the same subscription can be added for more than one subject
+        std::unordered_map<long long, std::unordered_multimap<int, NatsSublistNode*>> m_client_subscriptions;
+        NatsSublistNode* getOrCreateChild(NatsSublistNode* cur_node, const std::string& subject_part);
+        void insertSubscriptionIntoNode(NatsSublistNode* cur_node, const NatsSubscription& subscription, std::vector<std::string>& subject_list);
+        void eraseSubscriptionFromNode(NatsSublistNode* cur_node, const NatsSubscription& subscription);
+        void getSubjectListForNode(NatsSublistNode* cur_node, std::vector<std::string>& subject_list);
+        void pruneNode(NatsSublistNode* cur_node);
         void addSubscriptionsToVectorFromSublistNode(NatsSublistNode* cur_node, std::vector<NatsSubscription>& subscriptions);
+        void collectSubscriptionsForTopic(std::vector<std::string>& subject_list, std::vector<NatsSubscription>& subscriptions);
+        //subjects up to this many tokens are matched with a fixed size stack, deeper ones take the level by level walk
+        static constexpr std::size_t MATCH_STACK_DEPTH = 32;
+        //calls visit_node for every node whose subscriptions match the subject, must be called with m_sublist_mutex held
+        template<typename NodeVisitor> void forEachMatchingNode(std::vector<std::string>& subject_list, NodeVisitor&& visit_node);
+        void collectMatchingNodes(std::vector<std::string>& subject_list, std::vector<NatsSublistNode*>& nodes);
+        void queueRouteInterestChange(const std::vector<std::string>& subject_list, bool has_interest);
+        void queueSubscriptionChange(const std::vector<std::string>& subject_list, bool added);
+        void collectLocalInterest(NatsSublistNode* cur_node, std::string& prefix, std::vector<std::string>& subjects);
         public:
-        NatsSublist();
+        explicit NatsSublist(std::size_t filter_counters = 1<<16);
+        //routes subscribe on behalf of their peer with negative client ids, everything else is a client of this server
+        static bool isLocalClient(long long client_id){
+            return client_id >= 0;
+        }
+        //checks if a (possibly wildcard) subscription subject matches a literal subject
+        static bool subjectMatches(const std::vector<std::string>& pattern, const std::vector<std::string>& literal);
+        //keeps only the lowest sub id of each client, in place so it doesn't allocate
+        static void keepOnePerClient(std::vector<NatsSubscription>& subscriptions);
         void addSubscription(NatsSubscription subscription, std::vector<std::string>& subject_list);
         void removeSubscription(NatsSubscription& subscription, std::vector<std::string>& subject_list);
+        //adds many subscriptions of a client under a single lock, a prefix shared with the previous subject is only walked once
+        //stats[i] are the counters of subscriptions[i], stats is empty when the client doesn't count them
+        void addSubscriptions(long long client_id, std::vector<std::pair<int, std::vector<std::string>>>& subscriptions,
+            const std::vector<NatsSubscriptionStats*>& stats = {});
+        //removes many subscriptions of a client in a single locked pass using the back-references
+        void removeSubscriptions(long long client_id, const std::vector<int>& sub_ids);
+        void removeClient(long long client_id);
         std::vector<NatsSubscription> getSubscriptionsForTopic(std::vector<std::string>& subject_list);
+        //same as above but into a caller owned buffer (cleared first), a reused buffer keeps matching free of allocations
+        void getSubscriptionsForTopic(std::vector<std::string>& subject_list, std::vector<NatsSubscription>& subscriptions, NatsMatchMode mode = NatsMatchMode::ALL_SUBSCRIPTIONS);
+        //calls visit(const NatsSubscription&) for every match without collecting them anywhere
+        //visit runs with the sublist locked, so it has to be short and must not call back into the sublist
+        template<typename Visitor> void forEachSubscriptionForTopic(std::vector<std::string>& subject_list, Visitor&& visit);
+        //lock free check, false means getSubscriptionsForTopic would definitely return nothing
+        bool hasPossibleInterest(std::vector<std::string>& subject_list);
+        //from now on, queues a change every time a subject gets its first or loses its last local subscription
+        void setRouteInterestTracking(bool enabled);
+        void takeRouteInterestChanges(std::vector<NatsRouteInterestChange>& changes);
+        bool hasRouteInterestChanges();
+        //from now on, queues every subscription that is added or removed, disabling drops what is queued
+        void setSubscriptionChangeTracking(bool enabled);
+        void takeSubscriptionChanges(std::vector<NatsSubscriptionChange>& changes);
+        bool hasSubscriptionChanges();
+        //counts the subscriptions matching the subject and takes the queued changes under one lock,
+        //so every change is either part of the count or still queued
+        long long countMatchesAndTakeChanges(std::vector<std::string>& subject_list, std::vector<NatsSubscriptionChange>& changes);
+        //every subject with at least one local subscription, what a new route starts out with
+        void collectLocalInterest(std::vector<std::string>& subjects);
+        long long getSubscriptionCount();
     };
+
+    template<typename NodeVisitor>
+    void NatsSublist::forEachMatchingNode(std::vector<std::string>& subject_list, NodeVisitor&& visit_node){
+        if(subject_list.size() > MATCH_STACK_DEPTH){
+            thread_local std::vector<NatsSublistNode*> nodes;
+            collectMatchingNodes(subject_list, nodes);
+            for(NatsSublistNode* node: nodes){
+                visit_node(node);
+            }
+            return;
+        }
+        //depth first, every popped node pushes at most its literal and "*" children, so one waiting sibling per level fits
+        struct Frame {
+            NatsSublistNode* m_node;
+            std::size_t m_depth;
+        };
+        Frame stack[2 * MATCH_STACK_DEPTH + 1];
+        int top = 0;
+        stack[top++] = {m_head.get(), 0};
+        while(top > 0){
+            Frame frame = stack[--top];
+            if(frame.m_depth == subject_list.size()){
+                visit_node(frame.m_node);
+                continue;
+            }
+            auto& next = frame.m_node->m_next;
+            auto it = next.find(">");
+            if(it != next.end()){
+                //">" covers everything after the previous subject part
+                visit_node(it->second.get());
+            }
+            it = next.find("*");
+            if(it != next.end()){
+                stack[top++] = {it->second.get(), frame.m_depth + 1};
+            }
+            it = next.find(subject_list[frame.m_depth]);
+            if(it != next.end()){
+                stack[top++] = {it->second.get(), frame.m_depth + 1};
+            }
+        }
+    }
+
+    template<typename Visitor>
+    void NatsSublist::forEachSubscriptionForTopic(std::vector<std::string>& subject_list, Visitor&& visit){
+        NatsLatencyTimer match_timer(NatsLatencyStats::shared().m_match);
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        forEachMatchingNode(subject_list, [&visit](NatsSublistNode* node) {
+            for(const NatsSubscription& subscription: node->m_subscriptions){
+                visit(subscription);
+            }
+        });
+    }
 }
 
 #endif
\ No newline at end of file
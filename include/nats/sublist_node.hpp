@@ -2,6 +2,9 @@
 #define NATS_SUBLIST_NODE_H
 
 #include "subscription.hpp"
+#include "interest_filter.hpp"
+#include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 #include <unordered_set>
@@ -10,9 +13,17 @@
 namespace nats{
     class NatsSublistNode{
     public:
-        std::unordered_map<std::string,std::unique_ptr<NatsSublistNode>> m_next;
+        std::string m_token; //the subject part this node stands for, empty for the head
+        NatsSublistNode* m_parent; //lets a node be reached from a subscription without walking down from the head
+        //keys are views into the m_token of the child they point to, so each token is stored once
+        std::unordered_map<std::string_view,std::unique_ptr<NatsSublistNode>> m_next;
         std::unordered_set<NatsSubscription, NatsSubscriptionHash> m_subscriptions;
+        NatsInterestKey m_interest_key; //filter key of the full subject of this node, set once it holds a subscription
+        int m_local_subscriptions; //subscriptions of this server's own clients, the rest belong to routes
+
+        NatsSublistNode(std::string token = "", NatsSublistNode* parent = nullptr):
+            m_token(std::move(token)), m_parent(parent), m_interest_key{false, 0}, m_local_subscriptions(0) {}
     };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -5,9 +5,14 @@
 #include <functional>
 
 namespace nats{
+    struct NatsSubscriptionStats;
+
     struct NatsSubscription {
         int m_sub_id;
         long long m_client_id;
+        //the counters of a client's subscription, resolved once at SUB time so a delivery doesn't look them up
+        //nullptr for routes, the server's own subscriptions and clients that don't count them, not part of the identity
+        NatsSubscriptionStats* m_stats = nullptr;
 
         bool operator==(const NatsSubscription& other) const {
             return m_sub_id == other.m_sub_id && m_client_id == other.m_client_id;
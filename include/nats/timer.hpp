@@ -0,0 +1,43 @@
+#ifndef NATS_TIMER_H
+#define NATS_TIMER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace nats{
+
+    //called on the timer's thread with the id an entry was scheduled with
+    using NatsTimerCallback = std::function<void(uint64_t id)>;
+
+    //One thread firing deadlines for many owners, entries are (deadline, id) in a min-heap and the callback
+    //decides what an id means, so an owner that went away in the meantime is simply not found
+    //the thread is only started by the first schedule, a server that never needs a timer doesn't have one
+    class NatsTimer{
+        NatsTimerCallback m_callback;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::priority_queue<std::pair<int64_t, uint64_t>, std::vector<std::pair<int64_t, uint64_t>>, std::greater<std::pair<int64_t, uint64_t>>> m_queue;
+        std::thread m_thread;
+        bool m_running;
+        bool m_stopped; //nothing is scheduled anymore once stop was called
+        void run();
+        public:
+        explicit NatsTimer(NatsTimerCallback callback);
+        ~NatsTimer();
+        NatsTimer(const NatsTimer&) = delete;
+        NatsTimer& operator=(const NatsTimer&) = delete;
+        //deadline is in nowNanos() time, the callback runs once it has passed (right away if it already has)
+        void schedule(int64_t deadline, uint64_t id);
+        void stop();
+        std::size_t size();
+        static int64_t nowNanos(); //steady clock
+    };
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "../include/nats/alloc_counter.hpp"
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace nats{
+    namespace{
+        //thread local so counting costs one increment and other threads (clients, monitor) don't show up in a measurement
+        thread_local unsigned long long t_allocations = 0;
+    }
+
+    bool NatsAllocCounter::enabled(){
+#ifdef NATS_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    unsigned long long NatsAllocCounter::threadAllocations(){
+        return t_allocations;
+    }
+
+#ifdef NATS_COUNT_ALLOCATIONS
+    static void* countedAlloc(size_t size){
+        t_allocations++;
+        if(void* ptr = malloc(size == 0 ? 1 : size)) return ptr;
+        throw bad_alloc();
+    }
+
+    static void* countedAlignedAlloc(size_t size, align_val_t alignment){
+        t_allocations++;
+        //aligned_alloc wants a size that is a multiple of the alignment
+        size_t align = static_cast<size_t>(alignment);
+        size_t rounded = (size == 0 ? align : (size + align - 1) / align * align);
+        if(void* ptr = aligned_alloc(align, rounded)) return ptr;
+        throw bad_alloc();
+    }
+#endif
+}
+
+#ifdef NATS_COUNT_ALLOCATIONS
+//replacement allocation functions, libstdc++'s nothrow forms call these but its aligned ones don't, so over-aligned
+//types (alignas(64) counters) get their own replacements below
+void* operator new(std::size_t size){
+    return nats::countedAlloc(size);
+}
+
+void* operator new[](std::size_t size){
+    return nats::countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept{
+    std::free(ptr);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment){
+    return nats::countedAlignedAlloc(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment){
+    return nats::countedAlignedAlloc(size, alignment);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept{
+    std::free(ptr);
+}
+#endif
@@ -0,0 +1,56 @@
+#include "../include/nats/buffer_pool.hpp"
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace nats{
+
+    NatsBufferPool& NatsBufferPool::shared(){
+        static NatsBufferPool pool;
+        return pool;
+    }
+
+    NatsBufferPool::~NatsBufferPool(){
+        for(SizeClass& size_class: m_classes){
+            for(char* buffer: size_class.m_free){
+                delete[] buffer;
+            }
+        }
+    }
+
+    int NatsBufferPool::sizeClassIndex(int size){
+        for(int i=0;i<SIZE_CLASS_COUNT;i++){
+            if(size <= SIZE_CLASSES[i]) return i;
+        }
+        return SIZE_CLASS_COUNT-1;
+    }
+
+    char* NatsBufferPool::acquire(int min_size, int& capacity){
+        int idx = sizeClassIndex(min_size);
+        capacity = SIZE_CLASSES[idx];
+        SizeClass& size_class = m_classes[idx];
+        {
+            std::lock_guard<std::mutex> lock(size_class.m_mutex);
+            if(!size_class.m_free.empty()){
+                char* buffer = size_class.m_free.back();
+                size_class.m_free.pop_back();
+                return buffer;
+            }
+        }
+        return new char[capacity];
+    }
+
+    void NatsBufferPool::release(char* buffer, int capacity){
+        if(buffer == nullptr) return;
+        SizeClass& size_class = m_classes[sizeClassIndex(capacity)];
+        {
+            std::lock_guard<std::mutex> lock(size_class.m_mutex);
+            if(size_class.m_free.size() < MAX_FREE_BUFFERS){
+                size_class.m_free.push_back(buffer);
+                return;
+            }
+        }
+        delete[] buffer;
+    }
+}
@@ -3,7 +3,11 @@
 #include "../include/nats/parser_state.hpp"
 #include "../include/nats/subscription.hpp"
 #include "../include/nats/custom_specific_exceptions.hpp"
-#include <random>
+#include "../include/nats/buffer_pool.hpp"
+#include "../include/nats/stream.hpp"
+#include "../include/nats/stream_consumer.hpp"
+#include "../include/nats/replay_buffer.hpp"
+#include <algorithm>
 #include <utility>
 #include <climits>
 #include <sys/socket.h>
@@ -16,51 +20,249 @@
 #include <chrono>
 #include <thread>
 #include <atomic>
+#include <charconv>
+#include <cerrno>
+#include <sys/uio.h>
 
 using namespace std;
 
 namespace nats{
+    namespace {
+        //client ids only have to be unique within the process, a counter is far cheaper than seeding a generator from
+        //random_device (a read of /dev/urandom) on every connection
+        std::atomic<long long> next_client_id{1};
+    }
+
+    long long NatsClient::nextClientId(){
+        return next_client_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
     NatsClient::NatsClient(int client_fd, NatsServer* server): 
+        m_server(server),
+        m_client_fd(client_fd),
+        m_pending_oks(0),
+        m_arg_capacity(0),
+        m_msg_capacity(0),
+        m_payload_sub_capacity(0),
         m_waiting_for_initial_connect(true), 
         m_waiting_for_initial_pong(false),
-        m_arg_len(0),
-        m_msg_len(0),
+        m_shm_requested(false),
         m_as(-1),
         m_drop(0),
+        m_arg_len(0),
+        m_msg_len(0),
         m_state(NatsParserState::OP_START),
+        m_msg_buffer(nullptr),
+        m_arg_buffer(nullptr),
         m_payload_size(0),
-        m_client_fd(client_fd),
-        m_server(server)
+        m_payload_sub(m_payload_sub_inline)
     {
-        random_device rd;
-        mt19937 gen(rd());
-        uniform_int_distribution<long long> dis(1, LLONG_MAX);
-        
-        m_client_id = dis(gen);
+        m_client_id = nextClientId();
+        m_payload_sub_inline[0] = '\0';
     }
 
     NatsClient::~NatsClient() {
+        stopConsumers();
         stopTimeoutThread();
+        releaseParseBuffers();
         // we need to remove the subscriptions from the common sublist of this client
-        m_server->removeSubscriptions(getUnsubParams());
+        m_server->removeClientSubscriptions(m_client_id);
+        if(!m_interest_watches.empty()){
+            m_server->removeInterestWatches(std::vector<std::string>(m_interest_watches.begin(), m_interest_watches.end()), m_client_id);
+        }
     }
 
     void NatsClient::closeConnection(){
+        stopConsumers();
         stopTimeoutThread();
+        if(m_shm){
+            m_shm->close();
+        }
         close(m_client_fd);
     }
 
+    void NatsClient::sendBytes(const char* data, size_t size){
+        struct iovec iov {const_cast<char*>(data), size};
+        std::lock_guard<std::mutex> lock(m_write_mutex);
+        writeLocked(&iov, 1);
+    }
+
     void NatsClient::sendMessage(string msg){
-        send(m_client_fd, msg.c_str(), msg.size(), 0);
+        ssize_t bytes_sent;
+        {
+            struct iovec iov {msg.data(), msg.size()};
+            std::lock_guard<std::mutex> lock(m_write_mutex);
+            bytes_sent = writeLocked(&iov, 1);
+        }
+        //a client that doesn't take everything we write is a slow consumer
+        if(bytes_sent < static_cast<ssize_t>(msg.size())){
+            m_stats.m_slow_consumers.fetch_add(1, std::memory_order_relaxed);
+            m_server->m_stats.m_slow_consumers.add(1);
+        }
+    }
+
+    void NatsClient::deliverMessage(std::string_view subject, const NatsSubscription& subscription, std::string_view payload){
+        //"MSG <subject> <sid> <size>\r\n<payload>\r\n" written straight from where the pieces already are
+        char sid_and_size[32];
+        char* pos = sid_and_size;
+        char* end = sid_and_size + sizeof(sid_and_size);
+        *pos++ = ' ';
+        pos = std::to_chars(pos, end, subscription.m_sub_id).ptr;
+        *pos++ = ' ';
+        pos = std::to_chars(pos, end, payload.size()).ptr;
+        *pos++ = '\r';
+        *pos++ = '\n';
+
+        struct iovec iov[5] = {
+            {const_cast<char*>("MSG "), 4},
+            {const_cast<char*>(subject.data()), subject.size()},
+            {sid_and_size, static_cast<size_t>(pos - sid_and_size)},
+            {const_cast<char*>(payload.data()), payload.size()},
+            {const_cast<char*>("\r\n"), 2},
+        };
+        size_t total = 4 + subject.size() + (pos - sid_and_size) + payload.size() + 2;
+        ssize_t bytes_sent;
+        {
+            std::lock_guard<std::mutex> write_lock(m_write_mutex);
+            bytes_sent = writeLocked(iov, 5);
+        }
+        bool dropped = bytes_sent < static_cast<ssize_t>(total);
+        if(dropped){
+            m_stats.m_slow_consumers.fetch_add(1, std::memory_order_relaxed);
+            m_server->m_stats.m_slow_consumers.add(1);
+        }
+        if(subscription.m_stats != nullptr){
+            (dropped ? subscription.m_stats->m_dropped : subscription.m_stats->m_delivered).fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void NatsClient::sendAllLocked(const char* data, size_t size){
+        if(m_shm){
+            struct iovec iov {const_cast<char*>(data), size};
+            m_shm->toClient().write(&iov, 1);
+            return;
+        }
+        while(size > 0){
+            ssize_t sent = send(m_client_fd, data, size, MSG_NOSIGNAL);
+            if(sent < 0 && errno == EINTR){
+                continue;
+            }
+            if(sent <= 0){
+                return;
+            }
+            data += sent;
+            size -= sent;
+        }
+    }
+
+    bool NatsClient::sendAllLocked(struct iovec* iov, int count){
+        if(m_shm){
+            return m_shm->toClient().write(iov, count);
+        }
+        while(count > 0){
+            struct msghdr message{};
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+            ssize_t sent = sendmsg(m_client_fd, &message, MSG_NOSIGNAL);
+            if(sent < 0){
+                if(errno == EINTR) continue;
+                return false;
+            }
+            while(count > 0 && static_cast<size_t>(sent) >= iov->iov_len){
+                sent -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if(count > 0){
+                iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+                iov->iov_len -= sent;
+            }
+        }
+        return true;
+    }
+
+    ssize_t NatsClient::writeLocked(const struct iovec* iov, int count){
+        if(m_shm){
+            //a ring write only comes back short when the client is gone
+            ssize_t total = 0;
+            for(int i=0;i<count;i++){
+                total += iov[i].iov_len;
+            }
+            return m_shm->toClient().write(iov, count) ? total : -1;
+        }
+        return writev(m_client_fd, iov, count);
+    }
+
+    ssize_t NatsClient::readInput(char* buffer, size_t size){
+        if(m_shm){
+            return m_shm->toServer().read(buffer, size, m_client_fd);
+        }
+        return recv(m_client_fd, buffer, size, 0);
+    }
+
+    bool NatsClient::usesSharedMemory() const{
+        return m_shm != nullptr;
+    }
+
+    bool NatsClient::startSharedMemory(){
+        if(m_shm || m_server->m_shm_ring_size == 0){
+            return false;
+        }
+        std::unique_ptr<NatsShmTransport> transport = NatsShmTransport::create(m_server->m_shm_ring_size);
+        if(!transport){
+            return false;
+        }
+        //the reply carries the memfd, so it can only go over a unix socket, a tcp client just gets the usual +OK
+        std::string reply = "+SHM " + std::to_string(m_server->m_shm_ring_size) + "\r\n";
+        std::lock_guard<std::mutex> lock(m_write_mutex);
+        if(!NatsShmTransport::sendWithFd(m_client_fd, reply, transport->getFd())){
+            return false;
+        }
+        m_shm = std::move(transport);
+        return true;
     }
 
     void NatsClient::sendErrorMessage(string msg){
-        send(m_client_fd, msg.c_str(), msg.size(), 0);
+        //the error belongs after the +OKs of the operations that came before it
+        flushPendingSubscriptions();
+        sendBytes(msg.c_str(), msg.size());
+    }
+
+    void NatsClient::flushPendingSubscriptions(){
+        if(!m_pending_subs.empty()){
+            m_server->addSubscriptions(m_client_id, m_pending_subs);
+            m_pending_subs.clear();
+        }
+        if(!m_pending_unsubs.empty()){
+            m_server->removeSubscriptions(m_client_id, m_pending_unsubs);
+            m_pending_unsubs.clear();
+        }
+        if(!m_released_subscription_stats.empty()){
+            //a publish that matched before the UNSUB reached the sublist may still count into the slot it finds reused
+            std::lock_guard<std::mutex> lock(m_subscription_stats_mutex);
+            m_free_subscription_stats.insert(m_free_subscription_stats.end(), m_released_subscription_stats.begin(),
+                m_released_subscription_stats.end());
+            m_released_subscription_stats.clear();
+        }
+        if(m_pending_oks > 0){
+            std::string oks;
+            oks.reserve(m_pending_oks * 5);
+            for(int i=0;i<m_pending_oks;i++){
+                oks += "+OK\r\n";
+            }
+            sendBytes(oks.c_str(), oks.size());
+            m_pending_oks = 0;
+        }
     }
 
     void NatsClient::closeConnection(string msg){
+        flushPendingSubscriptions();
         stopTimeoutThread();
-        send(m_client_fd, msg.c_str(), msg.size(), 0);
+        sendBytes(msg.c_str(), msg.size());
+        stopConsumers();
+        if(m_shm){
+            m_shm->close();
+        }
         close(m_client_fd);
     }
 
@@ -72,9 +274,74 @@ namespace nats{
         m_msg_len = 0;
         m_drop = 0;
         m_payload_size = 0;
-        memset(m_arg_buffer, 0, INTERNAL_BUFFER_SIZE);
-        memset(m_msg_buffer, 0, INTERNAL_BUFFER_SIZE);
-        memset(m_payload_sub, 0, INTERNAL_BUFFER_SIZE);
+        //the buffers are only needed again if a later operation is split, until then they are better off in the pool
+        releaseParseBuffers();
+    }
+
+    void NatsClient::releaseParseBuffers(){
+        NatsBufferPool& pool = NatsBufferPool::shared();
+        if(m_arg_buffer!=nullptr){
+            pool.release(m_arg_buffer, m_arg_capacity);
+            m_arg_buffer = nullptr;
+            m_arg_capacity = 0;
+        }
+        if(m_msg_buffer!=nullptr){
+            pool.release(m_msg_buffer, m_msg_capacity);
+            m_msg_buffer = nullptr;
+            m_msg_capacity = 0;
+        }
+        if(m_payload_sub!=m_payload_sub_inline){
+            pool.release(m_payload_sub, m_payload_sub_capacity);
+            m_payload_sub = m_payload_sub_inline;
+            m_payload_sub_capacity = 0;
+        }
+        m_payload_sub_inline[0] = '\0';
+    }
+
+    void NatsClient::growParseBuffer(char*& buffer, int& capacity, int used, int needed){
+        if(needed <= capacity) return;
+        NatsBufferPool& pool = NatsBufferPool::shared();
+        int new_capacity = 0;
+        char* new_buffer = pool.acquire(needed, new_capacity);
+        if(buffer!=nullptr){
+            memcpy(new_buffer, buffer, used);
+            pool.release(buffer, capacity);
+        }
+        buffer = new_buffer;
+        capacity = new_capacity;
+    }
+
+    void NatsClient::saveSplitArg(const char* data, int len){
+        if(len > INTERNAL_BUFFER_SIZE){
+            throw MaximumArgumentSizeReachedException();
+        }
+        m_arg_len = len;
+        if(len == 0) return;
+        growParseBuffer(m_arg_buffer, m_arg_capacity, 0, len);
+        memcpy(m_arg_buffer, data, len);
+    }
+
+    void NatsClient::saveSplitMsg(const char* data, int len){
+        if(len > INTERNAL_BUFFER_SIZE-1){
+            throw MaximumMessageSizeReachedException();
+        }
+        m_msg_len = len;
+        if(len == 0) return;
+        //the whole payload is going to end up here, so borrow a buffer for all of it right away
+        growParseBuffer(m_msg_buffer, m_msg_capacity, 0, std::max(len, m_payload_size));
+        memcpy(m_msg_buffer, data, len);
+    }
+
+    void NatsClient::appendArgByte(char b){
+        growParseBuffer(m_arg_buffer, m_arg_capacity, m_arg_len, m_arg_len+1);
+        m_arg_buffer[m_arg_len] = b;
+        m_arg_len++;
+    }
+
+    void NatsClient::appendMsgByte(char b){
+        growParseBuffer(m_msg_buffer, m_msg_capacity, m_msg_len, m_msg_len+1);
+        m_msg_buffer[m_msg_len] = b;
+        m_msg_len++;
     }
 
     bool NatsClient::maxArgSizeReached(){
@@ -117,7 +384,10 @@ namespace nats{
                 if (elapsed.count() >= 1) {
                     // Send timeout message and close socket directly
                     string timeout_msg = "Pong timeout occured. Connection closed!\r\n";
-                    send(m_client_fd, timeout_msg.c_str(), timeout_msg.size(), 0);
+                    sendBytes(timeout_msg.c_str(), timeout_msg.size());
+                    if(m_shm){
+                        m_shm->close();
+                    }
                     close(m_client_fd);
                     
                     // Signal that we should stop the thread
@@ -139,19 +409,27 @@ namespace nats{
 
     void NatsClient::processConnect(){
         verifyState();
+        flushPendingSubscriptions();
+        //"+SHM <ring size>" takes the place of the +OK, everything after it already goes through the rings
+        bool shm_started = m_shm_requested && startSharedMemory();
         if(m_waiting_for_initial_connect){
             m_waiting_for_initial_connect = false;
-            send(m_client_fd, "+OK\r\nPING\r\n", 11, 0);
+            if(shm_started){
+                sendBytes("PING\r\n", 6);
+            } else {
+                sendBytes("+OK\r\nPING\r\n", 11);
+            }
             m_waiting_for_initial_pong = true;
             startPongTimeoutThread();
-        } else{  
-            send(m_client_fd, "+OK\r\n", 5, 0);
+        } else if(!shm_started){
+            sendBytes("+OK\r\n", 5);
         }
     }
 
     void NatsClient::processPing(){
         verifyState();
-        send(m_client_fd, "PONG\r\n", 6, 0);
+        flushPendingSubscriptions();
+        sendBytes("PONG\r\n", 6);
     }
 
     void NatsClient::processPong(){
@@ -182,16 +460,11 @@ namespace nats{
             throw ArgumentParseException();
         }
 
-        // Parse payload_size_str as integer
-        size_t idx = 0;
+        // Parse payload_size_str as integer, from_chars works on the view directly
         int payload_size = 0;
-        try {
-            payload_size = std::stoi(std::string(payload_size_str), &idx);
-        } catch (...) {
-            throw ArgumentParseException();
-        }
+        auto [parse_end, parse_error] = std::from_chars(payload_size_str.data(), payload_size_str.data() + payload_size_str.size(), payload_size);
         // Ensure the whole string was parsed
-        if (idx != payload_size_str.size() || payload_size < 0) {
+        if (parse_error != std::errc() || parse_end != payload_size_str.data() + payload_size_str.size() || payload_size < 0) {
             throw ArgumentParseException();
         }
         if(payload_size>INTERNAL_BUFFER_SIZE){
@@ -200,20 +473,32 @@ namespace nats{
 
         m_payload_size = payload_size;
 
-        std::memset(m_payload_sub, 0, INTERNAL_BUFFER_SIZE);
         size_t copy_len = std::min(subject.size(), static_cast<size_t>(INTERNAL_BUFFER_SIZE - 1));
+        if(m_payload_sub == m_payload_sub_inline){
+            if(copy_len >= PAYLOAD_SUB_INLINE_SIZE){
+                m_payload_sub = nullptr;
+                growParseBuffer(m_payload_sub, m_payload_sub_capacity, 0, copy_len + 1);
+            }
+        } else {
+            growParseBuffer(m_payload_sub, m_payload_sub_capacity, 0, copy_len + 1);
+        }
         std::memcpy(m_payload_sub, subject.data(), copy_len);
         m_payload_sub[copy_len] = '\0';
     }
 
     void NatsClient::processPub(string_view& payload){
         verifyState();
-        //parse subject and convert to subject list
-        std::string subject = m_payload_sub;
-        std::string_view subject_view(m_payload_sub);
-        std::vector<std::string> subject_list = convertSubjectToList(subject_view, true);
-        send(m_client_fd, "+OK\r\n", 5, 0);
-        m_server->publishMessage(subject,subject_list,std::string(payload));
+        //subscriptions parsed before this PUB have to be in the sublist before it is published
+        flushPendingSubscriptions();
+        //the subject and its tokens live in per thread buffers that keep their capacity, so a steady stream of PUBs doesn't allocate
+        thread_local std::string subject;
+        thread_local std::vector<std::string> subject_list;
+        subject.assign(m_payload_sub);
+        convertSubjectToList(subject, true, subject_list);
+        sendBytes("+OK\r\n", 5);
+        NatsClientStats::addSingleWriter(m_stats.m_in_msgs, 1);
+        NatsClientStats::addSingleWriter(m_stats.m_in_bytes, payload.size());
+        m_server->publishMessage(subject,subject_list,payload);
     }
 
     void NatsClient::processSub(string_view& sub_args){
@@ -232,8 +517,17 @@ namespace nats{
         sub_id_str.remove_prefix(std::min(sub_id_str.find_first_not_of(' '), sub_id_str.size()));
         sub_id_str.remove_suffix(sub_id_str.size() - sub_id_str.find_last_not_of(' ') - 1);
 
+        // Options can follow the sub_id, "SUB <subject> <sid> stream=<name> [start_seq=<n>|start_time=<unix ns>]"
+        // or "SUB <subject> <sid> replay=<name> [replay_ms=<ms>]"
+        std::string_view options;
+        size_t options_pos = sub_id_str.find(' ');
+        if (options_pos != std::string_view::npos) {
+            options = sub_id_str.substr(options_pos + 1);
+            sub_id_str = sub_id_str.substr(0, options_pos);
+        }
+
         // Check for empty subject or sub_id
-        if (subject.empty() || sub_id_str.empty() || sub_id_str.find(' ') != std::string_view::npos) {
+        if (subject.empty() || sub_id_str.empty()) {
             throw ArgumentParseException();
         }
 
@@ -252,13 +546,30 @@ namespace nats{
 
         //parse subject and convert to subject list
         std::vector<std::string> subject_list = convertSubjectToList(subject, false);
+        if (!options.empty()) {
+            if (options.find("replay=") != std::string_view::npos) {
+                startReplay(sub_id, subject_list, options);
+            } else {
+                startConsumer(sub_id, std::move(subject_list), options);
+            }
+            return;
+        }
 
         //First add to metadata, essentially this is just a check that there doesn't exist a subscription tied to the same sub_id
-        addSubscriptionMetadata(sub_id,std::string(subject));
-        //make server process the subscription and add to sublist
-        m_server->addSubscription(sub_id,subject_list,m_client_id);
-
-        send(m_client_fd, "+OK\r\n", 5, 0);
+        addSubscriptionMetadata(sub_id);
+        //a subscription to tracked subjects gets their last values first, so it isn't batched with the others
+        if(m_server->m_last_values.mayHold(subject_list)){
+            m_pending_oks++;
+            flushPendingSubscriptions();
+            m_server->subscribeWithLastValues(this, sub_id, subject_list);
+            return;
+        }
+        //queue the subscription, consecutive SUBs in the same read reach the sublist together in flushPendingSubscriptions
+        if(!m_pending_unsubs.empty()){
+            flushPendingSubscriptions();
+        }
+        m_pending_subs.emplace_back(sub_id, std::move(subject_list));
+        m_pending_oks++;
     }
 
     void NatsClient::processUnsub(std::string_view& unsub_args){
@@ -288,53 +599,253 @@ namespace nats{
         }
 
         // we need to remove the subscriptions from the common sublist of this client
-        vector<pair<vector<std::string>,NatsSubscription>> unsub_params = getUnsubParams(true,sub_id);
-        if(unsub_params.size()==0){
+        if(m_subscriptions.find(sub_id)==m_subscriptions.end()){
             throw NoSuchSubscriptionIdException();
         } else{
-            m_server->removeSubscriptions(unsub_params);
+            auto consumer = m_consumers.find(sub_id);
+            if(consumer != m_consumers.end()){
+                //the consumer's thread may be blocked writing to this very client, so it is joined once it is done
+                //(or when the connection closes), and it can still finish the batch it is writing
+                consumer->second->stop();
+                m_stopped_consumers.push_back(std::move(consumer->second));
+                m_consumers.erase(consumer);
+                m_stopped_consumers.erase(std::remove_if(m_stopped_consumers.begin(), m_stopped_consumers.end(),
+                    [](const std::unique_ptr<NatsStreamConsumer>& stopped){ return stopped->isFinished(); }), m_stopped_consumers.end());
+            } else{
+                //pending SUBs go first so that a SUB followed by an UNSUB of the same id ends up unsubscribed
+                if(!m_pending_subs.empty()){
+                    flushPendingSubscriptions();
+                }
+                m_pending_unsubs.push_back(sub_id);
+            }
             m_subscriptions.erase(sub_id);
-            send(m_client_fd, "+OK\r\n", 5, 0);
+            m_stats.m_subscriptions.fetch_sub(1, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(m_subscription_stats_mutex);
+                auto stats = m_subscription_stats.find(sub_id);
+                //the sublist still points at the slot until the UNSUB is flushed, only then can a SUB have it
+                m_released_subscription_stats.push_back(stats->second);
+                m_subscription_stats.erase(stats);
+            }
+            m_pending_oks++;
         }
         
     }
 
-    vector<pair<vector<std::string>,NatsSubscription>> NatsClient::getUnsubParams(bool filter_sub_id, int sub_id){
-        vector<pair<vector<std::string>,NatsSubscription>> unsub_params;
+    void NatsClient::processWatch(std::string_view& watch_args){
+        verifyState();
+        std::string_view subject = watch_args;
+
+        // Remove any leading/trailing spaces from subject
+        subject.remove_prefix(std::min(subject.find_first_not_of(' '), subject.size()));
+        subject.remove_suffix(subject.size() - subject.find_last_not_of(' ') - 1);
+
+        // Check for empty subject, only a single subject can be watched per WATCH
+        if (subject.empty() || subject.find(' ') != std::string_view::npos) {
+            throw ArgumentParseException();
+        }
+
+        //watched subjects are subjects that are published to, so the same rules apply (no wildcards)
+        std::vector<std::string> subject_list = convertSubjectToList(subject, true);
+        std::string subject_str(subject);
+
+        flushPendingSubscriptions();
+        sendBytes("+OK\r\n", 5);
+        //watching an already watched subject just sends the current state again
+        m_interest_watches.insert(subject_str);
+        m_server->addInterestWatch(subject_str, subject_list, m_client_id);
+    }
+
+    void NatsClient::processUnwatch(std::string_view& unwatch_args){
+        verifyState();
+        std::string_view subject = unwatch_args;
+
+        // Remove any leading/trailing spaces from subject
+        subject.remove_prefix(std::min(subject.find_first_not_of(' '), subject.size()));
+        subject.remove_suffix(subject.size() - subject.find_last_not_of(' ') - 1);
+
+        if (subject.empty() || subject.find(' ') != std::string_view::npos) {
+            throw ArgumentParseException();
+        }
+
+        std::string subject_str(subject);
+        if(m_interest_watches.find(subject_str)==m_interest_watches.end()){
+            throw NoSuchInterestWatchException();
+        }
+        m_interest_watches.erase(subject_str);
+        flushPendingSubscriptions();
+        m_server->removeInterestWatches({subject_str}, m_client_id);
+        sendBytes("+OK\r\n", 5);
+    }
+
+    void NatsClient::startConsumer(int sub_id, std::vector<std::string> subject_list, std::string_view options){
+        std::string_view stream_name;
+        uint64_t start_seq = 1;
+        int64_t start_time = 0;
+        bool has_start_seq = false;
+        bool has_start_time = false;
+        int ack_wait_ms = 0;
+        std::size_t max_pending = NatsStreamConsumer::DEFAULT_MAX_PENDING;
+        while(!options.empty()){
+            size_t end = options.find(' ');
+            std::string_view option = options.substr(0, end);
+            options = end == std::string_view::npos ? std::string_view() : options.substr(end + 1);
+            if(option.empty()){
+                continue;
+            }
+            size_t eq = option.find('=');
+            if(eq == std::string_view::npos){
+                throw ArgumentParseException();
+            }
+            std::string_view key = option.substr(0, eq);
+            std::string_view value = option.substr(eq + 1);
+            std::from_chars_result parsed{value.data() + value.size(), std::errc()};
+            if(key == "stream" && !value.empty()){
+                stream_name = value;
+            } else if(key == "start_seq"){
+                parsed = std::from_chars(value.data(), value.data() + value.size(), start_seq);
+                has_start_seq = true;
+            } else if(key == "start_time"){
+                parsed = std::from_chars(value.data(), value.data() + value.size(), start_time);
+                has_start_time = true;
+            } else if(key == "ack_wait"){
+                parsed = std::from_chars(value.data(), value.data() + value.size(), ack_wait_ms);
+            } else if(key == "max_pending"){
+                parsed = std::from_chars(value.data(), value.data() + value.size(), max_pending);
+            } else{
+                throw ArgumentParseException();
+            }
+            if(parsed.ec != std::errc() || parsed.ptr != value.data() + value.size()){
+                throw ArgumentParseException();
+            }
+        }
+        if(stream_name.empty() || (has_start_seq && has_start_time) || ack_wait_ms < 0 || max_pending == 0){
+            throw ArgumentParseException();
+        }
+        std::shared_ptr<NatsStream> stream = m_server->getStream(std::string(stream_name));
+        if(stream == nullptr){
+            throw NoSuchStreamException();
+        }
+        addSubscriptionMetadata(sub_id);
+        if(has_start_time){
+            start_seq = stream->findSeqByTime(start_time);
+        }
+        //the +OK has to be out before the consumer writes its first MSG
+        m_pending_oks++;
+        flushPendingSubscriptions();
+        auto consumer = std::make_unique<NatsStreamConsumer>(this, m_server, m_client_fd, sub_id, std::move(stream), std::move(subject_list), start_seq,
+            ack_wait_ms, max_pending);
+        consumer->start();
+        m_consumers.emplace(sub_id, std::move(consumer));
+    }
 
-        if(filter_sub_id){
-            if(m_subscriptions.find(sub_id)!=m_subscriptions.end()){
-                std::string_view cur_subscription_subject = m_subscriptions[sub_id];
-                unsub_params.emplace_back(convertSubjectToList(cur_subscription_subject,false) , NatsSubscription{sub_id,m_client_id} );
+    void NatsClient::startReplay(int sub_id, std::vector<std::string>& subject_list, std::string_view options){
+        std::string_view buffer_name;
+        int64_t replay_ms = -1;
+        while(!options.empty()){
+            size_t end = options.find(' ');
+            std::string_view option = options.substr(0, end);
+            options = end == std::string_view::npos ? std::string_view() : options.substr(end + 1);
+            if(option.empty()){
+                continue;
             }
-        } else {
-            for(const auto& pair: m_subscriptions){
-                std::string_view cur_subscription_subject = pair.second;
-                unsub_params.emplace_back(convertSubjectToList(cur_subscription_subject,false) , NatsSubscription{pair.first,m_client_id});
+            size_t eq = option.find('=');
+            if(eq == std::string_view::npos){
+                throw ArgumentParseException();
+            }
+            std::string_view key = option.substr(0, eq);
+            std::string_view value = option.substr(eq + 1);
+            std::from_chars_result parsed{value.data() + value.size(), std::errc()};
+            if(key == "replay" && !value.empty()){
+                buffer_name = value;
+            } else if(key == "replay_ms"){
+                parsed = std::from_chars(value.data(), value.data() + value.size(), replay_ms);
+            } else{
+                throw ArgumentParseException();
+            }
+            if(parsed.ec != std::errc() || parsed.ptr != value.data() + value.size()){
+                throw ArgumentParseException();
             }
         }
+        if(buffer_name.empty()){
+            throw ArgumentParseException();
+        }
+        std::shared_ptr<NatsReplayBuffer> buffer = m_server->getReplayBuffer(std::string(buffer_name));
+        if(buffer == nullptr){
+            throw NoSuchReplayBufferException();
+        }
+        addSubscriptionMetadata(sub_id);
+        //without replay_ms everything still in the buffer is replayed
+        int64_t since_ns = replay_ms < 0 ? INT64_MIN : NatsReplayBuffer::nowNanos() - replay_ms * 1000000;
+        //queued SUBs go in first and the +OK has to be out before the first replayed MSG
+        m_pending_oks++;
+        flushPendingSubscriptions();
+        m_server->subscribeWithReplay(this, sub_id, subject_list, *buffer, since_ns);
+    }
 
-        return unsub_params;
+    NatsStreamConsumer* NatsClient::getConsumer(int sub_id){
+        auto it = m_consumers.find(sub_id);
+        return it != m_consumers.end() ? it->second.get() : nullptr;
     }
 
-    void NatsClient::addSubscriptionMetadata(int sub_id, std::string subject){
+    void NatsClient::stopConsumers(){
+        if(m_consumers.empty() && m_stopped_consumers.empty()){
+            return;
+        }
+        for(auto& pair: m_consumers){
+            pair.second->stop();
+        }
+        //a consumer blocked writing to a client that stopped reading only returns once the socket is shut down
+        shutdown(m_client_fd, SHUT_RDWR);
+        if(m_shm){
+            m_shm->close();
+        }
+        m_consumers.clear();
+        m_stopped_consumers.clear();
+    }
+
+    void NatsClient::addSubscriptionMetadata(int sub_id){
         if(m_subscriptions.find(sub_id)!=m_subscriptions.end()){
             //this means there is already a subscription with the current sub_id provided
             throw ExistingSubscriptionIdException();
         } else{
-            m_subscriptions[sub_id]=subject;
+            m_subscriptions.insert(sub_id);
+            m_stats.m_subscriptions.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(m_subscription_stats_mutex);
+            NatsSubscriptionStats* stats;
+            if(m_free_subscription_stats.empty()){
+                stats = &m_subscription_stats_slots.emplace_back();
+            } else {
+                stats = m_free_subscription_stats.back();
+                m_free_subscription_stats.pop_back();
+                stats->m_delivered.store(0, std::memory_order_relaxed);
+                stats->m_dropped.store(0, std::memory_order_relaxed);
+                stats->m_redelivered.store(0, std::memory_order_relaxed);
+            }
+            m_subscription_stats.emplace(sub_id, stats);
         }
     }
 
+    NatsSubscriptionStats* NatsClient::getSubscriptionStats(int sub_id){
+        std::lock_guard<std::mutex> lock(m_subscription_stats_mutex);
+        auto it = m_subscription_stats.find(sub_id);
+        return it != m_subscription_stats.end() ? it->second : nullptr;
+    }
+
     std::vector<std::string> NatsClient::convertSubjectToList(std::string_view& subject, bool is_publish) {
-        std::vector<std::string> subject_list; // thread_local to avoid issues in multithreaded context
-        subject_list.clear();
-    
+        std::vector<std::string> subject_list;
+        convertSubjectToList(subject, is_publish, subject_list);
+        return subject_list;
+    }
+
+    void NatsClient::convertSubjectToList(std::string_view subject, bool is_publish, std::vector<std::string>& subject_list) {
+        //the tokens are assigned into the strings already in subject_list, so a reused list doesn't allocate once it is warm
+        size_t token_count = 0;
         size_t start = 0;
         while (start < subject.size()) {
             size_t end = subject.find('.', start);
             if (end == std::string_view::npos) end = subject.size();
-            std::string token = std::string(subject.substr(start, end - start));
+            std::string_view token = subject.substr(start, end - start);
     
             // Check for empty token
             if (token.empty()) {
@@ -354,11 +865,22 @@ namespace nats{
                 throw InvalidSubscribeSubjectException();
             }
 
-            subject_list.push_back(token);
+            if (token_count < subject_list.size()) {
+                subject_list[token_count].assign(token.data(), token.size());
+            } else {
+                subject_list.emplace_back(token);
+            }
+            token_count++;
             start = end + 1;
         }
-    
-        return subject_list;
+        //a subject ending in "." has an empty last token
+        if (!subject.empty() && subject.back() == '.') {
+            if (is_publish)
+                throw InvalidPublishSubjectException();
+            else
+                throw InvalidSubscribeSubjectException();
+        }
+        subject_list.resize(token_count);
     }
 }
 
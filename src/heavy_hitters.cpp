@@ -0,0 +1,130 @@
+#include "../include/nats/heavy_hitters.hpp"
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+using namespace std;
+
+namespace nats{
+
+    NatsHeavyHitters::NatsHeavyHitters(): m_cells(new Cell[DEPTH * WIDTH]){
+        reset();
+    }
+
+    std::size_t NatsHeavyHitters::counterIndex(int row, uint64_t hash){
+        //the rows need independent positions, derived from one hash by double hashing
+        uint64_t step = (hash >> 32) | 1;
+        return row * WIDTH + ((hash + row * step) & (WIDTH - 1));
+    }
+
+    uint64_t NatsHeavyHitters::estimate(uint64_t hash, bool by_msgs) const{
+        uint64_t min_count = std::numeric_limits<uint64_t>::max();
+        for(int row=0;row<DEPTH;row++){
+            const Cell& cell = m_cells[counterIndex(row, hash)];
+            min_count = std::min(min_count, (by_msgs ? cell.m_msgs : cell.m_bytes).load(std::memory_order_relaxed));
+        }
+        return min_count;
+    }
+
+    void NatsHeavyHitters::record(std::string_view subject, uint64_t bytes){
+        //std::hash can be the identity for short keys on some libraries, the multiply carries the low bits into the high ones
+        uint64_t hash = std::hash<std::string_view>{}(subject) * 0x9E3779B97F4A7C15ull;
+        uint64_t msgs_estimate = std::numeric_limits<uint64_t>::max();
+        uint64_t bytes_estimate = std::numeric_limits<uint64_t>::max();
+        for(int row=0;row<DEPTH;row++){
+            Cell& cell = m_cells[counterIndex(row, hash)];
+            uint64_t msgs = cell.m_msgs.load(std::memory_order_relaxed) + 1;
+            uint64_t cell_bytes = cell.m_bytes.load(std::memory_order_relaxed) + bytes;
+            cell.m_msgs.store(msgs, std::memory_order_relaxed);
+            cell.m_bytes.store(cell_bytes, std::memory_order_relaxed);
+            msgs_estimate = std::min(msgs_estimate, msgs);
+            bytes_estimate = std::min(bytes_estimate, cell_bytes);
+        }
+        offer(m_by_msgs, true, hash, subject, msgs_estimate);
+        offer(m_by_bytes, false, hash, subject, bytes_estimate);
+    }
+
+    void NatsHeavyHitters::offer(Candidates& candidates, bool by_msgs, uint64_t hash, std::string_view subject, uint64_t estimate){
+        //most messages stop here, their subject is either too cold or already tracked
+        int size = candidates.m_size.load(std::memory_order_acquire);
+        if(size == CAPACITY && estimate <= candidates.m_min_estimate.load(std::memory_order_relaxed)){
+            return;
+        }
+        for(int i=0;i<size;i++){
+            if(candidates.m_hashes[i].load(std::memory_order_relaxed) == hash){
+                return;
+            }
+        }
+        std::lock_guard<std::mutex> lock(candidates.m_mutex);
+        size = candidates.m_size.load(std::memory_order_relaxed);
+        for(int i=0;i<size;i++){
+            if(candidates.m_hashes[i].load(std::memory_order_relaxed) == hash){
+                return;
+            }
+        }
+        int slot = size;
+        if(size == CAPACITY){
+            //the table is full, the subject takes the place of the weakest candidate if it beats it
+            uint64_t min_estimate = std::numeric_limits<uint64_t>::max();
+            for(int i=0;i<CAPACITY;i++){
+                uint64_t candidate_estimate = this->estimate(candidates.m_hashes[i].load(std::memory_order_relaxed), by_msgs);
+                if(candidate_estimate < min_estimate){
+                    min_estimate = candidate_estimate;
+                    slot = i;
+                }
+            }
+            candidates.m_min_estimate.store(min_estimate, std::memory_order_relaxed);
+            if(estimate <= min_estimate){
+                return;
+            }
+        }
+        candidates.m_subjects[slot].assign(subject.data(), subject.size());
+        candidates.m_hashes[slot].store(hash, std::memory_order_relaxed);
+        if(slot == size){
+            candidates.m_size.store(size + 1, std::memory_order_release);
+        }
+    }
+
+    std::vector<NatsSubjectCount> NatsHeavyHitters::top(Candidates& candidates, bool by_msgs, int count){
+        std::vector<NatsSubjectCount> result;
+        {
+            std::lock_guard<std::mutex> lock(candidates.m_mutex);
+            int size = candidates.m_size.load(std::memory_order_relaxed);
+            for(int i=0;i<size;i++){
+                uint64_t hash = candidates.m_hashes[i].load(std::memory_order_relaxed);
+                result.push_back({candidates.m_subjects[i], estimate(hash, true), estimate(hash, false)});
+            }
+        }
+        std::sort(result.begin(), result.end(), [by_msgs](const NatsSubjectCount& a, const NatsSubjectCount& b) {
+            return by_msgs ? a.m_msgs > b.m_msgs : a.m_bytes > b.m_bytes;
+        });
+        if(count >= 0 && result.size() > static_cast<std::size_t>(count)){
+            result.resize(count);
+        }
+        return result;
+    }
+
+    std::vector<NatsSubjectCount> NatsHeavyHitters::topByMsgs(int count){
+        return top(m_by_msgs, true, count);
+    }
+
+    std::vector<NatsSubjectCount> NatsHeavyHitters::topByBytes(int count){
+        return top(m_by_bytes, false, count);
+    }
+
+    void NatsHeavyHitters::reset(){
+        std::lock_guard<std::mutex> msgs_lock(m_by_msgs.m_mutex);
+        std::lock_guard<std::mutex> bytes_lock(m_by_bytes.m_mutex);
+        for(std::size_t i=0;i<DEPTH * WIDTH;i++){
+            m_cells[i].m_msgs.store(0, std::memory_order_relaxed);
+            m_cells[i].m_bytes.store(0, std::memory_order_relaxed);
+        }
+        for(Candidates* candidates: {&m_by_msgs, &m_by_bytes}){
+            candidates->m_size.store(0, std::memory_order_relaxed);
+            candidates->m_min_estimate.store(0, std::memory_order_relaxed);
+            for(int i=0;i<CAPACITY;i++){
+                candidates->m_hashes[i].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
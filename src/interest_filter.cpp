@@ -0,0 +1,129 @@
+#include "../include/nats/interest_filter.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr uint64_t FNV_OFFSET = 1469598103934665603ULL;
+        constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+        //different seeds so that a literal subject "foo" and the first token "foo" of "foo.*" dont share counters
+        constexpr uint64_t LITERAL_SEED = 0x9e3779b97f4a7c15ULL;
+        constexpr uint64_t PREFIX_SEED = 0xc2b2ae3d27d4eb4fULL;
+
+        uint64_t hashBytes(uint64_t hash, const std::string& bytes){
+            for(unsigned char ch: bytes){
+                hash ^= ch;
+                hash *= FNV_PRIME;
+            }
+            return hash;
+        }
+
+        uint64_t hashSubject(const std::vector<std::string>& subject_list){
+            uint64_t hash = FNV_OFFSET ^ LITERAL_SEED;
+            for(size_t i=0;i<subject_list.size();i++){
+                if(i>0){
+                    hash ^= '.';
+                    hash *= FNV_PRIME;
+                }
+                hash = hashBytes(hash, subject_list[i]);
+            }
+            return hash;
+        }
+
+        uint64_t hashPrefix(const std::string& first_token){
+            return hashBytes(FNV_OFFSET ^ PREFIX_SEED, first_token);
+        }
+
+        bool isWildcard(const std::string& token){
+            return token == "*" || token == ">";
+        }
+    }
+
+    NatsInterestFilter::NatsInterestFilter(std::size_t counter_count): m_root_wildcards(0){
+        //round up to a power of two so that indexing is just a mask
+        std::size_t size = 1;
+        while(size < counter_count) size <<= 1;
+        m_mask = size - 1;
+        m_counters = std::make_unique<std::atomic<uint16_t>[]>(size);
+        for(std::size_t i=0;i<size;i++){
+            m_counters[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void NatsInterestFilter::updateCounters(uint64_t hash, bool increment){
+        //double hashing, k indexes derived from the two halves of the 64 bit hash
+        uint64_t h1 = hash;
+        uint64_t h2 = (hash >> 32) | 1;
+        for(int i=0;i<HASH_COUNT;i++){
+            std::atomic<uint16_t>& counter = m_counters[(h1 + i*h2) & m_mask];
+            uint16_t value = counter.load(std::memory_order_relaxed);
+            //a saturated counter is never decremented again since we no longer know its real value
+            if(value == COUNTER_MAX) continue;
+            if(increment){
+                counter.store(value + 1, std::memory_order_release);
+            } else if(value > 0){
+                counter.store(value - 1, std::memory_order_release);
+            }
+        }
+    }
+
+    bool NatsInterestFilter::testCounters(uint64_t hash) const{
+        uint64_t h1 = hash;
+        uint64_t h2 = (hash >> 32) | 1;
+        for(int i=0;i<HASH_COUNT;i++){
+            if(m_counters[(h1 + i*h2) & m_mask].load(std::memory_order_acquire) == 0){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    NatsInterestKey NatsInterestFilter::interestKey(const std::vector<std::string>& subject_list){
+        if(subject_list.empty() || isWildcard(subject_list[0])){
+            return {true, 0};
+        }
+        for(const std::string& token: subject_list){
+            if(isWildcard(token)){
+                return {false, hashPrefix(subject_list[0])};
+            }
+        }
+        return {false, hashSubject(subject_list)};
+    }
+
+    void NatsInterestFilter::addInterest(const NatsInterestKey& key){
+        if(key.m_root_wildcard){
+            m_root_wildcards.fetch_add(1, std::memory_order_release);
+        } else {
+            updateCounters(key.m_hash, true);
+        }
+    }
+
+    void NatsInterestFilter::removeInterest(const NatsInterestKey& key){
+        if(key.m_root_wildcard){
+            m_root_wildcards.fetch_sub(1, std::memory_order_release);
+        } else {
+            updateCounters(key.m_hash, false);
+        }
+    }
+
+    void NatsInterestFilter::addInterest(const std::vector<std::string>& subject_list){
+        if(subject_list.empty()) return;
+        addInterest(interestKey(subject_list));
+    }
+
+    void NatsInterestFilter::removeInterest(const std::vector<std::string>& subject_list){
+        if(subject_list.empty()) return;
+        removeInterest(interestKey(subject_list));
+    }
+
+    bool NatsInterestFilter::mayHaveInterest(const std::vector<std::string>& subject_list) const{
+        if(subject_list.empty()) return false;
+        if(m_root_wildcards.load(std::memory_order_acquire) > 0) return true;
+        return testCounters(hashSubject(subject_list)) || testCounters(hashPrefix(subject_list[0]));
+    }
+}
@@ -0,0 +1,480 @@
+#include "../include/nats/interest_summary.hpp"
+
+#include <algorithm>
+#include <charconv>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr uint64_t FNV_OFFSET = 1469598103934665603ULL;
+        constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+        std::vector<std::string> splitSubject(const std::string& subject){
+            std::vector<std::string> tokens;
+            std::size_t start = 0;
+            while(true){
+                std::size_t dot = subject.find('.', start);
+                if(dot == std::string::npos){
+                    tokens.push_back(subject.substr(start));
+                    return tokens;
+                }
+                tokens.push_back(subject.substr(start, dot - start));
+                start = dot + 1;
+            }
+        }
+
+        void appendNumber(std::string& out, uint64_t number){
+            char digits[24];
+            out.append(digits, std::to_chars(digits, digits + sizeof(digits), number).ptr - digits);
+        }
+    }
+
+    void NatsSummaryFilter::bitsFor(std::string_view subject, uint32_t bits, uint32_t (&indexes)[HASH_COUNT]){
+        uint64_t hash = FNV_OFFSET;
+        for(unsigned char ch: subject){
+            hash ^= ch;
+            hash *= FNV_PRIME;
+        }
+        //double hashing like NatsInterestFilter, bits is a power of two
+        uint64_t h1 = hash;
+        uint64_t h2 = (hash >> 32) | 1;
+        for(int i=0;i<HASH_COUNT;i++){
+            indexes[i] = static_cast<uint32_t>((h1 + i*h2) & (bits - 1));
+        }
+    }
+
+    bool NatsSummaryFilter::isValidSize(uint64_t bits){
+        return bits >= MIN_BITS && bits <= MAX_BITS && (bits & (bits - 1)) == 0;
+    }
+
+    uint32_t NatsSummaryFilter::sizeFor(std::size_t subjects){
+        uint32_t bits = MIN_BITS;
+        while(bits < MAX_BITS && bits < subjects * BITS_PER_SUBJECT){
+            bits <<= 1;
+        }
+        return bits;
+    }
+
+    NatsSummaryFilter::NatsSummaryFilter(uint32_t bits): m_words(bits / 64, 0), m_bits(bits){
+    }
+
+    NatsSummaryFilter::NatsSummaryFilter(uint32_t bits, std::string_view bitmap): m_words(bits / 64, 0), m_bits(bits){
+        for(std::size_t i=0;i<bitmap.size() && i < bits / 8;i++){
+            m_words[i / 8] |= static_cast<uint64_t>(static_cast<unsigned char>(bitmap[i])) << (8 * (i % 8));
+        }
+    }
+
+    uint32_t NatsSummaryFilter::getBits() const{
+        return m_bits;
+    }
+
+    void NatsSummaryFilter::set(uint32_t bit){
+        m_words[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    void NatsSummaryFilter::clear(uint32_t bit){
+        m_words[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+    }
+
+    bool NatsSummaryFilter::mayContain(std::string_view subject) const{
+        uint32_t indexes[HASH_COUNT];
+        bitsFor(subject, m_bits, indexes);
+        for(uint32_t bit: indexes){
+            if((m_words[bit / 64] & (uint64_t(1) << (bit % 64))) == 0){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    NatsInterestSummary::NatsInterestSummary(std::size_t max_fanout): m_max_fanout(max_fanout), m_folded_count(0){
+    }
+
+    void NatsInterestSummary::setMaxFanout(std::size_t max_fanout){
+        m_max_fanout = max_fanout;
+    }
+
+    std::string NatsInterestSummary::foldedEntry(const std::string& prefix){
+        //the root folds into ">", which matches every subject
+        return prefix.empty() ? ">" : prefix + ".>";
+    }
+
+    bool NatsInterestSummary::isLiteral(const std::vector<std::string>& tokens){
+        for(const std::string& token: tokens){
+            if(token == "*" || token == ">"){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void NatsInterestSummary::announce(const std::string& subject, std::string& out){
+        if(++m_announced[subject] == 1){
+            out += "RS+ ";
+            out += subject;
+            out += "\r\n";
+        }
+    }
+
+    void NatsInterestSummary::withdraw(const std::string& subject, std::string& out){
+        auto it = m_announced.find(subject);
+        if(it != m_announced.end() && --it->second == 0){
+            m_announced.erase(it);
+            out += "RS- ";
+            out += subject;
+            out += "\r\n";
+        }
+    }
+
+    void NatsInterestSummary::collectBelow(Node* node, std::string& prefix, std::vector<std::string>& literals,
+        std::vector<std::pair<Node*, std::string>>& folded){
+        std::size_t prefix_size = prefix.size();
+        for(auto& pair: node->m_children){
+            if(prefix_size > 0){
+                prefix += '.';
+            }
+            prefix += pair.first;
+            Node* child = pair.second.get();
+            bool wildcard = pair.first == "*" || pair.first == ">";
+            if(!wildcard){
+                if(child->m_terminal){
+                    literals.push_back(prefix);
+                }
+                if(child->m_folded){
+                    folded.emplace_back(child, prefix);
+                } else {
+                    collectBelow(child, prefix, literals, folded);
+                }
+            }
+            prefix.resize(prefix_size);
+        }
+    }
+
+    void NatsInterestSummary::collectLiterals(Node* node, std::string& prefix, std::vector<std::string>& literals){
+        std::size_t prefix_size = prefix.size();
+        for(auto& pair: node->m_children){
+            if(pair.first == "*" || pair.first == ">"){
+                continue;
+            }
+            if(prefix_size > 0){
+                prefix += '.';
+            }
+            prefix += pair.first;
+            if(pair.second->m_terminal){
+                literals.push_back(prefix);
+            }
+            collectLiterals(pair.second.get(), prefix, literals);
+            prefix.resize(prefix_size);
+        }
+    }
+
+    void NatsInterestSummary::appendFilter(const Filter& filter, std::string& out){
+        out += "RF+ ";
+        out += filter.m_entry;
+        out += ' ';
+        appendNumber(out, filter.m_counts.size());
+        out += "\r\n";
+        for(std::size_t i=0;i<filter.m_counts.size();i+=8){
+            unsigned char byte = 0;
+            for(int bit=0;bit<8;bit++){
+                if(filter.m_counts[i + bit] > 0){
+                    byte |= 1 << bit;
+                }
+            }
+            out += static_cast<char>(byte);
+        }
+        out += "\r\n";
+    }
+
+    void NatsInterestSummary::createFilter(Node* node, std::string prefix, std::string& out){
+        //also replaces a filter that got too full, the peer swaps it for the new one
+        std::string entry = foldedEntry(prefix);
+        std::vector<std::string> literals;
+        collectLiterals(node, prefix, literals);
+        auto filter = std::make_unique<Filter>();
+        filter->m_entry = entry;
+        filter->m_counts.assign(NatsSummaryFilter::sizeFor(literals.size()), 0);
+        filter->m_subjects = literals.size();
+        uint32_t indexes[NatsSummaryFilter::HASH_COUNT];
+        for(const std::string& literal: literals){
+            NatsSummaryFilter::bitsFor(literal, filter->m_counts.size(), indexes);
+            for(uint32_t bit: indexes){
+                if(filter->m_counts[bit] < UINT8_MAX){
+                    filter->m_counts[bit]++;
+                }
+            }
+        }
+        appendFilter(*filter, out);
+        node->m_filter = std::move(filter);
+        m_filters[entry] = node;
+    }
+
+    void NatsInterestSummary::removeFilter(Node* node, std::string& out){
+        out += "RF- ";
+        out += node->m_filter->m_entry;
+        out += "\r\n";
+        m_filters.erase(node->m_filter->m_entry);
+        node->m_filter.reset();
+    }
+
+    void NatsInterestSummary::addToFilter(Node* node, const std::string& prefix, const std::string& subject, std::string& out){
+        Filter& filter = *node->m_filter;
+        filter.m_subjects++;
+        if(filter.m_subjects * NatsSummaryFilter::BITS_PER_SUBJECT > filter.m_counts.size()
+            && filter.m_counts.size() < NatsSummaryFilter::MAX_BITS){
+            //twice the size, so the whole filter is sent again about as often as a vector reallocates
+            createFilter(node, prefix, out);
+            return;
+        }
+        uint32_t indexes[NatsSummaryFilter::HASH_COUNT];
+        NatsSummaryFilter::bitsFor(subject, filter.m_counts.size(), indexes);
+        for(uint32_t bit: indexes){
+            if(filter.m_counts[bit] < UINT8_MAX && filter.m_counts[bit]++ == 0){
+                filter.m_touched.push_back(bit);
+            }
+        }
+    }
+
+    void NatsInterestSummary::removeFromFilter(Node* node, const std::string& subject){
+        Filter& filter = *node->m_filter;
+        filter.m_subjects--;
+        uint32_t indexes[NatsSummaryFilter::HASH_COUNT];
+        NatsSummaryFilter::bitsFor(subject, filter.m_counts.size(), indexes);
+        for(uint32_t bit: indexes){
+            if(filter.m_counts[bit] < UINT8_MAX && --filter.m_counts[bit] == 0){
+                filter.m_touched.push_back(bit);
+            }
+        }
+    }
+
+    void NatsInterestSummary::fold(Node* node, std::string prefix, bool covered, std::string& out){
+        node->m_folded = true;
+        m_folded_count++;
+        if(covered){
+            return;
+        }
+        std::vector<std::string> literals;
+        std::vector<std::pair<Node*, std::string>> folded;
+        collectBelow(node, prefix, literals, folded);
+        //the new filter holds everything below, the smaller filters and exact entries it replaces go after it
+        createFilter(node, prefix, out);
+        for(auto& pair: folded){
+            removeFilter(pair.first, out);
+        }
+        for(const std::string& literal: literals){
+            withdraw(literal, out);
+        }
+    }
+
+    void NatsInterestSummary::unfold(Node* node, std::string prefix, bool covered, std::string& out){
+        node->m_folded = false;
+        m_folded_count--;
+        if(covered){
+            return;
+        }
+        std::vector<std::string> literals;
+        std::vector<std::pair<Node*, std::string>> folded;
+        collectBelow(node, prefix, literals, folded);
+        for(const std::string& literal: literals){
+            announce(literal, out);
+        }
+        for(auto& pair: folded){
+            createFilter(pair.first, pair.second, out);
+        }
+        removeFilter(node, out);
+    }
+
+    void NatsInterestSummary::apply(const std::vector<NatsRouteInterestChange>& changes, std::string& out){
+        for(const NatsRouteInterestChange& change: changes){
+            if(change.m_has_interest){
+                add(change.m_subject, out);
+            } else {
+                remove(change.m_subject, out);
+            }
+        }
+        appendTouchedBits(out);
+    }
+
+    void NatsInterestSummary::add(const std::string& subject, std::string& out){
+        std::vector<std::string> tokens = splitSubject(subject);
+        //path[i] is the node of the first i tokens, prefixes[i] its subject
+        std::vector<Node*> path{&m_root};
+        std::vector<std::string> prefixes{""};
+        for(const std::string& token: tokens){
+            std::unique_ptr<Node>& child = path.back()->m_children[token];
+            if(child == nullptr){
+                child = std::make_unique<Node>();
+            }
+            path.push_back(child.get());
+            prefixes.push_back(prefixes.size() == 1 ? token : prefixes.back() + "." + token);
+        }
+        std::size_t depth = tokens.size();
+        if(path[depth]->m_terminal){
+            return;
+        }
+        for(std::size_t i = depth + 1; i-- > 0;){
+            if(++path[i]->m_subjects == 1 && i > 0){
+                path[i - 1]->m_live_children++;
+            }
+        }
+        //only prefixes without wildcards fold, the subjects below any other are wildcards a filter can't hold
+        std::size_t foldable = 0;
+        while(foldable < depth && tokens[foldable] != "*" && tokens[foldable] != ">"){
+            foldable++;
+        }
+        //deepest first, so a shallower fold replaces the deeper filter rather than the subjects under it
+        //the new subject isn't marked yet, a fold it causes doesn't see it and it is added to the filter below
+        for(std::size_t i = std::min(foldable + 1, depth); m_max_fanout > 0 && i-- > 0;){
+            if(!path[i]->m_folded && path[i]->m_live_children > m_max_fanout){
+                bool covered = false;
+                for(std::size_t k = 0; k < i && !covered; k++){
+                    covered = path[k]->m_folded;
+                }
+                fold(path[i], prefixes[i], covered, out);
+            }
+        }
+        path[depth]->m_terminal = true;
+        if(isLiteral(tokens)){
+            //the topmost folded prefix above the subject is the one with the filter
+            for(std::size_t i = 0; i < depth; i++){
+                if(path[i]->m_folded){
+                    addToFilter(path[i], prefixes[i], subject, out);
+                    return;
+                }
+            }
+        }
+        announce(subject, out);
+    }
+
+    void NatsInterestSummary::remove(const std::string& subject, std::string& out){
+        std::vector<std::string> tokens = splitSubject(subject);
+        std::vector<Node*> path{&m_root};
+        std::vector<std::string> prefixes{""};
+        for(const std::string& token: tokens){
+            auto it = path.back()->m_children.find(token);
+            if(it == path.back()->m_children.end()){
+                return;
+            }
+            path.push_back(it->second.get());
+            prefixes.push_back(prefixes.size() == 1 ? token : prefixes.back() + "." + token);
+        }
+        std::size_t depth = tokens.size();
+        if(!path[depth]->m_terminal){
+            return;
+        }
+        path[depth]->m_terminal = false;
+        for(std::size_t i = depth + 1; i-- > 0;){
+            if(--path[i]->m_subjects == 0 && i > 0){
+                path[i - 1]->m_live_children--;
+            }
+        }
+        Node* filtered_by = nullptr;
+        if(isLiteral(tokens)){
+            for(std::size_t i = 0; i < depth && filtered_by == nullptr; i++){
+                filtered_by = path[i]->m_folded ? path[i] : nullptr;
+            }
+        }
+        if(filtered_by != nullptr){
+            removeFromFilter(filtered_by, subject);
+        } else {
+            withdraw(subject, out);
+        }
+        //shallowest first, an unfolded prefix hands filters to the deeper folds that may unfold right after
+        bool covered = false;
+        for(std::size_t i = 0; i <= depth; i++){
+            if(path[i]->m_folded && path[i]->m_live_children <= m_max_fanout / 2){
+                unfold(path[i], prefixes[i], covered, out);
+            }
+            covered = covered || path[i]->m_folded;
+        }
+        //nodes left without any subject are gone, none of them is folded anymore
+        for(std::size_t i = 1; i <= depth; i++){
+            if(path[i]->m_subjects == 0){
+                path[i - 1]->m_children.erase(tokens[i - 1]);
+                break;
+            }
+        }
+    }
+
+    void NatsInterestSummary::appendTouchedBits(std::string& out){
+        //one line per filter and direction for all of the changes, a bit that flipped back and forth is sent as it is now
+        for(auto& pair: m_filters){
+            Filter& filter = *pair.second->m_filter;
+            if(filter.m_touched.empty()){
+                continue;
+            }
+            std::sort(filter.m_touched.begin(), filter.m_touched.end());
+            filter.m_touched.erase(std::unique(filter.m_touched.begin(), filter.m_touched.end()), filter.m_touched.end());
+            std::string set = "RFS " + filter.m_entry;
+            std::string cleared = "RFC " + filter.m_entry;
+            std::size_t empty_size = set.size();
+            for(uint32_t bit: filter.m_touched){
+                std::string& line = filter.m_counts[bit] > 0 ? set : cleared;
+                line += ' ';
+                appendNumber(line, bit);
+            }
+            for(std::string* line: {&set, &cleared}){
+                if(line->size() > empty_size){
+                    out += *line;
+                    out += "\r\n";
+                }
+            }
+            filter.m_touched.clear();
+        }
+    }
+
+    std::string NatsInterestSummary::getSnapshot() const{
+        std::string snapshot;
+        for(const auto& pair: m_announced){
+            snapshot += "RS+ ";
+            snapshot += pair.first;
+            snapshot += "\r\n";
+        }
+        for(const auto& pair: m_filters){
+            appendFilter(*pair.second->m_filter, snapshot);
+        }
+        return snapshot;
+    }
+
+    std::vector<std::string> NatsInterestSummary::getExactEntries() const{
+        std::vector<std::string> entries;
+        for(const auto& pair: m_announced){
+            entries.push_back(pair.first);
+        }
+        return entries;
+    }
+
+    std::vector<std::string> NatsInterestSummary::getFilterEntries() const{
+        std::vector<std::string> entries;
+        for(const auto& pair: m_filters){
+            entries.push_back(pair.first);
+        }
+        return entries;
+    }
+
+    std::size_t NatsInterestSummary::getSubjectCount() const{
+        return m_root.m_subjects;
+    }
+
+    std::size_t NatsInterestSummary::getAnnouncedCount() const{
+        return m_announced.size() + m_filters.size();
+    }
+
+    std::size_t NatsInterestSummary::getFilterBytes() const{
+        std::size_t bytes = 0;
+        for(const auto& pair: m_filters){
+            bytes += pair.second->m_filter->m_counts.size() / 8;
+        }
+        return bytes;
+    }
+
+    std::size_t NatsInterestSummary::getFoldedCount() const{
+        return m_folded_count;
+    }
+
+    std::size_t NatsInterestSummary::getMaxFanout() const{
+        return m_max_fanout;
+    }
+}
@@ -0,0 +1,55 @@
+#include "../include/nats/interest_watch.hpp"
+
+using namespace std;
+
+namespace nats{
+
+    NatsInterestWatch* NatsInterestWatchIndex::find(const std::string& subject){
+        auto it = m_watches.find(subject);
+        return it != m_watches.end() ? &it->second : nullptr;
+    }
+
+    NatsInterestWatch& NatsInterestWatchIndex::insert(const std::string& subject, NatsInterestWatch watch){
+        auto entry = m_watches.emplace(subject, std::move(watch)).first;
+        Node* node = &m_head;
+        for(const std::string& token: entry->second.m_subject_list){
+            std::unique_ptr<Node>& child = node->m_next[token];
+            if(!child){
+                child = std::make_unique<Node>();
+            }
+            node = child.get();
+        }
+        node->m_watch = &*entry;
+        return entry->second;
+    }
+
+    void NatsInterestWatchIndex::erase(const std::string& subject){
+        auto entry = m_watches.find(subject);
+        if(entry == m_watches.end()){
+            return;
+        }
+        //the path down to the watch, so the nodes nothing else needs any more can be pruned from the bottom up
+        const std::vector<std::string>& subject_list = entry->second.m_subject_list;
+        std::vector<Node*> path{&m_head};
+        for(const std::string& token: subject_list){
+            path.push_back(path.back()->m_next.at(token).get());
+        }
+        path.back()->m_watch = nullptr;
+        for(std::size_t depth = subject_list.size(); depth > 0; depth--){
+            Node* node = path[depth];
+            if(node->m_watch != nullptr || !node->m_next.empty()){
+                break;
+            }
+            path[depth - 1]->m_next.erase(subject_list[depth - 1]);
+        }
+        m_watches.erase(entry);
+    }
+
+    bool NatsInterestWatchIndex::empty() const{
+        return m_watches.empty();
+    }
+
+    std::size_t NatsInterestWatchIndex::size() const{
+        return m_watches.size();
+    }
+}
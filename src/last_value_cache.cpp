@@ -0,0 +1,264 @@
+#include "../include/nats/last_value_cache.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/sublist.hpp"
+
+#include <charconv>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+namespace nats{
+
+    NatsLastValueCache::NatsLastValueCache(): m_shards(SHARD_COUNT), m_subjects(0), m_bytes(0), m_updates(0){
+        m_filter_lists.push_back(std::make_unique<const std::vector<std::vector<std::string>>>());
+        m_filters = m_filter_lists.back().get();
+    }
+
+    std::size_t NatsLastValueCache::shardIndex(std::string_view subject) const{
+        return std::hash<std::string_view>{}(subject) % m_shards.size();
+    }
+
+    NatsLastValueCache::Shard& NatsLastValueCache::shardFor(std::string_view subject){
+        return m_shards[shardIndex(subject)];
+    }
+
+    template<typename Visitor>
+    void NatsLastValueCache::forEachBelow(const SubjectNode& node, Visitor& visit){
+        for(const auto& pair: node.m_next){
+            if(pair.second->m_value != nullptr){
+                visit(*pair.second);
+            }
+            forEachBelow(*pair.second, visit);
+        }
+    }
+
+    template<typename Visitor>
+    void NatsLastValueCache::forEachStored(const SubjectNode& node, const std::vector<std::string>& pattern, std::size_t depth,
+        Visitor& visit){
+        if(depth == pattern.size()){
+            if(node.m_value != nullptr){
+                visit(node);
+            }
+            return;
+        }
+        const std::string& token = pattern[depth];
+        if(token == ">"){
+            forEachBelow(node, visit);
+        } else if(token == "*"){
+            for(const auto& pair: node.m_next){
+                forEachStored(*pair.second, pattern, depth + 1, visit);
+            }
+        } else {
+            auto it = node.m_next.find(token);
+            if(it != node.m_next.end()){
+                forEachStored(*it->second, pattern, depth + 1, visit);
+            }
+        }
+    }
+
+    void NatsLastValueCache::matchingShards(const std::vector<std::string>& pattern, std::vector<std::size_t>& shards){
+        std::vector<bool> matched(m_shards.size(), false);
+        auto mark = [&matched](const SubjectNode& node){
+            matched[node.m_shard] = true;
+        };
+        forEachStored(m_subject_trie, pattern, 0, mark);
+        shards.clear();
+        for(std::size_t i=0;i<matched.size();i++){
+            if(matched[i]){
+                shards.push_back(i);
+            }
+        }
+    }
+
+    bool NatsLastValueCache::isLiteral(const std::vector<std::string>& subject_list){
+        for(const std::string& token: subject_list){
+            if(token == "*" || token == ">"){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string NatsLastValueCache::joinSubject(const std::vector<std::string>& subject_list){
+        std::string subject;
+        for(const std::string& token: subject_list){
+            if(!subject.empty()){
+                subject += '.';
+            }
+            subject += token;
+        }
+        return subject;
+    }
+
+    bool NatsLastValueCache::track(const std::string& subject){
+        std::vector<std::string> subject_list;
+        try {
+            NatsClient::convertSubjectToList(subject, false, subject_list);
+        } catch (const std::exception& e){
+            std::cerr << "can't keep last values of " << subject << ": " << e.what() << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_filters_mutex);
+        //copy on write like the server's stream list
+        auto filters = std::make_unique<std::vector<std::vector<std::string>>>(*m_filters.load(std::memory_order_relaxed));
+        filters->push_back(std::move(subject_list));
+        m_filter_lists.push_back(std::move(filters));
+        m_filters.store(m_filter_lists.back().get(), std::memory_order_release);
+        return true;
+    }
+
+    std::vector<std::string> NatsLastValueCache::getTrackedSubjects(){
+        std::vector<std::string> subjects;
+        for(const std::vector<std::string>& filter: *m_filters.load(std::memory_order_acquire)){
+            subjects.push_back(joinSubject(filter));
+        }
+        return subjects;
+    }
+
+    bool NatsLastValueCache::tracks(const std::vector<std::string>& subject_list) const{
+        for(const std::vector<std::string>& filter: *m_filters.load(std::memory_order_acquire)){
+            if(NatsSublist::subjectMatches(filter, subject_list)){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool NatsLastValueCache::mayHold(const std::vector<std::string>& subject_list) const{
+        //two patterns overlap if some literal subject matches both, token by token until either has a '>'
+        for(const std::vector<std::string>& filter: *m_filters.load(std::memory_order_acquire)){
+            std::size_t i = 0;
+            bool overlap = true;
+            for(; i < filter.size() && i < subject_list.size(); i++){
+                const std::string& a = filter[i];
+                const std::string& b = subject_list[i];
+                if(a == ">" || b == ">"){
+                    return true;
+                }
+                if(a != "*" && b != "*" && a != b){
+                    overlap = false;
+                    break;
+                }
+            }
+            if(overlap && filter.size() == subject_list.size()){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::unique_lock<std::mutex> NatsLastValueCache::store(const std::string& subject, const std::vector<std::string>& subject_list,
+        std::string_view payload){
+        if(!tracks(subject_list)){
+            return std::unique_lock<std::mutex>();
+        }
+        std::size_t index = shardIndex(subject);
+        Shard& shard = m_shards[index];
+        std::unique_lock<std::mutex> lock(shard.m_mutex);
+        auto it = shard.m_values.find(subject);
+        if(it == shard.m_values.end()){
+            //a new subject also goes into the trie, whose lock comes before the shard's, so the shard is locked again
+            lock.unlock();
+            std::lock_guard<std::mutex> trie_lock(m_subject_trie_mutex);
+            lock.lock();
+            auto inserted = shard.m_values.try_emplace(subject);
+            it = inserted.first;
+            if(inserted.second){
+                m_subjects.fetch_add(1, std::memory_order_relaxed);
+                SubjectNode* node = &m_subject_trie;
+                for(const std::string& token: subject_list){
+                    std::unique_ptr<SubjectNode>& child = node->m_next[token];
+                    if(!child){
+                        child = std::make_unique<SubjectNode>();
+                    }
+                    node = child.get();
+                }
+                node->m_value = &*it;
+                node->m_shard = index;
+            }
+        }
+        std::string& value = it->second;
+        m_bytes.fetch_add(payload.size() - value.size(), std::memory_order_relaxed);
+        value.assign(payload.data(), payload.size());
+        m_updates.fetch_add(1, std::memory_order_relaxed);
+        return lock;
+    }
+
+    void NatsLastValueCache::lockFor(const std::vector<std::string>& subject_list){
+        if(isLiteral(subject_list)){
+            shardFor(joinSubject(subject_list)).m_mutex.lock();
+            return;
+        }
+        //publishes only ever hold one shard, and take the trie lock before it, so taking the shards in order can't deadlock
+        m_subject_trie_mutex.lock();
+        thread_local std::vector<std::size_t> shards;
+        matchingShards(subject_list, shards);
+        for(std::size_t index: shards){
+            m_shards[index].m_mutex.lock();
+        }
+    }
+
+    void NatsLastValueCache::unlockFor(const std::vector<std::string>& subject_list){
+        if(isLiteral(subject_list)){
+            shardFor(joinSubject(subject_list)).m_mutex.unlock();
+            return;
+        }
+        //nothing was stored since lockFor, so the same shards match
+        thread_local std::vector<std::size_t> shards;
+        matchingShards(subject_list, shards);
+        for(std::size_t index: shards){
+            m_shards[index].m_mutex.unlock();
+        }
+        m_subject_trie_mutex.unlock();
+    }
+
+    uint64_t NatsLastValueCache::appendFrames(const std::vector<std::string>& subject_list, int sub_id, std::string& frames,
+        uint64_t& payload_bytes){
+        uint64_t matched = 0;
+        auto appendFrame = [&](const std::string& subject, const std::string& payload){
+            //"MSG <subject> <sid> <size>\r\n<payload>\r\n" like deliverMessage writes it
+            char args[32];
+            char* pos = args;
+            *pos++ = ' ';
+            pos = std::to_chars(pos, args + sizeof(args), sub_id).ptr;
+            *pos++ = ' ';
+            pos = std::to_chars(pos, args + sizeof(args), payload.size()).ptr;
+            frames.append("MSG ", 4);
+            frames.append(subject);
+            frames.append(args, pos - args);
+            frames.append("\r\n", 2);
+            frames.append(payload);
+            frames.append("\r\n", 2);
+            payload_bytes += payload.size();
+            matched++;
+        };
+        if(isLiteral(subject_list)){
+            std::string subject = joinSubject(subject_list);
+            Shard& shard = shardFor(subject);
+            auto it = shard.m_values.find(subject);
+            if(it != shard.m_values.end()){
+                appendFrame(it->first, it->second);
+            }
+            return matched;
+        }
+        //a wildcard walks the trie, only the stored subjects it matches are visited
+        auto append = [&appendFrame](const SubjectNode& node){
+            appendFrame(node.m_value->first, node.m_value->second);
+        };
+        forEachStored(m_subject_trie, subject_list, 0, append);
+        return matched;
+    }
+
+    uint64_t NatsLastValueCache::getSubjectCount() const{
+        return m_subjects.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsLastValueCache::getByteCount() const{
+        return m_bytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsLastValueCache::getUpdateCount() const{
+        return m_updates.load(std::memory_order_relaxed);
+    }
+}
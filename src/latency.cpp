@@ -0,0 +1,104 @@
+#include "../include/nats/latency.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+namespace nats{
+
+    NatsLatencyHistogram::NatsLatencyHistogram(){
+        m_stripes = std::make_unique<Stripe[]>(STRIPE_COUNT);
+        reset();
+    }
+
+    uint64_t NatsLatencyHistogram::bucketUpperBound(int index){
+        if(index < SUB_BUCKET_COUNT) return index;
+        int shift = index / SUB_BUCKET_COUNT - 1;
+        uint64_t sub_bucket = SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT;
+        //the last bucket would overflow, it simply ends at the largest value there is
+        if(shift + SUB_BUCKET_BITS >= 63 && sub_bucket == 2*SUB_BUCKET_COUNT - 1) return UINT64_MAX;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    void NatsLatencyHistogram::reset(){
+        for(int s=0;s<STRIPE_COUNT;s++){
+            for(std::atomic<uint64_t>& bucket: m_stripes[s].m_buckets){
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            m_stripes[s].m_sum.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t NatsLatencyHistogram::valueAtPercentile(double percentile) const{
+        std::vector<uint64_t> buckets(BUCKET_COUNT, 0);
+        uint64_t count = 0;
+        for(int s=0;s<STRIPE_COUNT;s++){
+            for(int b=0;b<BUCKET_COUNT;b++){
+                uint64_t value = m_stripes[s].m_buckets[b].load(std::memory_order_relaxed);
+                buckets[b] += value;
+                count += value;
+            }
+        }
+        if(count == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+        if(rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for(int b=0;b<BUCKET_COUNT;b++){
+            seen += buckets[b];
+            if(seen >= rank) return bucketUpperBound(b);
+        }
+        return bucketUpperBound(BUCKET_COUNT - 1);
+    }
+
+    NatsLatencySummary NatsLatencyHistogram::summary() const{
+        std::vector<uint64_t> buckets(BUCKET_COUNT, 0);
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        for(int s=0;s<STRIPE_COUNT;s++){
+            for(int b=0;b<BUCKET_COUNT;b++){
+                uint64_t value = m_stripes[s].m_buckets[b].load(std::memory_order_relaxed);
+                buckets[b] += value;
+                count += value;
+            }
+            sum += m_stripes[s].m_sum.load(std::memory_order_relaxed);
+        }
+
+        NatsLatencySummary summary {count, 0, 0, 0, 0, 0, 0};
+        if(count == 0) return summary;
+        summary.m_mean_ns = sum / count;
+
+        //walk the buckets once, filling in every percentile as its rank is passed
+        const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+        uint64_t* results[] = {&summary.m_p50_ns, &summary.m_p90_ns, &summary.m_p99_ns, &summary.m_p999_ns};
+        int next = 0;
+        uint64_t seen = 0;
+        for(int b=0;b<BUCKET_COUNT;b++){
+            if(buckets[b] == 0) continue;
+            seen += buckets[b];
+            while(next < 4 && seen >= static_cast<uint64_t>(percentiles[next] * count + 0.5)){
+                *results[next] = bucketUpperBound(b);
+                next++;
+            }
+            summary.m_max_ns = bucketUpperBound(b);
+        }
+        return summary;
+    }
+
+    NatsLatencyStats::NatsLatencyStats(): m_enabled(false){}
+
+    NatsLatencyStats& NatsLatencyStats::shared(){
+        static NatsLatencyStats stats;
+        return stats;
+    }
+
+    void NatsLatencyStats::setEnabled(bool enabled){
+        m_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    void NatsLatencyStats::reset(){
+        m_parse.reset();
+        m_match.reset();
+        m_publish.reset();
+    }
+}
@@ -0,0 +1,401 @@
+#include "../include/nats/monitor.hpp"
+#include "../include/nats/server.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/stats.hpp"
+#include "../include/nats/latency.hpp"
+#include "../include/nats/stream.hpp"
+#include "../include/nats/replay_buffer.hpp"
+#include "../include/nats/route.hpp"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr int REQUEST_BUFFER_SIZE = 4096;
+
+        //value of a key in a "a=1&b=2" query string, empty if it isn't there
+        std::string queryValue(const std::string& query, const std::string& key){
+            size_t start = 0;
+            while(start <= query.size()){
+                size_t end = query.find('&', start);
+                if(end == std::string::npos) end = query.size();
+                std::string_view param(query.data() + start, end - start);
+                if(param.size() > key.size() && param.substr(0, key.size()) == key && param[key.size()] == '='){
+                    return std::string(param.substr(key.size() + 1));
+                }
+                start = end + 1;
+            }
+            return "";
+        }
+
+        nlohmann::json summaryToJson(const NatsLatencySummary& summary){
+            return {
+                {"count", summary.m_count},
+                {"mean_ns", summary.m_mean_ns},
+                {"p50_ns", summary.m_p50_ns},
+                {"p90_ns", summary.m_p90_ns},
+                {"p99_ns", summary.m_p99_ns},
+                {"p999_ns", summary.m_p999_ns},
+                {"max_ns", summary.m_max_ns},
+            };
+        }
+
+        nlohmann::json subjectCountsToJson(const std::vector<NatsSubjectCount>& counts){
+            nlohmann::json subjects = nlohmann::json::array();
+            for(const NatsSubjectCount& count: counts){
+                subjects.push_back({{"subject", count.m_subject}, {"msgs", count.m_msgs}, {"bytes", count.m_bytes}});
+            }
+            return subjects;
+        }
+
+        std::string httpResponse(const std::string& status, const std::string& body){
+            return "HTTP/1.1 " + status + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size())
+                + "\r\nConnection: close\r\n\r\n" + body;
+        }
+    }
+
+    NatsMonitor::NatsMonitor(NatsServer* server): m_server(server), m_monitor_fd(-1), m_running(false){}
+
+    NatsMonitor::~NatsMonitor(){
+        stop();
+    }
+
+    bool NatsMonitor::start(const std::string& host, int port){
+        struct sockaddr_in monitor_addr {};
+        monitor_addr.sin_family = AF_INET;
+        monitor_addr.sin_port = htons(port);
+        if(inet_pton(AF_INET, host.c_str(), &monitor_addr.sin_addr) != 1){
+            cerr << "monitor host " << host << " is not an IPv4 address\n";
+            return false;
+        }
+        int monitor_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(monitor_fd == -1){
+            perror("monitor socket failed");
+            return false;
+        }
+        int reuse = 1;
+        setsockopt(monitor_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        //not being able to monitor is no reason to not serve clients, so failures here only disable monitoring
+        if(bind(monitor_fd, (struct sockaddr*)&monitor_addr, sizeof(monitor_addr)) < 0 || listen(monitor_fd, 16) < 0){
+            perror("monitor bind failed");
+            close(monitor_fd);
+            return false;
+        }
+
+        m_monitor_fd = monitor_fd;
+        m_running = true;
+        m_monitor_thread = std::thread([this]() { acceptLoop(); });
+        cout << "Monitoring endpoint listening on " << host << ":" << port << "...\n";
+        return true;
+    }
+
+    void NatsMonitor::stop(){
+        if(!m_running.exchange(false)){
+            return;
+        }
+        //shutdown wakes up the accept the monitor thread is blocked in, the fd is only closed once the thread is done with it
+        shutdown(m_monitor_fd, SHUT_RDWR);
+        if(m_monitor_thread.joinable()){
+            m_monitor_thread.join();
+        }
+        close(m_monitor_fd);
+        m_monitor_fd = -1;
+    }
+
+    void NatsMonitor::acceptLoop(){
+        while(m_running){
+            int connection_fd = accept(m_monitor_fd, nullptr, nullptr);
+            if(connection_fd < 0){
+                if(!m_running) break;
+                continue;
+            }
+            handleConnection(connection_fd);
+            close(connection_fd);
+        }
+    }
+
+    void NatsMonitor::handleConnection(int connection_fd){
+        //a client that never sends its request shouldn't block monitoring for everyone else
+        struct timeval timeout {1, 0};
+        setsockopt(connection_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        char buffer[REQUEST_BUFFER_SIZE];
+        ssize_t bytes_received = recv(connection_fd, buffer, REQUEST_BUFFER_SIZE - 1, 0);
+        if(bytes_received <= 0){
+            return;
+        }
+        //only the request line matters, "GET <path>[?query] HTTP/1.1"
+        std::string_view request(buffer, bytes_received);
+        size_t method_end = request.find(' ');
+        size_t target_end = method_end == std::string_view::npos ? std::string_view::npos : request.find(' ', method_end + 1);
+        std::string response;
+        if(target_end == std::string_view::npos || request.substr(0, method_end) != "GET"){
+            response = httpResponse("400 Bad Request", "{\"error\":\"bad request\"}");
+        } else {
+            std::string_view target = request.substr(method_end + 1, target_end - method_end - 1);
+            size_t query_start = target.find('?');
+            std::string path(target.substr(0, query_start));
+            std::string query = query_start == std::string_view::npos ? "" : std::string(target.substr(query_start + 1));
+            std::string body;
+            if(handleRequest(path, query, body)){
+                response = httpResponse("200 OK", body);
+            } else {
+                response = httpResponse("404 Not Found", "{\"error\":\"unknown endpoint\"}");
+            }
+        }
+        send(connection_fd, response.c_str(), response.size(), MSG_NOSIGNAL);
+    }
+
+    bool NatsMonitor::handleRequest(const std::string& path, const std::string& query, std::string& body){
+        if(path == "/varz"){
+            body = varz();
+        } else if(path == "/connz"){
+            body = connz(query);
+        } else if(path == "/subsz"){
+            body = subsz();
+        } else if(path == "/subjectz"){
+            body = subjectz(query);
+        } else if(path == "/streamz"){
+            body = streamz();
+        } else if(path == "/routez"){
+            body = routez();
+        } else if(path == "/latz"){
+            body = latz(query);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    std::string NatsMonitor::varz(){
+        NatsServerStats& stats = m_server->m_stats;
+        size_t connections;
+        uint64_t in_msgs;
+        uint64_t in_bytes;
+        {
+            //PUBs are only counted per client (by the client's own thread), the totals are summed up here
+            std::lock_guard<std::mutex> lock(m_server->m_clients_mutex);
+            connections = m_server->m_clients.size();
+            in_msgs = stats.m_closed_in_msgs.load(std::memory_order_relaxed) + stats.m_local_in_msgs.load();
+            in_bytes = stats.m_closed_in_bytes.load(std::memory_order_relaxed) + stats.m_local_in_bytes.load();
+            for(auto& pair: m_server->m_clients){
+                in_msgs += pair.second->m_stats.m_in_msgs.load(std::memory_order_relaxed);
+                in_bytes += pair.second->m_stats.m_in_bytes.load(std::memory_order_relaxed);
+            }
+        }
+        auto uptime = std::chrono::steady_clock::now() - m_server->m_start_time;
+        nlohmann::json varz = {
+            {"server_id", m_server->m_server_id},
+            {"uptime_seconds", std::chrono::duration_cast<std::chrono::seconds>(uptime).count()},
+            {"connections", connections},
+            {"total_connections", stats.m_total_connections.load(std::memory_order_relaxed)},
+            {"subscriptions", m_server->m_sublist->getSubscriptionCount()},
+            {"in_msgs", in_msgs},
+            {"in_bytes", in_bytes},
+            {"out_msgs", stats.m_out_msgs.load()},
+            {"out_bytes", stats.m_out_bytes.load()},
+            {"no_interest_msgs", stats.m_no_interest.load()},
+            {"slow_consumers", stats.m_slow_consumers.load()},
+        };
+        return varz.dump();
+    }
+
+    std::string NatsMonitor::connz(const std::string& query){
+        std::string subs = queryValue(query, "subs");
+        bool with_subscriptions = subs == "1" || subs == "true";
+        nlohmann::json connections = nlohmann::json::array();
+        {
+            //clients are only destroyed after being removed under this lock, so they stay valid while it is held
+            std::lock_guard<std::mutex> lock(m_server->m_clients_mutex);
+            for(auto& pair: m_server->m_clients){
+                NatsClientStats& stats = pair.second->m_stats;
+                nlohmann::json connection = {
+                    {"cid", pair.first},
+                    {"ip", pair.second->m_client_ip},
+                    {"subscriptions", stats.m_subscriptions.load(std::memory_order_relaxed)},
+                    {"in_msgs", stats.m_in_msgs.load(std::memory_order_relaxed)},
+                    {"in_bytes", stats.m_in_bytes.load(std::memory_order_relaxed)},
+                    {"out_msgs", stats.m_out_msgs.load(std::memory_order_relaxed)},
+                    {"out_bytes", stats.m_out_bytes.load(std::memory_order_relaxed)},
+                    {"slow_consumers", stats.m_slow_consumers.load(std::memory_order_relaxed)},
+                };
+                if(with_subscriptions){
+                    nlohmann::json subscriptions = nlohmann::json::array();
+                    std::lock_guard<std::mutex> subscriptions_lock(pair.second->m_subscription_stats_mutex);
+                    for(auto& subscription: pair.second->m_subscription_stats){
+                        subscriptions.push_back({
+                            {"sid", subscription.first},
+                            {"delivered", subscription.second->m_delivered.load(std::memory_order_relaxed)},
+                            {"dropped", subscription.second->m_dropped.load(std::memory_order_relaxed)},
+                            {"redelivered", subscription.second->m_redelivered.load(std::memory_order_relaxed)},
+                        });
+                    }
+                    connection["subscriptions_list"] = subscriptions;
+                }
+                connections.push_back(connection);
+            }
+        }
+        nlohmann::json connz = {
+            {"num_connections", connections.size()},
+            {"connections", connections},
+        };
+        return connz.dump();
+    }
+
+    std::string NatsMonitor::subsz(){
+        nlohmann::json subsz = {
+            {"num_subscriptions", m_server->m_sublist->getSubscriptionCount()},
+            {"num_interest_watches", m_server->m_sublist->getInterestWatchCount()},
+            {"no_interest_msgs", m_server->m_stats.m_no_interest.load()},
+        };
+        return subsz.dump();
+    }
+
+    std::string NatsMonitor::subjectz(const std::string& query){
+        NatsHeavyHitters& hot_subjects = m_server->m_stats.m_hot_subjects;
+        std::string reset = queryValue(query, "reset");
+        if(reset == "1" || reset == "true"){
+            hot_subjects.reset();
+        }
+        int top = 10;
+        std::string top_value = queryValue(query, "top");
+        if(!top_value.empty()){
+            top = std::clamp(std::atoi(top_value.c_str()), 0, NatsHeavyHitters::CAPACITY);
+        }
+        nlohmann::json subjectz = {
+            {"by_msgs", subjectCountsToJson(hot_subjects.topByMsgs(top))},
+            {"by_bytes", subjectCountsToJson(hot_subjects.topByBytes(top))},
+        };
+        return subjectz.dump();
+    }
+
+    std::string NatsMonitor::streamz(){
+        static const char* const fsync_policies[] = {"none", "interval", "always"};
+        nlohmann::json streams = nlohmann::json::array();
+        for(const std::shared_ptr<NatsStream>& stream: m_server->getStreams()){
+            const NatsStreamConfig& config = stream->getConfig();
+            streams.push_back({
+                {"name", config.m_name},
+                {"subject", config.m_subject},
+                {"messages", stream->getMessageCount()},
+                {"bytes", stream->getByteCount()},
+                {"first_seq", stream->getFirstSeq()},
+                {"last_seq", stream->getLastSeq()},
+                {"segments", stream->getSegmentCount()},
+                {"segment_size", config.m_segment_size},
+                {"fsync", fsync_policies[static_cast<int>(config.m_fsync_policy)]},
+                {"max_age_ms", config.m_max_age_ms},
+                {"max_bytes", config.m_max_bytes},
+                {"max_messages", config.m_max_messages},
+                {"keep_last_per_subject", config.m_keep_last_per_subject},
+                {"deleted_segments", stream->getDeletedSegmentCount()},
+                {"compacted_messages", stream->getCompactedMessageCount()},
+            });
+        }
+        nlohmann::json replay_buffers = nlohmann::json::array();
+        for(const std::shared_ptr<NatsReplayBuffer>& buffer: m_server->getReplayBuffers()){
+            replay_buffers.push_back({
+                {"name", buffer->getConfig().m_name},
+                {"subject", buffer->getConfig().m_subject},
+                {"capacity", buffer->getCapacity()},
+                {"messages", buffer->getMessageCount()},
+                {"bytes", buffer->getByteCount()},
+                {"appended", buffer->getAppendedCount()},
+                {"evicted", buffer->getEvictedCount()},
+                {"oversized", buffer->getOversizedCount()},
+            });
+        }
+        nlohmann::json streamz = {
+            {"streams", streams},
+            {"replay_buffers", replay_buffers},
+            {"last_values", {
+                {"subjects", m_server->m_last_values.getTrackedSubjects()},
+                {"stored_subjects", m_server->m_last_values.getSubjectCount()},
+                {"bytes", m_server->m_last_values.getByteCount()},
+                {"updates", m_server->m_last_values.getUpdateCount()},
+            }},
+        };
+        return streamz.dump();
+    }
+
+    std::string NatsMonitor::routez(){
+        nlohmann::json routes = nlohmann::json::array();
+        {
+            std::shared_lock<std::shared_mutex> lock(m_server->m_routes_mutex);
+            for(auto& pair: m_server->m_routes){
+                NatsRoute* route = pair.second.get();
+                routes.push_back({
+                    {"route_id", route->getRouteId()},
+                    {"remote_server_id", route->getRemoteServerId()},
+                    {"solicited", route->isSolicited()},
+                    {"remote_subjects", route->getRemoteSubjectCount()},
+                    {"remote_filter_bytes", route->getRemoteFilterBytes()},
+                    {"in_msgs", route->getInMsgs()},
+                    {"in_bytes", route->getInBytes()},
+                    {"in_msgs_unwanted", route->getInUnwanted()},
+                    {"out_msgs", route->getOutMsgs()},
+                    {"out_bytes", route->getOutBytes()},
+                });
+            }
+        }
+        nlohmann::json summary;
+        {
+            std::lock_guard<std::mutex> lock(m_server->m_route_interest_mutex);
+            NatsInterestSummary& interest = m_server->m_interest_summary;
+            summary = {
+                {"subjects", interest.getSubjectCount()},
+                {"announced", interest.getAnnouncedCount()},
+                {"filters", interest.getFilterEntries().size()},
+                {"filter_bytes", interest.getFilterBytes()},
+                {"folded_prefixes", interest.getFoldedCount()},
+                {"max_fanout", interest.getMaxFanout()},
+            };
+        }
+        nlohmann::json routez = {
+            {"server_id", m_server->m_server_id},
+            {"cluster_port", m_server->m_cluster_port},
+            {"interest_summary", summary},
+            {"routes", routes},
+        };
+        return routez.dump();
+    }
+
+    std::string NatsMonitor::latz(const std::string& query){
+        NatsLatencyStats& latency = NatsLatencyStats::shared();
+        std::string enable = queryValue(query, "enable");
+        if(enable == "1" || enable == "true"){
+            latency.setEnabled(true);
+        } else if(enable == "0" || enable == "false"){
+            latency.setEnabled(false);
+        }
+        std::string reset = queryValue(query, "reset");
+        if(reset == "1" || reset == "true"){
+            latency.reset();
+        }
+        nlohmann::json latz = {
+            {"enabled", latency.isEnabled()},
+            {"parse", summaryToJson(latency.m_parse.summary())},
+            {"match", summaryToJson(latency.m_match.summary())},
+            {"publish", summaryToJson(latency.m_publish.summary())},
+        };
+        return latz.dump();
+    }
+}
@@ -3,6 +3,7 @@
 #include "../include/nats/client.hpp"
 #include "../include/nats/custom_base_exceptions.hpp"
 #include "../include/nats/custom_specific_exceptions.hpp"
+#include "../include/nats/latency.hpp"
 #include <iostream>
 #include <cstring>
 #include <string_view>
@@ -12,6 +13,7 @@ using namespace std;
 
 namespace nats{
     void NatsParser::parse (NatsClient* c, char* buf, int buffer_size){
+        NatsLatencyTimer parse_timer(NatsLatencyStats::shared().m_parse);
         try{
             char b;
             for(int i=0;i<buffer_size;i++){
@@ -26,6 +28,8 @@ namespace nats{
                             c->m_state = NatsParserState::OP_S;
                         } else if(b=='U' || b=='u'){
                             c->m_state = NatsParserState::OP_U;
+                        } else if(b=='W' || b=='w'){
+                            c->m_state = NatsParserState::OP_W;
                         }else{
                             throw UnknownProtocolOperationException();
                         }
@@ -102,12 +106,16 @@ namespace nats{
                                 json_view = string_view(buf + c->m_as, i - c->m_drop - c->m_as);
                             } 
 
+                            nlohmann::json options;
                             try{
-                                nlohmann::json::parse(json_view, nullptr, true);
+                                options = nlohmann::json::parse(json_view, nullptr, true);
                             } catch(const nlohmann::json::parse_error& e){
                                 //indicates invalid json
                                 throw JsonParseException();
                             }
+                            //{"shm":true} asks for the shared memory transport, anything else keeps the socket
+                            auto shm = options.find("shm");
+                            c->m_shm_requested = shm != options.end() && shm->is_boolean() && shm->get<bool>();
 
                             //process connect
                             c->processConnect();
@@ -117,8 +125,7 @@ namespace nats{
                                 if(c->maxArgSizeReached()){
                                     throw MaximumArgumentSizeReachedException();
                                 }
-                                c->m_arg_buffer[c->m_arg_len] = b;
-                                c->m_arg_len++;
+                                c->appendArgByte(b);
                             }
                         }
                         
@@ -228,8 +235,7 @@ namespace nats{
                                 if(c->maxArgSizeReached()){
                                     throw MaximumArgumentSizeReachedException();
                                 }
-                                c->m_arg_buffer[c->m_arg_len] = b;
-                                c->m_arg_len++;
+                                c->appendArgByte(b);
                             }
                         }
                         
@@ -245,8 +251,7 @@ namespace nats{
                                 if(c->maxMessageSizeReached()){
                                     throw MaximumMessageSizeReachedException();
                                 }
-                                c->m_msg_buffer[c->m_msg_len] = b;
-                                c->m_msg_len++;
+                                c->appendMsgByte(b);
                             }
                         }
                         break;
@@ -321,8 +326,7 @@ namespace nats{
                                 if(c->maxArgSizeReached()){
                                     throw MaximumArgumentSizeReachedException();
                                 }
-                                c->m_arg_buffer[c->m_arg_len] = b;
-                                c->m_arg_len++;
+                                c->appendArgByte(b);
                             }
                         }
                         
@@ -337,6 +341,8 @@ namespace nats{
                     case NatsParserState::OP_UN:
                         if(b=='S' || b=='s'){
                             c->m_state = NatsParserState::OP_UNS;
+                        } else if(b=='W' || b=='w'){
+                            c->m_state = NatsParserState::OP_UNW;
                         } else {
                             throw UnknownProtocolOperationException();
                         }
@@ -389,8 +395,139 @@ namespace nats{
                                 if(c->maxArgSizeReached()){
                                     throw MaximumArgumentSizeReachedException();
                                 }
-                                c->m_arg_buffer[c->m_arg_len] = b;
-                                c->m_arg_len++;
+                                c->appendArgByte(b);
+                            }
+                        }
+                        break;
+                    case NatsParserState::OP_W:
+                        if(b=='A' || b=='a'){
+                            c->m_state = NatsParserState::OP_WA;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_WA:
+                        if(b=='T' || b=='t'){
+                            c->m_state = NatsParserState::OP_WAT;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_WAT:
+                        if(b=='C' || b=='c'){
+                            c->m_state = NatsParserState::OP_WATC;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_WATC:
+                        if(b=='H' || b=='h'){
+                            c->m_state = NatsParserState::OP_WATCH;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_WATCH:
+                        if(b==' '||b=='\t'){
+                            c->m_state = NatsParserState::OP_WATCH_SPC;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_WATCH_SPC:
+                        if(b==' '||b=='\t'){
+                        } else {
+                            c->m_state = NatsParserState::WATCH_ARG;
+                            c->m_as = i;
+                        }
+                        break;
+                    case NatsParserState::WATCH_ARG:
+                        if(b=='\r'){
+                            c->m_drop=1;
+                        } else if(b=='\n'){
+                            //string view is memory efficient
+                            //as it doesnt copy contents rather just gives a view of the memory contents of the char buffer
+                            string_view arg_view;
+                            if(c->m_arg_len>0){
+                                arg_view = string_view(c->m_arg_buffer,c->m_arg_len);
+                            } else{
+                                arg_view = string_view(buf + c->m_as, i - c->m_drop - c->m_as);
+                            } 
+
+                            c->processWatch(arg_view);
+                            c->resetParsingVars();
+                        } else {
+                            if(c->m_arg_len>0){
+                                if(c->maxArgSizeReached()){
+                                    throw MaximumArgumentSizeReachedException();
+                                }
+                                c->appendArgByte(b);
+                            }
+                        }
+                        break;
+                    case NatsParserState::OP_UNW:
+                        if(b=='A' || b=='a'){
+                            c->m_state = NatsParserState::OP_UNWA;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_UNWA:
+                        if(b=='T' || b=='t'){
+                            c->m_state = NatsParserState::OP_UNWAT;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_UNWAT:
+                        if(b=='C' || b=='c'){
+                            c->m_state = NatsParserState::OP_UNWATC;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_UNWATC:
+                        if(b=='H' || b=='h'){
+                            c->m_state = NatsParserState::OP_UNWATCH;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_UNWATCH:
+                        if(b==' '||b=='\t'){
+                            c->m_state = NatsParserState::OP_UNWATCH_SPC;
+                        } else {
+                            throw UnknownProtocolOperationException();
+                        }
+                        break;
+                    case NatsParserState::OP_UNWATCH_SPC:
+                        if(b==' '||b=='\t'){
+                        } else {
+                            c->m_state = NatsParserState::UNWATCH_ARG;
+                            c->m_as = i;
+                        }
+                        break;
+                    case NatsParserState::UNWATCH_ARG:
+                        if(b=='\r'){
+                            c->m_drop=1;
+                        } else if(b=='\n'){
+                            //string view is memory efficient
+                            //as it doesnt copy contents rather just gives a view of the memory contents of the char buffer
+                            string_view arg_view;
+                            if(c->m_arg_len>0){
+                                arg_view = string_view(c->m_arg_buffer,c->m_arg_len);
+                            } else{
+                                arg_view = string_view(buf + c->m_as, i - c->m_drop - c->m_as);
+                            } 
+
+                            c->processUnwatch(arg_view);
+                            c->resetParsingVars();
+                        } else {
+                            if(c->m_arg_len>0){
+                                if(c->maxArgSizeReached()){
+                                    throw MaximumArgumentSizeReachedException();
+                                }
+                                c->appendArgByte(b);
                             }
                         }
                         break;
@@ -399,6 +536,8 @@ namespace nats{
                         break;
                 }
             }
+            //SUB/UNSUB operations of this read are applied to the sublist together
+            c->flushPendingSubscriptions();
             //This indicates that the buffer is ending but the argument list hasnt been completely sent yet
             if(c->m_state==NatsParserState::OP_START){
                 //Operation successfully parsed and we are back to OP_START
@@ -407,20 +546,29 @@ namespace nats{
                 || c->m_state==NatsParserState::PUB_ARG
                 || c->m_state==NatsParserState::SUB_ARG
                 || c->m_state==NatsParserState::UNSUB_ARG
+                || c->m_state==NatsParserState::WATCH_ARG
+                || c->m_state==NatsParserState::UNWATCH_ARG
                 ){
                 if(c->m_arg_len==0){
-                    c->m_arg_len = buffer_size - c->m_as;
-                    memcpy(c->m_arg_buffer, buf+c->m_as, c->m_arg_len);
+                    //a trailing '\r' (m_drop) isn't part of the argument
+                    c->saveSplitArg(buf+c->m_as, buffer_size - c->m_as - c->m_drop);
                 }
             } else if(c->m_state==NatsParserState::MSG_PAYLOAD) {
                 if(c->m_msg_len==0){
                     if(c->m_as==buffer_size){
                         c->m_as =0;
                     } else{
-                        c->m_msg_len = buffer_size - c->m_as;
-                        memcpy(c->m_msg_buffer, buf+c->m_as, c->m_msg_len); 
+                        c->saveSplitMsg(buf+c->m_as, buffer_size - c->m_as);
                     }
                 }
+            } else if(c->m_state==NatsParserState::MSG_END_R) {
+                //the buffer ended right after the '\r' of the payload, so the payload has to be kept for the '\n' in the next buffer
+                if(c->m_msg_len==0){
+                    c->saveSplitMsg(buf+c->m_as, buffer_size - c->m_as - c->m_drop);
+                    //an empty payload is then read as an empty view at the start of the next buffer
+                    c->m_as = 0;
+                    c->m_drop = 0;
+                }
             }
         } catch (const NatsParserException &ex) {
             c->closeConnection("A Parser Exception occured : " + string(ex.what()) + "\r\n");
@@ -0,0 +1,119 @@
+#include "../include/nats/pending_set.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr uint64_t WORD_BITS = 64;
+    }
+
+    NatsPendingSet::NatsPendingSet(std::size_t max_pending):
+        m_words(std::max<std::size_t>(1, (max_pending + WORD_BITS - 1) / WORD_BITS), 0),
+        m_deadlines(m_words.size(), 0), m_base(0), m_head(0), m_count(0), m_max_pending(max_pending){
+    }
+
+    std::size_t NatsPendingSet::wordIndex(uint64_t seq) const{
+        return (m_head + (seq - m_base) / WORD_BITS) % m_words.size();
+    }
+
+    bool NatsPendingSet::canAdd(uint64_t seq) const{
+        //the words are whole, so the window can be wider than max_pending, the count is what limits
+        if(m_count >= m_max_pending){
+            return false;
+        }
+        //an empty window moves to wherever the next seq is
+        return m_count == 0 || (seq >= m_base && seq - m_base < capacity());
+    }
+
+    bool NatsPendingSet::add(uint64_t seq, int64_t deadline){
+        if(contains(seq)){
+            return true;
+        }
+        if(!canAdd(seq)){
+            return false;
+        }
+        if(m_count == 0){
+            m_base = seq - seq % WORD_BITS;
+            m_head = 0;
+        }
+        std::size_t index = wordIndex(seq);
+        uint64_t bit = uint64_t(1) << ((seq - m_base) % WORD_BITS);
+        m_words[index] |= bit;
+        m_deadlines[index] = std::max(m_deadlines[index], deadline);
+        m_count++;
+        return true;
+    }
+
+    bool NatsPendingSet::contains(uint64_t seq) const{
+        if(m_count == 0 || seq < m_base || seq - m_base >= capacity()){
+            return false;
+        }
+        return m_words[wordIndex(seq)] & (uint64_t(1) << ((seq - m_base) % WORD_BITS));
+    }
+
+    bool NatsPendingSet::remove(uint64_t seq){
+        if(!contains(seq)){
+            return false;
+        }
+        std::size_t index = wordIndex(seq);
+        m_words[index] &= ~(uint64_t(1) << ((seq - m_base) % WORD_BITS));
+        if(m_words[index] == 0){
+            m_deadlines[index] = 0;
+        }
+        m_count--;
+        //the window starts at the oldest word with something pending, acks in order keep sliding it forward
+        while(m_count > 0 && m_words[m_head] == 0){
+            m_head = (m_head + 1) % m_words.size();
+            m_base += WORD_BITS;
+        }
+        return true;
+    }
+
+    void NatsPendingSet::collectDue(int64_t now, int64_t next_deadline, std::vector<uint64_t>& due){
+        std::size_t remaining = m_count;
+        for(std::size_t i = 0; i < m_words.size() && remaining > 0; i++){
+            std::size_t index = (m_head + i) % m_words.size();
+            uint64_t word = m_words[index];
+            if(word == 0){
+                continue;
+            }
+            remaining -= __builtin_popcountll(word);
+            if(m_deadlines[index] > now){
+                continue;
+            }
+            m_deadlines[index] = next_deadline;
+            uint64_t word_base = m_base + i * WORD_BITS;
+            while(word != 0){
+                due.push_back(word_base + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+
+    int64_t NatsPendingSet::earliestDeadline() const{
+        int64_t earliest = 0;
+        std::size_t remaining = m_count;
+        for(std::size_t i = 0; i < m_words.size() && remaining > 0; i++){
+            std::size_t index = (m_head + i) % m_words.size();
+            if(m_words[index] == 0){
+                continue;
+            }
+            remaining -= __builtin_popcountll(m_words[index]);
+            if(earliest == 0 || m_deadlines[index] < earliest){
+                earliest = m_deadlines[index];
+            }
+        }
+        return earliest;
+    }
+
+    std::size_t NatsPendingSet::size() const{
+        return m_count;
+    }
+
+    std::size_t NatsPendingSet::capacity() const{
+        return m_words.size() * WORD_BITS;
+    }
+}
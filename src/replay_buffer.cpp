@@ -0,0 +1,189 @@
+#include "../include/nats/replay_buffer.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/sublist.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr uint64_t RECORD_ALIGNMENT = 8;
+
+        uint64_t recordSize(std::size_t subject_size, std::size_t payload_size){
+            uint64_t size = sizeof(NatsReplayRecordHeader) + subject_size + payload_size;
+            return (size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+        }
+    }
+
+    NatsReplayBuffer::NatsReplayBuffer(NatsReplayBufferConfig config): m_config(std::move(config)), m_head(0), m_tail(0),
+        m_end(0), m_count(0), m_appended(0), m_evicted(0), m_oversized(0), m_stored_count(0), m_stored_bytes(0){
+        m_end = m_config.m_capacity;
+    }
+
+    int64_t NatsReplayBuffer::nowNanos(){
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool NatsReplayBuffer::open(){
+        try {
+            NatsClient::convertSubjectToList(m_config.m_subject, false, m_subject_list);
+        } catch (const std::exception& e){
+            std::cerr << "replay buffer " << m_config.m_name << " has an invalid subject: " << e.what() << std::endl;
+            return false;
+        }
+        if(m_config.m_capacity < recordSize(0, 0) || m_config.m_capacity > UINT32_MAX){
+            std::cerr << "replay buffer " << m_config.m_name << " needs a capacity between " << recordSize(0, 0) << " and 4GB" << std::endl;
+            return false;
+        }
+        m_data.reset(new (std::nothrow) char[m_config.m_capacity]);
+        if(m_data == nullptr){
+            std::cerr << "can't allocate " << m_config.m_capacity << " bytes for replay buffer " << m_config.m_name << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const NatsReplayBufferConfig& NatsReplayBuffer::getConfig() const{
+        return m_config;
+    }
+
+    bool NatsReplayBuffer::matches(const std::vector<std::string>& subject_list) const{
+        return NatsSublist::subjectMatches(m_subject_list, subject_list);
+    }
+
+    void NatsReplayBuffer::lock(){
+        m_mutex.lock();
+    }
+
+    void NatsReplayBuffer::unlock(){
+        m_mutex.unlock();
+    }
+
+    const NatsReplayRecordHeader* NatsReplayBuffer::recordAt(uint64_t offset) const{
+        return reinterpret_cast<const NatsReplayRecordHeader*>(m_data.get() + offset);
+    }
+
+    void NatsReplayBuffer::evictOldest(){
+        m_head += recordAt(m_head)->m_record_size;
+        m_count--;
+        m_evicted.fetch_add(1, std::memory_order_relaxed);
+        if(m_count == 0){
+            m_head = m_tail = 0;
+            m_end = m_config.m_capacity;
+        } else if(m_head == m_end){
+            //the rest starts over at the front
+            m_head = 0;
+            m_end = m_config.m_capacity;
+        }
+    }
+
+    void NatsReplayBuffer::append(std::string_view subject, std::string_view payload){
+        uint64_t record_size = recordSize(subject.size(), payload.size());
+        if(record_size > m_config.m_capacity){
+            m_oversized.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        //find record_size free bytes at m_tail, dropping the oldest records until there are
+        while(true){
+            if(m_count == 0 || m_tail > m_head){
+                //free space is after m_tail up to the end (and before m_head, which only counts once the tail wraps)
+                if(m_config.m_capacity - m_tail >= record_size){
+                    break;
+                }
+                //the rest of the ring is too short, it is skipped and the tail starts over at the front
+                m_end = m_tail;
+                m_tail = 0;
+                continue;
+            }
+            //wrapped, the free space is [m_tail, m_head)
+            if(m_head - m_tail >= record_size){
+                break;
+            }
+            evictOldest();
+        }
+        char* record = m_data.get() + m_tail;
+        NatsReplayRecordHeader* header = reinterpret_cast<NatsReplayRecordHeader*>(record);
+        header->m_record_size = record_size;
+        header->m_payload_size = payload.size();
+        header->m_timestamp_ns = nowNanos();
+        header->m_subject_size = subject.size();
+        header->m_reserved16 = 0;
+        header->m_reserved = 0;
+        memcpy(record + sizeof(NatsReplayRecordHeader), subject.data(), subject.size());
+        memcpy(record + sizeof(NatsReplayRecordHeader) + subject.size(), payload.data(), payload.size());
+        m_tail += record_size;
+        m_count++;
+        m_appended.fetch_add(1, std::memory_order_relaxed);
+        m_stored_count.store(m_count, std::memory_order_relaxed);
+        uint64_t used = m_tail > m_head ? m_tail - m_head : m_end - m_head + m_tail;
+        m_stored_bytes.store(used, std::memory_order_relaxed);
+    }
+
+    uint64_t NatsReplayBuffer::appendFrames(const std::vector<std::string>& subject_list, int64_t since_ns, int sub_id,
+        std::string& frames, uint64_t& payload_bytes){
+        thread_local std::vector<std::string> subject_tokens;
+        uint64_t matched = 0;
+        uint64_t offset = m_head;
+        for(uint64_t i = 0; i < m_count; i++){
+            const NatsReplayRecordHeader* header = recordAt(offset);
+            offset += header->m_record_size;
+            if(offset == m_end){
+                offset = 0;
+            }
+            if(header->m_timestamp_ns < since_ns){
+                continue;
+            }
+            std::string_view subject(reinterpret_cast<const char*>(header) + sizeof(NatsReplayRecordHeader), header->m_subject_size);
+            NatsClient::convertSubjectToList(subject, true, subject_tokens);
+            if(!NatsSublist::subjectMatches(subject_list, subject_tokens)){
+                continue;
+            }
+            //"MSG <subject> <sid> <size>\r\n<payload>\r\n" like deliverMessage writes it
+            char args[32];
+            char* pos = args;
+            *pos++ = ' ';
+            pos = std::to_chars(pos, args + sizeof(args), sub_id).ptr;
+            *pos++ = ' ';
+            pos = std::to_chars(pos, args + sizeof(args), header->m_payload_size).ptr;
+            frames.append("MSG ", 4);
+            frames.append(subject);
+            frames.append(args, pos - args);
+            frames.append("\r\n", 2);
+            frames.append(subject.data() + subject.size(), header->m_payload_size);
+            frames.append("\r\n", 2);
+            payload_bytes += header->m_payload_size;
+            matched++;
+        }
+        return matched;
+    }
+
+    uint64_t NatsReplayBuffer::getCapacity() const{
+        return m_config.m_capacity;
+    }
+
+    uint64_t NatsReplayBuffer::getMessageCount() const{
+        return m_stored_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsReplayBuffer::getByteCount() const{
+        return m_stored_bytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsReplayBuffer::getAppendedCount() const{
+        return m_appended.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsReplayBuffer::getEvictedCount() const{
+        return m_evicted.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsReplayBuffer::getOversizedCount() const{
+        return m_oversized.load(std::memory_order_relaxed);
+    }
+}
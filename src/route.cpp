@@ -0,0 +1,424 @@
+#include "../include/nats/route.hpp"
+#include "../include/nats/server.hpp"
+#include "../include/nats/client.hpp"
+
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr std::size_t ROUTE_READ_SIZE = 64 * 1024;
+        constexpr std::size_t MAX_ROUTE_PAYLOAD = 64 * 1024 * 1024;
+    }
+
+    NatsRoute::NatsRoute(NatsServer* server, int fd, long long route_id, bool solicited): m_server(server), m_fd(fd),
+        m_route_id(route_id), m_solicited(solicited), m_remote_server_id(0), m_next_sub_id(1), m_next_filter_sub_id(-1), m_remote_filter_bytes(0), m_remote_subjects(0),
+        m_in_msgs(0), m_in_bytes(0), m_in_unwanted(0), m_out_msgs(0), m_out_bytes(0){
+    }
+
+    NatsRoute::~NatsRoute(){
+        shutdown();
+        if(m_thread.joinable()){
+            m_thread.join();
+        }
+        close(m_fd);
+    }
+
+    void NatsRoute::start(){
+        m_thread = std::thread([this]() {
+            readLoop();
+            m_server->removeRoute(m_route_id);
+        });
+    }
+
+    void NatsRoute::shutdown(){
+        ::shutdown(m_fd, SHUT_RDWR);
+    }
+
+    void NatsRoute::readLoop(){
+        std::string buffer;
+        char chunk[ROUTE_READ_SIZE];
+        while(true){
+            ssize_t received = recv(m_fd, chunk, sizeof(chunk), 0);
+            if(received <= 0){
+                return;
+            }
+            long long used;
+            //most reads end on a complete operation, those are handled straight from the read buffer
+            if(buffer.empty()){
+                used = processData(chunk, received);
+                if(used >= 0 && used < received){
+                    buffer.assign(chunk + used, received - used);
+                }
+            } else {
+                buffer.append(chunk, received);
+                used = processData(buffer.data(), buffer.size());
+                if(used > 0){
+                    buffer.erase(0, used);
+                }
+            }
+            flushPendingSubs();
+            if(used < 0){
+                std::cerr << "route " << m_route_id << " closed, the peer sent something unexpected or went away" << std::endl;
+                return;
+            }
+        }
+    }
+
+    long long NatsRoute::processData(const char* data, std::size_t size){
+        std::size_t pos = 0;
+        while(pos < size){
+            const char* line_end = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+            if(line_end == nullptr){
+                return pos;
+            }
+            std::size_t line_size = line_end - (data + pos);
+            std::string_view line(data + pos, line_size > 0 && line_end[-1] == '\r' ? line_size - 1 : line_size);
+            std::size_t next = pos + line_size + 1;
+            if(line.rfind("RMSG ", 0) == 0){
+                //RMSG <subject> <size>, the payload and its \r\n follow the line
+                std::string_view args = line.substr(5);
+                std::size_t space = args.rfind(' ');
+                if(space == std::string_view::npos){
+                    return -1;
+                }
+                std::size_t payload_size = 0;
+                std::string_view size_str = args.substr(space + 1);
+                auto parsed = std::from_chars(size_str.data(), size_str.data() + size_str.size(), payload_size);
+                if(parsed.ec != std::errc() || parsed.ptr != size_str.data() + size_str.size() || payload_size > MAX_ROUTE_PAYLOAD){
+                    return -1;
+                }
+                if(size - next < payload_size + 2){
+                    return pos;
+                }
+                //subscriptions before the message, a RS+ in the same read has to be in the sublist by now
+                flushPendingSubs();
+                std::string subject(args.substr(0, space));
+                std::string_view payload(data + next, payload_size);
+                thread_local std::vector<std::string> subject_list;
+                try {
+                    NatsClient::convertSubjectToList(subject, true, subject_list);
+                    if(!m_server->publishFromRoute(subject, subject_list, payload)){
+                        m_in_unwanted.fetch_add(1, std::memory_order_relaxed);
+                    }
+                } catch (const std::exception& e){
+                    std::cerr << "route " << m_route_id << " dropped a message to " << subject << ": " << e.what() << std::endl;
+                }
+                m_in_msgs.fetch_add(1, std::memory_order_relaxed);
+                m_in_bytes.fetch_add(payload_size, std::memory_order_relaxed);
+                next += payload_size + 2;
+            } else if(line.rfind("RF+ ", 0) == 0){
+                //RF+ <prefix>.> <bits>, the bitmap of bits/8 bytes and its \r\n follow the line
+                std::string_view args = line.substr(4);
+                std::size_t space = args.rfind(' ');
+                if(space == std::string_view::npos){
+                    return -1;
+                }
+                uint64_t bits = 0;
+                std::string_view bits_str = args.substr(space + 1);
+                auto parsed = std::from_chars(bits_str.data(), bits_str.data() + bits_str.size(), bits);
+                if(parsed.ec != std::errc() || parsed.ptr != bits_str.data() + bits_str.size() || !NatsSummaryFilter::isValidSize(bits)){
+                    return -1;
+                }
+                if(size - next < bits / 8 + 2){
+                    return pos;
+                }
+                if(!processFilter(args.substr(0, space), bits, std::string_view(data + next, bits / 8))){
+                    return -1;
+                }
+                next += bits / 8 + 2;
+            } else if(!processLine(line)){
+                return -1;
+            }
+            pos = next;
+        }
+        return pos;
+    }
+
+    bool NatsRoute::processLine(std::string_view line){
+        if(line.empty()){
+            return true;
+        }
+        bool add = line.rfind("RS+ ", 0) == 0;
+        if(add || line.rfind("RS- ", 0) == 0){
+            std::string subject(line.substr(4));
+            std::vector<std::string> subject_list;
+            try {
+                NatsClient::convertSubjectToList(subject, false, subject_list);
+            } catch (const std::exception&){
+                return false;
+            }
+            auto it = m_remote_interest.find(subject);
+            if(add){
+                //RS+ is idempotent, a subject can be announced again when the route was set up while it changed
+                if(it == m_remote_interest.end()){
+                    int sub_id = m_next_sub_id++;
+                    m_remote_interest.emplace(std::move(subject), sub_id);
+                    m_pending_subs.emplace_back(sub_id, std::move(subject_list));
+                    m_remote_subjects.fetch_add(1, std::memory_order_relaxed);
+                }
+                return true;
+            }
+            if(it != m_remote_interest.end()){
+                //a RS+ of the same subject may still be waiting in m_pending_subs
+                flushPendingSubs();
+                NatsSubscription subscription{it->second, m_route_id};
+                m_server->m_sublist->removeSubscription(subscription, subject_list);
+                m_remote_interest.erase(it);
+                m_remote_subjects.fetch_sub(1, std::memory_order_relaxed);
+                m_server->notifyInterestChanges();
+            }
+            return true;
+        }
+        if(line.rfind("RF- ", 0) == 0){
+            return removeFilter(line.substr(4));
+        }
+        if(line.rfind("RFS ", 0) == 0 || line.rfind("RFC ", 0) == 0){
+            return updateFilterBits(line.substr(4), line[2] == 'S');
+        }
+        if(line.rfind("ROUTE ", 0) == 0){
+            long long server_id = 0;
+            std::string_view id_str = line.substr(6);
+            auto parsed = std::from_chars(id_str.data(), id_str.data() + id_str.size(), server_id);
+            if(parsed.ec != std::errc() || server_id <= 0){
+                return false;
+            }
+            m_remote_server_id = server_id;
+            //the server already said why it doesn't want the route, the read loop ends quietly once the socket is shut down
+            if(!m_server->identifyRoute(this)){
+                shutdown();
+            }
+            return true;
+        }
+        if(line == "PING"){
+            sendAll("PONG\r\n", 6);
+            return true;
+        }
+        return line == "PONG";
+    }
+
+    bool NatsRoute::processFilter(std::string_view entry, uint64_t bits, std::string_view bitmap){
+        auto filter = std::make_unique<NatsSummaryFilter>(static_cast<uint32_t>(bits), bitmap);
+        auto it = m_remote_filter_ids.find(std::string(entry));
+        if(it != m_remote_filter_ids.end()){
+            //a filter that outgrew its size, the subscription stays
+            std::unique_lock<std::shared_mutex> lock(m_filters_mutex);
+            std::unique_ptr<NatsSummaryFilter>& current = m_filters[it->second];
+            m_remote_filter_bytes.fetch_add(bits / 8 - current->getBits() / 8, std::memory_order_relaxed);
+            current = std::move(filter);
+            return true;
+        }
+        std::vector<std::string> subject_list;
+        try {
+            NatsClient::convertSubjectToList(std::string(entry), false, subject_list);
+        } catch (const std::exception&){
+            return false;
+        }
+        if(subject_list.back() != ">"){
+            return false;
+        }
+        int sub_id = m_next_filter_sub_id--;
+        {
+            //in place before the sublist can find the subscription
+            std::unique_lock<std::shared_mutex> lock(m_filters_mutex);
+            m_filters.emplace(sub_id, std::move(filter));
+        }
+        m_remote_filter_ids.emplace(std::string(entry), sub_id);
+        m_pending_subs.emplace_back(sub_id, std::move(subject_list));
+        m_remote_subjects.fetch_add(1, std::memory_order_relaxed);
+        m_remote_filter_bytes.fetch_add(bits / 8, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool NatsRoute::removeFilter(std::string_view entry){
+        auto it = m_remote_filter_ids.find(std::string(entry));
+        if(it == m_remote_filter_ids.end()){
+            return true;
+        }
+        std::vector<std::string> subject_list;
+        NatsClient::convertSubjectToList(it->first, false, subject_list);
+        //a RF+ of the same prefix may still be waiting in m_pending_subs
+        flushPendingSubs();
+        NatsSubscription subscription{it->second, m_route_id};
+        m_server->m_sublist->removeSubscription(subscription, subject_list);
+        {
+            std::unique_lock<std::shared_mutex> lock(m_filters_mutex);
+            auto filter = m_filters.find(it->second);
+            m_remote_filter_bytes.fetch_sub(filter->second->getBits() / 8, std::memory_order_relaxed);
+            m_filters.erase(filter);
+        }
+        m_remote_filter_ids.erase(it);
+        m_remote_subjects.fetch_sub(1, std::memory_order_relaxed);
+        m_server->notifyInterestChanges();
+        return true;
+    }
+
+    bool NatsRoute::updateFilterBits(std::string_view args, bool set){
+        //<prefix>.> <bit> <bit>...
+        std::size_t space = args.find(' ');
+        if(space == std::string_view::npos){
+            return false;
+        }
+        auto it = m_remote_filter_ids.find(std::string(args.substr(0, space)));
+        if(it == m_remote_filter_ids.end()){
+            return false;
+        }
+        std::unique_lock<std::shared_mutex> lock(m_filters_mutex);
+        NatsSummaryFilter& filter = *m_filters[it->second];
+        const char* pos = args.data() + space;
+        const char* end = args.data() + args.size();
+        while(pos < end){
+            uint32_t bit = 0;
+            auto parsed = std::from_chars(pos + 1, end, bit);
+            if(*pos != ' ' || parsed.ec != std::errc() || bit >= filter.getBits()){
+                return false;
+            }
+            if(set){
+                filter.set(bit);
+            } else {
+                filter.clear(bit);
+            }
+            pos = parsed.ptr;
+        }
+        return true;
+    }
+
+    bool NatsRoute::wants(int sub_id, std::string_view subject){
+        //exact subjects have positive sub ids and need no look at all
+        if(sub_id > 0){
+            return true;
+        }
+        std::shared_lock<std::shared_mutex> lock(m_filters_mutex);
+        auto it = m_filters.find(sub_id);
+        return it == m_filters.end() || it->second->mayContain(subject);
+    }
+
+    void NatsRoute::flushPendingSubs(){
+        if(m_pending_subs.empty()){
+            return;
+        }
+        m_server->m_sublist->addSubscriptions(m_route_id, m_pending_subs);
+        m_pending_subs.clear();
+        m_server->notifyInterestChanges();
+    }
+
+    void NatsRoute::sendAll(const char* data, std::size_t size){
+        std::lock_guard<std::mutex> lock(m_write_mutex);
+        while(size > 0){
+            ssize_t sent = send(m_fd, data, size, MSG_NOSIGNAL);
+            if(sent < 0 && errno == EINTR){
+                continue;
+            }
+            if(sent <= 0){
+                return;
+            }
+            data += sent;
+            size -= sent;
+        }
+    }
+
+    void NatsRoute::sendRoute(long long server_id){
+        std::string msg = "ROUTE " + std::to_string(server_id) + "\r\n";
+        sendAll(msg.data(), msg.size());
+    }
+
+    void NatsRoute::sendInterestChanges(const std::string& changes){
+        if(!changes.empty()){
+            sendAll(changes.data(), changes.size());
+        }
+    }
+
+    void NatsRoute::forward(std::string_view subject, std::string_view payload){
+        char size_str[24];
+        char* pos = size_str;
+        *pos++ = ' ';
+        pos = std::to_chars(pos, size_str + sizeof(size_str), payload.size()).ptr;
+        *pos++ = '\r';
+        *pos++ = '\n';
+        struct iovec iov[5] = {
+            {const_cast<char*>("RMSG "), 5},
+            {const_cast<char*>(subject.data()), subject.size()},
+            {size_str, static_cast<size_t>(pos - size_str)},
+            {const_cast<char*>(payload.data()), payload.size()},
+            {const_cast<char*>("\r\n"), 2},
+        };
+        std::size_t total = 5 + subject.size() + (pos - size_str) + payload.size() + 2;
+        {
+            std::lock_guard<std::mutex> lock(m_write_mutex);
+            //a route is not dropped like a slow client, so a short write is finished before anything else goes out
+            ssize_t sent = writev(m_fd, iov, 5);
+            if(sent >= 0 && static_cast<std::size_t>(sent) < total){
+                std::string rest;
+                rest.reserve(total - sent);
+                for(const struct iovec& part: iov){
+                    rest.append(static_cast<const char*>(part.iov_base), part.iov_len);
+                }
+                rest.erase(0, sent);
+                const char* data = rest.data();
+                std::size_t size = rest.size();
+                while(size > 0){
+                    ssize_t more = send(m_fd, data, size, MSG_NOSIGNAL);
+                    if(more < 0 && errno == EINTR){
+                        continue;
+                    }
+                    if(more <= 0){
+                        break;
+                    }
+                    data += more;
+                    size -= more;
+                }
+            }
+        }
+        m_out_msgs.fetch_add(1, std::memory_order_relaxed);
+        m_out_bytes.fetch_add(payload.size(), std::memory_order_relaxed);
+    }
+
+    long long NatsRoute::getRouteId() const{
+        return m_route_id;
+    }
+
+    long long NatsRoute::getRemoteServerId() const{
+        return m_remote_server_id.load();
+    }
+
+    bool NatsRoute::isSolicited() const{
+        return m_solicited;
+    }
+
+    uint64_t NatsRoute::getRemoteSubjectCount() const{
+        return m_remote_subjects.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsRoute::getRemoteFilterBytes() const{
+        return m_remote_filter_bytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsRoute::getInMsgs() const{
+        return m_in_msgs.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsRoute::getInBytes() const{
+        return m_in_bytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsRoute::getInUnwanted() const{
+        return m_in_unwanted.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsRoute::getOutMsgs() const{
+        return m_out_msgs.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsRoute::getOutBytes() const{
+        return m_out_bytes.load(std::memory_order_relaxed);
+    }
+}
@@ -3,9 +3,22 @@
 #include "../include/nats/parser.hpp"
 #include "../include/nats/subscription.hpp"
 #include "../include/nats/sublist.hpp"
+#include "../include/nats/sharded_sublist.hpp"
+#include "../include/nats/monitor.hpp"
+#include "../include/nats/stats.hpp"
+#include "../include/nats/latency.hpp"
+#include "../include/nats/stream.hpp"
+#include "../include/nats/stream_consumer.hpp"
+#include "../include/nats/replay_buffer.hpp"
+#include "../include/nats/last_value_cache.hpp"
+#include "../include/nats/route.hpp"
 
 #include <random>
+#include <algorithm>
+#include <shared_mutex>
+#include <csignal>
 #include <cerrno>
+#include <charconv>
 #include <climits>
 #include <iostream>
 #include <string>
@@ -16,10 +29,14 @@
 #include <unordered_map>
 #include <mutex>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <net/if.h>
 #include <netdb.h>
+#include <poll.h>
 
 using namespace std;
 
@@ -27,34 +44,97 @@ namespace nats {
 
     constexpr int PORT = 4222;  // Telnet-like port
     constexpr int BUFFER_SIZE = 1024;
+    constexpr int MONITOR_PORT = 8222;
+    constexpr const char* MONITOR_HOST = "127.0.0.1";
+    constexpr std::size_t SHM_RING_SIZE = 1024*1024;
+    constexpr int LISTEN_BACKLOG = 4096;
+    constexpr int ACCEPT_BATCH = 64; //connections taken per wakeup of the accept loop
+    constexpr int ACCEPT_POLL_MS = 100; //how often the accept loop looks at whether the server still runs
 
-    NatsServer::NatsServer() {
+    namespace {
+        //replay buffers a publish stored its message in, locked until the publish found its subscribers
+        struct NatsReplayLocks {
+            std::vector<NatsReplayBuffer*>& m_locked;
+            explicit NatsReplayLocks(std::vector<NatsReplayBuffer*>& locked): m_locked(locked){
+            }
+            ~NatsReplayLocks(){
+                release();
+            }
+            void release(){
+                for(NatsReplayBuffer* buffer: m_locked){
+                    buffer->unlock();
+                }
+                m_locked.clear();
+            }
+        };
+
+        //marks a thread as being inside a publish, a local handler publishing from inside a delivery would
+        //otherwise reuse the per thread buffers the outer publish is still iterating over
+        struct NatsPublishScope {
+            bool& m_in_publish;
+            bool m_nested;
+            explicit NatsPublishScope(bool& in_publish): m_in_publish(in_publish), m_nested(in_publish){
+                m_in_publish = true;
+            }
+            ~NatsPublishScope(){
+                if(!m_nested) m_in_publish = false;
+            }
+        };
+    }
+
+    NatsServer::NatsServer(): m_server_fd(-1), m_port(PORT), m_monitor_port(MONITOR_PORT), m_monitor_host(MONITOR_HOST), m_next_local_sub_id(1), m_next_consumer_id(1),
+        m_ack_timer([this](uint64_t consumer_id) { onAckTimer(consumer_id); }), m_cluster_port(0), m_cluster_fd(-1),
+        m_next_route_id(-1), m_interest_summary_seeded(false), m_route_summary_fanout(NatsInterestSummary::DEFAULT_MAX_FANOUT),
+        m_unix_fd(-1), m_shm_ring_size(SHM_RING_SIZE), m_listen_backlog(LISTEN_BACKLOG), m_next_client_thread(0) {
+        m_unix_running = false;
         m_running = false;
+        m_start_time = std::chrono::steady_clock::now();
         random_device rd;
         mt19937 gen(rd());
         uniform_int_distribution<long long> dis(1, LLONG_MAX);
         
         m_server_id = dis(gen);
-        m_sublist = std::make_unique<NatsSublist>();
+        m_sublist = std::make_unique<NatsShardedSublist>();
+        m_stream_lists.push_back(std::make_unique<const std::vector<std::shared_ptr<NatsStream>>>());
+        m_streams = m_stream_lists.back().get();
+        m_replay_buffer_lists.push_back(std::make_unique<const std::vector<std::shared_ptr<NatsReplayBuffer>>>());
+        m_replay_buffers = m_replay_buffer_lists.back().get();
     }
 
     NatsServer::~NatsServer(){
         if(m_running) stopServer();
+        //clients that came in through a unix listener started without startServer
+        stopUnixListener();
+        joinClientThreads();
+        //routes deliver to clients, so they are gone before the clients are
+        stopCluster();
+        //clients go first, their consumers unregister from the ack registry and timer declared after m_clients
+        std::unordered_map<long long, std::unique_ptr<NatsClient>> clients;
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            clients.swap(m_clients);
+        }
+        clients.clear();
+        m_ack_timer.stop();
     }
 
     void NatsServer::startServer(){
-        int server_fd, client_fd;
-        struct sockaddr_in server_addr {}, client_addr{};
-        socklen_t client_len = sizeof(client_addr);
-
-        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (server_fd == -1) {
             perror("socket failed");
             return;
         }
 
+        //a client that disconnects while it is being written to must not take the whole process down with SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+
+        //a restarted server shouldn't have to wait for connections of the previous one to leave TIME_WAIT
+        int reuse = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        struct sockaddr_in server_addr {};
         server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(PORT);
+        server_addr.sin_port = htons(m_port);
         server_addr.sin_addr.s_addr = INADDR_ANY;
 
         if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
@@ -63,7 +143,7 @@ namespace nats {
             return;
         }
 
-        if (listen(server_fd, 5) < 0) {
+        if (listen(server_fd, m_listen_backlog) < 0) {
             perror("listen failed");
             close(server_fd);
             return;
@@ -71,71 +151,239 @@ namespace nats {
 
         m_server_fd = server_fd;
 
-        cout << "Telnet-style server listening on port " << PORT << "...\n";
+        cout << "Telnet-style server listening on port " << m_port << "...\n";
         m_running = true;
+        m_start_time = std::chrono::steady_clock::now();
+        if(m_monitor_port > 0){
+            m_monitor = std::make_unique<NatsMonitor>(this);
+            m_monitor->start(m_monitor_host, m_monitor_port);
+        }
+        if(m_cluster_port > 0){
+            startClusterListener();
+        }
+        if(!m_unix_socket_path.empty()){
+            startUnixListener();
+        }
+
+        acceptClients(server_fd, m_running, true);
+        //only closed once the accept loop is done with it, closing it under a poll or accept4 could hand the number to
+        //a segment file or route socket opened meanwhile
+        {
+            std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+            m_server_fd = -1;
+        }
+        close(server_fd);
+
+        //no more clients can come in through the unix socket either once it is closed
+        stopUnixListener();
+        joinClientThreads();
+        stopServer();
+    }
 
-        // Vector to keep track of client threads
-        std::vector<std::thread> client_threads;
-
-        while (m_running) {
-            struct sockaddr_in client_addr {};
-            int client_fd = accept(m_server_fd, (struct sockaddr*)&client_addr, &client_len);
-            if (client_fd < 0) {
-                if (!m_running || errno == EBADF || errno == EINVAL) break;
-                perror("accept failed");
-                continue; // Don't exit the server, just skip this iteration
-            }
-
-            // Lambda to handle each client in a separate thread
-            client_threads.emplace_back([this, client_fd, client_addr]() mutable {
-                cout << "Client connected: " << inet_ntoa(client_addr.sin_addr) << "\n";
-                std::unique_ptr<NatsClient> client_unique_ptr = std::make_unique<NatsClient>(client_fd, this);
-                NatsClient* client = client_unique_ptr.get();
-                addClient(std::move(client_unique_ptr));
-
-                string initResponse = "INFO {\"server_id\":"+ std::to_string(m_server_id) + ",\"server_name\":\"nats-message-broker\",\"version\":\"1.0.0\",\"client_id\":" + std::to_string(client->m_client_id) + ",\"client_ip\":\"" + std::string(inet_ntoa(client_addr.sin_addr)) + "\",\"host_ip\":\"0.0.0.0\",\"host_port\":" + std::to_string(PORT) + "}\r\n";
-                send(client_fd, initResponse.c_str(), initResponse.size(), 0);
-
-                char buffer[BUFFER_SIZE];
-                while (true) {
-                    memset(buffer, 0, BUFFER_SIZE);
-                    ssize_t bytes_received = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-                    if (bytes_received <= 0) {
-                        cout << "Connection closed or error.\n";
+    void NatsServer::acceptClients(int listen_fd, const std::atomic<bool>& running, bool tcp){
+        struct pollfd poll_fd {listen_fd, POLLIN, 0};
+        while (running) {
+            //threads of clients that left are joined here, so a server that sees many short connections doesn't
+            //pile up finished threads until it stops
+            reapClientThreads();
+            int ready = poll(&poll_fd, 1, ACCEPT_POLL_MS);
+            if (ready < 0 && errno != EINTR) break;
+            if (ready <= 0) continue;
+            if (poll_fd.revents & (POLLNVAL | POLLERR)) break;
+            //after a deploy every client reconnects at once, everything waiting is taken before polling again
+            for (int i = 0; i < ACCEPT_BATCH; i++) {
+                struct sockaddr_in client_addr {};
+                socklen_t client_len = sizeof(client_addr);
+                int client_fd = accept4(listen_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_CLOEXEC);
+                if (client_fd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                        //the connection stays in the backlog, polling again right away would only spin
+                        perror("accept failed");
+                        std::this_thread::sleep_for(std::chrono::milliseconds(ACCEPT_POLL_MS));
                         break;
                     }
-                    nats::NatsParser::parse(client, buffer, bytes_received);
+                    //the listener was closed
+                    return;
+                }
+                if (tcp) {
+                    //MSGs and +OKs are small writes, Nagle would hold each one back until the previous was acknowledged,
+                    //which turns every ack round trip of a stream consumer into a delayed ACK timeout
+                    int no_delay = 1;
+                    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
                 }
+                char ip[INET_ADDRSTRLEN] = "unix";
+                if (tcp) {
+                    inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof(ip));
+                }
+                startClientThread(client_fd, ip);
+            }
+        }
+    }
+
+    void NatsServer::startClientThread(int client_fd, std::string client_ip){
+        std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+        uint64_t key = m_next_client_thread++;
+        m_client_threads.emplace(key, std::thread([this, client_fd, client_ip, key]() {
+            serveClient(client_fd, client_ip);
+            std::lock_guard<std::mutex> finished_lock(m_client_threads_mutex);
+            m_finished_client_threads.push_back(key);
+        }));
+    }
 
-                // Close connections
-                removeClient(client->m_client_id);
-                close(client_fd);
-                cout << "Client disconnected: " << inet_ntoa(client_addr.sin_addr) << "\n";
-            });
+    void NatsServer::reapClientThreads(){
+        std::vector<std::thread> finished;
+        {
+            std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+            for (uint64_t key : m_finished_client_threads) {
+                auto it = m_client_threads.find(key);
+                //joinClientThreads may have taken it already
+                if (it != m_client_threads.end()) {
+                    finished.push_back(std::move(it->second));
+                    m_client_threads.erase(it);
+                }
+            }
+            m_finished_client_threads.clear();
+        }
+        //they are past their last lock, so these joins return right away
+        for (auto& t : finished) {
+            t.join();
         }
+    }
 
-        for (auto& t : client_threads) {
-            if (t.joinable()) t.join();
+    void NatsServer::joinClientThreads(){
+        std::unordered_map<uint64_t, std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+            threads.swap(m_client_threads);
+            m_finished_client_threads.clear();
         }
-        stopServer();
+        for (auto& pair : threads) {
+            if (pair.second.joinable()) pair.second.join();
+        }
+    }
+
+    std::size_t NatsServer::getClientThreadCount(){
+        std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+        return m_client_threads.size();
+    }
+
+    void NatsServer::serveClient(int client_fd, std::string client_ip){
+        cout << "Client connected: " << client_ip << "\n";
+        std::unique_ptr<NatsClient> client_unique_ptr = std::make_unique<NatsClient>(client_fd, this);
+        NatsClient* client = client_unique_ptr.get();
+        client->m_client_ip = client_ip;
+        addClient(std::move(client_unique_ptr));
+
+        string initResponse = "INFO {\"server_id\":"+ std::to_string(m_server_id) + ",\"server_name\":\"nats-message-broker\",\"version\":\"1.0.0\",\"client_id\":" + std::to_string(client->m_client_id) + ",\"client_ip\":\"" + client_ip + "\",\"host_ip\":\"0.0.0.0\",\"host_port\":" + std::to_string(m_port) + "}\r\n";
+        send(client_fd, initResponse.c_str(), initResponse.size(), 0);
+
+        char buffer[BUFFER_SIZE];
+        while (true) {
+            memset(buffer, 0, BUFFER_SIZE);
+            //the socket, or the shared memory ring once a CONNECT switched the client over to it
+            ssize_t bytes_received = client->readInput(buffer, BUFFER_SIZE - 1);
+            if (bytes_received <= 0) {
+                cout << "Connection closed or error.\n";
+                break;
+            }
+            nats::NatsParser::parse(client, buffer, bytes_received);
+        }
+
+        // Close connections
+        removeClient(client->m_client_id);
+        close(client_fd);
+        cout << "Client disconnected: " << client_ip << "\n";
+    }
+
+    bool NatsServer::startUnixListener(){
+        struct sockaddr_un unix_addr {};
+        if(m_unix_socket_path.size() >= sizeof(unix_addr.sun_path)){
+            cerr << "unix socket path too long: " << m_unix_socket_path << endl;
+            return false;
+        }
+        int unix_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(unix_fd == -1){
+            perror("unix socket failed");
+            return false;
+        }
+        //a socket file left behind by a server that didn't shut down cleanly would make the bind fail
+        unlink(m_unix_socket_path.c_str());
+        unix_addr.sun_family = AF_UNIX;
+        memcpy(unix_addr.sun_path, m_unix_socket_path.c_str(), m_unix_socket_path.size());
+        if(bind(unix_fd, (struct sockaddr*)&unix_addr, sizeof(unix_addr)) < 0 || listen(unix_fd, m_listen_backlog) < 0){
+            perror("unix listen failed");
+            close(unix_fd);
+            return false;
+        }
+        m_unix_fd = unix_fd;
+        m_unix_running = true;
+        m_unix_thread = std::thread([this, unix_fd]() {
+            acceptClients(unix_fd, m_unix_running, false);
+        });
+        return true;
+    }
+
+    void NatsServer::stopUnixListener(){
+        //stopServer and the end of startServer can both get here, only one of them gets the listener
+        int unix_fd;
+        std::thread unix_thread;
+        {
+            std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+            m_unix_running = false;
+            unix_fd = m_unix_fd;
+            m_unix_fd = -1;
+            unix_thread.swap(m_unix_thread);
+        }
+        if(unix_fd < 0){
+            return;
+        }
+        //the accept loop sees m_unix_running within one poll, the fd is only closed once it is done with it
+        shutdown(unix_fd, SHUT_RDWR);
+        if(unix_thread.joinable()){
+            unix_thread.join();
+        }
+        close(unix_fd);
+        unlink(m_unix_socket_path.c_str());
     }
 
     void NatsServer::stopServer() { 
         m_running = false; 
-        close(m_server_fd);
+        {
+            //wakes the accept loop, startServer closes the listener once the loop returned
+            std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+            if(m_server_fd >= 0){
+                shutdown(m_server_fd, SHUT_RDWR);
+            }
+        }
+        if(m_monitor){
+            m_monitor->stop();
+        }
+        stopUnixListener();
+        stopCluster();
     }
 
     void NatsServer::addClient(std::unique_ptr<NatsClient>client) {
         std::lock_guard<std::mutex> lock(m_clients_mutex);
         m_clients[client->m_client_id] = std::move(client);
+        m_stats.m_total_connections.fetch_add(1, std::memory_order_relaxed);
     }
 
     void NatsServer::removeClient(long long client_id) {
-        std::lock_guard<std::mutex> lock(m_clients_mutex);
-        auto it = m_clients.find(client_id);
-        if (it != m_clients.end()) {
-            m_clients.erase(it);
+        std::unique_ptr<NatsClient> client;
+        {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            auto it = m_clients.find(client_id);
+            if (it != m_clients.end()) {
+                client = std::move(it->second);
+                m_clients.erase(it);
+                //the monitoring totals are live clients plus these, so both change under the same lock
+                m_stats.m_closed_in_msgs.fetch_add(client->m_stats.m_in_msgs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                m_stats.m_closed_in_bytes.fetch_add(client->m_stats.m_in_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
         }
+        //the client is destroyed outside the lock as its destructor may need to notify other clients
     }
 
     NatsClient* NatsServer::getClient(long long client_id) {
@@ -147,24 +395,575 @@ namespace nats {
     void NatsServer::addSubscription(int sub_id, std::vector<std::string>& subject_list, long long client_id){
         //for subscription the server just passes on the request to the Sublist Class
         m_sublist->addSubscription({sub_id,client_id},subject_list);
+        notifyInterestChanges();
     }
 
-    void NatsServer::removeSubscriptions(vector<pair<vector<std::string>,NatsSubscription>> unsub_params){
-        for(auto& pair: unsub_params){
-            m_sublist->removeSubscription(pair.second,pair.first);
+    void NatsServer::addSubscriptions(long long client_id, std::vector<std::pair<int, std::vector<std::string>>>& subscriptions){
+        //the counters of each subscription are looked up here once, so deliveries find them in the sublist entries
+        std::vector<NatsSubscriptionStats*> stats;
+        NatsClient* client = getClient(client_id);
+        if(client != nullptr){
+            stats.reserve(subscriptions.size());
+            for(auto& pair: subscriptions){
+                stats.push_back(client->getSubscriptionStats(pair.first));
+            }
         }
+        //one locked pass over the sublist for the whole batch
+        m_sublist->addSubscriptions(client_id, subscriptions, stats);
+        notifyInterestChanges();
     }
 
-    void NatsServer::publishMessage(std::string& subject, std::vector<std::string>& subject_list, std::string msg){
-        //first we get list of Subscriptions to the particular topic
-        std::vector<NatsSubscription>subscriptions = m_sublist->getSubscriptionsForTopic(subject_list);
+    void NatsServer::removeSubscriptions(long long client_id, std::vector<int> sub_ids){
+        //one locked pass over the sublist no matter how many subscriptions are removed
+        m_sublist->removeSubscriptions(client_id, sub_ids);
+        notifyInterestChanges();
+    }
+
+    void NatsServer::removeClientSubscriptions(long long client_id){
+        m_sublist->removeClient(client_id);
+        notifyInterestChanges();
+    }
+
+    void NatsServer::publishMessage(std::string& subject, std::vector<std::string>& subject_list, std::string_view msg){
+        processPublish(subject, subject_list, msg, false);
+    }
+
+    bool NatsServer::publishFromRoute(std::string& subject, std::vector<std::string>& subject_list, std::string_view msg){
+        return processPublish(subject, subject_list, msg, true);
+    }
+
+    bool NatsServer::processPublish(std::string& subject, std::vector<std::string>& subject_list, std::string_view msg, bool from_route){
+        NatsLatencyTimer publish_timer(NatsLatencyStats::shared().m_publish);
+        thread_local std::vector<NatsReplayBuffer*> locked_buffers;
+        NatsReplayLocks replay_locks(locked_buffers);
+        std::unique_lock<std::mutex> last_value_lock;
+        //streams, replay buffers and last values belong to the server the message was published to
+        if(!from_route){
+            //two compares for every other publish, acks are never stored or delivered
+            if(subject_list.size() == 3 && subject_list[0][0] == '$' && handleAck(subject_list)){
+                return true;
+            }
+            m_stats.m_hot_subjects.record(subject, msg.length());
+            //stored whether or not anyone is subscribed right now, that is the point of a stream
+            if(!m_streams.load(std::memory_order_acquire)->empty()){
+                storeInStreams(subject, subject_list, msg);
+            }
+            //a replaying SUB either finds the message in the buffer or is found by the sublist lookup below, never both
+            //the locks are released before anything is delivered, so a nested publish finds the list empty again
+            const std::vector<std::shared_ptr<NatsReplayBuffer>>& replay_buffers = *m_replay_buffers.load(std::memory_order_acquire);
+            for(const std::shared_ptr<NatsReplayBuffer>& buffer: replay_buffers){
+                if(buffer->matches(subject_list)){
+                    buffer->lock();
+                    locked_buffers.push_back(buffer.get());
+                    buffer->append(subject, msg);
+                }
+            }
+            //same for the last value, a subscription snapshots the subject's value or finds this publish in the sublist
+            last_value_lock = m_last_values.store(subject, subject_list, msg);
+        }
+        //most publishes go to subjects nobody listens to, so skip the sublist entirely when the filter rules it out
+        if(!m_sublist->hasPossibleInterest(subject_list)){
+            m_stats.m_no_interest.add(1);
+            return false;
+        }
+        //first we get list of Subscriptions to the particular topic, into a per thread buffer that is reused by every publish
+        thread_local std::vector<NatsSubscription> subscriptions_buffer;
+        thread_local bool in_publish = false;
+        NatsPublishScope scope(in_publish);
+        std::vector<NatsSubscription> nested_subscriptions;
+        std::vector<NatsSubscription>& subscriptions = scope.m_nested ? nested_subscriptions : subscriptions_buffer;
+        m_sublist->getSubscriptionsForTopic(subject_list, subscriptions);
+        replay_locks.release();
+        if(last_value_lock.owns_lock()){
+            last_value_lock.unlock();
+        }
+        //a peer can hold several subjects matching the message, it still gets it once
+        thread_local std::vector<long long> routes_buffer;
+        std::vector<long long> nested_routes;
+        std::vector<long long>& forwarded_routes = scope.m_nested ? nested_routes : routes_buffer;
+        forwarded_routes.clear();
+        bool delivered = false;
         for(NatsSubscription& subscription: subscriptions){
+            if(subscription.m_client_id == LOCAL_CLIENT_ID){
+                deliverLocal(subject, subscription.m_sub_id, msg);
+                delivered = true;
+                continue;
+            }
+            if(!NatsSublist::isLocalClient(subscription.m_client_id)){
+                //a message from a route already reached every server that wants it
+                if(!from_route && std::find(forwarded_routes.begin(), forwarded_routes.end(), subscription.m_client_id) == forwarded_routes.end()
+                    && forwardToRoute(subscription.m_client_id, subscription.m_sub_id, subject, msg)){
+                    forwarded_routes.push_back(subscription.m_client_id);
+                }
+                continue;
+            }
             NatsClient* client = getClient(subscription.m_client_id);
             if(client !=nullptr){
-                client->sendMessage(
-                    "MSG "+subject+" "+std::to_string(subscription.m_sub_id)+" "+std::to_string(msg.length())+"\r\n"
-                    + msg +"\r\n"
-                );
+                client->deliverMessage(subject, subscription, msg);
+                client->m_stats.m_out_msgs.fetch_add(1, std::memory_order_relaxed);
+                client->m_stats.m_out_bytes.fetch_add(msg.length(), std::memory_order_relaxed);
+                m_stats.m_out_msgs.add(1);
+                m_stats.m_out_bytes.add(msg.length());
+                delivered = true;
+            }
+        }
+        return delivered;
+    }
+
+    void NatsServer::deliverLocal(std::string_view subject, int sub_id, std::string_view msg){
+        std::shared_ptr<NatsMessageHandler> handler;
+        {
+            std::lock_guard<std::mutex> lock(m_local_mutex);
+            auto it = m_local_handlers.find(sub_id);
+            if(it == m_local_handlers.end()){
+                return;
+            }
+            handler = it->second;
+        }
+        //called without the lock so the handler can publish or (un)subscribe itself
+        (*handler)(subject, msg);
+        m_stats.m_out_msgs.add(1);
+        m_stats.m_out_bytes.add(msg.length());
+    }
+
+    void NatsServer::storeInStreams(std::string_view subject, const std::vector<std::string>& subject_list, std::string_view msg){
+        for(const std::shared_ptr<NatsStream>& stream: *m_streams.load(std::memory_order_acquire)){
+            if(stream->matches(subject_list)){
+                stream->append(subject, msg);
+            }
+        }
+    }
+
+    bool NatsServer::addStream(NatsStreamConfig config){
+        std::lock_guard<std::mutex> lock(m_streams_mutex);
+        for(const std::shared_ptr<NatsStream>& stream: *m_streams.load(std::memory_order_relaxed)){
+            if(stream->getConfig().m_name == config.m_name){
+                std::cerr << "stream " << config.m_name << " already exists" << std::endl;
+                return false;
+            }
+        }
+        auto stream = std::make_shared<NatsStream>(std::move(config));
+        if(!stream->open()){
+            return false;
+        }
+        //copy on write, a publish still reading the old list just doesn't see the new stream yet
+        auto streams = std::make_unique<std::vector<std::shared_ptr<NatsStream>>>(*m_streams.load(std::memory_order_relaxed));
+        streams->push_back(stream);
+        m_stream_lists.push_back(std::move(streams));
+        m_streams.store(m_stream_lists.back().get(), std::memory_order_release);
+        return true;
+    }
+
+    std::shared_ptr<NatsStream> NatsServer::getStream(const std::string& name){
+        for(const std::shared_ptr<NatsStream>& stream: getStreams()){
+            if(stream->getConfig().m_name == name){
+                return stream;
+            }
+        }
+        return nullptr;
+    }
+
+    const std::vector<std::shared_ptr<NatsStream>>& NatsServer::getStreams(){
+        return *m_streams.load(std::memory_order_acquire);
+    }
+
+    bool NatsServer::startClusterListener(){
+        int cluster_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(cluster_fd == -1){
+            perror("cluster socket failed");
+            return false;
+        }
+        int reuse = 1;
+        setsockopt(cluster_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in cluster_addr {};
+        cluster_addr.sin_family = AF_INET;
+        cluster_addr.sin_port = htons(m_cluster_port);
+        cluster_addr.sin_addr.s_addr = INADDR_ANY;
+        if(bind(cluster_fd, (struct sockaddr*)&cluster_addr, sizeof(cluster_addr)) < 0 || listen(cluster_fd, 128) < 0){
+            perror("cluster listen failed");
+            close(cluster_fd);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+        m_cluster_fd = cluster_fd;
+        m_cluster_thread = std::thread([this, cluster_fd]() {
+            while(true){
+                int route_fd = accept(cluster_fd, nullptr, nullptr);
+                if(route_fd < 0){
+                    if(errno == EINTR || errno == ECONNABORTED) continue;
+                    break;
+                }
+                int no_delay = 1;
+                setsockopt(route_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+                addRoute(route_fd, false);
+            }
+        });
+        return true;
+    }
+
+    bool NatsServer::connectRoute(const std::string& host, int port){
+        struct addrinfo hints {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* addresses = nullptr;
+        if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0 || addresses == nullptr){
+            std::cerr << "can't resolve route " << host << ":" << port << std::endl;
+            return false;
+        }
+        int route_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(route_fd == -1){
+            perror("route socket failed");
+            freeaddrinfo(addresses);
+            return false;
+        }
+        int connected = connect(route_fd, addresses->ai_addr, addresses->ai_addrlen);
+        freeaddrinfo(addresses);
+        if(connected < 0){
+            perror("route connect failed");
+            close(route_fd);
+            return false;
+        }
+        int no_delay = 1;
+        setsockopt(route_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        addRoute(route_fd, true);
+        return true;
+    }
+
+    NatsRoute* NatsServer::addRoute(int fd, bool solicited){
+        auto route_unique_ptr = std::make_unique<NatsRoute>(this, fd, m_next_route_id.fetch_sub(1), solicited);
+        NatsRoute* route = route_unique_ptr.get();
+        //from the first route on the sublist queues every change of local interest
+        m_sublist->setRouteInterestTracking(true);
+        std::vector<std::unique_ptr<NatsRoute>> closed_routes;
+        {
+            std::unique_lock<std::shared_mutex> lock(m_routes_mutex);
+            m_routes.emplace(route->getRouteId(), std::move(route_unique_ptr));
+            closed_routes.swap(m_closed_routes);
+        }
+        //joined outside the lock, a closing route's thread may still be on its way out of removeRoute
+        closed_routes.clear();
+        route->sendRoute(m_server_id);
+        {
+            //changes queued so far go out to every route first, the new one then gets the whole current summary, anything
+            //changing meanwhile is sent again afterwards, which the peer takes as a no-op
+            std::lock_guard<std::mutex> lock(m_route_interest_mutex);
+            if(!m_interest_summary_seeded){
+                //tracking is on already, a subject changing while it is collected is also queued and applied after it
+                m_interest_summary.setMaxFanout(m_route_summary_fanout);
+                std::vector<NatsRouteInterestChange> current;
+                for(std::string& subject: m_sublist->collectLocalInterest()){
+                    current.push_back({std::move(subject), true});
+                }
+                std::string ignored;
+                m_interest_summary.apply(current, ignored);
+                m_interest_summary_seeded = true;
+            }
+            sendRouteInterestChanges();
+            route->sendInterestChanges(m_interest_summary.getSnapshot());
+        }
+        route->start();
+        return route;
+    }
+
+    void NatsServer::removeRoute(long long route_id){
+        m_sublist->removeClient(route_id);
+        notifyInterestChanges();
+        std::unique_lock<std::shared_mutex> lock(m_routes_mutex);
+        auto it = m_routes.find(route_id);
+        if(it != m_routes.end()){
+            m_closed_routes.push_back(std::move(it->second));
+            m_routes.erase(it);
+        }
+    }
+
+    bool NatsServer::identifyRoute(NatsRoute* route){
+        long long remote_id = route->getRemoteServerId();
+        if(remote_id == m_server_id){
+            std::cerr << "route " << route->getRouteId() << " leads back to this server" << std::endl;
+            return false;
+        }
+        auto connected_by = [this, remote_id](NatsRoute* r) {
+            return r->isSolicited() ? m_server_id : remote_id;
+        };
+        std::shared_lock<std::shared_mutex> lock(m_routes_mutex);
+        for(auto& pair: m_routes){
+            NatsRoute* other = pair.second.get();
+            if(other == route || other->getRemoteServerId() != remote_id){
+                continue;
+            }
+            //two routes to the same server would deliver every message twice
+            if(connected_by(route) > connected_by(other)){
+                std::cerr << "route " << route->getRouteId() << " duplicates route " << other->getRouteId() << std::endl;
+                return false;
+            }
+            other->shutdown();
+        }
+        return true;
+    }
+
+    std::size_t NatsServer::getRouteCount(){
+        std::shared_lock<std::shared_mutex> lock(m_routes_mutex);
+        return m_routes.size();
+    }
+
+    void NatsServer::stopCluster(){
+        //stopServer and the destructor can both get here, only one of them gets the listener
+        int cluster_fd;
+        std::thread cluster_thread;
+        {
+            std::lock_guard<std::mutex> lock(m_client_threads_mutex);
+            cluster_fd = m_cluster_fd;
+            m_cluster_fd = -1;
+            cluster_thread.swap(m_cluster_thread);
+        }
+        if(cluster_fd >= 0){
+            //wakes up the accept, the fd is only closed once the thread is done with it
+            shutdown(cluster_fd, SHUT_RDWR);
+        }
+        if(cluster_thread.joinable()){
+            cluster_thread.join();
+        }
+        if(cluster_fd >= 0){
+            close(cluster_fd);
+        }
+        std::unordered_map<long long, std::unique_ptr<NatsRoute>> routes;
+        std::vector<std::unique_ptr<NatsRoute>> closed_routes;
+        {
+            std::unique_lock<std::shared_mutex> lock(m_routes_mutex);
+            routes.swap(m_routes);
+            closed_routes.swap(m_closed_routes);
+        }
+        //each destructor shuts its socket down and joins the reading thread
+        routes.clear();
+        closed_routes.clear();
+    }
+
+    bool NatsServer::forwardToRoute(long long route_id, int sub_id, std::string_view subject, std::string_view msg){
+        std::shared_lock<std::shared_mutex> lock(m_routes_mutex);
+        auto it = m_routes.find(route_id);
+        if(it == m_routes.end() || !it->second->wants(sub_id, subject)){
+            return false;
+        }
+        it->second->forward(subject, msg);
+        return true;
+    }
+
+    void NatsServer::sendRouteInterestChanges(){
+        std::vector<NatsRouteInterestChange> changes = m_sublist->takeRouteInterestChanges();
+        std::string msg;
+        m_interest_summary.apply(changes, msg);
+        //most changes under a folded prefix only touch bits that were set already
+        if(msg.empty()){
+            return;
+        }
+        std::shared_lock<std::shared_mutex> routes_lock(m_routes_mutex);
+        for(auto& pair: m_routes){
+            pair.second->sendInterestChanges(msg);
+        }
+    }
+
+    bool NatsServer::addReplayBuffer(NatsReplayBufferConfig config){
+        std::lock_guard<std::mutex> lock(m_replay_buffers_mutex);
+        for(const std::shared_ptr<NatsReplayBuffer>& buffer: *m_replay_buffers.load(std::memory_order_relaxed)){
+            if(buffer->getConfig().m_name == config.m_name){
+                std::cerr << "replay buffer " << config.m_name << " already exists" << std::endl;
+                return false;
+            }
+        }
+        auto buffer = std::make_shared<NatsReplayBuffer>(std::move(config));
+        if(!buffer->open()){
+            return false;
+        }
+        //copy on write like addStream
+        auto buffers = std::make_unique<std::vector<std::shared_ptr<NatsReplayBuffer>>>(*m_replay_buffers.load(std::memory_order_relaxed));
+        buffers->push_back(buffer);
+        m_replay_buffer_lists.push_back(std::move(buffers));
+        m_replay_buffers.store(m_replay_buffer_lists.back().get(), std::memory_order_release);
+        return true;
+    }
+
+    std::shared_ptr<NatsReplayBuffer> NatsServer::getReplayBuffer(const std::string& name){
+        for(const std::shared_ptr<NatsReplayBuffer>& buffer: getReplayBuffers()){
+            if(buffer->getConfig().m_name == name){
+                return buffer;
+            }
+        }
+        return nullptr;
+    }
+
+    const std::vector<std::shared_ptr<NatsReplayBuffer>>& NatsServer::getReplayBuffers(){
+        return *m_replay_buffers.load(std::memory_order_acquire);
+    }
+
+    void NatsServer::subscribeWithReplay(NatsClient* client, int sub_id, std::vector<std::string>& subject_list, NatsReplayBuffer& buffer,
+        int64_t since_ns){
+        std::string frames;
+        uint64_t replayed;
+        uint64_t replayed_bytes = 0;
+        NatsSubscriptionStats* stats = client->getSubscriptionStats(sub_id);
+        {
+            //live MSGs for the new subscription wait for the client's write lock until the replay is written
+            std::lock_guard<std::mutex> write_lock(client->m_write_mutex);
+            buffer.lock();
+            m_sublist->addSubscription({sub_id, client->m_client_id, stats}, subject_list);
+            replayed = buffer.appendFrames(subject_list, since_ns, sub_id, frames, replayed_bytes);
+            buffer.unlock();
+            client->sendAllLocked(frames.data(), frames.size());
+        }
+        //INTEREST updates are written to clients, maybe this one, so only once its write lock is released
+        notifyInterestChanges();
+        if(replayed > 0){
+            client->m_stats.m_out_msgs.fetch_add(replayed, std::memory_order_relaxed);
+            client->m_stats.m_out_bytes.fetch_add(replayed_bytes, std::memory_order_relaxed);
+            m_stats.m_out_msgs.add(replayed);
+            m_stats.m_out_bytes.add(replayed_bytes);
+            if(stats != nullptr){
+                stats->m_delivered.fetch_add(replayed, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool NatsServer::trackLastValues(const std::string& subject){
+        return m_last_values.track(subject);
+    }
+
+    void NatsServer::subscribeWithLastValues(NatsClient* client, int sub_id, std::vector<std::string>& subject_list){
+        std::string frames;
+        uint64_t sent;
+        uint64_t sent_bytes = 0;
+        NatsSubscriptionStats* stats = client->getSubscriptionStats(sub_id);
+        {
+            //like subscribeWithReplay, live MSGs wait for the client's write lock until the snapshot is written
+            std::lock_guard<std::mutex> write_lock(client->m_write_mutex);
+            m_last_values.lockFor(subject_list);
+            m_sublist->addSubscription({sub_id, client->m_client_id, stats}, subject_list);
+            sent = m_last_values.appendFrames(subject_list, sub_id, frames, sent_bytes);
+            m_last_values.unlockFor(subject_list);
+            client->sendAllLocked(frames.data(), frames.size());
+        }
+        notifyInterestChanges();
+        if(sent > 0){
+            client->m_stats.m_out_msgs.fetch_add(sent, std::memory_order_relaxed);
+            client->m_stats.m_out_bytes.fetch_add(sent_bytes, std::memory_order_relaxed);
+            m_stats.m_out_msgs.add(sent);
+            m_stats.m_out_bytes.add(sent_bytes);
+            if(stats != nullptr){
+                stats->m_delivered.fetch_add(sent, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    uint64_t NatsServer::registerAckConsumer(NatsStreamConsumer* consumer){
+        uint64_t consumer_id = m_next_consumer_id.fetch_add(1);
+        std::unique_lock<std::shared_mutex> lock(m_ack_consumers_mutex);
+        m_ack_consumers[consumer_id] = consumer;
+        return consumer_id;
+    }
+
+    void NatsServer::unregisterAckConsumer(uint64_t consumer_id){
+        //its timer entries stay queued, they just don't find the consumer anymore
+        std::unique_lock<std::shared_mutex> lock(m_ack_consumers_mutex);
+        m_ack_consumers.erase(consumer_id);
+    }
+
+    bool NatsServer::handleAck(const std::vector<std::string>& subject_list){
+        if(subject_list[0] != NatsStreamConsumer::ACK_PREFIX){
+            return false;
+        }
+        uint64_t consumer_id = 0;
+        uint64_t seq = 0;
+        const std::string& id_token = subject_list[1];
+        const std::string& seq_token = subject_list[2];
+        auto id_parsed = std::from_chars(id_token.data(), id_token.data() + id_token.size(), consumer_id);
+        auto seq_parsed = std::from_chars(seq_token.data(), seq_token.data() + seq_token.size(), seq);
+        if(id_parsed.ec != std::errc() || id_parsed.ptr != id_token.data() + id_token.size()
+            || seq_parsed.ec != std::errc() || seq_parsed.ptr != seq_token.data() + seq_token.size()){
+            return false;
+        }
+        //shared, acks for different consumers don't wait on each other, only (un)registering does
+        std::shared_lock<std::shared_mutex> lock(m_ack_consumers_mutex);
+        auto it = m_ack_consumers.find(consumer_id);
+        if(it != m_ack_consumers.end()){
+            it->second->ack(seq);
+        }
+        return true;
+    }
+
+    void NatsServer::onAckTimer(uint64_t consumer_id){
+        std::shared_lock<std::shared_mutex> lock(m_ack_consumers_mutex);
+        auto it = m_ack_consumers.find(consumer_id);
+        if(it != m_ack_consumers.end()){
+            it->second->requestRedelivery();
+        }
+    }
+
+    void NatsServer::publish(std::string_view subject, std::string_view payload){
+        //per thread like a client's PUB, and for the same reason, a steady stream of publishes doesn't allocate
+        thread_local std::string subject_buffer;
+        thread_local std::vector<std::string> subject_list_buffer;
+        thread_local bool in_publish = false;
+        NatsPublishScope scope(in_publish);
+        std::string nested_subject;
+        std::vector<std::string> nested_subject_list;
+        std::string& subject_string = scope.m_nested ? nested_subject : subject_buffer;
+        std::vector<std::string>& subject_list = scope.m_nested ? nested_subject_list : subject_list_buffer;
+        NatsClient::convertSubjectToList(subject, true, subject_list);
+        subject_string.assign(subject.data(), subject.size());
+        m_stats.m_local_in_msgs.add(1);
+        m_stats.m_local_in_bytes.add(payload.size());
+        publishMessage(subject_string, subject_list, payload);
+    }
+
+    int NatsServer::subscribe(std::string_view subject, NatsMessageHandler handler){
+        std::vector<std::string> subject_list;
+        NatsClient::convertSubjectToList(subject, false, subject_list);
+        int sub_id = m_next_local_sub_id.fetch_add(1);
+        {
+            //the handler has to be there before the subscription can match anything
+            std::lock_guard<std::mutex> lock(m_local_mutex);
+            m_local_handlers.emplace(sub_id, std::make_shared<NatsMessageHandler>(std::move(handler)));
+        }
+        addSubscription(sub_id, subject_list, LOCAL_CLIENT_ID);
+        return sub_id;
+    }
+
+    void NatsServer::unsubscribe(int sub_id){
+        removeSubscriptions(LOCAL_CLIENT_ID, {sub_id});
+        std::lock_guard<std::mutex> lock(m_local_mutex);
+        m_local_handlers.erase(sub_id);
+    }
+
+    void NatsServer::addInterestWatch(std::string& subject, std::vector<std::string>& subject_list, long long client_id){
+        m_sublist->addInterestWatch(subject, subject_list, client_id);
+        notifyInterestChanges();
+    }
+
+    void NatsServer::removeInterestWatches(std::vector<std::string> subjects, long long client_id){
+        for(std::string& subject: subjects){
+            m_sublist->removeInterestWatch(subject, client_id);
+        }
+    }
+
+    void NatsServer::notifyInterestChanges(){
+        if(m_sublist->hasRouteInterestChanges()){
+            //taking and sending under the same lock means a later change can never overtake an earlier one
+            std::lock_guard<std::mutex> lock(m_route_interest_mutex);
+            sendRouteInterestChanges();
+        }
+        //cheap check so that servers without any watches pay nothing on SUB/UNSUB
+        if(!m_sublist->hasInterestChanges()){
+            return;
+        }
+        //taking and sending under the same lock means a later change can never overtake an earlier one
+        std::lock_guard<std::mutex> lock(m_interest_notify_mutex);
+        std::vector<NatsInterestChange> changes = m_sublist->takeInterestChanges();
+        for(NatsInterestChange& change: changes){
+            std::string msg = "INTEREST " + change.m_subject + (change.m_has_interest ? " 1\r\n" : " 0\r\n");
+            for(long long client_id: change.m_client_ids){
+                NatsClient* client = getClient(client_id);
+                if(client != nullptr){
+                    client->sendMessage(msg);
+                }
             }
         }
     }
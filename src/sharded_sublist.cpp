@@ -0,0 +1,290 @@
+#include "../include/nats/sharded_sublist.hpp"
+#include "../include/nats/sublist.hpp"
+#include "../include/nats/subscription.hpp"
+#include "../include/nats/interest_watch.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr std::size_t FILTER_COUNTERS = 1<<16;
+        constexpr std::size_t MIN_SHARD_FILTER_COUNTERS = 1<<12;
+
+        bool startsWithWildcard(const std::vector<std::string>& subject_list){
+            return !subject_list.empty() && (subject_list[0] == "*" || subject_list[0] == ">");
+        }
+    }
+
+    NatsShardedSublist::NatsShardedSublist(int shard_count): m_watch_count(0), m_has_interest_changes(false),
+        m_track_route_interest(false){
+        //the interest filters split the counters one sublist would have, so sharding doesn't multiply their memory
+        std::size_t filter_counters = std::max(FILTER_COUNTERS / std::max(shard_count, 1), MIN_SHARD_FILTER_COUNTERS);
+        for(int i=0;i<std::max(shard_count, 1);i++){
+            m_shards.push_back(std::make_unique<NatsSublist>(filter_counters));
+        }
+        m_root_wildcards = std::make_unique<NatsSublist>(MIN_SHARD_FILTER_COUNTERS);
+    }
+
+    int NatsShardedSublist::getShardCount() const{
+        return m_shards.size();
+    }
+
+    std::size_t NatsShardedSublist::shardIndex(const std::vector<std::string>& subject_list) const{
+        if(subject_list.empty()){
+            return 0;
+        }
+        if(startsWithWildcard(subject_list)){
+            return m_shards.size();
+        }
+        return std::hash<std::string>{}(subject_list[0]) % m_shards.size();
+    }
+
+    NatsSublist& NatsShardedSublist::shardAt(std::size_t index){
+        return index == m_shards.size() ? *m_root_wildcards : *m_shards[index];
+    }
+
+    NatsSublist& NatsShardedSublist::shardFor(const std::vector<std::string>& subject_list){
+        return shardAt(shardIndex(subject_list));
+    }
+
+    void NatsShardedSublist::addSubscription(NatsSubscription subscription, std::vector<std::string>& subject_list){
+        shardFor(subject_list).addSubscription(subscription, subject_list);
+        //a shard only queues changes while there are watches, and m_watch_count goes up before it starts
+        if(m_watch_count.load() > 0){
+            updateInterestWatches();
+        }
+    }
+
+    void NatsShardedSublist::removeSubscription(NatsSubscription& subscription, std::vector<std::string>& subject_list){
+        shardFor(subject_list).removeSubscription(subscription, subject_list);
+        if(m_watch_count.load() > 0){
+            updateInterestWatches();
+        }
+    }
+
+    void NatsShardedSublist::addSubscriptions(long long client_id, std::vector<std::pair<int, std::vector<std::string>>>& subscriptions,
+        const std::vector<NatsSubscriptionStats*>& stats){
+        //the subject lists are moved into the per shard batches and back afterwards, the caller's batch is left as it was
+        std::vector<std::vector<std::pair<int, std::vector<std::string>>>> batches(m_shards.size() + 1);
+        std::vector<std::vector<NatsSubscriptionStats*>> batch_stats(stats.empty() ? 0 : batches.size());
+        std::vector<std::size_t> batch_of(subscriptions.size());
+        for(std::size_t i=0;i<subscriptions.size();i++){
+            batch_of[i] = shardIndex(subscriptions[i].second);
+            batches[batch_of[i]].push_back(std::move(subscriptions[i]));
+            if(!stats.empty()){
+                batch_stats[batch_of[i]].push_back(stats[i]);
+            }
+        }
+        for(std::size_t batch=0;batch<batches.size();batch++){
+            if(!batches[batch].empty()){
+                shardAt(batch).addSubscriptions(client_id, batches[batch], stats.empty() ? stats : batch_stats[batch]);
+            }
+        }
+        std::vector<std::size_t> next_in_batch(batches.size(), 0);
+        for(std::size_t i=0;i<subscriptions.size();i++){
+            subscriptions[i] = std::move(batches[batch_of[i]][next_in_batch[batch_of[i]]++]);
+        }
+        if(m_watch_count.load() > 0){
+            updateInterestWatches();
+        }
+    }
+
+    void NatsShardedSublist::removeSubscriptions(long long client_id, const std::vector<int>& sub_ids){
+        //the shards only know which of the client's subscriptions they hold, a shard without any returns right away
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            shard->removeSubscriptions(client_id, sub_ids);
+        }
+        m_root_wildcards->removeSubscriptions(client_id, sub_ids);
+        if(m_watch_count.load() > 0){
+            updateInterestWatches();
+        }
+    }
+
+    void NatsShardedSublist::removeClient(long long client_id){
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            shard->removeClient(client_id);
+        }
+        m_root_wildcards->removeClient(client_id);
+        if(m_watch_count.load() > 0){
+            updateInterestWatches();
+        }
+    }
+
+    std::vector<NatsSubscription> NatsShardedSublist::getSubscriptionsForTopic(std::vector<std::string>& subject_list){
+        std::vector<NatsSubscription> subscriptions;
+        getSubscriptionsForTopic(subject_list, subscriptions);
+        return subscriptions;
+    }
+
+    void NatsShardedSublist::getSubscriptionsForTopic(std::vector<std::string>& subject_list, std::vector<NatsSubscription>& subscriptions, NatsMatchMode mode){
+        shardFor(subject_list).getSubscriptionsForTopic(subject_list, subscriptions);
+        if(m_root_wildcards->getSubscriptionCount() > 0){
+            thread_local std::vector<NatsSubscription> root_subscriptions;
+            m_root_wildcards->getSubscriptionsForTopic(subject_list, root_subscriptions);
+            subscriptions.insert(subscriptions.end(), root_subscriptions.begin(), root_subscriptions.end());
+        }
+        //a client can have matches in both shards, so duplicates are only removed once they are merged
+        if(mode == NatsMatchMode::ONE_PER_CLIENT){
+            NatsSublist::keepOnePerClient(subscriptions);
+        }
+    }
+
+    bool NatsShardedSublist::hasPossibleInterest(std::vector<std::string>& subject_list){
+        return shardFor(subject_list).hasPossibleInterest(subject_list)
+            || (m_root_wildcards->getSubscriptionCount() > 0 && m_root_wildcards->hasPossibleInterest(subject_list));
+    }
+
+    void NatsShardedSublist::takeSubscriptionChanges(std::vector<NatsSubscriptionChange>& changes){
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            if(shard->hasSubscriptionChanges()){
+                shard->takeSubscriptionChanges(changes);
+            }
+        }
+        if(m_root_wildcards->hasSubscriptionChanges()){
+            m_root_wildcards->takeSubscriptionChanges(changes);
+        }
+    }
+
+    void NatsShardedSublist::applySubscriptionChanges(std::vector<NatsSubscriptionChange>& changes){
+        //a shard only queues a change when its trie really changed, so the counts can be adjusted instead of recounted
+        for(NatsSubscriptionChange& change: changes){
+            bool added = change.m_added;
+            m_interest_watches.forEachMatch(change.m_subject_list, [this, added](const std::string& subject, NatsInterestWatch& watch) {
+                watch.m_match_count += added ? 1 : -1;
+                if(watch.m_match_count == (added ? 1 : 0)){
+                    m_interest_changes.push_back({subject, added, std::vector<long long>(watch.m_client_ids.begin(), watch.m_client_ids.end())});
+                    m_has_interest_changes = true;
+                }
+            });
+        }
+    }
+
+    void NatsShardedSublist::updateInterestWatches(){
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        std::vector<NatsSubscriptionChange> changes;
+        takeSubscriptionChanges(changes);
+        applySubscriptionChanges(changes);
+    }
+
+    void NatsShardedSublist::addInterestWatch(std::string& subject, std::vector<std::string>& subject_list, long long client_id){
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        NatsInterestWatch* watch = m_interest_watches.find(subject);
+        if(watch == nullptr){
+            if(m_watch_count.fetch_add(1) == 0){
+                for(std::unique_ptr<NatsSublist>& shard: m_shards){
+                    shard->setSubscriptionChangeTracking(true);
+                }
+                m_root_wildcards->setSubscriptionChangeTracking(true);
+            }
+            //the existing watches catch up first, changes queued after that are either in the count or still queued
+            //and reach the new watch as well, only its own shard and the root wildcards can match the subject
+            std::vector<NatsSubscriptionChange> changes;
+            takeSubscriptionChanges(changes);
+            applySubscriptionChanges(changes);
+            changes.clear();
+            std::size_t index = shardIndex(subject_list);
+            long long match_count = shardAt(index).countMatchesAndTakeChanges(subject_list, changes);
+            if(index != m_shards.size()){
+                match_count += m_root_wildcards->countMatchesAndTakeChanges(subject_list, changes);
+            }
+            applySubscriptionChanges(changes);
+            watch = &m_interest_watches.insert(subject, NatsInterestWatch{subject_list, {}, match_count});
+        }
+        watch->m_client_ids.insert(client_id);
+        m_interest_changes.push_back({subject, watch->m_match_count > 0, {client_id}});
+        m_has_interest_changes = true;
+    }
+
+    void NatsShardedSublist::removeInterestWatch(std::string& subject, long long client_id){
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        NatsInterestWatch* watch = m_interest_watches.find(subject);
+        if(watch == nullptr){
+            return;
+        }
+        watch->m_client_ids.erase(client_id);
+        if(watch->m_client_ids.empty()){
+            m_interest_watches.erase(subject);
+            if(m_watch_count.fetch_sub(1) == 1){
+                for(std::unique_ptr<NatsSublist>& shard: m_shards){
+                    shard->setSubscriptionChangeTracking(false);
+                }
+                m_root_wildcards->setSubscriptionChangeTracking(false);
+            }
+        }
+    }
+
+    std::vector<NatsInterestChange> NatsShardedSublist::takeInterestChanges(){
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        std::vector<NatsInterestChange> changes;
+        changes.swap(m_interest_changes);
+        m_has_interest_changes = false;
+        return changes;
+    }
+
+    bool NatsShardedSublist::hasInterestChanges(){
+        return m_has_interest_changes;
+    }
+
+    void NatsShardedSublist::setRouteInterestTracking(bool enabled){
+        m_track_route_interest = enabled;
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            shard->setRouteInterestTracking(enabled);
+        }
+        m_root_wildcards->setRouteInterestTracking(enabled);
+    }
+
+    std::vector<NatsRouteInterestChange> NatsShardedSublist::takeRouteInterestChanges(){
+        std::vector<NatsRouteInterestChange> changes;
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            if(shard->hasRouteInterestChanges()){
+                shard->takeRouteInterestChanges(changes);
+            }
+        }
+        if(m_root_wildcards->hasRouteInterestChanges()){
+            m_root_wildcards->takeRouteInterestChanges(changes);
+        }
+        return changes;
+    }
+
+    bool NatsShardedSublist::hasRouteInterestChanges(){
+        if(!m_track_route_interest.load(std::memory_order_relaxed)){
+            return false;
+        }
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            if(shard->hasRouteInterestChanges()){
+                return true;
+            }
+        }
+        return m_root_wildcards->hasRouteInterestChanges();
+    }
+
+    std::vector<std::string> NatsShardedSublist::collectLocalInterest(){
+        std::vector<std::string> subjects;
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            shard->collectLocalInterest(subjects);
+        }
+        m_root_wildcards->collectLocalInterest(subjects);
+        return subjects;
+    }
+
+    long long NatsShardedSublist::getSubscriptionCount(){
+        long long count = m_root_wildcards->getSubscriptionCount();
+        for(std::unique_ptr<NatsSublist>& shard: m_shards){
+            count += shard->getSubscriptionCount();
+        }
+        return count;
+    }
+
+    std::size_t NatsShardedSublist::getInterestWatchCount(){
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        return m_interest_watches.size();
+    }
+}
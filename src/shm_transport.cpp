@@ -0,0 +1,277 @@
+#include "../include/nats/shm_transport.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr std::size_t HEADER_SIZE = sizeof(NatsShmRingHeader);
+        constexpr std::string_view SHM_REPLY = "+SHM ";
+
+        //not FUTEX_PRIVATE, the word is mapped by two processes
+        void futexWait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms){
+            struct timespec timeout {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+        }
+
+        void futexWake(std::atomic<uint32_t>* word){
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+
+        //the other side closed the connection or died, anything it still sent on the socket is ignored
+        bool isHungUp(int fd){
+            struct pollfd poll_fd {fd, POLLIN | POLLRDHUP, 0};
+            if(poll(&poll_fd, 1, 0) <= 0){
+                return false;
+            }
+            if(poll_fd.revents & (POLLHUP | POLLRDHUP | POLLERR | POLLNVAL)){
+                return true;
+            }
+            char scratch[256];
+            return recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT) == 0;
+        }
+    }
+
+    NatsShmRing::NatsShmRing(NatsShmRingHeader* header, std::size_t capacity):
+        m_header(header), m_data(reinterpret_cast<char*>(header) + HEADER_SIZE), m_capacity(capacity){}
+
+    bool NatsShmRing::write(const struct iovec* iov, int count){
+        uint64_t head = m_header->m_head.load(std::memory_order_relaxed);
+        for(int i=0;i<count;i++){
+            const char* data = static_cast<const char*>(iov[i].iov_base);
+            std::size_t size = iov[i].iov_len;
+            while(size > 0){
+                std::size_t space = m_capacity - (head - m_header->m_tail.load(std::memory_order_acquire));
+                if(space == 0){
+                    //what is written so far has to be visible or the reader never makes room
+                    m_header->m_head.store(head, std::memory_order_seq_cst);
+                    if(m_header->m_reader_waiting.load(std::memory_order_seq_cst)){
+                        m_header->m_data_seq.fetch_add(1, std::memory_order_seq_cst);
+                        futexWake(&m_header->m_data_seq);
+                    }
+                    m_header->m_writer_waiting.store(1, std::memory_order_seq_cst);
+                    uint32_t seq = m_header->m_space_seq.load(std::memory_order_seq_cst);
+                    if(m_header->m_closed.load(std::memory_order_acquire)){
+                        m_header->m_writer_waiting.store(0, std::memory_order_relaxed);
+                        return false;
+                    }
+                    if(head - m_header->m_tail.load(std::memory_order_seq_cst) == m_capacity){
+                        futexWait(&m_header->m_space_seq, seq, WAIT_MS);
+                    }
+                    m_header->m_writer_waiting.store(0, std::memory_order_relaxed);
+                    continue;
+                }
+                //the bytes up to the end of the ring, the rest wraps around on the next pass
+                std::size_t offset = head & (m_capacity - 1);
+                std::size_t chunk = std::min({size, space, m_capacity - offset});
+                std::memcpy(m_data + offset, data, chunk);
+                head += chunk;
+                data += chunk;
+                size -= chunk;
+            }
+        }
+        if(m_header->m_closed.load(std::memory_order_acquire)){
+            return false;
+        }
+        m_header->m_head.store(head, std::memory_order_seq_cst);
+        if(m_header->m_reader_waiting.load(std::memory_order_seq_cst)){
+            m_header->m_data_seq.fetch_add(1, std::memory_order_seq_cst);
+            futexWake(&m_header->m_data_seq);
+        }
+        return true;
+    }
+
+    std::size_t NatsShmRing::read(char* buffer, std::size_t size, int hangup_fd){
+        uint64_t tail = m_header->m_tail.load(std::memory_order_relaxed);
+        int spins = 0;
+        bool waited = false;
+        while(true){
+            uint64_t head = m_header->m_head.load(std::memory_order_acquire);
+            if(head != tail){
+                std::size_t offset = tail & (m_capacity - 1);
+                std::size_t chunk = std::min({static_cast<std::size_t>(head - tail), size, m_capacity - offset});
+                std::memcpy(buffer, m_data + offset, chunk);
+                m_header->m_tail.store(tail + chunk, std::memory_order_seq_cst);
+                if(m_header->m_writer_waiting.load(std::memory_order_seq_cst)){
+                    m_header->m_space_seq.fetch_add(1, std::memory_order_seq_cst);
+                    futexWake(&m_header->m_space_seq);
+                }
+                return chunk;
+            }
+            if(m_header->m_closed.load(std::memory_order_acquire)){
+                return 0;
+            }
+            //the socket is only looked at after a wait came back empty, not on every read that finds the ring empty
+            if(waited && hangup_fd >= 0 && isHungUp(hangup_fd)){
+                return 0;
+            }
+            //the other side is usually in the middle of writing, a few more looks are cheaper than sleeping
+            if(spins++ < SPIN_COUNT){
+                continue;
+            }
+            //a writer that stores its head after this sees m_reader_waiting and bumps the seq we wait on
+            m_header->m_reader_waiting.store(1, std::memory_order_seq_cst);
+            uint32_t seq = m_header->m_data_seq.load(std::memory_order_seq_cst);
+            if(m_header->m_head.load(std::memory_order_seq_cst) == tail){
+                futexWait(&m_header->m_data_seq, seq, WAIT_MS);
+            }
+            m_header->m_reader_waiting.store(0, std::memory_order_relaxed);
+            waited = true;
+        }
+    }
+
+    void NatsShmRing::close(){
+        m_header->m_closed.store(1, std::memory_order_release);
+        m_header->m_data_seq.fetch_add(1, std::memory_order_seq_cst);
+        m_header->m_space_seq.fetch_add(1, std::memory_order_seq_cst);
+        futexWake(&m_header->m_data_seq);
+        futexWake(&m_header->m_space_seq);
+    }
+
+    bool NatsShmRing::isClosed() const{
+        return m_header->m_closed.load(std::memory_order_acquire) != 0;
+    }
+
+    std::size_t NatsShmRing::getCapacity() const{
+        return m_capacity;
+    }
+
+    NatsShmTransport::NatsShmTransport(int fd, void* memory, std::size_t size, std::size_t ring_size):
+        m_fd(fd), m_memory(memory), m_size(size){
+        char* base = static_cast<char*>(memory);
+        m_to_server = std::make_unique<NatsShmRing>(reinterpret_cast<NatsShmRingHeader*>(base), ring_size);
+        m_to_client = std::make_unique<NatsShmRing>(reinterpret_cast<NatsShmRingHeader*>(base + HEADER_SIZE + ring_size), ring_size);
+    }
+
+    bool NatsShmTransport::isValidRingSize(std::size_t ring_size){
+        return ring_size >= MIN_RING_SIZE && (ring_size & (ring_size - 1)) == 0;
+    }
+
+    std::unique_ptr<NatsShmTransport> NatsShmTransport::create(std::size_t ring_size){
+        if(!isValidRingSize(ring_size)){
+            return nullptr;
+        }
+        int fd = memfd_create("nats-shm", MFD_CLOEXEC);
+        if(fd < 0){
+            return nullptr;
+        }
+        //a fresh memfd reads as zeroes, which is both rings empty and open
+        std::size_t size = 2 * (HEADER_SIZE + ring_size);
+        if(ftruncate(fd, size) != 0){
+            ::close(fd);
+            return nullptr;
+        }
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(memory == MAP_FAILED){
+            ::close(fd);
+            return nullptr;
+        }
+        return std::unique_ptr<NatsShmTransport>(new NatsShmTransport(fd, memory, size, ring_size));
+    }
+
+    std::unique_ptr<NatsShmTransport> NatsShmTransport::attach(int fd, std::size_t ring_size){
+        struct stat info {};
+        std::size_t size = 2 * (HEADER_SIZE + ring_size);
+        if(!isValidRingSize(ring_size) || fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) != size){
+            ::close(fd);
+            return nullptr;
+        }
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(memory == MAP_FAILED){
+            ::close(fd);
+            return nullptr;
+        }
+        return std::unique_ptr<NatsShmTransport>(new NatsShmTransport(fd, memory, size, ring_size));
+    }
+
+    bool NatsShmTransport::sendWithFd(int socket_fd, std::string_view data, int fd){
+        struct sockaddr_storage address {};
+        socklen_t address_len = sizeof(address);
+        if(getsockname(socket_fd, reinterpret_cast<struct sockaddr*>(&address), &address_len) != 0 || address.ss_family != AF_UNIX){
+            return false;
+        }
+        struct iovec iov {const_cast<char*>(data.data()), data.size()};
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] {};
+        struct msghdr message {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+        return sendmsg(socket_fd, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+    }
+
+    std::unique_ptr<NatsShmTransport> NatsShmTransport::receive(int socket_fd, std::string& line){
+        line.clear();
+        int fd = -1;
+        char buffer[256];
+        while(line.size() < 2 || line.compare(line.size() - 2, 2, "\r\n") != 0){
+            struct iovec iov {buffer, sizeof(buffer)};
+            alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] {};
+            struct msghdr message {};
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            ssize_t n = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                break;
+            }
+            for(struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)){
+                if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS){
+                    std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+                }
+            }
+            line.append(buffer, n);
+        }
+        if(fd < 0){
+            return nullptr;
+        }
+        if(line.compare(0, SHM_REPLY.size(), SHM_REPLY) != 0){
+            ::close(fd);
+            return nullptr;
+        }
+        return attach(fd, std::strtoull(line.c_str() + SHM_REPLY.size(), nullptr, 10));
+    }
+
+    NatsShmTransport::~NatsShmTransport(){
+        munmap(m_memory, m_size);
+        ::close(m_fd);
+    }
+
+    int NatsShmTransport::getFd() const{
+        return m_fd;
+    }
+
+    NatsShmRing& NatsShmTransport::toServer(){
+        return *m_to_server;
+    }
+
+    NatsShmRing& NatsShmTransport::toClient(){
+        return *m_to_client;
+    }
+
+    void NatsShmTransport::close(){
+        m_to_server->close();
+        m_to_client->close();
+    }
+}
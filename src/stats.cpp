@@ -0,0 +1,21 @@
+#include "../include/nats/stats.hpp"
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+namespace nats{
+
+    int NatsStripedCounter::nextStripe(){
+        static std::atomic<int> next_stripe{0};
+        return next_stripe.fetch_add(1, std::memory_order_relaxed) % STRIPE_COUNT;
+    }
+
+    uint64_t NatsStripedCounter::load() const{
+        uint64_t total = 0;
+        for(const NatsCounterStripe& stripe: m_stripes){
+            total += stripe.m_value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+}
@@ -0,0 +1,735 @@
+#include "../include/nats/stream.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/sublist.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string_view>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr uint64_t RECORD_ALIGNMENT = 8;
+        constexpr const char* SEGMENT_SUFFIX = ".seg";
+        constexpr const char* COMPACT_SUFFIX = ".compact"; //a compacted segment being written, renamed over the original once done
+        constexpr uint64_t COMPACT_MIN_FREED = 4; //a segment is only rewritten if that frees at least 1/4 of it
+        constexpr int IOPRIO_WHO_PROCESS = 1; //ioprio_set has no glibc wrapper or header
+        constexpr int IOPRIO_CLASS_IDLE = 3;
+        constexpr int IOPRIO_CLASS_SHIFT = 13;
+
+        uint64_t pageSize(){
+            static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+            return page_size;
+        }
+
+        int64_t nowNanos(){
+            return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    NatsStreamSegment::NatsStreamSegment(std::string path, uint64_t first_seq, uint64_t capacity):
+        m_path(std::move(path)), m_fd(-1), m_data(nullptr), m_capacity(capacity), m_write_offset(0), m_synced_offset(0),
+        m_first_seq(first_seq), m_last_seq(0), m_message_count(0), m_payload_bytes(0), m_last_indexed_offset(0){
+    }
+
+    NatsStreamSegment::~NatsStreamSegment(){
+        if(m_data != nullptr){
+            munmap(m_data, m_capacity);
+        }
+        if(m_fd >= 0){
+            close(m_fd);
+        }
+    }
+
+    bool NatsStreamSegment::open(){
+        m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if(m_fd < 0){
+            perror("stream segment open failed");
+            return false;
+        }
+        struct stat file_stat{};
+        if(fstat(m_fd, &file_stat) < 0){
+            perror("stream segment fstat failed");
+            return false;
+        }
+        bool existing = file_stat.st_size > 0;
+        if(existing){
+            //an existing segment keeps the size it was created with
+            m_capacity = file_stat.st_size;
+        } else if(ftruncate(m_fd, m_capacity) < 0){
+            //the whole segment is reserved up front so appends never have to grow the file or remap
+            perror("stream segment ftruncate failed");
+            return false;
+        }
+        void* data = mmap(nullptr, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if(data == MAP_FAILED){
+            perror("stream segment mmap failed");
+            return false;
+        }
+        m_data = static_cast<char*>(data);
+        if(existing){
+            //the file is zero filled past the last record, so a zero size is where appending continues
+            //a record whose seq doesn't go up is what was left of an append that didn't make it to disk
+            uint64_t expected_seq = m_first_seq;
+            while(m_write_offset + sizeof(NatsStreamRecordHeader) <= m_capacity){
+                const NatsStreamRecordHeader* header = recordAt(m_write_offset);
+                if(header->m_record_size == 0 || header->m_seq < expected_seq
+                    || header->m_record_size > m_capacity - m_write_offset
+                    || header->m_record_size < recordSize(header->m_subject_size, header->m_payload_size)){
+                    break;
+                }
+                if(m_last_seq == 0){
+                    m_first_seq = header->m_seq; //later than the name says once the segment was compacted
+                }
+                addToIndex(header->m_seq, m_write_offset);
+                m_last_seq = header->m_seq;
+                m_message_count++;
+                m_payload_bytes += header->m_payload_size;
+                m_write_offset += header->m_record_size;
+                expected_seq = header->m_seq + 1;
+            }
+            m_synced_offset = m_write_offset;
+        }
+        return true;
+    }
+
+    uint64_t NatsStreamSegment::recordSize(std::size_t subject_size, std::size_t payload_size){
+        uint64_t size = sizeof(NatsStreamRecordHeader) + subject_size + payload_size;
+        return (size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+    }
+
+    void NatsStreamSegment::addToIndex(uint64_t seq, uint64_t offset){
+        if(m_index.empty() || offset - m_last_indexed_offset >= INDEX_SPACING){
+            m_index.emplace_back(seq, offset);
+            m_last_indexed_offset = offset;
+        }
+    }
+
+    bool NatsStreamSegment::append(uint64_t seq, int64_t timestamp_ns, std::string_view subject, std::string_view payload){
+        uint64_t record_size = recordSize(subject.size(), payload.size());
+        if(record_size > m_capacity - m_write_offset){
+            return false;
+        }
+        char* record = m_data + m_write_offset;
+        NatsStreamRecordHeader* header = reinterpret_cast<NatsStreamRecordHeader*>(record);
+        header->m_payload_size = payload.size();
+        header->m_seq = seq;
+        header->m_timestamp_ns = timestamp_ns;
+        header->m_subject_size = subject.size();
+        header->m_flags = 0;
+        header->m_reserved = 0;
+        memcpy(record + sizeof(NatsStreamRecordHeader), subject.data(), subject.size());
+        memcpy(record + sizeof(NatsStreamRecordHeader) + subject.size(), payload.data(), payload.size());
+        //the size goes in last, until it is set the record reads as the end of the segment
+        header->m_record_size = record_size;
+        addToIndex(seq, m_write_offset);
+        m_write_offset += record_size;
+        m_last_seq = seq;
+        m_message_count++;
+        m_payload_bytes += payload.size();
+        return true;
+    }
+
+    bool NatsStreamSegment::sync(uint64_t upto){
+        if(upto <= m_synced_offset){
+            return true;
+        }
+        //msync wants a page aligned start, the partly synced page at the front is simply synced again
+        uint64_t start = m_synced_offset & ~(pageSize() - 1);
+        if(msync(m_data + start, upto - start, MS_SYNC) < 0){
+            perror("stream segment msync failed");
+            return false;
+        }
+        m_synced_offset = upto;
+        return true;
+    }
+
+    int64_t NatsStreamSegment::findOffset(uint64_t seq) const{
+        if(m_last_seq == 0 || seq > m_last_seq){
+            return -1;
+        }
+        if(seq <= m_first_seq){
+            return 0;
+        }
+        //last index entry at or before seq, then walk the records from there
+        auto it = std::upper_bound(m_index.begin(), m_index.end(), seq,
+            [](uint64_t value, const std::pair<uint64_t, uint64_t>& entry){ return value < entry.first; });
+        uint64_t offset = std::prev(it)->second;
+        while(recordAt(offset)->m_seq < seq){
+            offset += recordAt(offset)->m_record_size;
+        }
+        return offset;
+    }
+
+    uint64_t NatsStreamSegment::findSeqByTime(int64_t timestamp_ns) const{
+        if(m_last_seq == 0){
+            return 0;
+        }
+        //timestamps only go up within a segment (unless the clock is set back), so the index can be searched by them too
+        auto it = std::partition_point(m_index.begin(), m_index.end(),
+            [this, timestamp_ns](const std::pair<uint64_t, uint64_t>& entry){ return recordAt(entry.second)->m_timestamp_ns < timestamp_ns; });
+        uint64_t offset = it == m_index.begin() ? 0 : std::prev(it)->second;
+        while(offset < m_write_offset){
+            const NatsStreamRecordHeader* header = recordAt(offset);
+            if(header->m_timestamp_ns >= timestamp_ns){
+                return header->m_seq;
+            }
+            offset += header->m_record_size;
+        }
+        return 0;
+    }
+
+    const NatsStreamRecordHeader* NatsStreamSegment::recordAt(uint64_t offset) const{
+        return reinterpret_cast<const NatsStreamRecordHeader*>(m_data + offset);
+    }
+
+    bool NatsStreamSegment::rename(const std::string& path){
+        if(::rename(m_path.c_str(), path.c_str()) < 0){
+            perror("stream segment rename failed");
+            return false;
+        }
+        m_path = path;
+        return true;
+    }
+
+    uint64_t NatsStreamSegment::getFirstSeq() const{
+        return m_first_seq;
+    }
+
+    uint64_t NatsStreamSegment::getLastSeq() const{
+        return m_last_seq;
+    }
+
+    uint64_t NatsStreamSegment::getWriteOffset() const{
+        return m_write_offset;
+    }
+
+    uint64_t NatsStreamSegment::getCapacity() const{
+        return m_capacity;
+    }
+
+    uint64_t NatsStreamSegment::getMessageCount() const{
+        return m_message_count;
+    }
+
+    uint64_t NatsStreamSegment::getPayloadBytes() const{
+        return m_payload_bytes;
+    }
+
+    int NatsStreamSegment::getFd() const{
+        return m_fd;
+    }
+
+    const std::string& NatsStreamSegment::getPath() const{
+        return m_path;
+    }
+
+    NatsStream::NatsStream(NatsStreamConfig config): m_config(std::move(config)), m_sealed_handoff(nullptr), m_first_seq(0), m_last_seq(0),
+        m_messages(0), m_bytes(0), m_synced_seq(0), m_syncing(false), m_running(false), m_append_waiters(0), m_compacted_upto(0),
+        m_deleted_segments(0), m_compacted_messages(0){
+    }
+
+    NatsStream::~NatsStream(){
+        {
+            std::lock_guard<std::mutex> lock(m_sync_mutex);
+            m_running = false;
+        }
+        m_sync_cv.notify_all();
+        {
+            std::lock_guard<std::mutex> lock(m_retention_mutex);
+        }
+        m_retention_cv.notify_all();
+        if(m_flusher_thread.joinable()){
+            m_flusher_thread.join();
+        }
+        if(m_retention_thread.joinable()){
+            m_retention_thread.join();
+        }
+        //whatever the policy, a stream that is closed cleanly leaves everything on disk
+        sync();
+        std::lock_guard<std::mutex> lock(m_segments_mutex);
+        takeSealedSegments();
+        for(auto& segment: m_sealed){
+            segment->sync(segment->getWriteOffset());
+        }
+    }
+
+    std::string NatsStream::directory() const{
+        return m_config.m_directory + "/" + m_config.m_name;
+    }
+
+    std::string NatsStream::segmentPath(uint64_t first_seq) const{
+        //zero padded so the directory listing sorts like the sequence numbers
+        char name[32];
+        snprintf(name, sizeof(name), "%020llu", static_cast<unsigned long long>(first_seq));
+        return directory() + "/" + name + SEGMENT_SUFFIX;
+    }
+
+    bool NatsStream::open(){
+        if(m_config.m_name.empty() || m_config.m_name.find('/') != std::string::npos){
+            std::cerr << "stream name '" << m_config.m_name << "' can't be used as a directory name" << std::endl;
+            return false;
+        }
+        try {
+            NatsClient::convertSubjectToList(m_config.m_subject, false, m_subject_list);
+        } catch (const std::exception& e){
+            std::cerr << "stream " << m_config.m_name << " has an invalid subject: " << e.what() << std::endl;
+            return false;
+        }
+        std::error_code error;
+        std::filesystem::create_directories(directory(), error);
+        if(error){
+            std::cerr << "can't create stream directory " << directory() << ": " << error.message() << std::endl;
+            return false;
+        }
+        std::vector<uint64_t> first_seqs;
+        for(const auto& entry: std::filesystem::directory_iterator(directory(), error)){
+            if(entry.path().extension() == SEGMENT_SUFFIX){
+                first_seqs.push_back(std::stoull(entry.path().stem().string()));
+            } else if(entry.path().extension() == COMPACT_SUFFIX){
+                //a compaction that didn't finish, the original segment is still there
+                std::filesystem::remove(entry.path(), error);
+            }
+        }
+        std::sort(first_seqs.begin(), first_seqs.end());
+        for(uint64_t first_seq: first_seqs){
+            auto segment = std::make_shared<NatsStreamSegment>(segmentPath(first_seq), first_seq, m_config.m_segment_size);
+            if(!segment->open()){
+                return false;
+            }
+            //the newest one is appended to, the others are full
+            if(m_active != nullptr){
+                m_sealed.push_back(m_active);
+            }
+            m_active = segment;
+            m_messages += segment->getMessageCount();
+            m_bytes += segment->getPayloadBytes();
+            if(segment->getLastSeq() != 0){
+                if(m_first_seq == 0) m_first_seq = segment->getFirstSeq();
+                m_last_seq = segment->getLastSeq();
+            }
+        }
+        m_synced_seq = m_last_seq;
+        if(m_active == nullptr){
+            auto segment = std::make_shared<NatsStreamSegment>(segmentPath(1), 1, m_config.m_segment_size);
+            if(!segment->open()){
+                return false;
+            }
+            m_active = segment;
+        }
+        m_running = true;
+        if(m_config.m_fsync_policy == NatsFsyncPolicy::INTERVAL){
+            m_flusher_thread = std::thread(&NatsStream::flusherLoop, this);
+        }
+        bool limited = m_config.m_max_age_ms > 0 || m_config.m_max_bytes > 0 || m_config.m_max_messages > 0
+            || m_config.m_keep_last_per_subject > 0;
+        if(limited && m_config.m_retention_interval_ms > 0){
+            m_retention_thread = std::thread(&NatsStream::retentionLoop, this);
+        }
+        return true;
+    }
+
+    const NatsStreamConfig& NatsStream::getConfig() const{
+        return m_config;
+    }
+
+    bool NatsStream::matches(const std::vector<std::string>& subject_list) const{
+        return NatsSublist::subjectMatches(m_subject_list, subject_list);
+    }
+
+    uint64_t NatsStream::append(std::string_view subject, std::string_view payload){
+        if(subject.size() > UINT16_MAX || payload.size() > UINT32_MAX - NatsStreamSegment::recordSize(subject.size(), 0)){
+            return 0;
+        }
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            seq = m_last_seq.load(std::memory_order_relaxed) + 1;
+            int64_t timestamp = nowNanos();
+            if(!m_active->append(seq, timestamp, subject, payload)){
+                //the active segment is full, a record bigger than a whole segment gets a segment of its own size
+                uint64_t capacity = std::max(m_config.m_segment_size, NatsStreamSegment::recordSize(subject.size(), payload.size()));
+                auto segment = std::make_shared<NatsStreamSegment>(segmentPath(seq), seq, capacity);
+                if(!segment->open()){
+                    return 0;
+                }
+                if(m_config.m_fsync_policy != NatsFsyncPolicy::NONE){
+                    m_unsynced.push_back(m_active);
+                }
+                //handed over before it stops being the active one, so a reader looking at both never misses it
+                SealedSegment* sealed = new SealedSegment{std::move(m_active), m_sealed_handoff.load(std::memory_order_relaxed)};
+                while(!m_sealed_handoff.compare_exchange_weak(sealed->m_next, sealed, std::memory_order_release, std::memory_order_relaxed)){
+                }
+                m_active = segment;
+                segment->append(seq, timestamp, subject, payload);
+            }
+            if(m_first_seq.load(std::memory_order_relaxed) == 0){
+                m_first_seq.store(seq, std::memory_order_relaxed);
+            }
+            m_messages.fetch_add(1, std::memory_order_relaxed);
+            m_bytes.fetch_add(payload.size(), std::memory_order_relaxed);
+            //seq_cst with the load of m_append_waiters, a consumer about to wait either sees this seq or gets notified
+            m_last_seq.store(seq, std::memory_order_seq_cst);
+        }
+        if(m_append_waiters.load(std::memory_order_seq_cst) > 0){
+            wakeWaiters();
+        }
+        if(m_config.m_fsync_policy == NatsFsyncPolicy::ALWAYS){
+            waitDurable(seq);
+        }
+        return seq;
+    }
+
+    bool NatsStream::syncSegments(){
+        //only ever called by the one thread holding m_syncing, so the segments' synced offsets are its alone
+        std::vector<std::pair<std::shared_ptr<NatsStreamSegment>, uint64_t>> pending;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(auto& segment: m_unsynced){
+                pending.emplace_back(segment, segment->getWriteOffset());
+            }
+            m_unsynced.clear();
+            pending.emplace_back(m_active, m_active->getWriteOffset());
+        }
+        bool synced = true;
+        for(auto& pair: pending){
+            synced = pair.first->sync(pair.second) && synced;
+        }
+        return synced;
+    }
+
+    void NatsStream::waitDurable(uint64_t seq){
+        std::unique_lock<std::mutex> lock(m_sync_mutex);
+        while(m_synced_seq < seq){
+            if(m_syncing){
+                //someone else is already syncing, their msync may well cover this append too
+                m_sync_cv.wait(lock);
+                continue;
+            }
+            m_syncing = true;
+            lock.unlock();
+            //everything up to here is under the segments' write offsets once syncSegments takes m_mutex
+            uint64_t target = m_last_seq.load(std::memory_order_acquire);
+            syncSegments();
+            lock.lock();
+            m_syncing = false;
+            m_synced_seq = std::max(m_synced_seq, target);
+            m_sync_cv.notify_all();
+        }
+    }
+
+    void NatsStream::flusherLoop(){
+        std::unique_lock<std::mutex> lock(m_sync_mutex);
+        while(m_running){
+            m_sync_cv.wait_for(lock, std::chrono::milliseconds(m_config.m_fsync_interval_ms));
+            if(!m_running){
+                break;
+            }
+            lock.unlock();
+            sync();
+            lock.lock();
+        }
+    }
+
+    void NatsStream::sync(){
+        waitDurable(m_last_seq.load(std::memory_order_acquire));
+    }
+
+    bool NatsStream::read(uint64_t seq, NatsStoredMessage& message){
+        std::shared_ptr<NatsStreamSegment> segment;
+        uint64_t offset;
+        if(!locate(seq, segment, offset)){
+            return false;
+        }
+        const NatsStreamRecordHeader* header = segment->recordAt(offset);
+        const char* data = reinterpret_cast<const char*>(header) + sizeof(NatsStreamRecordHeader);
+        message.m_seq = header->m_seq;
+        message.m_timestamp_ns = header->m_timestamp_ns;
+        message.m_subject.assign(data, header->m_subject_size);
+        message.m_payload.assign(data + header->m_subject_size, header->m_payload_size);
+        return true;
+    }
+
+    void NatsStream::takeSealedSegments(){
+        //the handover is newest first, every one goes in front of the one taken before it
+        SealedSegment* sealed = m_sealed_handoff.exchange(nullptr, std::memory_order_acquire);
+        std::size_t position = m_sealed.size();
+        while(sealed != nullptr){
+            m_sealed.insert(m_sealed.begin() + position, std::move(sealed->m_segment));
+            SealedSegment* next = sealed->m_next;
+            delete sealed;
+            sealed = next;
+        }
+    }
+
+    bool NatsStream::locate(uint64_t seq, std::shared_ptr<NatsStreamSegment>& segment, uint64_t& offset){
+        std::lock_guard<std::mutex> segments_lock(m_segments_mutex);
+        std::shared_ptr<NatsStreamSegment> active;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(seq > m_last_seq.load(std::memory_order_relaxed)){
+                return false;
+            }
+            active = m_active;
+        }
+        //whatever was sealed before that active segment is in the handover by now
+        takeSealedSegments();
+        auto it = std::upper_bound(m_sealed.begin(), m_sealed.end(), seq,
+            [](uint64_t value, const std::shared_ptr<NatsStreamSegment>& segment){ return value < segment->getFirstSeq(); });
+        if(it != m_sealed.begin()){
+            --it;
+        }
+        //seq can be past the end of its segment when it is the first one of the next (or was deleted or compacted away)
+        for(;it != m_sealed.end();++it){
+            int64_t found = (*it)->findOffset(seq);
+            if(found >= 0){
+                segment = *it;
+                offset = found;
+                return true;
+            }
+        }
+        //appends still change the active segment's index
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int64_t found = active->findOffset(seq);
+        if(found >= 0){
+            segment = active;
+            offset = found;
+            return true;
+        }
+        return false;
+    }
+
+    uint64_t NatsStream::findSeqByTime(int64_t timestamp_ns){
+        std::lock_guard<std::mutex> segments_lock(m_segments_mutex);
+        std::shared_ptr<NatsStreamSegment> active;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            active = m_active;
+        }
+        takeSealedSegments();
+        for(auto& segment: m_sealed){
+            uint64_t seq = segment->findSeqByTime(timestamp_ns);
+            if(seq != 0){
+                return seq;
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t seq = active->findSeqByTime(timestamp_ns);
+        return seq != 0 ? seq : m_last_seq.load(std::memory_order_relaxed) + 1;
+    }
+
+    bool NatsStream::waitForMessages(uint64_t after_seq, std::chrono::milliseconds timeout){
+        m_append_waiters.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> lock(m_append_mutex);
+            if(m_last_seq.load(std::memory_order_seq_cst) <= after_seq){
+                m_append_cv.wait_for(lock, timeout);
+            }
+        }
+        m_append_waiters.fetch_sub(1, std::memory_order_relaxed);
+        return m_last_seq.load(std::memory_order_acquire) > after_seq;
+    }
+
+    void NatsStream::wakeWaiters(){
+        //taking the lock makes sure a waiter that checked m_last_seq is already waiting
+        std::lock_guard<std::mutex> lock(m_append_mutex);
+        m_append_cv.notify_all();
+    }
+
+    uint64_t NatsStream::getFirstSeq() const{
+        return m_first_seq.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsStream::getLastSeq() const{
+        return m_last_seq.load(std::memory_order_acquire);
+    }
+
+    uint64_t NatsStream::getMessageCount() const{
+        return m_messages.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsStream::getByteCount() const{
+        return m_bytes.load(std::memory_order_relaxed);
+    }
+
+    std::size_t NatsStream::getSegmentCount(){
+        std::lock_guard<std::mutex> lock(m_segments_mutex);
+        takeSealedSegments();
+        return m_sealed.size() + 1;
+    }
+
+    uint64_t NatsStream::getDeletedSegmentCount() const{
+        return m_deleted_segments.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsStream::getCompactedMessageCount() const{
+        return m_compacted_messages.load(std::memory_order_relaxed);
+    }
+
+    void NatsStream::retentionLoop(){
+        //only this thread, disk space can wait for whatever else the machine is doing
+        setpriority(PRIO_PROCESS, 0, 19);
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+        std::unique_lock<std::mutex> lock(m_retention_mutex);
+        while(m_running){
+            m_retention_cv.wait_for(lock, std::chrono::milliseconds(m_config.m_retention_interval_ms), [this]() { return !m_running; });
+            if(!m_running){
+                break;
+            }
+            lock.unlock();
+            applyRetention();
+            lock.lock();
+        }
+    }
+
+    void NatsStream::applyRetention(){
+        int64_t oldest_kept = m_config.m_max_age_ms > 0 ? nowNanos() - m_config.m_max_age_ms * 1000000 : INT64_MIN;
+        std::vector<std::shared_ptr<NatsStreamSegment>> sealed;
+        {
+            std::lock_guard<std::mutex> lock(m_segments_mutex);
+            takeSealedSegments();
+            //oldest first, a segment goes once all of its messages are past a limit, the counters only shrink here
+            uint64_t messages = m_messages.load(std::memory_order_relaxed);
+            uint64_t bytes = m_bytes.load(std::memory_order_relaxed);
+            std::size_t expired = 0;
+            for(;expired < m_sealed.size();expired++){
+                const NatsStreamSegment& segment = *m_sealed[expired];
+                bool empty = segment.getLastSeq() == 0;
+                bool too_old = !empty && segment.recordAt(segment.findOffset(segment.getLastSeq()))->m_timestamp_ns < oldest_kept;
+                bool too_many = m_config.m_max_messages > 0 && messages - segment.getMessageCount() >= m_config.m_max_messages;
+                bool too_big = m_config.m_max_bytes > 0 && bytes - segment.getPayloadBytes() >= m_config.m_max_bytes;
+                if(!empty && !too_old && !too_many && !too_big){
+                    break;
+                }
+                messages -= segment.getMessageCount();
+                bytes -= segment.getPayloadBytes();
+            }
+            for(std::size_t i = 0; i < expired; i++){
+                //readers still holding the segment keep its mapping, the file is gone as soon as they let go
+                const NatsStreamSegment& segment = *m_sealed[i];
+                if(unlink(segment.getPath().c_str()) < 0){
+                    perror("stream segment unlink failed");
+                }
+                m_messages.fetch_sub(segment.getMessageCount(), std::memory_order_relaxed);
+                m_bytes.fetch_sub(segment.getPayloadBytes(), std::memory_order_relaxed);
+                if(segment.getLastSeq() != 0){
+                    //segments follow each other, so without a sealed one left the stream starts after the last deleted one
+                    m_first_seq.store(segment.getLastSeq() + 1, std::memory_order_relaxed);
+                }
+            }
+            m_sealed.erase(m_sealed.begin(), m_sealed.begin() + expired);
+            m_deleted_segments.fetch_add(expired, std::memory_order_relaxed);
+            if(!m_sealed.empty() && m_sealed.front()->getLastSeq() != 0){
+                m_first_seq.store(m_sealed.front()->getFirstSeq(), std::memory_order_relaxed);
+            }
+            sealed = m_sealed;
+        }
+        //nothing new to compact until another segment is full
+        if(m_config.m_keep_last_per_subject == 0 || sealed.empty() || sealed.back()->getLastSeq() <= m_compacted_upto){
+            return;
+        }
+        m_compacted_upto = sealed.back()->getLastSeq();
+        //newest to oldest, counting how many of each subject are kept after the current record
+        //the subjects point into the mappings, which the copied list keeps alive even for segments replaced meanwhile
+        std::unordered_map<std::string_view, uint32_t> kept;
+        std::vector<uint64_t> offsets;
+        std::vector<uint64_t> dropped;
+        for(auto segment = sealed.rbegin(); segment != sealed.rend(); ++segment){
+            offsets.clear();
+            for(uint64_t offset = 0; offset < (*segment)->getWriteOffset(); offset += (*segment)->recordAt(offset)->m_record_size){
+                offsets.push_back(offset);
+            }
+            dropped.clear();
+            uint64_t dropped_size = 0;
+            for(auto offset = offsets.rbegin(); offset != offsets.rend(); ++offset){
+                const NatsStreamRecordHeader* header = (*segment)->recordAt(*offset);
+                std::string_view subject(reinterpret_cast<const char*>(header) + sizeof(NatsStreamRecordHeader), header->m_subject_size);
+                uint32_t& count = kept[subject];
+                if(count < m_config.m_keep_last_per_subject){
+                    count++;
+                } else{
+                    dropped.push_back(*offset);
+                    dropped_size += header->m_record_size;
+                }
+            }
+            //rewriting a segment for a few records isn't worth it, they go with a later compaction or the retention limits
+            if(!dropped.empty() && dropped_size * COMPACT_MIN_FREED >= (*segment)->getWriteOffset()){
+                std::reverse(dropped.begin(), dropped.end());
+                compactSegment(*segment, dropped);
+            }
+        }
+    }
+
+    bool NatsStream::compactSegment(const std::shared_ptr<NatsStreamSegment>& segment, const std::vector<uint64_t>& dropped){
+        uint64_t kept_size = segment->getWriteOffset();
+        uint64_t dropped_bytes = 0;
+        for(uint64_t offset: dropped){
+            kept_size -= segment->recordAt(offset)->m_record_size;
+            dropped_bytes += segment->recordAt(offset)->m_payload_size;
+        }
+        std::shared_ptr<NatsStreamSegment> compacted;
+        if(kept_size > 0){
+            //written next to the original and renamed over it once it is on disk, a crash in between leaves the original
+            std::string path = segment->getPath() + COMPACT_SUFFIX;
+            unlink(path.c_str());
+            uint64_t first_kept = 0;
+            for(uint64_t offset = 0; first_kept == 0; offset += segment->recordAt(offset)->m_record_size){
+                if(!std::binary_search(dropped.begin(), dropped.end(), offset)){
+                    first_kept = segment->recordAt(offset)->m_seq;
+                }
+            }
+            compacted = std::make_shared<NatsStreamSegment>(path, first_kept, kept_size);
+            if(!compacted->open()){
+                unlink(path.c_str());
+                return false;
+            }
+            auto next_dropped = dropped.begin();
+            for(uint64_t offset = 0; offset < segment->getWriteOffset(); offset += segment->recordAt(offset)->m_record_size){
+                if(next_dropped != dropped.end() && *next_dropped == offset){
+                    ++next_dropped;
+                    continue;
+                }
+                const NatsStreamRecordHeader* header = segment->recordAt(offset);
+                const char* data = reinterpret_cast<const char*>(header) + sizeof(NatsStreamRecordHeader);
+                compacted->append(header->m_seq, header->m_timestamp_ns, std::string_view(data, header->m_subject_size),
+                    std::string_view(data + header->m_subject_size, header->m_payload_size));
+            }
+            if(!compacted->sync(compacted->getWriteOffset()) || !compacted->rename(segment->getPath())){
+                unlink(path.c_str());
+                return false;
+            }
+        } else if(unlink(segment->getPath().c_str()) < 0){
+            perror("stream segment unlink failed");
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_segments_mutex);
+        auto it = std::find(m_sealed.begin(), m_sealed.end(), segment);
+        if(compacted != nullptr){
+            *it = compacted;
+        } else{
+            m_sealed.erase(it);
+            m_deleted_segments.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_messages.fetch_sub(dropped.size(), std::memory_order_relaxed);
+        m_bytes.fetch_sub(dropped_bytes, std::memory_order_relaxed);
+        m_compacted_messages.fetch_add(dropped.size(), std::memory_order_relaxed);
+        if(!m_sealed.empty() && m_sealed.front()->getLastSeq() != 0){
+            m_first_seq.store(m_sealed.front()->getFirstSeq(), std::memory_order_relaxed);
+        }
+        return true;
+    }
+}
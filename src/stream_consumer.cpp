@@ -0,0 +1,344 @@
+#include "../include/nats/stream_consumer.hpp"
+#include "../include/nats/client.hpp"
+#include "../include/nats/server.hpp"
+#include "../include/nats/sublist.hpp"
+#include "../include/nats/timer.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+namespace nats{
+
+    namespace {
+        constexpr std::chrono::milliseconds IDLE_WAIT(100); //how long a waiting consumer sleeps before checking if it should stop
+    }
+
+    NatsStreamConsumer::NatsStreamConsumer(NatsClient* client, NatsServer* server, int fd, int sub_id, std::shared_ptr<NatsStream> stream,
+        std::vector<std::string> subject_list, uint64_t start_seq, int ack_wait_ms, std::size_t max_pending):
+        m_client(client), m_server(server), m_fd(fd), m_sub_id(sub_id),
+        m_sub_stats(client->getSubscriptionStats(sub_id)), m_stream(std::move(stream)), m_subject_list(std::move(subject_list)),
+        m_next_seq(std::max<uint64_t>(start_seq, 1)), m_running(false), m_finished(false),
+        m_iov(BATCH_MESSAGES * 5), m_frame_args(BATCH_MESSAGES), m_iov_count(0), m_frame_count(0), m_batch_messages(0), m_batch_bytes(0),
+        m_ack_wait_ns(static_cast<int64_t>(ack_wait_ms) * 1000000), m_consumer_id(0), m_pending(ack_wait_ms > 0 ? max_pending : 1),
+        m_window_full(false), m_blocked_seq(0), m_timer_scheduled(false), m_redelivery_due(false), m_acked(0), m_redelivered(0){
+        m_batch_segments.reserve(BATCH_MESSAGES);
+    }
+
+    NatsStreamConsumer::~NatsStreamConsumer(){
+        stop();
+        join();
+        if(m_consumer_id != 0){
+            m_server->unregisterAckConsumer(m_consumer_id);
+        }
+    }
+
+    void NatsStreamConsumer::start(){
+        if(m_ack_wait_ns > 0){
+            m_consumer_id = m_server->registerAckConsumer(this);
+        }
+        m_running = true;
+        m_thread = std::thread(&NatsStreamConsumer::run, this);
+    }
+
+    void NatsStreamConsumer::wake(){
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+        }
+        m_wake_cv.notify_all();
+        m_stream->wakeWaiters();
+    }
+
+    void NatsStreamConsumer::stop(){
+        m_running = false;
+        wake();
+    }
+
+    void NatsStreamConsumer::join(){
+        if(m_thread.joinable()){
+            m_thread.join();
+        }
+    }
+
+    void NatsStreamConsumer::run(){
+        while(m_running){
+            if(m_redelivery_due.exchange(false) && !redeliver()){
+                break;
+            }
+            int passed = deliverBatch();
+            if(passed < 0){
+                break;
+            }
+            if(passed > 0){
+                continue;
+            }
+            bool window_full;
+            {
+                std::lock_guard<std::mutex> lock(m_pending_mutex);
+                window_full = m_window_full;
+            }
+            if(window_full){
+                //there are messages to deliver but max_pending of them are unacked already
+                std::unique_lock<std::mutex> lock(m_wake_mutex);
+                m_wake_cv.wait_for(lock, IDLE_WAIT, [this]() {
+                    std::lock_guard<std::mutex> pending_lock(m_pending_mutex);
+                    return !m_window_full || !m_running || m_redelivery_due;
+                });
+            } else if(!m_redelivery_due){
+                //caught up, from here on every append wakes the consumer
+                m_stream->waitForMessages(m_next_seq.load(std::memory_order_relaxed) - 1, IDLE_WAIT);
+            }
+        }
+        m_finished = true;
+    }
+
+    int NatsStreamConsumer::addFrameArgs(int index, uint64_t seq, uint32_t payload_size){
+        //" <sid> <size>\r\n" like deliverMessage writes it, or " <sid> $ACK.<consumer id>.<seq> <size>\r\n" with acks
+        char* begin = m_frame_args[index].data();
+        char* pos = begin;
+        char* end = begin + m_frame_args[index].size();
+        *pos++ = ' ';
+        pos = std::to_chars(pos, end, m_sub_id).ptr;
+        if(m_ack_wait_ns > 0){
+            *pos++ = ' ';
+            std::memcpy(pos, ACK_PREFIX, 4);
+            pos += 4;
+            *pos++ = '.';
+            pos = std::to_chars(pos, end, m_consumer_id).ptr;
+            *pos++ = '.';
+            pos = std::to_chars(pos, end, seq).ptr;
+        }
+        *pos++ = ' ';
+        pos = std::to_chars(pos, end, payload_size).ptr;
+        *pos++ = '\r';
+        *pos++ = '\n';
+        return pos - begin;
+    }
+
+    bool NatsStreamConsumer::flushFrames(){
+        bool sent = true;
+        if(m_iov_count > 0){
+            std::lock_guard<std::mutex> lock(m_client->m_write_mutex);
+            sent = m_client->sendAllLocked(m_iov.data(), m_iov_count);
+        }
+        m_iov_count = 0;
+        m_frame_count = 0;
+        m_batch_segments.clear();
+        return sent;
+    }
+
+    bool NatsStreamConsumer::sendFileFrame(const NatsStreamSegment& segment, uint64_t offset){
+        //the payload goes from the page cache to the socket without passing through this process at all
+        const NatsStreamRecordHeader* header = segment.recordAt(offset);
+        const char* subject = reinterpret_cast<const char*>(header) + sizeof(NatsStreamRecordHeader);
+        int args_size = addFrameArgs(0, header->m_seq, header->m_payload_size);
+        struct iovec head[3] = {
+            {const_cast<char*>("MSG "), 4},
+            {const_cast<char*>(subject), header->m_subject_size},
+            {m_frame_args[0].data(), static_cast<size_t>(args_size)},
+        };
+        struct iovec tail[1] = {
+            {const_cast<char*>("\r\n"), 2},
+        };
+        off_t payload_offset = offset + sizeof(NatsStreamRecordHeader) + header->m_subject_size;
+        size_t remaining = header->m_payload_size;
+        std::lock_guard<std::mutex> lock(m_client->m_write_mutex);
+        if(!m_client->sendAllLocked(head, 3)){
+            return false;
+        }
+        while(remaining > 0){
+            ssize_t sent = sendfile(m_fd, segment.getFd(), &payload_offset, remaining);
+            if(sent < 0 && errno == EINTR) continue;
+            if(sent <= 0){
+                return false;
+            }
+            remaining -= sent;
+        }
+        return m_client->sendAllLocked(tail, 1);
+    }
+
+    bool NatsStreamConsumer::addFrame(const std::shared_ptr<NatsStreamSegment>& segment, uint64_t offset){
+        const NatsStreamRecordHeader* header = segment->recordAt(offset);
+        m_batch_messages++;
+        m_batch_bytes += header->m_payload_size;
+        //a shared memory client has no socket to sendfile to, its big payloads are copied into the ring like the rest
+        if(header->m_payload_size >= SENDFILE_MIN_PAYLOAD && !m_client->usesSharedMemory()){
+            //frames already in the batch go first so the order is kept
+            return flushFrames() && sendFileFrame(*segment, offset);
+        }
+        if(m_frame_count == BATCH_MESSAGES && !flushFrames()){
+            return false;
+        }
+        if(m_batch_segments.empty() || m_batch_segments.back() != segment){
+            m_batch_segments.push_back(segment);
+        }
+        const char* subject = reinterpret_cast<const char*>(header) + sizeof(NatsStreamRecordHeader);
+        int args_size = addFrameArgs(m_frame_count, header->m_seq, header->m_payload_size);
+        m_iov[m_iov_count++] = {const_cast<char*>("MSG "), 4};
+        m_iov[m_iov_count++] = {const_cast<char*>(subject), header->m_subject_size};
+        m_iov[m_iov_count++] = {m_frame_args[m_frame_count].data(), static_cast<size_t>(args_size)};
+        m_iov[m_iov_count++] = {const_cast<char*>(subject) + header->m_subject_size, header->m_payload_size};
+        m_iov[m_iov_count++] = {const_cast<char*>("\r\n"), 2};
+        m_frame_count++;
+        return true;
+    }
+
+    void NatsStreamConsumer::countDelivered(uint64_t redelivered){
+        if(m_batch_messages == 0){
+            return;
+        }
+        m_client->m_stats.m_out_msgs.fetch_add(m_batch_messages, std::memory_order_relaxed);
+        m_client->m_stats.m_out_bytes.fetch_add(m_batch_bytes, std::memory_order_relaxed);
+        m_server->m_stats.m_out_msgs.add(m_batch_messages);
+        m_server->m_stats.m_out_bytes.add(m_batch_bytes);
+        if(m_sub_stats != nullptr){
+            m_sub_stats->m_delivered.fetch_add(m_batch_messages, std::memory_order_relaxed);
+            m_sub_stats->m_redelivered.fetch_add(redelivered, std::memory_order_relaxed);
+        }
+        m_batch_messages = 0;
+        m_batch_bytes = 0;
+    }
+
+    int NatsStreamConsumer::deliverBatch(){
+        uint64_t seq = m_next_seq.load(std::memory_order_relaxed);
+        uint64_t last_seq = m_stream->getLastSeq();
+        std::shared_ptr<NatsStreamSegment> segment;
+        uint64_t offset;
+        if(seq > last_seq || !m_stream->locate(seq, segment, offset)){
+            return 0;
+        }
+        bool acks = m_ack_wait_ns > 0;
+        int64_t deadline = acks ? NatsTimer::nowNanos() + m_ack_wait_ns : 0;
+        int passed = 0;
+        bool connected = true;
+        //every record up to last_seq is complete, once seq passes the last record of this segment the size read there is 0
+        while(seq <= last_seq && passed < BATCH_SCAN && m_batch_messages < BATCH_MESSAGES && m_batch_bytes < BATCH_BYTES
+            && offset + sizeof(NatsStreamRecordHeader) <= segment->getCapacity()){
+            const NatsStreamRecordHeader* header = segment->recordAt(offset);
+            if(header->m_record_size == 0){
+                break; //the rest is in the next segment, the next batch starts there
+            }
+            const char* subject = reinterpret_cast<const char*>(header) + sizeof(NatsStreamRecordHeader);
+            NatsClient::convertSubjectToList(std::string_view(subject, header->m_subject_size), true, m_subject_tokens);
+            bool matches = NatsSublist::subjectMatches(m_subject_list, m_subject_tokens);
+            if(matches && acks){
+                std::lock_guard<std::mutex> lock(m_pending_mutex);
+                if(!m_pending.add(header->m_seq, deadline)){
+                    //this one waits until the oldest unacked messages are acked
+                    m_window_full = true;
+                    m_blocked_seq = header->m_seq;
+                    break;
+                }
+            }
+            uint64_t record_offset = offset;
+            seq = header->m_seq + 1;
+            offset += header->m_record_size;
+            passed++;
+            if(matches && !addFrame(segment, record_offset)){
+                connected = false;
+                break;
+            }
+        }
+        if(!connected || !flushFrames()){
+            return -1;
+        }
+        m_next_seq.store(seq, std::memory_order_relaxed);
+        countDelivered(0);
+        if(acks && passed > 0 && !m_timer_scheduled){
+            m_timer_scheduled = true;
+            m_server->m_ack_timer.schedule(deadline, m_consumer_id);
+        }
+        return passed;
+    }
+
+    bool NatsStreamConsumer::redeliver(){
+        int64_t now = NatsTimer::nowNanos();
+        int64_t next_deadline;
+        m_due.clear();
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            m_pending.collectDue(now, now + m_ack_wait_ns, m_due);
+            next_deadline = m_pending.earliestDeadline();
+        }
+        std::shared_ptr<NatsStreamSegment> segment;
+        uint64_t offset;
+        for(uint64_t seq: m_due){
+            if(!m_stream->locate(seq, segment, offset) || segment->recordAt(offset)->m_seq != seq){
+                //the message isn't stored anymore, there is nothing to redeliver
+                ack(seq);
+                continue;
+            }
+            if(!addFrame(segment, offset)){
+                return false;
+            }
+        }
+        //counted before the last frames go out, an ack for them can arrive right after
+        m_redelivered.fetch_add(m_batch_messages, std::memory_order_relaxed);
+        countDelivered(m_batch_messages);
+        if(!flushFrames()){
+            return false;
+        }
+        //the next timer is for whatever is pending now, nothing means the next delivery schedules it
+        m_timer_scheduled = next_deadline != 0;
+        if(m_timer_scheduled){
+            m_server->m_ack_timer.schedule(next_deadline, m_consumer_id);
+        }
+        return true;
+    }
+
+    bool NatsStreamConsumer::ack(uint64_t seq){
+        bool wake_up;
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+            if(!m_pending.remove(seq)){
+                return false;
+            }
+            wake_up = m_window_full && m_pending.canAdd(m_blocked_seq);
+            if(wake_up){
+                m_window_full = false;
+            }
+        }
+        m_acked.fetch_add(1, std::memory_order_relaxed);
+        if(wake_up){
+            wake();
+        }
+        return true;
+    }
+
+    void NatsStreamConsumer::requestRedelivery(){
+        m_redelivery_due = true;
+        wake();
+    }
+
+    uint64_t NatsStreamConsumer::getNextSeq() const{
+        return m_next_seq.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsStreamConsumer::getConsumerId() const{
+        return m_consumer_id;
+    }
+
+    std::size_t NatsStreamConsumer::getPendingCount(){
+        std::lock_guard<std::mutex> lock(m_pending_mutex);
+        return m_pending.size();
+    }
+
+    uint64_t NatsStreamConsumer::getAckedCount() const{
+        return m_acked.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NatsStreamConsumer::getRedeliveredCount() const{
+        return m_redelivered.load(std::memory_order_relaxed);
+    }
+
+    bool NatsStreamConsumer::isFinished() const{
+        return m_finished.load();
+    }
+}
@@ -1,33 +1,120 @@
 #include "../include/nats/sublist.hpp"
 #include "../include/nats/subscription.hpp"
 #include "../include/nats/sublist_node.hpp"
+#include "../include/nats/interest_watch.hpp"
+#include "../include/nats/latency.hpp"
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <mutex>
 #include <memory>
-#include <queue>
+#include <algorithm>
+#include <string_view>
+#include <string>
 
 using namespace std;
 
 namespace nats{
 
-    NatsSublist::NatsSublist(){
+    NatsSublist::NatsSublist(std::size_t filter_counters):
+        m_interest_filter(filter_counters), m_track_route_interest(false),
+        m_has_route_interest_changes(false), m_track_subscription_changes(false), m_has_subscription_changes(false),
+        m_subscription_count(0){
         m_head = std::make_unique<NatsSublistNode>();
     }
 
+    bool NatsSublist::subjectMatches(const std::vector<std::string>& pattern, const std::vector<std::string>& literal){
+        for(size_t i=0;i<pattern.size();i++){
+            if(pattern[i]==">"){
+                //">" needs at least one token to cover
+                return i<literal.size();
+            }
+            if(i>=literal.size() || (pattern[i]!="*" && pattern[i]!=literal[i])){
+                return false;
+            }
+        }
+        return pattern.size()==literal.size();
+    }
+
+    void NatsSublist::keepOnePerClient(std::vector<NatsSubscription>& subscriptions){
+        //sorting by client and then sub id puts the lowest sub id of each client first
+        std::sort(subscriptions.begin(), subscriptions.end(), [](const NatsSubscription& a, const NatsSubscription& b) {
+            return a.m_client_id != b.m_client_id ? a.m_client_id < b.m_client_id : a.m_sub_id < b.m_sub_id;
+        });
+        auto last = std::unique(subscriptions.begin(), subscriptions.end(), [](const NatsSubscription& a, const NatsSubscription& b) {
+            return a.m_client_id == b.m_client_id;
+        });
+        subscriptions.erase(last, subscriptions.end());
+    }
+
     void NatsSublist::addSubscription(NatsSubscription subscription, std::vector<std::string>& subject_list){
         std::lock_guard<std::mutex> lock(m_sublist_mutex);
         NatsSublistNode* cur_node = m_head.get();
         //reach the correct subject nodes and if it doesn't exist create one
         for(std::string& subject_part: subject_list){
-            if(cur_node->m_next.find(subject_part) == cur_node->m_next.end()){
-                cur_node->m_next[subject_part] = std::make_unique<NatsSublistNode>();
-            }
-            cur_node = cur_node->m_next[subject_part].get();
+            cur_node = getOrCreateChild(cur_node, subject_part);
         }
         //now that we are at the current node, we add the subscription
-        cur_node->m_subscriptions.insert(subscription);
+        insertSubscriptionIntoNode(cur_node, subscription, subject_list);
+    }
+
+    void NatsSublist::addSubscriptions(long long client_id, std::vector<std::pair<int, std::vector<std::string>>>& subscriptions,
+        const std::vector<NatsSubscriptionStats*>& stats){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        //path[i] is the node reached after i subject parts of the previous subject, so the common prefix is not walked again
+        //the batch is not sorted, clients tend to resubscribe in the order they subscribed so neighbours already share prefixes
+        //and sorting the subject lists cost more than the walks it saved
+        std::vector<NatsSublistNode*> path;
+        path.push_back(m_head.get());
+        std::vector<std::string>* prev_subject_list = nullptr;
+        for(std::size_t index=0;index<subscriptions.size();index++){
+            auto& pair = subscriptions[index];
+            std::vector<std::string>& subject_list = pair.second;
+            size_t common = 0;
+            if(prev_subject_list != nullptr){
+                while(common < prev_subject_list->size() && common < subject_list.size()
+                    && (*prev_subject_list)[common] == subject_list[common]){
+                    common++;
+                }
+            }
+            path.resize(common + 1);
+            NatsSublistNode* cur_node = path.back();
+            for(size_t i=common;i<subject_list.size();i++){
+                cur_node = getOrCreateChild(cur_node, subject_list[i]);
+                path.push_back(cur_node);
+            }
+            insertSubscriptionIntoNode(cur_node, {pair.first, client_id, stats.empty() ? nullptr : stats[index]}, subject_list);
+            prev_subject_list = &subject_list;
+        }
+    }
+
+    NatsSublistNode* NatsSublist::getOrCreateChild(NatsSublistNode* cur_node, const std::string& subject_part){
+        auto it = cur_node->m_next.find(subject_part);
+        if(it == cur_node->m_next.end()){
+            std::unique_ptr<NatsSublistNode> next_node = std::make_unique<NatsSublistNode>(subject_part, cur_node);
+            std::string_view key = next_node->m_token;
+            it = cur_node->m_next.emplace(key, std::move(next_node)).first;
+        }
+        return it->second.get();
+    }
+
+    void NatsSublist::insertSubscriptionIntoNode(NatsSublistNode* cur_node, const NatsSubscription& subscription, std::vector<std::string>& subject_list){
+        //the interest filter is only updated for new subscriptions so that its counters stay in sync with the trie
+        if(cur_node->m_subscriptions.insert(subscription).second){
+            if(cur_node->m_subscriptions.size() == 1){
+                cur_node->m_interest_key = NatsInterestFilter::interestKey(subject_list);
+            }
+            m_interest_filter.addInterest(cur_node->m_interest_key);
+            m_subscription_count.fetch_add(1, std::memory_order_relaxed);
+            m_client_subscriptions[subscription.m_client_id].emplace(subscription.m_sub_id, cur_node);
+            if(isLocalClient(subscription.m_client_id) && ++cur_node->m_local_subscriptions == 1
+                && m_track_route_interest.load(std::memory_order_relaxed)){
+                queueRouteInterestChange(subject_list, true);
+            }
+            if(m_track_subscription_changes.load(std::memory_order_relaxed)){
+                queueSubscriptionChange(subject_list, true);
+            }
+        }
     }
 
     void NatsSublist::removeSubscription(NatsSubscription& subscription, std::vector<std::string>& subject_list){
@@ -35,48 +122,256 @@ namespace nats{
         NatsSublistNode* cur_node = m_head.get();
         //reach the correct subject nodes and if it doesn't exist, ignore
         for(std::string& subject_part: subject_list){
-            if(cur_node->m_next.find(subject_part) != cur_node->m_next.end()){
-                cur_node = cur_node->m_next[subject_part].get();
-            } else {
+            auto it = cur_node->m_next.find(subject_part);
+            if(it == cur_node->m_next.end()){
                 return;
             }
+            cur_node = it->second.get();
         }
-        //now that we are at the current node, we erase the subscription if it exists
-        cur_node->m_subscriptions.erase(subscription);
+        if(cur_node->m_subscriptions.find(subscription) == cur_node->m_subscriptions.end()){
+            return;
+        }
+        //drop the back-reference that points at this exact node
+        auto client_it = m_client_subscriptions.find(subscription.m_client_id);
+        if(client_it != m_client_subscriptions.end()){
+            auto range = client_it->second.equal_range(subscription.m_sub_id);
+            for(auto it = range.first; it != range.second; ++it){
+                if(it->second == cur_node){
+                    client_it->second.erase(it);
+                    break;
+                }
+            }
+            if(client_it->second.empty()){
+                m_client_subscriptions.erase(client_it);
+            }
+        }
+        eraseSubscriptionFromNode(cur_node, subscription);
     }
 
-    std::vector<NatsSubscription> NatsSublist::getSubscriptionsForTopic(std::vector<std::string>& subject_list){
+    void NatsSublist::removeSubscriptions(long long client_id, const std::vector<int>& sub_ids){
         std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        auto client_it = m_client_subscriptions.find(client_id);
+        if(client_it == m_client_subscriptions.end()){
+            return;
+        }
+        for(int sub_id: sub_ids){
+            auto range = client_it->second.equal_range(sub_id);
+            for(auto it = range.first; it != range.second; ++it){
+                eraseSubscriptionFromNode(it->second, {sub_id, client_id});
+            }
+            client_it->second.erase(sub_id);
+        }
+        if(client_it->second.empty()){
+            m_client_subscriptions.erase(client_it);
+        }
+    }
+
+    void NatsSublist::removeClient(long long client_id){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        auto client_it = m_client_subscriptions.find(client_id);
+        if(client_it == m_client_subscriptions.end()){
+            return;
+        }
+        for(auto& pair: client_it->second){
+            eraseSubscriptionFromNode(pair.second, {pair.first, client_id});
+        }
+        m_client_subscriptions.erase(client_it);
+    }
+
+    void NatsSublist::eraseSubscriptionFromNode(NatsSublistNode* cur_node, const NatsSubscription& subscription){
+        if(cur_node->m_subscriptions.erase(subscription) == 0){
+            return;
+        }
+        m_interest_filter.removeInterest(cur_node->m_interest_key);
+        m_subscription_count.fetch_sub(1, std::memory_order_relaxed);
+        bool lost_local_interest = isLocalClient(subscription.m_client_id) && --cur_node->m_local_subscriptions == 0
+            && m_track_route_interest.load(std::memory_order_relaxed);
+        bool track_change = m_track_subscription_changes.load(std::memory_order_relaxed);
+        //the subject is only needed (and rebuilt from the parents) when someone is watching interest
+        if(lost_local_interest || track_change){
+            std::vector<std::string> subject_list;
+            getSubjectListForNode(cur_node, subject_list);
+            if(lost_local_interest){
+                queueRouteInterestChange(subject_list, false);
+            }
+            if(track_change){
+                queueSubscriptionChange(subject_list, false);
+            }
+        }
+        pruneNode(cur_node);
+    }
+
+    void NatsSublist::getSubjectListForNode(NatsSublistNode* cur_node, std::vector<std::string>& subject_list){
+        subject_list.clear();
+        for(; cur_node != m_head.get(); cur_node = cur_node->m_parent){
+            subject_list.push_back(cur_node->m_token);
+        }
+        std::reverse(subject_list.begin(), subject_list.end());
+    }
+
+    void NatsSublist::pruneNode(NatsSublistNode* cur_node){
+        //walk up removing nodes that no longer hold subscriptions or lead anywhere, so subject churn doesnt grow the trie forever
+        while(cur_node != m_head.get() && cur_node->m_subscriptions.empty() && cur_node->m_next.empty()){
+            NatsSublistNode* parent = cur_node->m_parent;
+            parent->m_next.erase(parent->m_next.find(cur_node->m_token));
+            cur_node = parent;
+        }
+    }
+
+    std::vector<NatsSubscription> NatsSublist::getSubscriptionsForTopic(std::vector<std::string>& subject_list){
         std::vector<NatsSubscription> subscriptions;
-        NatsSublistNode* cur_node;
-        std::queue<NatsSublistNode*> q;
-        q.push(m_head.get());
-        //we do a bfs to get all the subscriptions, each level is essentially one of the subsubjects in the subject_list
+        getSubscriptionsForTopic(subject_list, subscriptions);
+        return subscriptions;
+    }
+
+    void NatsSublist::getSubscriptionsForTopic(std::vector<std::string>& subject_list, std::vector<NatsSubscription>& subscriptions, NatsMatchMode mode){
+        //started before taking the lock, waiting for it is part of the cost of a match
+        NatsLatencyTimer match_timer(NatsLatencyStats::shared().m_match);
+        subscriptions.clear();
+        {
+            std::lock_guard<std::mutex> lock(m_sublist_mutex);
+            collectSubscriptionsForTopic(subject_list, subscriptions);
+        }
+        if(mode == NatsMatchMode::ONE_PER_CLIENT){
+            keepOnePerClient(subscriptions);
+        }
+    }
+
+    void NatsSublist::collectSubscriptionsForTopic(std::vector<std::string>& subject_list, std::vector<NatsSubscription>& subscriptions){
+        forEachMatchingNode(subject_list, [this, &subscriptions](NatsSublistNode* node) {
+            addSubscriptionsToVectorFromSublistNode(node, subscriptions);
+        });
+    }
+
+    void NatsSublist::collectMatchingNodes(std::vector<std::string>& subject_list, std::vector<NatsSublistNode*>& nodes){
+        //the nodes of the current and the next level, per thread so that their capacity is reused by every match
+        thread_local std::vector<NatsSublistNode*> level;
+        thread_local std::vector<NatsSublistNode*> next_level;
+        nodes.clear();
+        level.clear();
+        level.push_back(m_head.get());
+        //a bfs, each level is essentially one of the subsubjects in the subject_list
         for(std::string& subject_part: subject_list){
-            int level_count = q.size();
-            for(int i=0;i<level_count;i++){
-                cur_node = q.front();
-                q.pop();
-                if(cur_node->m_next.find(subject_part) != cur_node->m_next.end()){
-                    q.push(cur_node->m_next[subject_part].get());
+            next_level.clear();
+            for(NatsSublistNode* cur_node: level){
+                auto it = cur_node->m_next.find(subject_part);
+                if(it != cur_node->m_next.end()){
+                    next_level.push_back(it->second.get());
                 }
-                if(cur_node->m_next.find("*") != cur_node->m_next.end()){
-                    q.push(cur_node->m_next["*"].get());
+                it = cur_node->m_next.find("*");
+                if(it != cur_node->m_next.end()){
+                    next_level.push_back(it->second.get());
                 }
-                if(cur_node->m_next.find(">") != cur_node->m_next.end()){
+                it = cur_node->m_next.find(">");
+                if(it != cur_node->m_next.end()){
                     //cover the case where ">" covers everything after the previous subject_part
-                    cur_node = cur_node->m_next[">"].get();
-                    addSubscriptionsToVectorFromSublistNode(cur_node,subscriptions);
+                    nodes.push_back(it->second.get());
                 }
             }
+            level.swap(next_level);
+        }
+        //the nodes left are the ones reached with the last subject_part
+        nodes.insert(nodes.end(), level.begin(), level.end());
+    }
+
+    bool NatsSublist::hasPossibleInterest(std::vector<std::string>& subject_list){
+        return m_interest_filter.mayHaveInterest(subject_list);
+    }
+
+    void NatsSublist::queueRouteInterestChange(const std::vector<std::string>& subject_list, bool has_interest){
+        std::string subject;
+        for(const std::string& subject_part: subject_list){
+            if(!subject.empty()){
+                subject += '.';
+            }
+            subject += subject_part;
         }
-        //now if there is anything in the queue, then that means we reached the last subject_part and have some NatsSublistNodes available
-        while(!q.empty()){
-            cur_node = q.front();
-            q.pop();
-            addSubscriptionsToVectorFromSublistNode(cur_node,subscriptions);
+        m_route_interest_changes.push_back({std::move(subject), has_interest});
+        m_has_route_interest_changes = true;
+    }
+
+    void NatsSublist::setRouteInterestTracking(bool enabled){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        m_track_route_interest = enabled;
+        if(!enabled){
+            m_route_interest_changes.clear();
+            m_has_route_interest_changes = false;
+        }
+    }
+
+    void NatsSublist::takeRouteInterestChanges(std::vector<NatsRouteInterestChange>& changes){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        for(NatsRouteInterestChange& change: m_route_interest_changes){
+            changes.push_back(std::move(change));
+        }
+        m_route_interest_changes.clear();
+        m_has_route_interest_changes = false;
+    }
+
+    bool NatsSublist::hasRouteInterestChanges(){
+        return m_has_route_interest_changes;
+    }
+
+    void NatsSublist::queueSubscriptionChange(const std::vector<std::string>& subject_list, bool added){
+        m_subscription_changes.push_back({subject_list, added});
+        m_has_subscription_changes = true;
+    }
+
+    void NatsSublist::setSubscriptionChangeTracking(bool enabled){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        m_track_subscription_changes = enabled;
+        if(!enabled){
+            m_subscription_changes.clear();
+            m_has_subscription_changes = false;
+        }
+    }
+
+    void NatsSublist::takeSubscriptionChanges(std::vector<NatsSubscriptionChange>& changes){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        for(NatsSubscriptionChange& change: m_subscription_changes){
+            changes.push_back(std::move(change));
+        }
+        m_subscription_changes.clear();
+        m_has_subscription_changes = false;
+    }
+
+    bool NatsSublist::hasSubscriptionChanges(){
+        return m_has_subscription_changes;
+    }
+
+    long long NatsSublist::countMatchesAndTakeChanges(std::vector<std::string>& subject_list, std::vector<NatsSubscriptionChange>& changes){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        long long match_count = 0;
+        forEachMatchingNode(subject_list, [&match_count](NatsSublistNode* node) {
+            match_count += node->m_subscriptions.size();
+        });
+        for(NatsSubscriptionChange& change: m_subscription_changes){
+            changes.push_back(std::move(change));
+        }
+        m_subscription_changes.clear();
+        m_has_subscription_changes = false;
+        return match_count;
+    }
+
+    void NatsSublist::collectLocalInterest(std::vector<std::string>& subjects){
+        std::lock_guard<std::mutex> lock(m_sublist_mutex);
+        std::string prefix;
+        collectLocalInterest(m_head.get(), prefix, subjects);
+    }
+
+    void NatsSublist::collectLocalInterest(NatsSublistNode* cur_node, std::string& prefix, std::vector<std::string>& subjects){
+        if(cur_node->m_local_subscriptions > 0){
+            subjects.push_back(prefix);
+        }
+        for(auto& pair: cur_node->m_next){
+            std::size_t prefix_size = prefix.size();
+            if(!prefix.empty()){
+                prefix += '.';
+            }
+            prefix += pair.first;
+            collectLocalInterest(pair.second.get(), prefix, subjects);
+            prefix.resize(prefix_size);
         }
-        return subscriptions;
     }
 
     void NatsSublist::addSubscriptionsToVectorFromSublistNode(NatsSublistNode* cur_node, std::vector<NatsSubscription>& subscriptions){
@@ -84,4 +379,8 @@ namespace nats{
             subscriptions.push_back(sub);
         }
     }
-}
\ No newline at end of file
+
+    long long NatsSublist::getSubscriptionCount(){
+        return m_subscription_count.load(std::memory_order_relaxed);
+    }
+}
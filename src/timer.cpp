@@ -0,0 +1,75 @@
+#include "../include/nats/timer.hpp"
+
+#include <chrono>
+
+using namespace std;
+
+namespace nats{
+
+    NatsTimer::NatsTimer(NatsTimerCallback callback): m_callback(std::move(callback)), m_running(false), m_stopped(false){
+    }
+
+    NatsTimer::~NatsTimer(){
+        stop();
+    }
+
+    int64_t NatsTimer::nowNanos(){
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void NatsTimer::schedule(int64_t deadline, uint64_t id){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopped){
+            return;
+        }
+        if(!m_thread.joinable()){
+            m_running = true;
+            m_thread = std::thread(&NatsTimer::run, this);
+        }
+        //only the thread's wait has to be cut short, and only if this is now the first deadline
+        bool earliest = m_queue.empty() || deadline < m_queue.top().first;
+        m_queue.emplace(deadline, id);
+        if(earliest){
+            m_cv.notify_one();
+        }
+    }
+
+    void NatsTimer::run(){
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(m_running){
+            if(m_queue.empty()){
+                m_cv.wait(lock);
+                continue;
+            }
+            int64_t deadline = m_queue.top().first;
+            int64_t now = nowNanos();
+            if(deadline > now){
+                m_cv.wait_for(lock, chrono::nanoseconds(deadline - now));
+                continue;
+            }
+            uint64_t id = m_queue.top().second;
+            m_queue.pop();
+            //without the lock, the callback can schedule again
+            lock.unlock();
+            m_callback(id);
+            lock.lock();
+        }
+    }
+
+    void NatsTimer::stop(){
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+            m_stopped = true;
+        }
+        m_cv.notify_one();
+        if(m_thread.joinable()){
+            m_thread.join();
+        }
+    }
+
+    std::size_t NatsTimer::size(){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queue.size();
+    }
+}
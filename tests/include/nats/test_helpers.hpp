@@ -0,0 +1,37 @@
+#ifndef NATS_TEST_HELPERS_H
+#define NATS_TEST_HELPERS_H
+
+#include "../../../include/nats/client.hpp"
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <poll.h>
+#include <sys/socket.h>
+
+namespace nats{
+    //reads from fd until size bytes arrived or timeout_ms passed without any
+    inline std::string readBytes(int fd, size_t size, int timeout_ms = 1000) {
+        std::string data;
+        char buffer[64 * 1024];
+        while(data.size() < size){
+            struct pollfd poll_fd = {fd, POLLIN, 0};
+            if(poll(&poll_fd, 1, timeout_ms) <= 0){
+                break;
+            }
+            ssize_t n = recv(fd, buffer, std::min(sizeof(buffer), size - data.size()), 0);
+            if(n <= 0){
+                break;
+            }
+            data.append(buffer, n);
+        }
+        return data;
+    }
+
+    //runs a SUB with its arguments (everything after "SUB ") through the client
+    inline void sub(NatsClient* client, const std::string& args) {
+        std::string_view args_view(args);
+        client->processSub(args_view);
+    }
+}
+
+#endif
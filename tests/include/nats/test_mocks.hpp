@@ -8,9 +8,13 @@ namespace nats{
     //Mock NatsServer for testing
     class MockNatsServer : public NatsServer {
     public:
-        MOCK_METHOD(void, publishMessage, (std::string&, std::vector<std::string>& , std::string), (override));
+        MOCK_METHOD(void, publishMessage, (std::string&, std::vector<std::string>& , std::string_view), (override));
         MOCK_METHOD(void, addSubscription, (int, std::vector<std::string>&, long long), (override));
-        MOCK_METHOD(void, removeSubscriptions, ((std::vector<std::pair<std::vector<std::string>, NatsSubscription>>)), (override));
+        MOCK_METHOD(void, addSubscriptions, (long long, (std::vector<std::pair<int, std::vector<std::string>>>&)), (override));
+        MOCK_METHOD(void, removeSubscriptions, (long long, std::vector<int>), (override));
+        MOCK_METHOD(void, removeClientSubscriptions, (long long), (override));
+        MOCK_METHOD(void, addInterestWatch, (std::string&, std::vector<std::string>&, long long), (override));
+        MOCK_METHOD(void, removeInterestWatches, (std::vector<std::string>, long long), (override));
     };
 
     // Mock NatsClient for testing
@@ -28,9 +32,12 @@ namespace nats{
         MOCK_METHOD(void, processPub, (std::string_view&), (override));
         MOCK_METHOD(void, processSub, (std::string_view&), (override));
         MOCK_METHOD(void, processUnsub, (std::string_view&), (override));
+        MOCK_METHOD(void, processWatch, (std::string_view&), (override));
+        MOCK_METHOD(void, processUnwatch, (std::string_view&), (override));
         MOCK_METHOD(void, closeConnection, (const std::string), (override));
         MOCK_METHOD(void, sendErrorMessage, (const std::string), (override));
         MOCK_METHOD(void, resetParsingVars, (), (override));
+        MOCK_METHOD(void, flushPendingSubscriptions, (), (override));
         MOCK_METHOD(bool, maxArgSizeReached, (), (override));
         MOCK_METHOD(bool, maxMessageSizeReached, (), (override));
         MOCK_METHOD(void, startPongTimeoutThread, (), (override)); 
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../include/nats/alloc_counter.hpp"
+#include "../include/nats/parser.hpp"
+#include "../include/nats/server.hpp"
+#include "../include/nats/sublist.hpp"
+#include "include/nats/test_mocks.hpp"
+
+using namespace nats;
+
+//Steady state publishing must not touch the heap, the parse, match and delivery buffers are all reused once warm
+class NatsAllocationTest : public ::testing::Test {
+    protected:
+    NatsServer server;
+    int publisher_fds[2];
+    int subscriber_fds[2];
+    NatsClient* publisher;
+    NatsClient* subscriber;
+
+    void SetUp() override {
+        ASSERT_TRUE(NatsAllocCounter::enabled());
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, publisher_fds), 0);
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, subscriber_fds), 0);
+        publisher = addClient(publisher_fds[0]);
+        subscriber = addClient(subscriber_fds[0]);
+        std::vector<std::pair<int, std::vector<std::string>>> subscriptions = {{1, {"foo", "bar"}}, {2, {"foo", "*"}}, {3, {">"}}};
+        server.addSubscriptions(subscriber->m_client_id, subscriptions);
+    }
+
+    void TearDown() override {
+        server.removeClient(publisher->m_client_id);
+        server.removeClient(subscriber->m_client_id);
+        close(publisher_fds[1]);
+        close(subscriber_fds[1]);
+    }
+
+    NatsClient* addClient(int fd){
+        auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(fd, &server);
+        NatsClient* client = client_unique_ptr.get();
+        client->m_waiting_for_initial_connect = false;
+        server.addClient(std::move(client_unique_ptr));
+        return client;
+    }
+
+    //the +OKs and MSGs go to the other end of the socketpairs, read them so the sends never block
+    void drain(){
+        char buffer[4096];
+        while(recv(publisher_fds[1], buffer, sizeof(buffer), MSG_DONTWAIT) > 0){}
+        while(recv(subscriber_fds[1], buffer, sizeof(buffer), MSG_DONTWAIT) > 0){}
+    }
+
+    unsigned long long allocationsForPublishes(const char* command, int count){
+        std::vector<char> buffer(command, command + strlen(command));
+        //warm up the per thread buffers first
+        NatsParser::parse(publisher, buffer.data(), buffer.size());
+        drain();
+        unsigned long long allocations = NatsAllocCounter::threadAllocations();
+        for(int i=0;i<count;i++){
+            NatsParser::parse(publisher, buffer.data(), buffer.size());
+            drain();
+        }
+        return NatsAllocCounter::threadAllocations() - allocations;
+    }
+};
+
+TEST_F(NatsAllocationTest, PublishWithDeliveryDoesNotAllocate) {
+    EXPECT_EQ(allocationsForPublishes("PUB foo.bar 5\r\nhello\r\n", 100), 0u);
+    EXPECT_EQ(subscriber->m_stats.m_out_msgs.load(), 101u * 3u);
+}
+
+TEST_F(NatsAllocationTest, PublishWithoutInterestDoesNotAllocate) {
+    server.removeSubscriptions(subscriber->m_client_id, {1, 2, 3});
+    EXPECT_EQ(allocationsForPublishes("PUB weather.today.london 5\r\nsunny\r\n", 100), 0u);
+    EXPECT_EQ(subscriber->m_stats.m_out_msgs.load(), 0u);
+}
+
+TEST_F(NatsAllocationTest, SublistMatchDoesNotAllocate) {
+    NatsSublist sublist;
+    std::vector<std::string> literal = {"foo", "bar"};
+    std::vector<std::string> star = {"foo", "*"};
+    sublist.addSubscription({1, 100}, literal);
+    sublist.addSubscription({2, 100}, star);
+    sublist.addSubscription({1, 200}, literal);
+    std::vector<NatsSubscription> buffer;
+    sublist.getSubscriptionsForTopic(literal, buffer);
+
+    unsigned long long allocations = NatsAllocCounter::threadAllocations();
+    size_t found = 0;
+    for(int i=0;i<100;i++){
+        sublist.getSubscriptionsForTopic(literal, buffer, NatsMatchMode::ONE_PER_CLIENT);
+        found += buffer.size();
+        sublist.forEachSubscriptionForTopic(literal, [&found](const NatsSubscription&) { found++; });
+    }
+    EXPECT_EQ(NatsAllocCounter::threadAllocations() - allocations, 0u);
+    EXPECT_EQ(found, 100u * (2 + 3));
+}
+
+TEST_F(NatsAllocationTest, LocalPublishDoesNotAllocate) {
+    long long received = 0;
+    server.subscribe("local.*", [&received](std::string_view, std::string_view) { received++; });
+    server.publish("local.events", "hello");
+
+    unsigned long long allocations = NatsAllocCounter::threadAllocations();
+    for(int i=0;i<100;i++){
+        server.publish("local.events", "hello");
+    }
+    EXPECT_EQ(NatsAllocCounter::threadAllocations() - allocations, 0u);
+    EXPECT_EQ(received, 101);
+}
+
+TEST(NatsAllocCounterTest, CountsOverAlignedAllocations) {
+    ASSERT_TRUE(NatsAllocCounter::enabled());
+    unsigned long long allocations = NatsAllocCounter::threadAllocations();
+    auto stats = std::make_unique<NatsClientStats>();
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(stats.get()) % 64, 0u);
+    EXPECT_EQ(NatsAllocCounter::threadAllocations() - allocations, 1u);
+}
@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+#include "../include/nats/buffer_pool.hpp"
+
+using namespace nats;
+
+TEST(NatsBufferPoolTest, AcquireRoundsUpToSizeClass) {
+    NatsBufferPool pool;
+    int capacity = 0;
+    char* small = pool.acquire(10, capacity);
+    EXPECT_EQ(capacity, 128);
+    pool.release(small, capacity);
+
+    char* medium = pool.acquire(129, capacity);
+    EXPECT_EQ(capacity, 1024);
+    pool.release(medium, capacity);
+
+    char* large = pool.acquire(NatsBufferPool::MAX_BUFFER_SIZE, capacity);
+    EXPECT_EQ(capacity, NatsBufferPool::MAX_BUFFER_SIZE);
+    pool.release(large, capacity);
+}
+
+TEST(NatsBufferPoolTest, ReleasedBufferIsReused) {
+    NatsBufferPool pool;
+    int capacity = 0;
+    char* first = pool.acquire(100, capacity);
+    pool.release(first, capacity);
+    char* second = pool.acquire(50, capacity);
+    EXPECT_EQ(first, second);
+    //a different size class doesn't get the same buffer
+    char* other = pool.acquire(500, capacity);
+    EXPECT_NE(first, other);
+    pool.release(second, 128);
+    pool.release(other, capacity);
+}
@@ -19,8 +19,8 @@ protected:
     int fake_fd = 1; // Use a dummy fd
 
     void SetUp() override {
-        //adding this as base  destructor is always called so removeSubscription will be called in every test case
-        EXPECT_CALL(server, removeSubscriptions(_)).Times(::testing::AnyNumber());
+        //adding this as base  destructor is always called so removeClientSubscriptions will be called in every test case
+        EXPECT_CALL(server, removeClientSubscriptions(_)).Times(::testing::AnyNumber());
         client = new PartialMockNatsClient(fake_fd, &server);
         //except for initial connect and pong cases, this is what's required for all test cases
         client->m_waiting_for_initial_connect = false;
@@ -81,6 +81,35 @@ TEST_F(NatsClientTest, ProcessPubArgs_Success_Valid) {
     EXPECT_STREQ(client->m_payload_sub, "foo.bar");
 }
 
+TEST_F(NatsClientTest, ProcessPubArgs_Success_LongSubject) {
+    std::string subject = "foo." + std::string(200, 'a') + ".bar";
+    std::string pub_args = subject + " 10";
+    std::string_view args_view(pub_args);
+    client->processPubArgs(args_view);
+    EXPECT_EQ(client->m_payload_size, 10);
+    EXPECT_STREQ(client->m_payload_sub, subject.c_str());
+    //the borrowed buffer goes back to the pool once the operation is done
+    client->NatsClient::resetParsingVars();
+    EXPECT_STREQ(client->m_payload_sub, "");
+}
+
+TEST_F(NatsClientTest, SplitBuffers_BorrowedOnlyWhileSplit) {
+    EXPECT_EQ(client->m_arg_buffer, nullptr);
+    EXPECT_EQ(client->m_msg_buffer, nullptr);
+    client->saveSplitArg("foo.bar", 7);
+    client->appendArgByte(' ');
+    client->appendArgByte('1');
+    EXPECT_EQ(std::string_view(client->m_arg_buffer, client->m_arg_len), "foo.bar 1");
+    client->m_payload_size = 5;
+    client->saveSplitMsg("he", 2);
+    client->appendMsgByte('y');
+    EXPECT_EQ(std::string_view(client->m_msg_buffer, client->m_msg_len), "hey");
+    client->NatsClient::resetParsingVars();
+    EXPECT_EQ(client->m_arg_buffer, nullptr);
+    EXPECT_EQ(client->m_msg_buffer, nullptr);
+    EXPECT_EQ(client->m_arg_len, 0);
+}
+
 TEST_F(NatsClientTest, ProcessPubArgs_Failure_Invalid_1) {
     std::string pub_args = "foo.bar";
     std::string_view args_view(pub_args);
@@ -147,10 +176,28 @@ TEST_F(NatsClientTest, ProcessSub_Success) {
     std::string sub_args = "foo.bar.*.test.> 42";
     std::string_view args_view(sub_args);
 
-    // Expect addSubscription to be called with correct arguments
-    EXPECT_CALL(server, addSubscription(42, testing::ElementsAre("foo", "bar","*","test",">"), testing::_)).Times(1);
+    // Expect addSubscriptions to be called with correct arguments once the pending subscriptions are flushed
+    EXPECT_CALL(server, addSubscriptions(testing::_, testing::ElementsAre(testing::Pair(42, testing::ElementsAre("foo", "bar","*","test",">"))))).Times(1);
 
     EXPECT_NO_THROW(client->processSub(args_view));
+    client->flushPendingSubscriptions();
+}
+
+TEST_F(NatsClientTest, ProcessSub_Success_Batched) {
+    std::string sub_args_1 = "foo.bar 1";
+    std::string sub_args_2 = "foo.baz 2";
+    std::string_view args_view_1(sub_args_1);
+    std::string_view args_view_2(sub_args_2);
+
+    // Both subscriptions reach the server in a single call
+    EXPECT_CALL(server, addSubscriptions(testing::_, testing::ElementsAre(
+        testing::Pair(1, testing::ElementsAre("foo", "bar")),
+        testing::Pair(2, testing::ElementsAre("foo", "baz"))
+    ))).Times(1);
+
+    client->processSub(args_view_1);
+    client->processSub(args_view_2);
+    client->flushPendingSubscriptions();
 }
 
 TEST_F(NatsClientTest, ProcessSub_Failure_Invalid_1_MissingSubId) {
@@ -173,9 +220,10 @@ TEST_F(NatsClientTest, ProcessSub_Failure_Invalid_3_ExistingSubId) {
     // sub_id already exists
     std::string sub_args = "foo.baz 42";
     std::string_view args_view(sub_args);
-    EXPECT_CALL(server, addSubscription(42, testing::ElementsAre("foo", "baz"), testing::_)).Times(1);
+    EXPECT_CALL(server, addSubscriptions(testing::_, testing::ElementsAre(testing::Pair(42, testing::ElementsAre("foo", "baz"))))).Times(1);
 
     client->processSub(args_view);
+    client->flushPendingSubscriptions();
 
     std::string sub_args_new = "foo.bar.new 42";
     std::string_view args_view_new(sub_args_new);
@@ -205,19 +253,20 @@ TEST_F(NatsClientTest, ProcessUnsub_Success) {
     std::string_view args_view(sub_args);
 
     //2 times because at the end we again add the same subscription
-    EXPECT_CALL(server, addSubscription(42, testing::ElementsAre("foo", "baz"), testing::_)).Times(2);
+    EXPECT_CALL(server, addSubscriptions(testing::_, testing::ElementsAre(testing::Pair(42, testing::ElementsAre("foo", "baz"))))).Times(2);
     client->processSub(args_view);
 
     std::string unsub_args = "42";
     std::string_view unsub_args_view(unsub_args);
 
-    // Expect removeSubscriptions to be called
-    //2 times because the destructor will call it once automatically apart from the one executed because of processUnsub
-    EXPECT_CALL(server, removeSubscriptions(testing::_)).Times(2);
+    // Expect removeSubscriptions to be called only for the unsubscribed id, the destructor uses removeClientSubscriptions
+    // the pending SUB has to be flushed before the UNSUB is queued
+    EXPECT_CALL(server, removeSubscriptions(testing::_, testing::ElementsAre(42))).Times(1);
     EXPECT_NO_THROW(client->processUnsub(unsub_args_view));
     
     //SUB again to make sure it doesn't throw exception for existing sub id
     EXPECT_NO_THROW(client->processSub(args_view));
+    client->flushPendingSubscriptions();
 }
 
 TEST_F(NatsClientTest, ProcessUnsub_Failure_Invalid_1_MissingSubId) {
@@ -242,4 +291,47 @@ TEST_F(NatsClientTest, ProcessUnsub_Failure_Invalid_3_NoSuchSubId) {
     std::string_view args_view(unsub_args);
 
     EXPECT_THROW(client->processUnsub(args_view), NoSuchSubscriptionIdException);
-}
\ No newline at end of file
+}
+TEST_F(NatsClientTest, ProcessWatch_Success) {
+    std::string watch_args = "telemetry.device1";
+    std::string_view args_view(watch_args);
+
+    EXPECT_CALL(server, addInterestWatch(testing::StrEq("telemetry.device1"), testing::ElementsAre("telemetry", "device1"), testing::_)).Times(1);
+    //the destructor drops the watches of the client
+    EXPECT_CALL(server, removeInterestWatches(testing::ElementsAre("telemetry.device1"), testing::_)).Times(1);
+
+    EXPECT_NO_THROW(client->processWatch(args_view));
+}
+
+TEST_F(NatsClientTest, ProcessWatch_Failure_WildcardSubject) {
+    std::string watch_args = "telemetry.*";
+    std::string_view args_view(watch_args);
+
+    EXPECT_THROW(client->processWatch(args_view), InvalidPublishSubjectException);
+}
+
+TEST_F(NatsClientTest, ProcessWatch_Failure_MultipleSubjects) {
+    std::string watch_args = "telemetry.device1 telemetry.device2";
+    std::string_view args_view(watch_args);
+
+    EXPECT_THROW(client->processWatch(args_view), ArgumentParseException);
+}
+
+TEST_F(NatsClientTest, ProcessUnwatch_Success) {
+    std::string watch_args = "telemetry.device1";
+    std::string_view args_view(watch_args);
+
+    EXPECT_CALL(server, addInterestWatch(testing::_, testing::_, testing::_)).Times(1);
+    client->processWatch(args_view);
+
+    //only once, the destructor has nothing left to remove
+    EXPECT_CALL(server, removeInterestWatches(testing::ElementsAre("telemetry.device1"), testing::_)).Times(1);
+    EXPECT_NO_THROW(client->processUnwatch(args_view));
+}
+
+TEST_F(NatsClientTest, ProcessUnwatch_Failure_NotWatched) {
+    std::string unwatch_args = "telemetry.device1";
+    std::string_view args_view(unwatch_args);
+
+    EXPECT_THROW(client->processUnwatch(args_view), NoSuchInterestWatchException);
+}
@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "../include/nats/server.hpp"
+#include "../include/nats/route.hpp"
+#include "../include/nats/interest_summary.hpp"
+
+using namespace nats;
+
+namespace {
+    //route traffic is handled on the routes' own threads, so the tests wait for its effects
+    bool waitFor(const std::function<bool()>& condition){
+        for(int i = 0; i < 2000; i++){
+            if(condition()){
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return condition();
+    }
+
+    void link(NatsServer& a, NatsServer& b){
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        a.addRoute(fds[0], true);
+        b.addRoute(fds[1], false);
+    }
+
+    NatsRoute* onlyRoute(NatsServer& server){
+        std::shared_lock<std::shared_mutex> lock(server.m_routes_mutex);
+        return server.m_routes.size() == 1 ? server.m_routes.begin()->second.get() : nullptr;
+    }
+
+    //what a peer makes of the RS/RF lines a summary sends, the first word and subject of every line
+    struct SummaryPeer {
+        std::set<std::string> m_exact;
+        std::map<std::string, NatsSummaryFilter> m_filters;
+        std::vector<std::string> apply(const std::string& out){
+            std::vector<std::string> lines;
+            std::size_t pos = 0;
+            while(pos < out.size()){
+                std::size_t end = out.find("\r\n", pos);
+                std::string line = out.substr(pos, end - pos);
+                pos = end + 2;
+                std::string op = line.substr(0, 3);
+                std::string args = line.substr(4);
+                std::string entry = args.substr(0, args.find(' '));
+                lines.push_back(op + " " + entry);
+                if(op == "RS+"){
+                    m_exact.insert(entry);
+                } else if(op == "RS-"){
+                    m_exact.erase(entry);
+                } else if(op == "RF+"){
+                    uint32_t bits = std::stoul(args.substr(args.find(' ') + 1));
+                    m_filters.erase(entry);
+                    m_filters.emplace(entry, NatsSummaryFilter(bits, std::string_view(out).substr(pos, bits / 8)));
+                    pos += bits / 8 + 2;
+                } else if(op == "RF-"){
+                    m_filters.erase(entry);
+                } else {
+                    NatsSummaryFilter& filter = m_filters.at(entry);
+                    std::istringstream bits(args.substr(entry.size()));
+                    uint32_t bit;
+                    while(bits >> bit){
+                        op == "RFS" ? filter.set(bit) : filter.clear(bit);
+                    }
+                }
+            }
+            return lines;
+        }
+        bool forwards(const std::string& subject){
+            std::vector<std::string> subject_list;
+            NatsClient::convertSubjectToList(subject, true, subject_list);
+            for(const std::string& entry: m_exact){
+                std::vector<std::string> pattern;
+                NatsClient::convertSubjectToList(entry, false, pattern);
+                if(NatsSublist::subjectMatches(pattern, subject_list)){
+                    return true;
+                }
+            }
+            for(auto& pair: m_filters){
+                std::string prefix = pair.first.substr(0, pair.first.size() - 1);
+                if(subject.rfind(prefix, 0) == 0 && pair.second.mayContain(subject)){
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    struct Received {
+        std::mutex m_mutex;
+        std::vector<std::string> m_messages;
+        NatsMessageHandler handler(const std::string& name){
+            return [this, name](std::string_view subject, std::string_view payload) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_messages.push_back(name + " " + std::string(subject) + " " + std::string(payload));
+            };
+        }
+        std::size_t size(){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_messages.size();
+        }
+        std::vector<std::string> take(){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::vector<std::string> messages;
+            messages.swap(m_messages);
+            return messages;
+        }
+    };
+}
+
+TEST(NatsClusterTest, ForwardsOnlyToPeersWithInterest) {
+    NatsServer a;
+    NatsServer b;
+    Received received;
+    //interest that exists before the route is sent when it is set up
+    b.subscribe("orders.*", received.handler("wildcard"));
+    link(a, b);
+    ASSERT_TRUE(waitFor([&]() { return onlyRoute(a) != nullptr && onlyRoute(a)->getRemoteSubjectCount() == 1; }));
+    NatsRoute* a_to_b = onlyRoute(a);
+
+    int literal = b.subscribe("orders.new", received.handler("literal"));
+    ASSERT_TRUE(waitFor([&]() { return a_to_b->getRemoteSubjectCount() == 2; }));
+    a.publish("orders.new", "1");
+    a.publish("payments.new", "2");
+    ASSERT_TRUE(waitFor([&]() { return received.size() == 2; }));
+    EXPECT_THAT(received.take(), ::testing::UnorderedElementsAre("wildcard orders.new 1", "literal orders.new 1"));
+    //matched two of b's subjects but went over the route once, and nothing nobody wants went at all
+    EXPECT_EQ(a_to_b->getOutMsgs(), 1u);
+
+    b.unsubscribe(literal);
+    ASSERT_TRUE(waitFor([&]() { return a_to_b->getRemoteSubjectCount() == 1; }));
+    b.unsubscribe(1);
+    ASSERT_TRUE(waitFor([&]() { return a_to_b->getRemoteSubjectCount() == 0; }));
+    a.publish("orders.new", "3");
+    EXPECT_EQ(a_to_b->getOutMsgs(), 1u);
+
+    //a second route between the same servers is closed on both ends
+    link(b, a);
+    EXPECT_TRUE(waitFor([&]() { return a.getRouteCount() == 1 && b.getRouteCount() == 1; }));
+}
+
+TEST(NatsClusterTest, MessagesFromRoutesAreNotForwardedAgain) {
+    NatsServer a;
+    NatsServer b;
+    NatsServer c;
+    link(a, b);
+    link(b, c);
+    link(a, c);
+    Received received;
+    b.subscribe("events.>", received.handler("b"));
+    c.subscribe("events.>", received.handler("c"));
+    ASSERT_TRUE(waitFor([&]() {
+        std::shared_lock<std::shared_mutex> lock(a.m_routes_mutex);
+        std::size_t interested = 0;
+        for(auto& pair: a.m_routes){
+            interested += pair.second->getRemoteSubjectCount();
+        }
+        return interested == 2;
+    }));
+
+    a.publish("events.login", "x");
+    ASSERT_TRUE(waitFor([&]() { return received.size() == 2; }));
+    //b and c are routed to each other too, but neither sends a message it got from a on
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_THAT(received.take(), ::testing::UnorderedElementsAre("b events.login x", "c events.login x"));
+
+    c.publish("events.logout", "y");
+    ASSERT_TRUE(waitFor([&]() { return received.size() == 2; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_THAT(received.take(), ::testing::UnorderedElementsAre("b events.logout y", "c events.logout y"));
+}
+
+TEST(NatsInterestSummaryTest, FoldsWidePrefixesIntoFiltersAndUnfoldsThem) {
+    NatsInterestSummary summary(4);
+    SummaryPeer peer;
+    std::string out;
+    summary.apply({{"orders", true}, {"orders.>", true}, {"orders.1", true}, {"orders.2", true}, {"orders.3", true}}, out);
+    EXPECT_EQ(peer.apply(out).size(), 5u);
+
+    //a fifth next token (">" is one too) folds the prefix, the filter goes out before the subjects it replaces
+    out.clear();
+    summary.apply({{"orders.4", true}}, out);
+    std::vector<std::string> lines = peer.apply(out);
+    ASSERT_GE(lines.size(), 4u);
+    EXPECT_EQ(lines[0], "RF+ orders.>");
+    EXPECT_THAT(std::vector<std::string>(lines.begin() + 1, lines.begin() + 4),
+        ::testing::UnorderedElementsAre("RS- orders.1", "RS- orders.2", "RS- orders.3"));
+    //the wildcard subscription can't go into a filter, and "orders" itself isn't below the prefix
+    EXPECT_THAT(summary.getExactEntries(), ::testing::UnorderedElementsAre("orders", "orders.>"));
+    EXPECT_THAT(summary.getFilterEntries(), ::testing::ElementsAre("orders.>"));
+    EXPECT_EQ(summary.getFoldedCount(), 1u);
+    //a new route gets the same from the snapshot
+    SummaryPeer fresh;
+    fresh.apply(summary.getSnapshot());
+    EXPECT_EQ(fresh.m_exact, peer.m_exact);
+    for(int i = 1; i <= 4; i++){
+        EXPECT_TRUE(fresh.forwards("orders." + std::to_string(i)));
+        EXPECT_TRUE(peer.forwards("orders." + std::to_string(i)));
+    }
+
+    //changes under the folded prefix only flip bits
+    out.clear();
+    summary.apply({{"orders.5.eu", true}}, out);
+    EXPECT_THAT(peer.apply(out), ::testing::ElementsAre("RFS orders.>"));
+    EXPECT_TRUE(peer.forwards("orders.5.eu"));
+    out.clear();
+    summary.apply({{"orders.5.eu", false}}, out);
+    EXPECT_THAT(peer.apply(out), ::testing::ElementsAre("RFC orders.>"));
+
+    //down to half of the fanout the subjects are exact again, before the filter is withdrawn
+    out.clear();
+    summary.apply({{"orders.>", false}, {"orders.4", false}}, out);
+    peer.apply(out);
+    out.clear();
+    summary.apply({{"orders.3", false}}, out);
+    lines = peer.apply(out);
+    EXPECT_THAT(lines, ::testing::UnorderedElementsAre("RS+ orders.1", "RS+ orders.2", "RF- orders.>"));
+    EXPECT_EQ(lines.back(), "RF- orders.>");
+    EXPECT_THAT(peer.m_exact, ::testing::UnorderedElementsAre("orders", "orders.1", "orders.2"));
+    EXPECT_TRUE(peer.m_filters.empty());
+    EXPECT_EQ(summary.getFoldedCount(), 0u);
+    EXPECT_EQ(summary.getSubjectCount(), 3u);
+}
+
+TEST(NatsInterestSummaryTest, FilterKeepsFalsePositivesLow) {
+    NatsInterestSummary summary(16);
+    SummaryPeer peer;
+    std::vector<NatsRouteInterestChange> changes;
+    for(int i = 0; i < 5000; i++){
+        changes.push_back({"_INBOX." + std::to_string(i * 2), true});
+    }
+    std::string out;
+    summary.apply(changes, out);
+    peer.apply(out);
+    //the filter grew with the subjects and got sent again whole, it still holds every one of them
+    EXPECT_EQ(summary.getAnnouncedCount(), 1u);
+    EXPECT_EQ(summary.getFilterBytes(), NatsSummaryFilter::sizeFor(5000) / 8);
+    int forwarded_unwanted = 0;
+    for(int i = 0; i < 5000; i++){
+        EXPECT_TRUE(peer.forwards("_INBOX." + std::to_string(i * 2)));
+        forwarded_unwanted += peer.forwards("_INBOX." + std::to_string(i * 2 + 1));
+    }
+    EXPECT_LT(forwarded_unwanted, 50);
+    EXPECT_FALSE(peer.forwards("_OTHER.1"));
+}
+
+TEST(NatsClusterTest, PeersOnlyHoldTheSummaryOfWideInterest) {
+    NatsServer a;
+    NatsServer b;
+    b.m_route_summary_fanout = 8;
+    Received received;
+    for(int i = 0; i < 50; i++){
+        b.subscribe("_INBOX." + std::to_string(i), received.handler("inbox"));
+    }
+    link(a, b);
+    ASSERT_TRUE(waitFor([&]() { return onlyRoute(a) != nullptr && onlyRoute(a)->getRemoteSubjectCount() == 1; }));
+    NatsRoute* a_to_b = onlyRoute(a);
+    //more inboxes don't add anything to what a holds
+    b.subscribe("_INBOX.50", received.handler("inbox"));
+    b.subscribe("status", received.handler("status"));
+    ASSERT_TRUE(waitFor([&]() { return a_to_b->getRemoteSubjectCount() == 2; }));
+    EXPECT_EQ(a_to_b->getRemoteFilterBytes(), NatsSummaryFilter::MIN_BITS / 8);
+
+    a.publish("_INBOX.7", "reply");
+    a.publish("_INBOX.50", "new");
+    //the filter rules out an inbox nobody has, the subject of a message b would only have to drop
+    a.publish("_INBOX.99", "nobody");
+    a.publish("other", "not forwarded");
+    ASSERT_TRUE(waitFor([&]() { return received.size() == 2; }));
+    EXPECT_THAT(received.take(), ::testing::ElementsAre("inbox _INBOX.7 reply", "inbox _INBOX.50 new"));
+    EXPECT_EQ(a_to_b->getOutMsgs(), 2u);
+    NatsRoute* b_to_a = onlyRoute(b);
+    ASSERT_NE(b_to_a, nullptr);
+    EXPECT_EQ(b_to_a->getInUnwanted(), 0u);
+}
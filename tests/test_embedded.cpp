@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../include/nats/server.hpp"
+#include "../include/nats/custom_specific_exceptions.hpp"
+#include "include/nats/test_mocks.hpp"
+
+using namespace nats;
+
+TEST(NatsEmbeddedTest, LocalPublishAndSubscribe) {
+    NatsServer server;
+    std::vector<std::string> received;
+    int literal = server.subscribe("weather.london", [&received](std::string_view subject, std::string_view payload) {
+        received.push_back("literal " + std::string(subject) + " " + std::string(payload));
+    });
+    server.subscribe("weather.*", [&received](std::string_view subject, std::string_view payload) {
+        received.push_back("wildcard " + std::string(subject) + " " + std::string(payload));
+    });
+
+    server.publish("weather.london", "rain");
+    server.publish("weather.paris", "sun");
+    server.publish("traffic.london", "jam");
+    EXPECT_THAT(received, ::testing::UnorderedElementsAre("literal weather.london rain", "wildcard weather.london rain", "wildcard weather.paris sun"));
+
+    received.clear();
+    server.unsubscribe(literal);
+    server.publish("weather.london", "fog");
+    EXPECT_THAT(received, ::testing::ElementsAre("wildcard weather.london fog"));
+
+    EXPECT_THROW(server.publish("weather.*", "x"), InvalidPublishSubjectException);
+    EXPECT_THROW(server.subscribe("weather..london", [](std::string_view, std::string_view) {}), InvalidSubscribeSubjectException);
+}
+
+TEST(NatsEmbeddedTest, HandlersCanPublish) {
+    NatsServer server;
+    std::vector<std::string> replies;
+    //a request/reply responder, it publishes from inside the delivery of the request
+    server.subscribe("requests.*", [&server](std::string_view subject, std::string_view payload) {
+        server.publish("replies." + std::string(subject.substr(subject.find('.') + 1)), payload);
+    });
+    server.subscribe("replies.>", [&replies](std::string_view subject, std::string_view payload) {
+        replies.push_back(std::string(subject) + " " + std::string(payload));
+    });
+    server.subscribe("requests.a", [](std::string_view, std::string_view) {});
+
+    server.publish("requests.a", "1");
+    server.publish("requests.b", "2");
+    EXPECT_THAT(replies, ::testing::ElementsAre("replies.a 1", "replies.b 2"));
+}
+
+TEST(NatsEmbeddedTest, LocalAndSocketClientsSeeEachOther) {
+    NatsServer server;
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(fds[0], &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    server.addClient(std::move(client_unique_ptr));
+
+    //a socket client's PUB reaches a local handler
+    std::string received;
+    server.subscribe("orders.new", [&received](std::string_view, std::string_view payload) {
+        received = payload;
+    });
+    std::string pub_args = "orders.new 3";
+    std::string_view pub_args_view(pub_args);
+    client->processPubArgs(pub_args_view);
+    std::string payload = "abc";
+    std::string_view payload_view(payload);
+    client->processPub(payload_view);
+    EXPECT_EQ(received, "abc");
+
+    //and a local publish reaches the socket client
+    std::string sub_args = "orders.* 9";
+    std::string_view sub_args_view(sub_args);
+    client->processSub(sub_args_view);
+    client->flushPendingSubscriptions();
+    char buffer[256];
+    while(recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT) > 0){}
+    server.publish("orders.old", "xy");
+    ssize_t n = recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+    ASSERT_GT(n, 0);
+    EXPECT_EQ(std::string(buffer, n), "MSG orders.old 9 2\r\nxy\r\n");
+
+    server.removeClient(client->m_client_id);
+    close(fds[1]);
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "../include/nats/interest_filter.hpp"
+#include "../include/nats/sublist.hpp"
+#include "../include/nats/subscription.hpp"
+
+using namespace nats;
+
+TEST(NatsInterestFilterTest, EmptyFilterHasNoInterest) {
+    NatsInterestFilter filter;
+    std::vector<std::string> subject = {"foo", "bar"};
+
+    EXPECT_FALSE(filter.mayHaveInterest(subject));
+}
+
+TEST(NatsInterestFilterTest, LiteralSubject) {
+    NatsInterestFilter filter;
+    std::vector<std::string> subject = {"foo", "bar"};
+    std::vector<std::string> other = {"foo", "baz"};
+
+    filter.addInterest(subject);
+    EXPECT_TRUE(filter.mayHaveInterest(subject));
+    EXPECT_FALSE(filter.mayHaveInterest(other));
+
+    filter.removeInterest(subject);
+    EXPECT_FALSE(filter.mayHaveInterest(subject));
+}
+
+TEST(NatsInterestFilterTest, WildcardUsesFirstToken) {
+    NatsInterestFilter filter;
+    std::vector<std::string> wildcard = {"foo", "*", "bar"};
+    std::vector<std::string> match = {"foo", "test", "bar"};
+    std::vector<std::string> other = {"weather", "test", "bar"};
+
+    filter.addInterest(wildcard);
+    EXPECT_TRUE(filter.mayHaveInterest(match));
+    EXPECT_FALSE(filter.mayHaveInterest(other));
+}
+
+TEST(NatsInterestFilterTest, RootWildcardMatchesEverything) {
+    NatsInterestFilter filter;
+    std::vector<std::string> wildcard = {">"};
+    std::vector<std::string> subject = {"anything", "at", "all"};
+
+    filter.addInterest(wildcard);
+    EXPECT_TRUE(filter.mayHaveInterest(subject));
+
+    filter.removeInterest(wildcard);
+    EXPECT_FALSE(filter.mayHaveInterest(subject));
+}
+
+TEST(NatsInterestFilterTest, CountsOverlappingSubscriptions) {
+    NatsInterestFilter filter;
+    std::vector<std::string> subject = {"foo", "bar"};
+
+    filter.addInterest(subject);
+    filter.addInterest(subject);
+    filter.removeInterest(subject);
+    EXPECT_TRUE(filter.mayHaveInterest(subject));
+
+    filter.removeInterest(subject);
+    EXPECT_FALSE(filter.mayHaveInterest(subject));
+}
+
+TEST(NatsInterestFilterTest, SublistKeepsFilterInSync) {
+    NatsSublist sublist;
+    NatsSubscription sub{1, 100};
+    std::vector<std::string> subject = {"foo", "bar"};
+
+    EXPECT_FALSE(sublist.hasPossibleInterest(subject));
+    sublist.addSubscription(sub, subject);
+    //duplicate adds and removes of unknown subscriptions must not skew the counters
+    sublist.addSubscription(sub, subject);
+    NatsSubscription unknown{2, 200};
+    sublist.removeSubscription(unknown, subject);
+    EXPECT_TRUE(sublist.hasPossibleInterest(subject));
+
+    sublist.removeSubscription(sub, subject);
+    EXPECT_FALSE(sublist.hasPossibleInterest(subject));
+}
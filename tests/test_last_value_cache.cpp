@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../include/nats/server.hpp"
+#include "../include/nats/last_value_cache.hpp"
+#include "include/nats/test_mocks.hpp"
+#include "include/nats/test_helpers.hpp"
+
+using namespace nats;
+
+TEST(NatsLastValueCacheTest, KeepsLatestValuePerTrackedSubject) {
+    NatsLastValueCache cache;
+    std::vector<std::string> eur = {"status", "eur"};
+    EXPECT_FALSE(cache.tracks(eur));
+    EXPECT_FALSE(cache.mayHold({"status", "*"}));
+    EXPECT_FALSE(cache.track("status.>.x"));
+    ASSERT_TRUE(cache.track("status.*"));
+    EXPECT_TRUE(cache.tracks(eur));
+    EXPECT_FALSE(cache.tracks({"status", "eur", "x"}));
+    EXPECT_TRUE(cache.mayHold({"*", "eur"}));
+    EXPECT_TRUE(cache.mayHold({">"}));
+    EXPECT_FALSE(cache.mayHold({"orders", "*"}));
+    EXPECT_FALSE(cache.mayHold({"status", "eur", "x"}));
+
+    EXPECT_TRUE(cache.store("status.eur", eur, "1.08").owns_lock());
+    EXPECT_TRUE(cache.store("status.eur", eur, "1.1").owns_lock());
+    EXPECT_TRUE(cache.store("status.gbp", {"status", "gbp"}, "1.27").owns_lock());
+    EXPECT_FALSE(cache.store("orders.new", {"orders", "new"}, "x").owns_lock());
+    EXPECT_EQ(cache.getSubjectCount(), 2u);
+    EXPECT_EQ(cache.getByteCount(), 7u);
+    EXPECT_EQ(cache.getUpdateCount(), 3u);
+
+    std::string frames;
+    uint64_t payload_bytes = 0;
+    cache.lockFor(eur);
+    EXPECT_EQ(cache.appendFrames(eur, 2, frames, payload_bytes), 1u);
+    cache.unlockFor(eur);
+    EXPECT_EQ(frames, "MSG status.eur 2 3\r\n1.1\r\n");
+
+    frames.clear();
+    std::vector<std::string> all = {"status", ">"};
+    cache.lockFor(all);
+    EXPECT_EQ(cache.appendFrames(all, 3, frames, payload_bytes), 2u);
+    cache.unlockFor(all);
+    EXPECT_NE(frames.find("MSG status.eur 3 3\r\n1.1\r\n"), std::string::npos);
+    EXPECT_NE(frames.find("MSG status.gbp 3 4\r\n1.27\r\n"), std::string::npos);
+    EXPECT_EQ(payload_bytes, 10u);
+}
+
+TEST(NatsLastValueCacheTest, WildcardSnapshotOnlyVisitsMatchingSubjects) {
+    NatsLastValueCache cache;
+    ASSERT_TRUE(cache.track(">"));
+    cache.store("status.eur", {"status", "eur"}, "1.1");
+    cache.store("status.eur.bid", {"status", "eur", "bid"}, "1.0");
+    cache.store("prices.eur", {"prices", "eur"}, "7");
+    cache.store("status", {"status"}, "up");
+
+    auto snapshot = [&cache](const std::vector<std::string>& subject_list) {
+        std::string frames;
+        uint64_t payload_bytes = 0;
+        cache.lockFor(subject_list);
+        uint64_t matched = cache.appendFrames(subject_list, 1, frames, payload_bytes);
+        cache.unlockFor(subject_list);
+        EXPECT_EQ(std::count(frames.begin(), frames.end(), '\n'), static_cast<long>(2 * matched));
+        return matched;
+    };
+    EXPECT_EQ(snapshot({"*", "eur"}), 2u);
+    EXPECT_EQ(snapshot({"status", ">"}), 2u);
+    EXPECT_EQ(snapshot({"status", "*"}), 1u);
+    EXPECT_EQ(snapshot({"*"}), 1u);
+    EXPECT_EQ(snapshot({">"}), 4u);
+    EXPECT_EQ(snapshot({"orders", ">"}), 0u);
+
+    //a subject stored after a snapshot shows up in the next one
+    cache.store("orders.new", {"orders", "new"}, "x");
+    EXPECT_EQ(snapshot({"orders", ">"}), 1u);
+}
+
+TEST(NatsLastValueCacheTest, SubscriptionGetsLastValuesThenUpdates) {
+    NatsServer server;
+    ASSERT_TRUE(server.trackLastValues("status.*"));
+    server.publish("status.a", "old");
+    server.publish("status.a", "up");
+    server.publish("status.b", "down");
+    server.publish("other.a", "not kept");
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(fds[0], &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    server.addClient(std::move(client_unique_ptr));
+
+    //a literal subscription gets its subject's value, then updates, each once
+    sub(client, "status.a 1");
+    std::string expected = "+OK\r\nMSG status.a 1 2\r\nup\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    server.publish("status.a", "busy");
+    expected = "MSG status.a 1 4\r\nbusy\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+
+    //a wildcard one gets every matching subject, in no particular order
+    sub(client, "*.b 2");
+    expected = "+OK\r\nMSG status.b 2 4\r\ndown\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+
+    //untracked subjects are subscribed the usual way
+    sub(client, "other.a 3");
+    client->flushPendingSubscriptions();
+    EXPECT_EQ(readBytes(fds[1], 5), "+OK\r\n");
+    EXPECT_EQ(client->m_stats.m_out_msgs.load(), 3u);
+    EXPECT_EQ(server.m_last_values.getSubjectCount(), 2u);
+
+    server.removeClient(client->m_client_id);
+    close(fds[1]);
+}
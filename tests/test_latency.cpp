@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+#include "../include/nats/latency.hpp"
+#include "../include/nats/monitor.hpp"
+#include "../include/nats/server.hpp"
+
+using namespace nats;
+
+TEST(NatsLatencyHistogramTest, BucketsAreWithinPrecision) {
+    for(uint64_t value: {0ULL, 1ULL, 7ULL, 8ULL, 15ULL, 16ULL, 1000ULL, 123456789ULL, 1ULL<<40}){
+        int index = NatsLatencyHistogram::bucketIndex(value);
+        ASSERT_LT(index, NatsLatencyHistogram::BUCKET_COUNT);
+        uint64_t upper = NatsLatencyHistogram::bucketUpperBound(index);
+        EXPECT_GE(upper, value);
+        EXPECT_LE(upper - value, value / 8 + 1);
+    }
+    EXPECT_EQ(NatsLatencyHistogram::bucketIndex(UINT64_MAX), NatsLatencyHistogram::BUCKET_COUNT - 1);
+}
+
+TEST(NatsLatencyHistogramTest, Percentiles) {
+    NatsLatencyHistogram histogram;
+    for(uint64_t i=1;i<=1000;i++){
+        histogram.record(i);
+    }
+    NatsLatencySummary summary = histogram.summary();
+    EXPECT_EQ(summary.m_count, 1000u);
+    EXPECT_EQ(summary.m_mean_ns, 500u);
+    //reported values are the upper bound of their bucket, so at most 12.5% above the real one
+    EXPECT_GE(summary.m_p50_ns, 500u);
+    EXPECT_LE(summary.m_p50_ns, 563u);
+    EXPECT_GE(summary.m_p99_ns, 990u);
+    EXPECT_LE(summary.m_p99_ns, 1114u);
+    EXPECT_GE(summary.m_max_ns, 1000u);
+    EXPECT_EQ(histogram.valueAtPercentile(50), summary.m_p50_ns);
+    EXPECT_EQ(histogram.valueAtPercentile(100), summary.m_max_ns);
+
+    histogram.reset();
+    EXPECT_EQ(histogram.summary().m_count, 0u);
+}
+
+TEST(NatsLatencyStatsTest, TimerOnlyRecordsWhenEnabled) {
+    NatsLatencyStats& latency = NatsLatencyStats::shared();
+    latency.setEnabled(false);
+    latency.reset();
+    {
+        NatsLatencyTimer timer(latency.m_match);
+    }
+    EXPECT_EQ(latency.m_match.summary().m_count, 0u);
+
+    latency.setEnabled(true);
+    {
+        NatsLatencyTimer timer(latency.m_match);
+    }
+    EXPECT_EQ(latency.m_match.summary().m_count, 1u);
+    latency.setEnabled(false);
+    latency.reset();
+}
+
+TEST(NatsLatencyStatsTest, LatzTogglesRecording) {
+    NatsServer server;
+    NatsMonitor monitor(&server);
+    std::string body;
+
+    ASSERT_TRUE(monitor.handleRequest("/latz", "enable=1&reset=1", body));
+    EXPECT_EQ(nlohmann::json::parse(body)["enabled"], true);
+
+    std::vector<std::string> subject_list = {"foo", "bar"};
+    std::string subject = "foo.bar";
+    server.m_sublist->addSubscription({1, 42}, subject_list);
+    server.publishMessage(subject, subject_list, "hello");
+
+    ASSERT_TRUE(monitor.handleRequest("/latz", "enable=0", body));
+    nlohmann::json latz = nlohmann::json::parse(body);
+    EXPECT_EQ(latz["enabled"], false);
+    EXPECT_EQ(latz["publish"]["count"], 1);
+    EXPECT_EQ(latz["match"]["count"], 1);
+
+    ASSERT_TRUE(monitor.handleRequest("/latz", "reset=1", body));
+    EXPECT_EQ(nlohmann::json::parse(body)["publish"]["count"], 0);
+}
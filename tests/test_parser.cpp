@@ -17,8 +17,10 @@ class ParserTest : public ::testing::Test {
 
         void SetUp() override {
             client = new MockNatsClient(&server);
-            //adding this as base  destructor is always called so removeSubscription will be called in every test case
-            EXPECT_CALL(server, removeSubscriptions(_)).Times(::testing::AnyNumber());
+            //every parse call ends by flushing the pending SUB/UNSUB operations
+            EXPECT_CALL(*client, flushPendingSubscriptions()).Times(::testing::AnyNumber());
+            //adding this as base  destructor is always called so removeClientSubscriptions will be called in every test case
+            EXPECT_CALL(server, removeClientSubscriptions(_)).Times(::testing::AnyNumber());
         }
 
         void TearDown() override {
@@ -169,6 +171,23 @@ TEST_F(ParserTest, Pub_Success_MultiBuffer) {
     NatsParser::parse(client, part4.data(), part4.size());
 }
 
+TEST_F(ParserTest, Pub_Success_MultiBuffer_SplitAfterPayloadCarriageReturn) {
+    client->m_payload_size = 5; 
+
+    std::string part1 = "PUB foo 5\r\nHello\r";
+    std::string part2 = "\n";
+
+    ON_CALL(*client, maxMessageSizeReached()).WillByDefault(::testing::Return(false));
+
+    EXPECT_CALL(*client, processPubArgs(::testing::Eq(std::string_view("foo 5")))).Times(1);
+    EXPECT_CALL(*client, processPub(::testing::Eq(std::string_view("Hello")))).Times(1);
+    EXPECT_CALL(*client, resetParsingVars()).Times(1);
+    EXPECT_CALL(*client, maxMessageSizeReached()).Times(::testing::AnyNumber());
+
+    NatsParser::parse(client, part1.data(), part1.size());
+    NatsParser::parse(client, part2.data(), part2.size());
+}
+
 TEST_F(ParserTest, Pub_Failure_MultiBuffer_MaxArgSizeReached) {
 
     std::string part1 = "PUB foo.bar.test 1";
@@ -242,6 +261,22 @@ TEST_F(ParserTest, Sub_Success_MultiBuffer) {
     NatsParser::parse(client, part2.data(), part2.size());
 }
 
+TEST_F(ParserTest, Sub_Success_MultiBuffer_SplitAfterCarriageReturn) {
+
+    std::string part1 = "SUB foo.bar 10\r";
+    std::string part2 = "\n";
+
+    ON_CALL(*client, maxArgSizeReached()).WillByDefault(::testing::Return(false));
+
+    //the '\r' at the end of the first buffer must not end up in the argument
+    EXPECT_CALL(*client, processSub(::testing::Eq(std::string_view("foo.bar 10")))).Times(1);
+    EXPECT_CALL(*client, resetParsingVars()).Times(1);
+    EXPECT_CALL(*client, maxArgSizeReached()).Times(::testing::AnyNumber());
+
+    NatsParser::parse(client, part1.data(), part1.size());
+    NatsParser::parse(client, part2.data(), part2.size());
+}
+
 TEST_F(ParserTest, Sub_Failure_MultiBuffer_MaxArgSizeReached) {
 
     std::string part1 = "SUB foo.bar.";
@@ -256,6 +291,22 @@ TEST_F(ParserTest, Sub_Failure_MultiBuffer_MaxArgSizeReached) {
     NatsParser::parse(client, part2.data(), part2.size());
 }
 
+TEST_F(ParserTest, Sub_Success_MultipleInOneRead) {
+
+    std::string subs = "SUB foo.bar 1\r\nSUB foo.baz 2\r\nUNSUB 1\r\n";
+
+    //the parser needs the real reset to go back to OP_START between the operations
+    ON_CALL(*client, resetParsingVars()).WillByDefault([this]() { client->NatsClient::resetParsingVars(); });
+
+    EXPECT_CALL(*client, processSub(::testing::_)).Times(2);
+    EXPECT_CALL(*client, processUnsub(::testing::_)).Times(1);
+    EXPECT_CALL(*client, resetParsingVars()).Times(3);
+    //the whole read is flushed to the server once
+    EXPECT_CALL(*client, flushPendingSubscriptions()).Times(1);
+
+    NatsParser::parse(client, subs.data(), subs.size());
+}
+
 //UNSUB
 
 TEST_F(ParserTest, Unsub_Success) {
@@ -307,6 +358,55 @@ TEST_F(ParserTest, Unsub_Failure_MultiBuffer_MaxArgSizeReached) {
     NatsParser::parse(client, part2.data(), part2.size());
 }
 
+//WATCH
+
+TEST_F(ParserTest, Watch_Success) {
+
+    std::string watch = "WATCH telemetry.device1\r\n";
+
+    EXPECT_CALL(*client, processWatch(::testing::Eq(std::string_view("telemetry.device1")))).Times(1);
+    EXPECT_CALL(*client, resetParsingVars()).Times(1);
+
+    NatsParser::parse(client, watch.data(), watch.size());
+}
+
+TEST_F(ParserTest, Watch_Success_MultiBuffer) {
+
+    std::string part1 = "WATCH teleme";
+    std::string part2 = "try.device1\r\n";
+
+    ON_CALL(*client, maxArgSizeReached()).WillByDefault(::testing::Return(false));
+
+    EXPECT_CALL(*client, processWatch(::testing::Eq(std::string_view("telemetry.device1")))).Times(1);
+    EXPECT_CALL(*client, resetParsingVars()).Times(1);
+    EXPECT_CALL(*client, maxArgSizeReached()).Times(::testing::AnyNumber());
+
+    NatsParser::parse(client, part1.data(), part1.size());
+    NatsParser::parse(client, part2.data(), part2.size());
+}
+
+//UNWATCH
+
+TEST_F(ParserTest, Unwatch_Success) {
+
+    std::string unwatch = "UNWATCH telemetry.device1\r\n";
+
+    EXPECT_CALL(*client, processUnwatch(::testing::Eq(std::string_view("telemetry.device1")))).Times(1);
+    EXPECT_CALL(*client, resetParsingVars()).Times(1);
+
+    NatsParser::parse(client, unwatch.data(), unwatch.size());
+}
+
+TEST_F(ParserTest, Unwatch_Success_OnlyNewLineAfterArgs) {
+
+    std::string unwatch = "UNWATCH telemetry.device1\n";
+
+    EXPECT_CALL(*client, processUnwatch(::testing::Eq(std::string_view("telemetry.device1")))).Times(1);
+    EXPECT_CALL(*client, resetParsingVars()).Times(1);
+
+    NatsParser::parse(client, unwatch.data(), unwatch.size());
+}
+
 //Generic Parser Failures
 
 //This is just to test that the client can handle Non fatal exceptions since all non fatal exceptions are thrown by the client functions which are being mocked
@@ -340,6 +440,9 @@ TEST_F(ParserTest, Parser_Failure_InvalidCommand_AllStates) {
         "SRNEW\r\n", "SUX\r\n", "SUBLEW\r\n",
         // Invalid after U, UN, UNS, etc.
         "UP\r\n","UNX\r\n", "UNSI\r\n", "UNSUY\r\n", "UNSUBH\r\n",
+        // Invalid after W, WA, WAT, etc. and UNW, UNWA, etc.
+        "WX\r\n", "WAX\r\n", "WATX\r\n", "WATCX\r\n", "WATCHX\r\n",
+        "UNWX\r\n", "UNWAX\r\n", "UNWATX\r\n", "UNWATCX\r\n", "UNWATCHX\r\n",
         // Completely unknown
         "FOO\r\n", "BAR\r\n", "XYZ\r\n"
     };
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../include/nats/server.hpp"
+#include "../include/nats/replay_buffer.hpp"
+#include "../include/nats/custom_specific_exceptions.hpp"
+#include "include/nats/test_mocks.hpp"
+#include "include/nats/test_helpers.hpp"
+
+using namespace nats;
+
+TEST(NatsReplayBufferTest, EvictsOldestMessagesWhenFull) {
+    NatsReplayBufferConfig config;
+    config.m_name = "recent";
+    config.m_subject = "a.*";
+    config.m_capacity = 256; //six 40 byte records, the seventh wraps around
+    NatsReplayBuffer buffer(config);
+    ASSERT_TRUE(buffer.open());
+    EXPECT_TRUE(buffer.matches({"a", "b"}));
+    EXPECT_FALSE(buffer.matches({"b", "a"}));
+
+    buffer.lock();
+    for(int i = 0; i < 20; i++){
+        buffer.append("a.b", "msg-" + std::to_string(1000 + i));
+    }
+    buffer.append("a.b", std::string(300, 'x'));
+    std::string frames;
+    uint64_t payload_bytes = 0;
+    uint64_t replayed = buffer.appendFrames({"a", ">"}, INT64_MIN, 3, frames, payload_bytes);
+    buffer.unlock();
+
+    EXPECT_EQ(buffer.getMessageCount(), 6u);
+    EXPECT_EQ(buffer.getByteCount(), 240u);
+    EXPECT_EQ(buffer.getAppendedCount(), 20u);
+    EXPECT_EQ(buffer.getEvictedCount(), 14u);
+    EXPECT_EQ(buffer.getOversizedCount(), 1u);
+    EXPECT_EQ(replayed, 6u);
+    EXPECT_EQ(payload_bytes, 48u);
+    std::string expected;
+    for(int i = 14; i < 20; i++){
+        expected += "MSG a.b 3 8\r\nmsg-" + std::to_string(1000 + i) + "\r\n";
+    }
+    EXPECT_EQ(frames, expected);
+
+    NatsReplayBufferConfig too_small = config;
+    too_small.m_capacity = 8;
+    NatsReplayBuffer small_buffer(too_small);
+    EXPECT_FALSE(small_buffer.open());
+}
+
+TEST(NatsReplayBufferTest, ReplaySubscriptionCatchesUpThenFollowsLive) {
+    NatsServer server;
+    NatsReplayBufferConfig replay_config;
+    replay_config.m_name = "recent";
+    replay_config.m_subject = "prices.>";
+    ASSERT_TRUE(server.addReplayBuffer(replay_config));
+    EXPECT_FALSE(server.addReplayBuffer(replay_config));
+    server.publish("prices.eur", "1.08");
+    server.publish("orders.new", "not kept");
+    server.publish("prices.gbp", "1.27");
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(fds[0], &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    server.addClient(std::move(client_unique_ptr));
+
+    EXPECT_THROW(sub(client, "prices.* 1 replay=missing"), NoSuchReplayBufferException);
+    EXPECT_THROW(sub(client, "prices.* 1 replay=recent replay_ms=x"), ArgumentParseException);
+    EXPECT_THROW(sub(client, "prices.* 1 replay=recent depth=3"), ArgumentParseException);
+
+    //everything buffered that matches, then live messages, none twice
+    sub(client, "prices.eur 4 replay=recent");
+    std::string expected = "+OK\r\nMSG prices.eur 4 4\r\n1.08\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    server.publish("prices.gbp", "1.28");
+    server.publish("prices.eur", "1.09");
+    expected = "MSG prices.eur 4 4\r\n1.09\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    EXPECT_EQ(client->m_stats.m_out_msgs.load(), 2u);
+    EXPECT_EQ(client->getSubscriptionStats(4)->m_delivered.load(), 2u);
+
+    //replay_ms leaves out what was stored before the window
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    server.publish("prices.chf", "0.96");
+    sub(client, "prices.* 5 replay=recent replay_ms=150");
+    expected = "+OK\r\nMSG prices.chf 5 4\r\n0.96\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size() + 1), expected);
+
+    std::shared_ptr<NatsReplayBuffer> buffer = server.getReplayBuffer("recent");
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->getMessageCount(), 5u);
+    EXPECT_EQ(buffer->getEvictedCount(), 0u);
+
+    server.removeClient(client->m_client_id);
+    close(fds[1]);
+}
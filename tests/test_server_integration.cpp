@@ -6,6 +6,8 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fstream>
+#include <set>
+#include <vector>
 #include "../include/nats/server.hpp"
 
 using namespace nats;
@@ -41,6 +43,30 @@ std::string send_and_recv(int sock, const std::string& cmd, int expected_bytes =
     return "";
 }
 
+// Helper to fetch a monitoring endpoint and return the response body
+std::string http_get(int port, const std::string& path) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in serv_addr{};
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    serv_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) != 0) {
+        close(sock);
+        return "";
+    }
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    send(sock, request.c_str(), request.size(), 0);
+    std::string response;
+    char buffer[2048];
+    int n;
+    while ((n = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, n);
+    }
+    close(sock);
+    size_t body_start = response.find("\r\n\r\n");
+    return body_start == std::string::npos ? "" : response.substr(body_start + 4);
+}
+
 TEST(ServerIntegration, BasicNatsFlow) {
     // Redirect cout and cerr for the server
     std::streambuf* orig_cout = std::cout.rdbuf();
@@ -119,7 +145,14 @@ TEST(ServerIntegration, BasicNatsFlow) {
     EXPECT_NE(published_msg.find("MSG foo.bar 1 5"), std::string::npos);
     EXPECT_NE(published_msg.find("hello"), std::string::npos);
 
-    // 8. Unsubscribe
+    // 8. The monitoring endpoint has seen the PUB and its delivery
+    std::string varz = http_get(server.m_monitor_port, "/varz");
+    GTEST_LOG_(INFO) << "varz: " << varz ;
+    EXPECT_NE(varz.find("\"in_msgs\":1"), std::string::npos);
+    EXPECT_NE(varz.find("\"out_msgs\":1"), std::string::npos);
+    EXPECT_NE(varz.find("\"subscriptions\":1"), std::string::npos);
+
+    // 9. Unsubscribe
     GTEST_LOG_(INFO) << "Sending UNSUB..." ;
     resp = send_and_recv(sock, "UNSUB 1\r\n");
     GTEST_LOG_(INFO) << "UNSUB response: " << resp ;
@@ -144,4 +177,58 @@ TEST(ServerIntegration, BasicNatsFlow) {
     // Restore cout and cerr
     std::cout.rdbuf(orig_cout);
     GTEST_LOG_(INFO) << "Test complete." ;
-}
\ No newline at end of file
+}
+TEST(ServerIntegration, ReapsThreadsOfClosedConnections) {
+    std::streambuf* orig_cout = std::cout.rdbuf();
+    std::ofstream null_stream("/dev/null");
+    std::cout.rdbuf(null_stream.rdbuf());
+
+    NatsServer server;
+    server.m_port = TEST_PORT + 11;
+    server.m_monitor_port = 0;
+    std::thread server_thread([&server]() {
+        server.startServer();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // A burst of connections, all of them are accepted and get ids of their own
+    constexpr int CONNECTIONS = 100;
+    std::vector<int> socks;
+    std::set<std::string> client_ids;
+    for (int i = 0; i < CONNECTIONS; ++i) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in serv_addr{};
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_port = htons(server.m_port);
+        serv_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        ASSERT_EQ(connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)), 0);
+        socks.push_back(sock);
+    }
+    for (int sock : socks) {
+        std::string info;
+        char buffer[1024];
+        while (info.find("\r\n") == std::string::npos) {
+            int n = recv(sock, buffer, sizeof(buffer), 0);
+            ASSERT_GT(n, 0);
+            info.append(buffer, n);
+        }
+        size_t id_start = info.find("\"client_id\":") + 12;
+        client_ids.insert(info.substr(id_start, info.find(',', id_start) - id_start));
+    }
+    EXPECT_EQ(client_ids.size(), static_cast<size_t>(CONNECTIONS));
+    EXPECT_EQ(server.getClientThreadCount(), static_cast<size_t>(CONNECTIONS));
+
+    // Once they are gone the accept loop joins their threads without waiting for the server to stop
+    for (int sock : socks) {
+        close(sock);
+    }
+    for (int i = 0; i < 100 && server.getClientThreadCount() > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    EXPECT_EQ(server.getClientThreadCount(), 0u);
+
+    // The accept loop notices the stop on its own, no connection is needed to wake it up
+    server.stopServer();
+    server_thread.join();
+    std::cout.rdbuf(orig_cout);
+}
@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "../include/nats/sharded_sublist.hpp"
+#include "../include/nats/subscription.hpp"
+
+using namespace nats;
+
+TEST(NatsShardedSublistTest, MatchesAcrossShardsAndRootWildcards) {
+    NatsShardedSublist sublist(4);
+    std::vector<std::pair<int, std::vector<std::string>>> batch = {
+        {1, {"foo", "bar"}},
+        {2, {"weather", "*"}},
+        {3, {"*", "bar"}},
+        {4, {">"}},
+        {5, {"orders", "eu", ">"}},
+    };
+    sublist.addSubscriptions(100, batch);
+    //the caller's batch is left as it was
+    EXPECT_EQ(batch[2].second, (std::vector<std::string>{"*", "bar"}));
+    EXPECT_EQ(sublist.getSubscriptionCount(), 5);
+
+    std::vector<std::string> foo_bar = {"foo", "bar"};
+    std::vector<std::string> weather = {"weather", "london"};
+    std::vector<std::string> orders = {"orders", "eu", "1"};
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(foo_bar), ::testing::UnorderedElementsAre(NatsSubscription{1, 100}, NatsSubscription{3, 100}, NatsSubscription{4, 100}));
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(weather), ::testing::UnorderedElementsAre(NatsSubscription{2, 100}, NatsSubscription{4, 100}));
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(orders), ::testing::UnorderedElementsAre(NatsSubscription{5, 100}, NatsSubscription{4, 100}));
+
+    //duplicates of a client are removed after the shard and the root wildcard matches are merged
+    std::vector<NatsSubscription> buffer;
+    sublist.getSubscriptionsForTopic(foo_bar, buffer, NatsMatchMode::ONE_PER_CLIENT);
+    EXPECT_THAT(buffer, ::testing::ElementsAre(NatsSubscription{1, 100}));
+
+    sublist.removeSubscriptions(100, {4});
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(weather), ::testing::ElementsAre(NatsSubscription{2, 100}));
+    sublist.removeClient(100);
+    EXPECT_EQ(sublist.getSubscriptionCount(), 0);
+    EXPECT_FALSE(sublist.hasPossibleInterest(foo_bar));
+}
+
+TEST(NatsShardedSublistTest, InterestWatchesSeeRootWildcards) {
+    NatsShardedSublist sublist(4);
+    std::string subject = "foo.bar";
+    std::vector<std::string> subject_list = {"foo", "bar"};
+    sublist.addInterestWatch(subject, subject_list, 500);
+    auto changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_FALSE(changes[0].m_has_interest);
+
+    //a root wildcard and a literal subscription live in different shards but count for the same watch
+    std::vector<std::string> star = {"*", "bar"};
+    sublist.addSubscription({1, 100}, star);
+    sublist.addSubscription({2, 100}, subject_list);
+    changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_TRUE(changes[0].m_has_interest);
+    EXPECT_THAT(changes[0].m_client_ids, ::testing::ElementsAre(500));
+
+    NatsSubscription star_sub{1, 100};
+    sublist.removeSubscription(star_sub, star);
+    EXPECT_FALSE(sublist.hasInterestChanges());
+    sublist.removeClient(100);
+    changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_FALSE(changes[0].m_has_interest);
+
+    sublist.removeInterestWatch(subject, 500);
+    EXPECT_EQ(sublist.getInterestWatchCount(), 0u);
+}
+
+TEST(NatsShardedSublistTest, BatchChangesAdjustWatchCounts) {
+    NatsShardedSublist sublist(4);
+    std::string subject = "orders.eu";
+    std::vector<std::string> subject_list = {"orders", "eu"};
+    std::vector<std::pair<int, std::vector<std::string>>> batch = {
+        {1, {"orders", "eu"}},
+        {2, {"orders", "*"}},
+        {3, {">"}},
+        {4, {"other", "eu"}},
+    };
+    sublist.addSubscriptions(100, batch);
+    sublist.addInterestWatch(subject, subject_list, 500);
+    auto changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_TRUE(changes[0].m_has_interest);
+
+    //a duplicate adds nothing, so removing the three matches once is enough to lose the interest
+    sublist.addSubscriptions(100, batch);
+    sublist.removeSubscriptions(100, {1, 3, 4});
+    EXPECT_FALSE(sublist.hasInterestChanges());
+    sublist.removeSubscriptions(100, {2});
+    changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_FALSE(changes[0].m_has_interest);
+}
+
+TEST(NatsShardedSublistTest, InterestWatch_InitialState) {
+    NatsShardedSublist sublist;
+    std::string watched = "foo.bar";
+    std::vector<std::string> watched_list = {"foo", "bar"};
+    std::vector<std::string> wildcard = {"foo", "*"};
+    sublist.addSubscription({1, 100}, wildcard);
+
+    sublist.addInterestWatch(watched, watched_list, 500);
+
+    ASSERT_TRUE(sublist.hasInterestChanges());
+    auto changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_EQ(changes[0].m_subject, "foo.bar");
+    EXPECT_TRUE(changes[0].m_has_interest);
+    EXPECT_THAT(changes[0].m_client_ids, ::testing::ElementsAre(500));
+    EXPECT_FALSE(sublist.hasInterestChanges());
+}
+
+TEST(NatsShardedSublistTest, InterestWatch_OnlyTransitionsAreReported) {
+    NatsShardedSublist sublist;
+    std::string watched = "foo.bar";
+    std::vector<std::string> watched_list = {"foo", "bar"};
+    std::vector<std::string> literal = {"foo", "bar"};
+    std::vector<std::string> wildcard = {"foo", ">"};
+    std::vector<std::string> unrelated = {"foo", "baz"};
+    NatsSubscription sub_1{1, 100};
+    NatsSubscription sub_2{2, 200};
+    NatsSubscription sub_3{3, 300};
+
+    sublist.addInterestWatch(watched, watched_list, 500);
+    sublist.takeInterestChanges();
+
+    sublist.addSubscription(sub_3, unrelated);
+    EXPECT_FALSE(sublist.hasInterestChanges());
+
+    sublist.addSubscription(sub_1, literal);
+    sublist.addSubscription(sub_2, wildcard);
+    sublist.removeSubscription(sub_1, literal);
+    sublist.removeSubscription(sub_2, wildcard);
+
+    auto changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 2);
+    EXPECT_TRUE(changes[0].m_has_interest);
+    EXPECT_FALSE(changes[1].m_has_interest);
+    EXPECT_THAT(changes[1].m_client_ids, ::testing::ElementsAre(500));
+}
+
+TEST(NatsShardedSublistTest, InterestWatch_RemovedWatchIsNotReported) {
+    NatsShardedSublist sublist;
+    std::string watched = "foo.bar";
+    std::vector<std::string> watched_list = {"foo", "bar"};
+
+    sublist.addInterestWatch(watched, watched_list, 500);
+    sublist.removeInterestWatch(watched, 500);
+    sublist.takeInterestChanges();
+
+    sublist.addSubscription({1, 100}, watched_list);
+    EXPECT_FALSE(sublist.hasInterestChanges());
+}
+
+TEST(NatsShardedSublistTest, InterestWatch_RemoveClientReportsChanges) {
+    NatsShardedSublist sublist;
+    std::string watched = "foo.bar";
+    std::vector<std::string> watched_list = {"foo", "bar"};
+    std::vector<std::string> wildcard = {"foo", "*"};
+
+    sublist.addSubscription({1, 100}, wildcard);
+    sublist.addInterestWatch(watched, watched_list, 500);
+    sublist.takeInterestChanges();
+
+    sublist.removeClient(100);
+
+    auto changes = sublist.takeInterestChanges();
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_FALSE(changes[0].m_has_interest);
+}
@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <nlohmann/json.hpp>
+#include <thread>
+#include <vector>
+#include "../include/nats/stats.hpp"
+#include "../include/nats/monitor.hpp"
+#include "../include/nats/server.hpp"
+#include "include/nats/test_mocks.hpp"
+
+using namespace nats;
+
+TEST(NatsStripedCounterTest, SumsAllThreads) {
+    NatsStripedCounter counter;
+    std::vector<std::thread> threads;
+    for(int t=0;t<8;t++){
+        threads.emplace_back([&counter]() {
+            for(int i=0;i<10000;i++){
+                counter.add(2);
+            }
+        });
+    }
+    for(std::thread& thread: threads){
+        thread.join();
+    }
+    EXPECT_EQ(counter.load(), 8u * 10000u * 2u);
+}
+
+TEST(NatsMonitorTest, VarzConnzSubsz) {
+    NatsServer server;
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(-1, &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    client->m_client_ip = "127.0.0.1";
+    server.addClient(std::move(client_unique_ptr));
+
+    std::vector<std::pair<int, std::vector<std::string>>> subscriptions = {{1, {"foo", "bar"}}, {2, {"foo", "*"}}};
+    server.addSubscriptions(client->m_client_id, subscriptions);
+
+    std::string pub_args = "foo.bar 5";
+    std::string_view pub_args_view(pub_args);
+    client->processPubArgs(pub_args_view);
+    std::string payload = "hello";
+    std::string_view payload_view(payload);
+    client->processPub(payload_view);
+    //no one listens to this one, so the interest filter answers it
+    std::vector<std::string> other = {"weather", "today"};
+    std::string other_subject = "weather.today";
+    server.publishMessage(other_subject, other, "sunny");
+
+    NatsMonitor monitor(&server);
+    std::string body;
+    ASSERT_TRUE(monitor.handleRequest("/varz", "", body));
+    nlohmann::json varz = nlohmann::json::parse(body);
+    EXPECT_EQ(varz["connections"], 1);
+    EXPECT_EQ(varz["total_connections"], 1);
+    EXPECT_EQ(varz["subscriptions"], 2);
+    EXPECT_EQ(varz["in_msgs"], 1);
+    EXPECT_EQ(varz["in_bytes"], 5);
+    //both subscriptions match foo.bar
+    EXPECT_EQ(varz["out_msgs"], 2);
+    EXPECT_EQ(varz["out_bytes"], 10);
+    EXPECT_EQ(varz["no_interest_msgs"], 1);
+
+    ASSERT_TRUE(monitor.handleRequest("/connz", "", body));
+    nlohmann::json connz = nlohmann::json::parse(body);
+    ASSERT_EQ(connz["num_connections"], 1);
+    EXPECT_EQ(connz["connections"][0]["cid"], client->m_client_id);
+    EXPECT_EQ(connz["connections"][0]["ip"], "127.0.0.1");
+    EXPECT_EQ(connz["connections"][0]["in_msgs"], 1);
+    EXPECT_EQ(connz["connections"][0]["out_msgs"], 2);
+
+    ASSERT_TRUE(monitor.handleRequest("/subsz", "", body));
+    nlohmann::json subsz = nlohmann::json::parse(body);
+    EXPECT_EQ(subsz["num_subscriptions"], 2);
+
+    EXPECT_FALSE(monitor.handleRequest("/unknown", "", body));
+    //the PUBs of a client that is gone still count
+    server.removeClient(client->m_client_id);
+    ASSERT_TRUE(monitor.handleRequest("/varz", "", body));
+    varz = nlohmann::json::parse(body);
+    EXPECT_EQ(varz["connections"], 0);
+    EXPECT_EQ(varz["in_msgs"], 1);
+    EXPECT_EQ(varz["in_bytes"], 5);
+}
+
+TEST(NatsHeavyHittersTest, FindsHotSubjectsAmongColdOnes) {
+    NatsHeavyHitters hot_subjects;
+    //a long tail of subjects seen once, with a few hot ones mixed in
+    for(int i=0;i<20000;i++){
+        hot_subjects.record("cold." + std::to_string(i), 10);
+        hot_subjects.record("hot." + std::to_string(i % 3), 1);
+        if(i % 4 == 0){
+            hot_subjects.record("big", 1000);
+        }
+    }
+    std::vector<NatsSubjectCount> by_msgs = hot_subjects.topByMsgs(3);
+    ASSERT_EQ(by_msgs.size(), 3u);
+    std::vector<std::string> subjects;
+    for(NatsSubjectCount& count: by_msgs){
+        subjects.push_back(count.m_subject);
+        //count-min only ever overestimates
+        EXPECT_GE(count.m_msgs, 6666u);
+    }
+    EXPECT_THAT(subjects, ::testing::UnorderedElementsAre("hot.0", "hot.1", "hot.2"));
+
+    std::vector<NatsSubjectCount> by_bytes = hot_subjects.topByBytes(1);
+    ASSERT_EQ(by_bytes.size(), 1u);
+    EXPECT_EQ(by_bytes[0].m_subject, "big");
+    EXPECT_GE(by_bytes[0].m_bytes, 5000u * 1000u);
+
+    hot_subjects.reset();
+    EXPECT_TRUE(hot_subjects.topByMsgs(3).empty());
+}
+
+TEST(NatsMonitorTest, SubjectzAndSubscriptionCounters) {
+    NatsServer server;
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(-1, &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    server.addClient(std::move(client_unique_ptr));
+
+    std::string sub_args = "weather.* 7";
+    std::string_view sub_args_view(sub_args);
+    client->processSub(sub_args_view);
+    client->flushPendingSubscriptions();
+    std::vector<std::string> subject_list = {"weather", "london"};
+    std::string subject = "weather.london";
+    server.publishMessage(subject, subject_list, "rain");
+    server.publishMessage(subject, subject_list, "rain");
+
+    NatsMonitor monitor(&server);
+    std::string body;
+    ASSERT_TRUE(monitor.handleRequest("/connz", "subs=1", body));
+    nlohmann::json connz = nlohmann::json::parse(body);
+    ASSERT_EQ(connz["connections"][0]["subscriptions_list"].size(), 1);
+    nlohmann::json subscription = connz["connections"][0]["subscriptions_list"][0];
+    EXPECT_EQ(subscription["sid"], 7);
+    //the client has no socket, so nothing can be written to it
+    EXPECT_EQ(subscription["delivered"], 0);
+    EXPECT_EQ(subscription["dropped"], 2);
+
+    ASSERT_TRUE(monitor.handleRequest("/subjectz", "top=5", body));
+    nlohmann::json subjectz = nlohmann::json::parse(body);
+    ASSERT_EQ(subjectz["by_msgs"].size(), 1);
+    EXPECT_EQ(subjectz["by_msgs"][0]["subject"], "weather.london");
+    EXPECT_EQ(subjectz["by_msgs"][0]["msgs"], 2);
+    EXPECT_EQ(subjectz["by_bytes"][0]["bytes"], 8);
+
+    ASSERT_TRUE(monitor.handleRequest("/subjectz", "reset=1", body));
+    subjectz = nlohmann::json::parse(body);
+    EXPECT_TRUE(subjectz["by_msgs"].empty());
+    server.removeClient(client->m_client_id);
+}
+
+TEST(NatsMonitorTest, UnsubscribedCountersStartOverForTheNextSub) {
+    NatsServer server;
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(-1, &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    server.addClient(std::move(client_unique_ptr));
+
+    std::string sub_args = "weather.* 7";
+    std::string_view sub_args_view(sub_args);
+    client->processSub(sub_args_view);
+    client->flushPendingSubscriptions();
+    std::vector<std::string> subject_list = {"weather", "london"};
+    std::string subject = "weather.london";
+    server.publishMessage(subject, subject_list, "rain");
+    NatsSubscriptionStats* stats = client->getSubscriptionStats(7);
+    ASSERT_NE(stats, nullptr);
+    EXPECT_EQ(stats->m_dropped.load(), 1u);
+
+    std::string unsub_args = "7";
+    std::string_view unsub_args_view(unsub_args);
+    client->processUnsub(unsub_args_view);
+    client->flushPendingSubscriptions();
+    EXPECT_EQ(client->getSubscriptionStats(7), nullptr);
+
+    //the next SUB gets the slot back, counted from zero
+    sub_args = "weather.* 8";
+    sub_args_view = sub_args;
+    client->processSub(sub_args_view);
+    client->flushPendingSubscriptions();
+    EXPECT_EQ(client->getSubscriptionStats(8), stats);
+    EXPECT_EQ(stats->m_dropped.load(), 0u);
+    server.publishMessage(subject, subject_list, "rain");
+    EXPECT_EQ(stats->m_dropped.load(), 1u);
+    server.removeClient(client->m_client_id);
+}
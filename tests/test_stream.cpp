@@ -0,0 +1,450 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include <filesystem>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../include/nats/server.hpp"
+#include "../include/nats/stream.hpp"
+#include "../include/nats/custom_specific_exceptions.hpp"
+#include "include/nats/test_mocks.hpp"
+#include "include/nats/test_helpers.hpp"
+
+using namespace nats;
+
+class NatsStreamTest : public ::testing::Test {
+protected:
+    std::string m_directory;
+
+    void SetUp() override {
+        char directory[] = "/tmp/nats_stream_test_XXXXXX";
+        ASSERT_NE(mkdtemp(directory), nullptr);
+        m_directory = directory;
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(m_directory);
+    }
+
+    NatsStreamConfig config(const std::string& name, const std::string& subject, NatsFsyncPolicy policy = NatsFsyncPolicy::NONE) {
+        NatsStreamConfig config;
+        config.m_name = name;
+        config.m_subject = subject;
+        config.m_directory = m_directory;
+        config.m_fsync_policy = policy;
+        return config;
+    }
+};
+
+TEST_F(NatsStreamTest, AppendAndReadBack) {
+    NatsStream stream(config("orders", "orders.>"));
+    ASSERT_TRUE(stream.open());
+    EXPECT_EQ(stream.getLastSeq(), 0u);
+
+    EXPECT_EQ(stream.append("orders.new", "first"), 1u);
+    EXPECT_EQ(stream.append("orders.paid", ""), 2u);
+    EXPECT_EQ(stream.append("orders.new", std::string(1000, 'x')), 3u);
+
+    NatsStoredMessage message;
+    ASSERT_TRUE(stream.read(1, message));
+    EXPECT_EQ(message.m_seq, 1u);
+    EXPECT_EQ(message.m_subject, "orders.new");
+    EXPECT_EQ(message.m_payload, "first");
+    EXPECT_GT(message.m_timestamp_ns, 0);
+    ASSERT_TRUE(stream.read(2, message));
+    EXPECT_EQ(message.m_subject, "orders.paid");
+    EXPECT_EQ(message.m_payload, "");
+    ASSERT_TRUE(stream.read(3, message));
+    EXPECT_EQ(message.m_payload, std::string(1000, 'x'));
+    EXPECT_FALSE(stream.read(4, message));
+
+    EXPECT_EQ(stream.getFirstSeq(), 1u);
+    EXPECT_EQ(stream.getMessageCount(), 3u);
+    EXPECT_EQ(stream.getByteCount(), 1005u);
+
+    EXPECT_FALSE(NatsStream(config("bad", "orders..new")).open());
+}
+
+TEST_F(NatsStreamTest, RollsOverSegmentsAndRecoversAfterReopen) {
+    NatsStreamConfig stream_config = config("events", ">", NatsFsyncPolicy::INTERVAL);
+    stream_config.m_segment_size = 64 * 1024;
+    stream_config.m_fsync_interval_ms = 5;
+    const int message_count = 5000;
+    {
+        NatsStream stream(stream_config);
+        ASSERT_TRUE(stream.open());
+        for(int i = 1; i <= message_count; i++){
+            ASSERT_EQ(stream.append("events." + std::to_string(i % 7), "payload " + std::to_string(i)), static_cast<uint64_t>(i));
+        }
+        //a message bigger than a whole segment still fits, in a segment of its own
+        ASSERT_EQ(stream.append("events.big", std::string(100 * 1024, 'b')), static_cast<uint64_t>(message_count + 1));
+        EXPECT_GT(stream.getSegmentCount(), 3u);
+    }
+
+    NatsStream reopened(stream_config);
+    ASSERT_TRUE(reopened.open());
+    EXPECT_EQ(reopened.getFirstSeq(), 1u);
+    EXPECT_EQ(reopened.getLastSeq(), static_cast<uint64_t>(message_count + 1));
+    EXPECT_EQ(reopened.getMessageCount(), static_cast<uint64_t>(message_count + 1));
+    //every message is found through the sparse index, including the ones right at segment boundaries
+    NatsStoredMessage message;
+    for(int i = 1; i <= message_count; i++){
+        ASSERT_TRUE(reopened.read(i, message));
+        ASSERT_EQ(message.m_seq, static_cast<uint64_t>(i));
+        ASSERT_EQ(message.m_subject, "events." + std::to_string(i % 7));
+        ASSERT_EQ(message.m_payload, "payload " + std::to_string(i));
+    }
+    ASSERT_TRUE(reopened.read(message_count + 1, message));
+    EXPECT_EQ(message.m_payload.size(), 100u * 1024);
+
+    //appending carries on with the next sequence number
+    EXPECT_EQ(reopened.append("events.after", "restart"), static_cast<uint64_t>(message_count + 2));
+    ASSERT_TRUE(reopened.read(message_count + 2, message));
+    EXPECT_EQ(message.m_payload, "restart");
+}
+
+TEST_F(NatsStreamTest, ConcurrentAppendsWithAlwaysFsync) {
+    NatsStream stream(config("audit", "audit.*", NatsFsyncPolicy::ALWAYS));
+    ASSERT_TRUE(stream.open());
+    const int thread_count = 4;
+    const int per_thread = 100;
+    std::vector<std::thread> threads;
+    for(int t = 0; t < thread_count; t++){
+        threads.emplace_back([&stream, t]() {
+            for(int i = 0; i < per_thread; i++){
+                EXPECT_NE(stream.append("audit." + std::to_string(t), std::to_string(i)), 0u);
+            }
+        });
+    }
+    for(std::thread& thread: threads){
+        thread.join();
+    }
+    EXPECT_EQ(stream.getLastSeq(), static_cast<uint64_t>(thread_count * per_thread));
+
+    //each thread's messages are stored in the order it appended them
+    std::vector<int> next(thread_count, 0);
+    NatsStoredMessage message;
+    for(uint64_t seq = 1; seq <= stream.getLastSeq(); seq++){
+        ASSERT_TRUE(stream.read(seq, message));
+        int t = std::stoi(message.m_subject.substr(6));
+        EXPECT_EQ(message.m_payload, std::to_string(next[t]++));
+    }
+}
+
+TEST_F(NatsStreamTest, ServerStoresMatchingPublishes) {
+    NatsServer server;
+    ASSERT_TRUE(server.addStream(config("weather", "weather.>")));
+    EXPECT_FALSE(server.addStream(config("weather", "other.>")));
+    ASSERT_TRUE(server.addStream(config("london", "*.london")));
+
+    //stored even though nobody is subscribed
+    server.publish("weather.london", "rain");
+    server.publish("traffic.london", "jam");
+    server.publish("traffic.paris", "clear");
+    server.publish("weather.paris.today", "sun");
+
+    std::shared_ptr<NatsStream> weather = server.getStream("weather");
+    std::shared_ptr<NatsStream> london = server.getStream("london");
+    ASSERT_NE(weather, nullptr);
+    ASSERT_NE(london, nullptr);
+    EXPECT_EQ(server.getStream("missing"), nullptr);
+    EXPECT_EQ(weather->getLastSeq(), 2u);
+    EXPECT_EQ(london->getLastSeq(), 2u);
+
+    NatsStoredMessage message;
+    ASSERT_TRUE(weather->read(2, message));
+    EXPECT_EQ(message.m_subject, "weather.paris.today");
+    ASSERT_TRUE(london->read(2, message));
+    EXPECT_EQ(message.m_subject, "traffic.london");
+    EXPECT_EQ(message.m_payload, "jam");
+
+    NatsMonitor monitor(&server);
+    std::string body;
+    ASSERT_TRUE(monitor.handleRequest("/streamz", "", body));
+    EXPECT_THAT(body, ::testing::HasSubstr("\"name\":\"london\""));
+    EXPECT_THAT(body, ::testing::HasSubstr("\"last_seq\":2"));
+}
+
+TEST_F(NatsStreamTest, SubscriptionReplaysStreamThenFollowsIt) {
+    NatsServer server;
+    ASSERT_TRUE(server.addStream(config("orders", "orders.>")));
+    server.publish("orders.new", "one");
+    server.publish("orders.paid", "two");
+    server.publish("orders.new", "three");
+    std::string big(40 * 1024, 'b'); //big enough to go out with sendfile
+    server.publish("orders.new", big);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(fds[0], &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    server.addClient(std::move(client_unique_ptr));
+
+    EXPECT_THROW(sub(client, "orders.* 1 stream=missing"), NoSuchStreamException);
+    EXPECT_THROW(sub(client, "orders.* 1 stream=orders start_seq=x"), ArgumentParseException);
+    EXPECT_THROW(sub(client, "orders.* 1 start_seq=2"), ArgumentParseException);
+    EXPECT_THROW(sub(client, "orders.* 1 stream=orders start_seq=1 start_time=1"), ArgumentParseException);
+    EXPECT_THROW(sub(client, "orders.* 1 stream=orders depth=3"), ArgumentParseException);
+
+    //from seq 2 on, only orders.new, then whatever is published after the replay
+    sub(client, "orders.new 7 stream=orders start_seq=2");
+    std::string expected = "+OK\r\nMSG orders.new 7 5\r\nthree\r\nMSG orders.new 7 " + std::to_string(big.size()) + "\r\n" + big + "\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    server.publish("orders.paid", "skipped");
+    server.publish("orders.new", "live");
+    expected = "MSG orders.new 7 4\r\nlive\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    EXPECT_EQ(client->m_stats.m_out_msgs.load(), 3u);
+
+    //a start time after the last message delivers only new ones
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    sub(client, "orders.> 8 stream=orders start_time=" + std::to_string(now));
+    EXPECT_EQ(readBytes(fds[1], 5), "+OK\r\n");
+    server.publish("orders.paid", "four");
+    expected = "MSG orders.paid 8 4\r\nfour\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+
+    std::string unsub_args = "8";
+    std::string_view unsub_view(unsub_args);
+    client->processUnsub(unsub_view);
+    client->flushPendingSubscriptions();
+    EXPECT_EQ(readBytes(fds[1], 5), "+OK\r\n");
+
+    server.removeClient(client->m_client_id);
+    close(fds[1]);
+}
+
+TEST(NatsPendingSetTest, SlidesWindowOverAckedSeqs) {
+    NatsPendingSet pending(128);
+    EXPECT_EQ(pending.capacity(), 128u);
+    EXPECT_TRUE(pending.add(100, 10));
+    EXPECT_TRUE(pending.add(101, 20));
+    EXPECT_TRUE(pending.add(190, 30));
+    //the window starts at the word holding 100, so it ends at 64 + 128
+    EXPECT_FALSE(pending.add(192, 40));
+    EXPECT_EQ(pending.size(), 3u);
+    EXPECT_EQ(pending.earliestDeadline(), 20);
+
+    //out of order acks, the window only slides once the oldest word is empty
+    EXPECT_TRUE(pending.remove(101));
+    EXPECT_FALSE(pending.remove(101));
+    EXPECT_FALSE(pending.canAdd(192));
+    EXPECT_TRUE(pending.remove(100));
+    EXPECT_TRUE(pending.add(192, 40));
+    EXPECT_TRUE(pending.contains(190));
+    EXPECT_FALSE(pending.contains(100));
+
+    std::vector<uint64_t> due;
+    pending.collectDue(35, 100, due);
+    EXPECT_EQ(due, std::vector<uint64_t>({190}));
+    EXPECT_EQ(pending.earliestDeadline(), 40);
+    due.clear();
+    pending.collectDue(40, 100, due);
+    EXPECT_EQ(due, std::vector<uint64_t>({192}));
+    EXPECT_EQ(pending.earliestDeadline(), 100);
+
+    EXPECT_TRUE(pending.remove(190));
+    EXPECT_TRUE(pending.remove(192));
+    EXPECT_EQ(pending.size(), 0u);
+    EXPECT_EQ(pending.earliestDeadline(), 0);
+    //empty, so the window moves to wherever the next delivery is
+    EXPECT_TRUE(pending.add(5000, 50));
+}
+
+TEST(NatsPendingSetTest, LimitsCountToMaxPending) {
+    //one word wide, but only two may be pending at once
+    NatsPendingSet pending(2);
+    EXPECT_EQ(pending.capacity(), 64u);
+    EXPECT_TRUE(pending.add(1, 10));
+    EXPECT_TRUE(pending.add(2, 10));
+    EXPECT_FALSE(pending.canAdd(3));
+    EXPECT_FALSE(pending.add(3, 10));
+    EXPECT_TRUE(pending.add(2, 20)); //already pending
+    EXPECT_EQ(pending.size(), 2u);
+    EXPECT_TRUE(pending.remove(1));
+    EXPECT_TRUE(pending.add(3, 10));
+    EXPECT_FALSE(pending.add(4, 10));
+}
+
+TEST_F(NatsStreamTest, AckedSubscriptionRedeliversUntilAcked) {
+    NatsServer server;
+    ASSERT_TRUE(server.addStream(config("orders", "orders.>")));
+    server.publish("orders.new", "one");
+    server.publish("orders.new", "two");
+    server.publish("orders.new", "three");
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    auto client_unique_ptr = std::make_unique<PartialMockNatsClient>(fds[0], &server);
+    NatsClient* client = client_unique_ptr.get();
+    client->m_waiting_for_initial_connect = false;
+    server.addClient(std::move(client_unique_ptr));
+
+    EXPECT_THROW(sub(client, "orders.* 1 stream=orders ack_wait=x"), ArgumentParseException);
+    EXPECT_THROW(sub(client, "orders.* 1 stream=orders ack_wait=100 max_pending=0"), ArgumentParseException);
+
+    //at most two unacked, the third has to wait for an ack
+    sub(client, "orders.new 7 stream=orders ack_wait=300 max_pending=2");
+    NatsStreamConsumer* consumer = client->getConsumer(7);
+    ASSERT_NE(consumer, nullptr);
+    ASSERT_EQ(consumer->getConsumerId(), 1u);
+    std::string expected = "+OK\r\nMSG orders.new 7 $ACK.1.1 3\r\none\r\nMSG orders.new 7 $ACK.1.2 3\r\ntwo\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    //nothing more comes until the ack, well within the ack wait so one isn't redelivered yet either
+    EXPECT_EQ(readBytes(fds[1], 1, 100), "");
+    server.publish("$ACK.1.1", "");
+    expected = "MSG orders.new 7 $ACK.1.3 5\r\nthree\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    EXPECT_EQ(consumer->getAckedCount(), 1u);
+
+    //two and three were never acked, so both come again once their ack wait passed
+    expected = "MSG orders.new 7 $ACK.1.2 3\r\ntwo\r\nMSG orders.new 7 $ACK.1.3 5\r\nthree\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    server.publish("$ACK.1.2", "");
+    server.publish("$ACK.1.3", "");
+    server.publish("$ACK.1.3", ""); //a second ack changes nothing
+    EXPECT_EQ(consumer->getPendingCount(), 0u);
+    EXPECT_EQ(consumer->getAckedCount(), 3u);
+    EXPECT_EQ(consumer->getRedeliveredCount(), 2u);
+    EXPECT_EQ(client->getSubscriptionStats(7)->m_delivered.load(), 5u);
+    EXPECT_EQ(client->getSubscriptionStats(7)->m_redelivered.load(), 2u);
+    //acks aren't messages, they are neither stored nor delivered
+    EXPECT_EQ(server.getStream("orders")->getLastSeq(), 3u);
+    server.publish("orders.new", "four");
+    expected = "MSG orders.new 7 $ACK.1.4 4\r\nfour\r\n";
+    EXPECT_EQ(readBytes(fds[1], expected.size()), expected);
+    server.publish("$ACK.1.4", "");
+    EXPECT_EQ(readBytes(fds[1], 1), "");
+
+    server.removeClient(client->m_client_id);
+    close(fds[1]);
+}
+
+TEST_F(NatsStreamTest, DeletesSegmentsPastRetentionLimits) {
+    std::string payload(100, 'p');
+    auto countFiles = [this](const std::string& name){
+        size_t files = 0;
+        for(const auto& entry: std::filesystem::directory_iterator(m_directory + "/" + name)){
+            files += entry.path().extension() == ".seg";
+        }
+        return files;
+    };
+
+    //by count, about 28 messages fit a segment, the one being appended to stays whatever the limits say
+    NatsStreamConfig by_count = config("by_count", ">");
+    by_count.m_segment_size = 4096;
+    by_count.m_max_messages = 100;
+    by_count.m_retention_interval_ms = 0;
+    NatsStream counted(by_count);
+    ASSERT_TRUE(counted.open());
+    for(int i = 0; i < 300; i++){
+        ASSERT_NE(counted.append("limits.count", payload), 0u);
+    }
+    size_t segments = counted.getSegmentCount();
+    counted.applyRetention();
+    EXPECT_GE(counted.getMessageCount(), 100u);
+    EXPECT_LT(counted.getMessageCount(), 160u);
+    EXPECT_EQ(counted.getSegmentCount() + counted.getDeletedSegmentCount(), segments);
+    EXPECT_EQ(countFiles("by_count"), counted.getSegmentCount());
+    EXPECT_EQ(counted.getFirstSeq(), 300 - counted.getMessageCount() + 1);
+    //a deleted seq reads as the first one still there
+    NatsStoredMessage message;
+    ASSERT_TRUE(counted.read(1, message));
+    EXPECT_EQ(message.m_seq, counted.getFirstSeq());
+
+    //by payload bytes
+    NatsStreamConfig by_bytes = config("by_bytes", ">");
+    by_bytes.m_segment_size = 4096;
+    by_bytes.m_max_bytes = 5000;
+    by_bytes.m_retention_interval_ms = 0;
+    NatsStream sized(by_bytes);
+    ASSERT_TRUE(sized.open());
+    for(int i = 0; i < 300; i++){
+        ASSERT_NE(sized.append("limits.bytes", payload), 0u);
+    }
+    sized.applyRetention();
+    EXPECT_GE(sized.getByteCount(), 5000u);
+    EXPECT_LT(sized.getByteCount(), 5000u + 6000u);
+    EXPECT_EQ(countFiles("by_bytes"), sized.getSegmentCount());
+
+    //by age, on the retention thread
+    NatsStreamConfig by_age = config("by_age", ">");
+    by_age.m_segment_size = 4096;
+    by_age.m_max_age_ms = 50;
+    by_age.m_retention_interval_ms = 10;
+    NatsStream aged(by_age);
+    ASSERT_TRUE(aged.open());
+    for(int i = 0; i < 300; i++){
+        ASSERT_NE(aged.append("limits.age", payload), 0u);
+    }
+    for(int i = 0; i < 200 && aged.getSegmentCount() > 1; i++){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(aged.getSegmentCount(), 1u);
+    EXPECT_EQ(countFiles("by_age"), 1u);
+    EXPECT_EQ(aged.getLastSeq() - aged.getFirstSeq() + 1, aged.getMessageCount());
+    EXPECT_EQ(aged.append("limits.age", "new"), 301u);
+}
+
+TEST_F(NatsStreamTest, CompactsFullSegmentsToLastMessagesPerSubject) {
+    NatsStreamConfig stream_config = config("kv", "kv.>");
+    stream_config.m_segment_size = 4096;
+    stream_config.m_keep_last_per_subject = 2;
+    stream_config.m_retention_interval_ms = 0;
+    const int message_count = 600;
+    std::vector<std::string> subjects = {"kv.a", "kv.b", "kv.c"};
+    auto readAll = [](NatsStream& stream){
+        std::vector<NatsStoredMessage> messages;
+        NatsStoredMessage message;
+        for(uint64_t seq = 1; stream.read(seq, message); seq = message.m_seq + 1){
+            messages.push_back(message);
+        }
+        return messages;
+    };
+    std::vector<NatsStoredMessage> compacted;
+    {
+        NatsStream stream(stream_config);
+        ASSERT_TRUE(stream.open());
+        for(int i = 1; i <= message_count; i++){
+            ASSERT_NE(stream.append(subjects[i % 3], "value " + std::to_string(i)), 0u);
+        }
+        stream.applyRetention();
+        EXPECT_GT(stream.getCompactedMessageCount(), 0u);
+        EXPECT_EQ(stream.getMessageCount() + stream.getCompactedMessageCount(), static_cast<uint64_t>(message_count));
+        compacted = readAll(stream);
+        EXPECT_EQ(compacted.size(), stream.getMessageCount());
+        //a second run without a new full segment has nothing to do
+        uint64_t compacted_count = stream.getCompactedMessageCount();
+        stream.applyRetention();
+        EXPECT_EQ(stream.getCompactedMessageCount(), compacted_count);
+    }
+    //the newest values of every subject are still there, in order
+    for(int i = message_count - 5; i <= message_count; i++){
+        auto found = std::find_if(compacted.begin(), compacted.end(), [i](const NatsStoredMessage& message){ return message.m_seq == static_cast<uint64_t>(i); });
+        ASSERT_NE(found, compacted.end());
+        EXPECT_EQ(found->m_payload, "value " + std::to_string(i));
+    }
+    EXPECT_TRUE(std::is_sorted(compacted.begin(), compacted.end(),
+        [](const NatsStoredMessage& a, const NatsStoredMessage& b){ return a.m_seq < b.m_seq; }));
+
+    //the gaps compaction left survive a restart
+    NatsStream reopened(stream_config);
+    ASSERT_TRUE(reopened.open());
+    std::vector<NatsStoredMessage> recovered = readAll(reopened);
+    ASSERT_EQ(recovered.size(), compacted.size());
+    for(size_t i = 0; i < recovered.size(); i++){
+        EXPECT_EQ(recovered[i].m_seq, compacted[i].m_seq);
+        EXPECT_EQ(recovered[i].m_payload, compacted[i].m_payload);
+    }
+    EXPECT_EQ(reopened.getMessageCount(), compacted.size());
+    EXPECT_EQ(reopened.append("kv.a", "after"), static_cast<uint64_t>(message_count + 1));
+}
@@ -2,6 +2,7 @@
 #include <gmock/gmock.h>
 #include "../include/nats/sublist.hpp"
 #include "../include/nats/subscription.hpp"
+#include <algorithm>
 
 using namespace nats;
 
@@ -148,4 +149,162 @@ TEST(NatsSublistTest, RemoveNonExistent) {
     auto result = sublist.getSubscriptionsForTopic(subject);
     ASSERT_EQ(result.size(), 1);
     EXPECT_EQ(result[0], sub);
-}
\ No newline at end of file
+}
+TEST(NatsSublistTest, InterestWatch_IndexVisitsOnlyMatchingWatches) {
+    NatsInterestWatchIndex index;
+    index.insert("foo", NatsInterestWatch{{"foo"}, {}, 0});
+    index.insert("foo.bar", NatsInterestWatch{{"foo", "bar"}, {}, 0});
+    index.insert("foo.baz", NatsInterestWatch{{"foo", "baz"}, {}, 0});
+    index.insert("foo.bar.qux", NatsInterestWatch{{"foo", "bar", "qux"}, {}, 0});
+    index.insert("other.bar", NatsInterestWatch{{"other", "bar"}, {}, 0});
+    auto matches = [&index](std::vector<std::string> pattern) {
+        std::vector<std::string> subjects;
+        index.forEachMatch(pattern, [&subjects, &pattern](const std::string& subject, NatsInterestWatch& watch) {
+            //every visit agrees with the matching the sublist does
+            EXPECT_TRUE(NatsSublist::subjectMatches(pattern, watch.m_subject_list));
+            subjects.push_back(subject);
+        });
+        std::sort(subjects.begin(), subjects.end());
+        return subjects;
+    };
+    EXPECT_THAT(matches({"foo", "bar"}), ::testing::ElementsAre("foo.bar"));
+    EXPECT_THAT(matches({"foo", "*"}), ::testing::ElementsAre("foo.bar", "foo.baz"));
+    EXPECT_THAT(matches({"*", "bar"}), ::testing::ElementsAre("foo.bar", "other.bar"));
+    EXPECT_THAT(matches({"foo", ">"}), ::testing::ElementsAre("foo.bar", "foo.bar.qux", "foo.baz"));
+    EXPECT_THAT(matches({">"}), ::testing::ElementsAre("foo", "foo.bar", "foo.bar.qux", "foo.baz", "other.bar"));
+    EXPECT_TRUE(matches({"foo", "bar", "*", "x"}).empty());
+
+    //erasing prunes the nodes only that watch needed, the ones it shares stay
+    index.erase("foo.bar.qux");
+    index.erase("foo.bar.qux");
+    EXPECT_THAT(matches({"foo", ">"}), ::testing::ElementsAre("foo.bar", "foo.baz"));
+    index.erase("foo");
+    EXPECT_EQ(index.find("foo"), nullptr);
+    ASSERT_NE(index.find("foo.bar"), nullptr);
+    EXPECT_THAT(matches({"foo", "bar"}), ::testing::ElementsAre("foo.bar"));
+    EXPECT_EQ(index.size(), 3u);
+}
+
+TEST(NatsSublistTest, RemoveClient) {
+    NatsSublist sublist;
+    std::vector<std::string> literal = {"foo", "bar"};
+    std::vector<std::string> wildcard = {"foo", ">"};
+    NatsSubscription sub_1{1, 100};
+    NatsSubscription sub_2{2, 100};
+    NatsSubscription other{1, 200};
+
+    sublist.addSubscription(sub_1, literal);
+    sublist.addSubscription(sub_2, wildcard);
+    //same subscription on a second subject, both have to go
+    sublist.addSubscription(sub_2, literal);
+    sublist.addSubscription(other, literal);
+
+    sublist.removeClient(100);
+
+    auto result = sublist.getSubscriptionsForTopic(literal);
+    ASSERT_EQ(result.size(), 1);
+    EXPECT_EQ(result[0], other);
+}
+
+TEST(NatsSublistTest, RemoveSubscriptionsBatch) {
+    NatsSublist sublist;
+    std::vector<std::string> subject_1 = {"foo", "bar"};
+    std::vector<std::string> subject_2 = {"foo", "*"};
+    std::vector<std::string> subject_3 = {"foo", "baz"};
+    NatsSubscription sub_1{1, 100};
+    NatsSubscription sub_2{2, 100};
+    NatsSubscription sub_3{3, 100};
+
+    sublist.addSubscription(sub_1, subject_1);
+    sublist.addSubscription(sub_2, subject_2);
+    sublist.addSubscription(sub_3, subject_3);
+
+    sublist.removeSubscriptions(100, {1, 2, 99});
+
+    EXPECT_TRUE(sublist.getSubscriptionsForTopic(subject_1).empty());
+    auto result = sublist.getSubscriptionsForTopic(subject_3);
+    ASSERT_EQ(result.size(), 1);
+    EXPECT_EQ(result[0], sub_3);
+    EXPECT_FALSE(sublist.hasPossibleInterest(subject_1));
+}
+
+TEST(NatsSublistTest, ResubscribeAfterRemoveClient) {
+    NatsSublist sublist;
+    std::vector<std::string> subject = {"foo", "bar", "baz"};
+    NatsSubscription sub{1, 100};
+
+    //the emptied nodes are pruned, subscribing again has to rebuild them
+    sublist.addSubscription(sub, subject);
+    sublist.removeClient(100);
+    sublist.addSubscription(sub, subject);
+
+    auto result = sublist.getSubscriptionsForTopic(subject);
+    ASSERT_EQ(result.size(), 1);
+    EXPECT_EQ(result[0], sub);
+}
+
+TEST(NatsSublistTest, AddSubscriptionsBatch) {
+    NatsSublist sublist;
+    std::vector<std::pair<int, std::vector<std::string>>> batch = {
+        {1, {"foo", "bar", "baz"}},
+        {2, {"weather", "*"}},
+        {3, {"foo", "bar"}},
+        {4, {"foo", ">"}},
+        {5, {"foo", "bar", "qux"}},
+    };
+
+    sublist.addSubscriptions(100, batch);
+
+    std::vector<std::string> match_1 = {"foo", "bar", "baz"};
+    std::vector<std::string> match_2 = {"weather", "India"};
+    std::vector<std::string> match_3 = {"foo", "bar"};
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(match_1), ::testing::UnorderedElementsAre(NatsSubscription{1, 100}, NatsSubscription{4, 100}));
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(match_2), ::testing::ElementsAre(NatsSubscription{2, 100}));
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(match_3), ::testing::UnorderedElementsAre(NatsSubscription{3, 100}, NatsSubscription{4, 100}));
+
+    //back-references are kept for batched subscriptions too
+    sublist.removeClient(100);
+    EXPECT_TRUE(sublist.getSubscriptionsForTopic(match_1).empty());
+    EXPECT_FALSE(sublist.hasPossibleInterest(match_2));
+}
+
+TEST(NatsSublistTest, VisitorAndBufferMatch) {
+    NatsSublist sublist;
+    std::vector<std::string> literal = {"foo", "bar"};
+    std::vector<std::string> star = {"foo", "*"};
+    std::vector<std::string> tail = {">"};
+    sublist.addSubscription({1, 100}, literal);
+    sublist.addSubscription({2, 100}, star);
+    sublist.addSubscription({3, 200}, tail);
+
+    std::vector<NatsSubscription> visited;
+    sublist.forEachSubscriptionForTopic(literal, [&visited](const NatsSubscription& subscription) {
+        visited.push_back(subscription);
+    });
+    EXPECT_THAT(visited, ::testing::UnorderedElementsAre(NatsSubscription{1, 100}, NatsSubscription{2, 100}, NatsSubscription{3, 200}));
+
+    //the buffer is cleared before each match
+    std::vector<NatsSubscription> buffer = {{9, 900}};
+    sublist.getSubscriptionsForTopic(literal, buffer);
+    EXPECT_THAT(buffer, ::testing::UnorderedElementsAre(NatsSubscription{1, 100}, NatsSubscription{2, 100}, NatsSubscription{3, 200}));
+    //client 100 has two overlapping subscriptions, only its lowest sub id is kept
+    sublist.getSubscriptionsForTopic(literal, buffer, NatsMatchMode::ONE_PER_CLIENT);
+    EXPECT_THAT(buffer, ::testing::ElementsAre(NatsSubscription{1, 100}, NatsSubscription{3, 200}));
+}
+
+TEST(NatsSublistTest, MatchDeeperThanTraversalStack) {
+    NatsSublist sublist;
+    std::vector<std::string> deep(40, "a");
+    std::vector<std::string> deep_star = deep;
+    deep_star[20] = "*";
+    std::vector<std::string> prefix_tail(deep.begin(), deep.begin() + 35);
+    prefix_tail.push_back(">");
+    sublist.addSubscription({1, 100}, deep);
+    sublist.addSubscription({2, 100}, deep_star);
+    sublist.addSubscription({3, 100}, prefix_tail);
+
+    EXPECT_THAT(sublist.getSubscriptionsForTopic(deep), ::testing::UnorderedElementsAre(NatsSubscription{1, 100}, NatsSubscription{2, 100}, NatsSubscription{3, 100}));
+    int visited = 0;
+    sublist.forEachSubscriptionForTopic(deep, [&visited](const NatsSubscription&) { visited++; });
+    EXPECT_EQ(visited, 3);
+}
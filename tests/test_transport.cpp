@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "../include/nats/server.hpp"
+#include "../include/nats/shm_transport.hpp"
+
+using namespace nats;
+
+namespace {
+    //reads from the ring until what came so far ends with terminator
+    std::string readRingUntil(NatsShmRing& ring, const std::string& terminator){
+        std::string received;
+        char buffer[4096];
+        while(received.size() < terminator.size() || received.compare(received.size() - terminator.size(), terminator.size(), terminator) != 0){
+            std::size_t n = ring.read(buffer, sizeof(buffer), -1);
+            if(n == 0) break;
+            received.append(buffer, n);
+        }
+        return received;
+    }
+
+    std::string readSocketUntil(int fd, const std::string& terminator){
+        std::string received;
+        char buffer[4096];
+        while(received.size() < terminator.size() || received.compare(received.size() - terminator.size(), terminator.size(), terminator) != 0){
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if(n <= 0) break;
+            received.append(buffer, n);
+        }
+        return received;
+    }
+
+    bool writeRing(NatsShmRing& ring, const std::string& data){
+        struct iovec iov {const_cast<char*>(data.data()), data.size()};
+        return ring.write(&iov, 1);
+    }
+}
+
+TEST(NatsShmRingTest, KeepsOrderAcrossWrapsAndFullRings){
+    std::unique_ptr<NatsShmTransport> transport = NatsShmTransport::create(NatsShmTransport::MIN_RING_SIZE);
+    ASSERT_NE(transport, nullptr);
+    EXPECT_EQ(NatsShmTransport::create(NatsShmTransport::MIN_RING_SIZE + 1), nullptr);
+    //the writer outruns the reader by far, so it keeps finding the ring full and the pieces keep wrapping around
+    constexpr std::size_t TOTAL = 1024 * 1024;
+    std::thread writer([&transport]() {
+        std::string piece;
+        std::size_t written = 0;
+        for(std::size_t size = 1; written < TOTAL; size = size % 5000 + 7){
+            piece.clear();
+            for(std::size_t i=0;i<size && written < TOTAL;i++){
+                piece += static_cast<char>(written++ % 251);
+            }
+            ASSERT_TRUE(writeRing(transport->toServer(), piece));
+        }
+    });
+    std::size_t received = 0;
+    char buffer[3000];
+    bool in_order = true;
+    while(received < TOTAL){
+        std::size_t n = transport->toServer().read(buffer, sizeof(buffer), -1);
+        ASSERT_GT(n, 0u);
+        for(std::size_t i=0;i<n;i++){
+            in_order &= buffer[i] == static_cast<char>((received + i) % 251);
+        }
+        received += n;
+    }
+    writer.join();
+    EXPECT_TRUE(in_order);
+    EXPECT_EQ(received, TOTAL);
+
+    //closing wakes a reader waiting on the empty ring and fails later writes
+    std::thread closer([&transport]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        transport->close();
+    });
+    EXPECT_EQ(transport->toServer().read(buffer, sizeof(buffer), -1), 0u);
+    closer.join();
+    EXPECT_FALSE(writeRing(transport->toClient(), "PING\r\n"));
+}
+
+TEST(NatsShmTransportTest, ConnectSwitchesAUnixClientToTheRings){
+    std::streambuf* orig_cout = std::cout.rdbuf();
+    std::ofstream null_stream("/dev/null");
+    std::cout.rdbuf(null_stream.rdbuf());
+    {
+        NatsServer server;
+        server.m_shm_ring_size = NatsShmTransport::MIN_RING_SIZE;
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        std::thread serving([&server, &fds]() { server.serveClient(fds[1], "unix"); });
+        ASSERT_NE(readSocketUntil(fds[0], "\r\n").find("INFO"), std::string::npos);
+        std::string connect_cmd = "CONNECT {\"verbose\":false,\"shm\":true}\r\n";
+        send(fds[0], connect_cmd.data(), connect_cmd.size(), 0);
+        std::string line;
+        std::unique_ptr<NatsShmTransport> transport = NatsShmTransport::receive(fds[0], line);
+        ASSERT_NE(transport, nullptr) << line;
+        EXPECT_EQ(line, "+SHM " + std::to_string(server.m_shm_ring_size) + "\r\n");
+
+        //the handshake goes on in the rings and the parser sees the same protocol as on a socket
+        EXPECT_EQ(readRingUntil(transport->toClient(), "PING\r\n"), "PING\r\n");
+        ASSERT_TRUE(writeRing(transport->toServer(), "PONG\r\nSUB shm.test 1\r\nPUB shm.test 5\r\nhello\r\n"));
+        EXPECT_EQ(readRingUntil(transport->toClient(), "hello\r\n"), "+OK\r\n+OK\r\nMSG shm.test 1 5\r\nhello\r\n");
+
+        //many times the ring size both ways, the publisher keeps finding the ring full while the MSGs fill the other one
+        std::string payload(1000, 'x');
+        std::string pub = "PUB shm.test " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+        std::string msg = "+OK\r\nMSG shm.test 1 " + std::to_string(payload.size()) + "\r\n" + payload + "\r\n";
+        constexpr int COUNT = 200;
+        std::thread publisher([&transport, &pub]() {
+            for(int i=0;i<COUNT;i++){
+                writeRing(transport->toServer(), pub);
+            }
+            writeRing(transport->toServer(), "PING\r\n");
+        });
+        std::string expected;
+        for(int i=0;i<COUNT;i++){
+            expected += msg;
+        }
+        EXPECT_EQ(readRingUntil(transport->toClient(), "PONG\r\n"), expected + "PONG\r\n");
+        publisher.join();
+
+        //hanging up the socket is how the server learns the client is gone
+        close(fds[0]);
+        serving.join();
+        EXPECT_EQ(server.m_clients.size(), 0u);
+    }
+    std::cout.rdbuf(orig_cout);
+}
+
+TEST(NatsShmTransportTest, UnixListenerServesPlainClientsToo){
+    std::streambuf* orig_cout = std::cout.rdbuf();
+    std::ofstream null_stream("/dev/null");
+    std::cout.rdbuf(null_stream.rdbuf());
+    {
+        NatsServer server;
+        server.m_unix_socket_path = "/tmp/nats-test-" + std::to_string(getpid()) + ".sock";
+        ASSERT_TRUE(server.startUnixListener());
+        struct sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, server.m_unix_socket_path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        ASSERT_EQ(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+        ASSERT_NE(readSocketUntil(fd, "\r\n").find("INFO"), std::string::npos);
+        //no shared memory asked for, the socket carries everything
+        std::string commands = "CONNECT {\"verbose\":false}\r\n";
+        send(fd, commands.data(), commands.size(), 0);
+        EXPECT_EQ(readSocketUntil(fd, "PING\r\n"), "+OK\r\nPING\r\n");
+        commands = "PONG\r\nSUB uds.test 1\r\nPUB uds.test 2\r\nhi\r\n";
+        send(fd, commands.data(), commands.size(), 0);
+        EXPECT_EQ(readSocketUntil(fd, "hi\r\n"), "+OK\r\n+OK\r\nMSG uds.test 1 2\r\nhi\r\n");
+
+        //with shared memory turned off a CONNECT asking for it is answered like any other
+        server.m_shm_ring_size = 0;
+        commands = "CONNECT {\"shm\":true}\r\nPING\r\n";
+        send(fd, commands.data(), commands.size(), 0);
+        EXPECT_EQ(readSocketUntil(fd, "PONG\r\n"), "+OK\r\nPONG\r\n");
+        close(fd);
+        server.stopUnixListener();
+        EXPECT_NE(access(server.m_unix_socket_path.c_str(), F_OK), 0);
+    }
+    std::cout.rdbuf(orig_cout);
+}